@@ -46,7 +46,8 @@ def compile(filename, tmpfile):
         if (assemble == 'true'):
             args = [executable, "-o", tmpfile, "--target-env", "spv1.0", filename]
         else:
-            args = [executable, "-V", "-H", "-o", tmpfile, filename]
+            # Ray tracing shaders require SPIR-V 1.4.
+            args = [executable, "-V", "-H", "--target-env", "vulkan1.2", "-o", tmpfile, filename]
         output = subprocess.check_output(args, universal_newlines=True)
     except subprocess.CalledProcessError as e:
         print(e.output, file=sys.stderr)
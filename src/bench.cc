@@ -0,0 +1,158 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+#include "render/benchmark.h"
+#include "render/engine.h"
+
+namespace {
+
+void usage(const char *program) {
+  std::cerr
+      << "Usage: " << program << " [options]\n"
+      << "  --scene NAME        Scene in assets/scenes, or a scene file.\n"
+      << "                      Default: viking_room.\n"
+      << "  --path NAME         Camera path: orbit, zoom or walk. Default: "
+         "orbit.\n"
+      << "  --mode MODE         raster or rt. Default: rt.\n"
+      << "  --renderer NAME     Ray tracer:";
+  for (int r = 0; r < rtx::render_engine::renderer_count(); ++r) {
+    std::cerr << (r > 0 ? ", " : " ") << rtx::render_engine::renderer_name(r);
+  }
+  std::cerr
+      << ".\n"
+      << "                      Default: "
+      << rtx::render_engine::renderer_name(0) << ".\n"
+      << "  --width N           Window width. Default: 1280.\n"
+      << "  --height N          Window height. Default: 720.\n"
+      << "  --frames N          Reported frames. Default: 300.\n"
+      << "  --warmup N          Frames drawn before. Default: 30.\n"
+      << "  --samples N         Samples per pixel. Default: 1.\n"
+      << "  --depth N           Maximum ray depth. Default: 8.\n"
+      << "  --rebuild-interval N\n"
+      << "                      Frames between builds of the acceleration\n"
+      << "                      structures of animated objects, refit in\n"
+      << "                      between. 0 never builds them. Default: 0.\n"
+      << "  --scratch-budget N  MiB of scratch memory of the BLASes built\n"
+      << "                      concurrently. Default: 256.\n"
+      << "  --output FILE       JSON report, - for standard output.\n"
+      << "                      Default: rtx_bench.json.\n";
+}
+
+bool parse_int(const char *value, int minimum, int &result) {
+  char *end = nullptr;
+  const long parsed = std::strtol(value, &end, 10);
+  if (end == value || *end != '\0' || parsed < minimum || parsed > 1 << 20) {
+    return false;
+  }
+  result = static_cast<int>(parsed);
+  return true;
+}
+
+bool parse_arguments(int argc, char *argv[],
+                     rtx::benchmark_settings_t &settings) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string option = argv[i];
+    if ("--help" == option) {
+      return false;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value of " << option << "." << std::endl;
+      return false;
+    }
+    const char *value = argv[++i];
+
+    bool valid = true;
+    if ("--scene" == option) {
+      settings.scene = value;
+    } else if ("--path" == option) {
+      settings.path = value;
+    } else if ("--mode" == option) {
+      if (0 == strcmp(value, "raster")) {
+        settings.render_mode = rtx::benchmark_settings_t::mode_raster;
+      } else if (0 == strcmp(value, "rt")) {
+        settings.render_mode = rtx::benchmark_settings_t::mode_ray_tracing;
+      } else {
+        valid = false;
+      }
+    } else if ("--renderer" == option) {
+      valid = false;
+      for (int r = 0; r < rtx::render_engine::renderer_count(); ++r) {
+        if (0 == strcmp(value, rtx::render_engine::renderer_name(r))) {
+          settings.renderer = r;
+          valid = true;
+        }
+      }
+    } else if ("--width" == option) {
+      valid = parse_int(value, 1, settings.width);
+    } else if ("--height" == option) {
+      valid = parse_int(value, 1, settings.height);
+    } else if ("--frames" == option) {
+      valid = parse_int(value, 1, settings.frames);
+    } else if ("--warmup" == option) {
+      valid = parse_int(value, 0, settings.warmup_frames);
+    } else if ("--samples" == option) {
+      valid = parse_int(value, 1, settings.samples);
+    } else if ("--depth" == option) {
+      valid = parse_int(value, 1, settings.max_iterations);
+    } else if ("--rebuild-interval" == option) {
+      valid = parse_int(value, 0, settings.rebuild_interval);
+    } else if ("--scratch-budget" == option) {
+      valid = parse_int(value, 1, settings.scratch_budget);
+    } else if ("--output" == option) {
+      settings.output = value;
+    } else {
+      std::cerr << "Unknown option " << option << "." << std::endl;
+      return false;
+    }
+
+    if (!valid) {
+      std::cerr << "Invalid value " << value << " of " << option << "."
+                << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  rtx::benchmark_settings_t settings;
+  if (!parse_arguments(argc, argv, settings)) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // Validation layers would be measured too.
+  bool debug = false;
+  rtx::render_engine r(debug);
+
+  const std::string title = "RTX benchmark";
+  const bool rtx_enabled =
+      rtx::benchmark_settings_t::mode_ray_tracing == settings.render_mode;
+  if (!r.init(title, 1, settings.width, settings.height, title, rtx_enabled,
+              settings.scene)) {
+    std::cerr << "Render init failed." << std::endl;
+    return -1;
+  }
+
+  rtx::benchmark_report_t report;
+  if (!r.benchmark(settings, report)) {
+    std::cerr << "Benchmark failed." << std::endl;
+    r.fini();
+    return -1;
+  }
+
+  r.fini();
+
+  if (!report.write(settings.output)) {
+    return -1;
+  }
+
+  return 0;
+}
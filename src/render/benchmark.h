@@ -0,0 +1,384 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "glm.h"
+
+namespace rtx {
+
+// Pose of the orbiting camera, see camera::set_pose().
+struct camera_pose_t {
+  glm::vec3 rotation;  // Degrees.
+  float distance;
+  glm::vec3 center;
+};
+
+// Scripted camera path, so that every run of a benchmark draws the same
+// frames. Key poses are evenly spaced in time and linearly interpolated.
+class camera_path {
+ public:
+  camera_path() : keys_() {}
+
+  // Built-in paths:
+  // - orbit: a full turn around the scene.
+  // - zoom: moves in close to the scene and back out.
+  // - walk: moves the center around the scene, as with the WASD keys.
+  bool init(const std::string &name) {
+    keys_.clear();
+
+    const glm::vec3 origin(0.0f);
+    if ("orbit" == name) {
+      for (int i = 0; i <= 8; ++i) {
+        keys_.push_back({glm::vec3(-20.0f, 45.0f * i, 0.0f), 3.0f, origin});
+      }
+    } else if ("zoom" == name) {
+      keys_.push_back({glm::vec3(-20.0f, 45.0f, 0.0f), 6.0f, origin});
+      keys_.push_back({glm::vec3(-30.0f, 60.0f, 0.0f), 1.0f, origin});
+      keys_.push_back({glm::vec3(-20.0f, 45.0f, 0.0f), 6.0f, origin});
+    } else if ("walk" == name) {
+      keys_.push_back({glm::vec3(-10.0f, 45.0f, 0.0f), 1.5f, origin});
+      keys_.push_back({glm::vec3(-10.0f, 90.0f, 0.0f), 1.5f,
+                       glm::vec3(0.5f, 0.0f, 0.0f)});
+      keys_.push_back({glm::vec3(-10.0f, 180.0f, 0.0f), 1.5f,
+                       glm::vec3(0.5f, 0.0f, 0.5f)});
+      keys_.push_back({glm::vec3(-10.0f, 270.0f, 0.0f), 1.5f,
+                       glm::vec3(0.0f, 0.0f, 0.5f)});
+      keys_.push_back({glm::vec3(-10.0f, 405.0f, 0.0f), 1.5f, origin});
+    } else {
+      std::cerr << "Unknown camera path " << name
+                << ". Available: orbit, zoom, walk." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Pose at a time in [0, 1] of the path.
+  camera_pose_t pose(float t) const {
+    const float position = std::min(std::max(t, 0.0f), 1.0f) *
+                           static_cast<float>(keys_.size() - 1);
+    const size_t key = std::min(static_cast<size_t>(position),
+                                keys_.size() - 2);
+    const float f = position - static_cast<float>(key);
+
+    const camera_pose_t &a = keys_[key];
+    const camera_pose_t &b = keys_[key + 1];
+    return {a.rotation + (b.rotation - a.rotation) * f,
+            a.distance + (b.distance - a.distance) * f,
+            a.center + (b.center - a.center) * f};
+  }
+
+ private:
+  std::vector<camera_pose_t> keys_;
+};
+
+struct benchmark_settings_t {
+  enum mode { mode_raster = 0, mode_ray_tracing = 1 };
+
+  std::string scene = "viking_room";
+  std::string path = "orbit";  // Camera path.
+  mode render_mode = mode_ray_tracing;
+  int renderer = 0;  // Ray tracer, as in the UI.
+  int width = 1280;
+  int height = 720;
+  int frames = 300;
+  int warmup_frames = 30;  // Drawn but not reported.
+  int samples = 1;
+  int max_iterations = 8;
+  // Frames between builds of the acceleration structures of the animated
+  // objects, refit in between. 0 never builds them again.
+  int rebuild_interval = 0;
+  int scratch_budget = 256;  // MiB of scratch memory of the BLAS builds.
+  std::string output = "rtx_bench.json";  // Standard output if "-".
+};
+
+// Times of a frame. The frame time is the wall time from the start of a
+// frame to its present, waits included. The CPU time is of recording and
+// submitting its commands. GPU times are of the raster pass or the ray tracer,
+// and of the skinning and the refit, or build, of the animated objects.
+struct benchmark_frame_t {
+  double frame_milliseconds;
+  double cpu_milliseconds;
+  float gpu_milliseconds;
+  float animation_milliseconds;
+  bool rebuilt;  // Whether the acceleration structures were built again.
+  // Every pass of the GPU timer, in the order of the report gpu_passes. 0
+  // when the pass did not run.
+  std::vector<float> pass_milliseconds;
+};
+
+// BLASes built concurrently at the start of the benchmark.
+struct benchmark_build_batch_t {
+  uint32_t blas_count;
+  uint64_t scratch_bytes;
+  float gpu_milliseconds;
+};
+
+struct benchmark_report_t {
+  std::string scene;
+  std::string path;
+  std::string mode;
+  std::string renderer;
+  std::string device;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  int samples = 0;
+  int max_iterations = 0;
+  bool gpu_timer = false;
+  double scene_load_milliseconds = 0.0;
+  double acceleration_structure_build_milliseconds = -1.0;  // -1: not built.
+  // BLASes deserialized from the cache, and built then written to it.
+  uint32_t acceleration_structure_cache_hits = 0;
+  uint32_t acceleration_structure_cache_misses = 0;
+  int scratch_budget = 0;  // MiB.
+  std::vector<benchmark_build_batch_t> build_batches;
+  std::vector<std::string> gpu_passes;  // Names of the GPU timer passes.
+  bool animated = false;  // Whether the scene has skinned objects.
+  int rebuild_interval = 0;
+  int64_t device_memory_bytes = -1;  // -1: unknown.
+  int64_t host_memory_bytes = -1;    // -1: unknown.
+  std::vector<benchmark_frame_t> frames;
+
+  bool write(const std::string &path) const {
+    if ("-" == path) {
+      write_json(std::cout);
+      return true;
+    }
+
+    std::ofstream file(path);
+    if (!file) {
+      std::cerr << "Failed to open " << path << "." << std::endl;
+      return false;
+    }
+    write_json(file);
+    if (!file) {
+      std::cerr << "Failed to write " << path << "." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void write_json(std::ostream &out) const {
+    std::vector<double> frame_times;
+    std::vector<double> cpu;
+    std::vector<double> gpu;
+    std::vector<double> refit;  // Animation times, by refit or build.
+    std::vector<double> rebuild;
+    for (const benchmark_frame_t &frame : frames) {
+      frame_times.push_back(frame.frame_milliseconds);
+      cpu.push_back(frame.cpu_milliseconds);
+      gpu.push_back(frame.gpu_milliseconds);
+      (frame.rebuilt ? rebuild : refit)
+          .push_back(frame.animation_milliseconds);
+    }
+    const bool animation_timed = animated && gpu_timer;
+
+    // Only the passes that ran are reported.
+    std::vector<std::vector<double>> passes(gpu_passes.size());
+    for (const benchmark_frame_t &frame : frames) {
+      for (size_t p = 0;
+           p < passes.size() && p < frame.pass_milliseconds.size(); ++p) {
+        passes[p].push_back(frame.pass_milliseconds[p]);
+      }
+    }
+    std::vector<size_t> passes_run;
+    for (size_t p = 0; gpu_timer && p < passes.size(); ++p) {
+      if (std::any_of(passes[p].begin(), passes[p].end(),
+                      [](double ms) { return ms > 0.0; })) {
+        passes_run.push_back(p);
+      }
+    }
+
+    out << std::fixed << std::setprecision(4);
+    out << "{\n";
+    out << "  \"scene\": " << quoted(scene) << ",\n";
+    out << "  \"camera_path\": " << quoted(path) << ",\n";
+    out << "  \"mode\": " << quoted(mode) << ",\n";
+    out << "  \"renderer\": " << quoted(renderer) << ",\n";
+    out << "  \"device\": " << quoted(device) << ",\n";
+    out << "  \"width\": " << width << ",\n";
+    out << "  \"height\": " << height << ",\n";
+    out << "  \"samples\": " << samples << ",\n";
+    out << "  \"max_iterations\": " << max_iterations << ",\n";
+    out << "  \"frame_count\": " << frames.size() << ",\n";
+    out << "  \"scene_load_ms\": " << scene_load_milliseconds << ",\n";
+    out << "  \"acceleration_structure_build_ms\": ";
+    if (acceleration_structure_build_milliseconds < 0.0) {
+      out << "null";
+    } else {
+      out << acceleration_structure_build_milliseconds;
+    }
+    out << ",\n";
+    out << "  \"acceleration_structure_cache_hits\": "
+        << acceleration_structure_cache_hits << ",\n";
+    out << "  \"acceleration_structure_cache_misses\": "
+        << acceleration_structure_cache_misses << ",\n";
+    out << "  \"scratch_budget_mib\": " << scratch_budget << ",\n";
+    out << "  \"blas_build_batches\": [";
+    for (size_t i = 0; i < build_batches.size(); ++i) {
+      out << (i > 0 ? ",\n    " : "\n    ");
+      out << "{\"blas_count\": " << build_batches[i].blas_count
+          << ", \"scratch_bytes\": " << build_batches[i].scratch_bytes
+          << ", \"gpu_ms\": ";
+      if (gpu_timer) {
+        out << build_batches[i].gpu_milliseconds;
+      } else {
+        out << "null";
+      }
+      out << "}";
+    }
+    out << (build_batches.empty() ? "],\n" : "\n  ],\n");
+    out << "  \"device_memory_bytes\": " << optional(device_memory_bytes)
+        << ",\n";
+    out << "  \"host_memory_bytes\": " << optional(host_memory_bytes)
+        << ",\n";
+    out << "  \"frame_ms\": ";
+    write_summary(out, frame_times);
+    out << ",\n";
+    out << "  \"cpu_ms\": ";
+    write_summary(out, cpu);
+    out << ",\n";
+    out << "  \"gpu_ms\": ";
+    if (gpu_timer) {
+      write_summary(out, gpu);
+    } else {
+      out << "null";
+    }
+    out << ",\n";
+    out << "  \"gpu_pass_ms\": {";
+    for (size_t i = 0; i < passes_run.size(); ++i) {
+      out << (i > 0 ? ",\n    " : "\n    ") << quoted(gpu_passes[passes_run[i]])
+          << ": ";
+      write_summary(out, passes[passes_run[i]]);
+    }
+    out << (passes_run.empty() ? "},\n" : "\n  },\n");
+    out << "  \"animated\": " << (animated ? "true" : "false") << ",\n";
+    out << "  \"rebuild_interval\": " << rebuild_interval << ",\n";
+    out << "  \"animation_refit_ms\": ";
+    if (animation_timed) {
+      write_summary(out, refit);
+    } else {
+      out << "null";
+    }
+    out << ",\n";
+    out << "  \"animation_rebuild_ms\": ";
+    if (animation_timed) {
+      write_summary(out, rebuild);
+    } else {
+      out << "null";
+    }
+    out << ",\n";
+    out << "  \"frames\": [";
+    for (size_t i = 0; i < frames.size(); ++i) {
+      out << (i > 0 ? ",\n    " : "\n    ");
+      out << "{\"frame_ms\": " << frames[i].frame_milliseconds
+          << ", \"cpu_ms\": " << frames[i].cpu_milliseconds
+          << ", \"gpu_ms\": ";
+      if (gpu_timer) {
+        out << frames[i].gpu_milliseconds;
+      } else {
+        out << "null";
+      }
+      if (animated) {
+        out << ", \"animation_ms\": ";
+        if (gpu_timer) {
+          out << frames[i].animation_milliseconds;
+        } else {
+          out << "null";
+        }
+        out << ", \"as_rebuild\": " << (frames[i].rebuilt ? "true" : "false");
+      }
+      if (!passes_run.empty()) {
+        out << ", \"gpu_pass_ms\": {";
+        for (size_t j = 0; j < passes_run.size(); ++j) {
+          const size_t p = passes_run[j];
+          out << (j > 0 ? ", " : "") << quoted(gpu_passes[p]) << ": "
+              << (p < frames[i].pass_milliseconds.size()
+                      ? frames[i].pass_milliseconds[p]
+                      : 0.0f);
+        }
+        out << "}";
+      }
+      out << "}";
+    }
+    out << (frames.empty() ? "]\n" : "\n  ]\n");
+    out << "}" << std::endl;
+  }
+
+  // Resident memory of the process, -1 where unknown.
+  static int64_t host_resident_bytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    int64_t size = 0;
+    int64_t resident = 0;
+    if (statm >> size >> resident) {
+      return resident * static_cast<int64_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return -1;
+  }
+
+ private:
+  static std::string quoted(const std::string &s) {
+    std::string result = "\"";
+    for (const char c : s) {
+      switch (c) {
+        case '"':
+          result += "\\\"";
+          break;
+        case '\\':
+          result += "\\\\";
+          break;
+        case '\n':
+          result += "\\n";
+          break;
+        default:
+          if (static_cast<unsigned char>(c) >= 0x20) {
+            result += c;
+          }
+      }
+    }
+    return result + "\"";
+  }
+
+  static std::string optional(int64_t value) {
+    return value < 0 ? "null" : std::to_string(value);
+  }
+
+  // Mean, percentiles and extremes of the frame times.
+  static void write_summary(std::ostream &out, std::vector<double> values) {
+    if (values.empty()) {
+      out << "null";
+      return;
+    }
+
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (const double v : values) {
+      sum += v;
+    }
+    const auto percentile = [&values](double p) {
+      const size_t i = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+      return values[i];
+    };
+
+    out << "{\"mean\": " << sum / values.size()
+        << ", \"median\": " << percentile(0.5)
+        << ", \"p95\": " << percentile(0.95)
+        << ", \"p99\": " << percentile(0.99) << ", \"min\": " << values.front()
+        << ", \"max\": " << values.back() << "}";
+  }
+};
+
+}  // namespace rtx
@@ -47,6 +47,11 @@ class camera {
   const glm::mat4 &view() const { return view_; }
   const glm::mat4 inverse_view() const { return glm::inverse(view_); }
 
+  const glm::vec3 position() const { return glm::vec3(inverse_view()[3]); }
+
+  // Vertical field of view, in degrees.
+  float fov() const { return FOV; }
+
   const glm::mat4 projection() const { return clip_ * projection_; }
   const glm::mat4 inverse_projection() const {
     return glm::inverse(clip_ * projection_);
@@ -100,6 +105,22 @@ class camera {
     }
   }
 
+  // Place the camera without user input, as in scripted camera paths.
+  void set_pose(const glm::vec3 &rotation, float distance,
+                const glm::vec3 &center) {
+    const float clamped_distance =
+        std::min(std::max(distance, MIN_DISTANCE), MAX_DISTANCE);
+    if (rotation == rotation_ && clamped_distance == distance_ &&
+        center == center_) {
+      return;
+    }
+
+    rotation_ = rotation;
+    distance_ = clamped_distance;
+    center_ = center;
+    updated_ = true;
+  }
+
   bool is_updated() const { return updated_; }
 
  private:
@@ -18,6 +18,10 @@ class constants {
 
   // Number of frames that can be drawed concurrently.
   static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+
+  // Maximum number of levels of detail of an object, including the full
+  // resolution one.
+  static constexpr uint32_t MAX_LODS = 4;
 };
 
 }  // namespace rtx
@@ -15,7 +15,7 @@ class descriptor_sets {
                  const std::vector<VkDescriptorPoolSize>& pool_sizes) {
     // static constexpr uint32_t pool_descriptor_count = 1;
     // VkDescriptorPoolSize descriptor_pool_size[] = {
-    //    {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, pool_descriptor_count},
+    //    {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, pool_descriptor_count},
     //    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, pool_descriptor_count},
     //    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, pool_descriptor_count},
     //    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2}};
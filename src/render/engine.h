@@ -1,7 +1,17 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -18,27 +28,43 @@
 #include <tiny_obj_loader.h>
 
 #include "acceleration_structure.h"
+#include "benchmark.h"
 #include "camera.h"
 #include "constants.h"
 #include "depth_buffer.h"
+#include "frame_time_controller.h"
 #include "glm.h"
+#include "gltf_loader.h"
+#include "gpu_timer.h"
 #include "helpers.h"
 #include "layer_properties.h"
 #include "memory.h"
+#include "mesh_cache.h"
+#include "mesh_simplifier.h"
 #include "object.h"
 #include "platform.h"
+#include "ply_loader.h"
+#include "scene.h"
 #include "ray_tracing_extensions.h"
+#include "raytracing/denoiser.h"
 #include "raytracing/descriptor_pool.h"
+#include "raytracing/hybrid.h"
+#include "raytracing/ray_counters.h"
 #include "raytracing/ray_tracer.h"
+#include "raytracing/upscaler.h"
+#include "raytracing/wavefront.h"
+#include "skinning.h"
 #include "swap_chain_buffer.h"
 #include "uniform_data.h"
 #include "vertex.h"
 
 // shaders
 #include "draw_cube.frag.h"
+#include "draw_cube_shadow.frag.h"
 #include "draw_cube.vert.h"
 
 // Ray tracing shaders
+#include "raytrace.comp.h"
 #include "raytrace.rchit.h"
 #include "raytrace.rgen.h"
 #include "raytrace.rmiss.h"
@@ -294,6 +320,7 @@ class render_engine {
         gpus_(),
         queue_props_(),
         memory_properties_(),
+        memory_budget_supported_(false),
         device_(),
         memory_(),
         graphics_queue_(),
@@ -309,11 +336,13 @@ class render_engine {
         buffers_(),
         current_buffer_(0),
         command_pool_(),
+        frame_command_pools_(),
         command_buffers_(),
+        imgui_command_buffers_(),
+        raster_commands_(),
         image_acquire_semaphores_(),
         render_finished_semaphores_(),
         in_flight_fences_(),
-        images_in_flight_(),
         current_frame_(0),
         depth_buffer_(),
         pipeline_layout_(),
@@ -329,8 +358,27 @@ class render_engine {
         texture_image_memory_(),
         texture_image_view_(),
         texture_sampler_(),
+        scene_name_(),
+        scene_stream_(),
+        init_start_(),
+        scene_load_milliseconds_(0.0),
+        first_frame_milliseconds_(0.0),
         objects_(),
         objects_instances_(),
+        geometry_buf_(VK_NULL_HANDLE),
+        geometry_mem_(VK_NULL_HANDLE),
+        geometry_size_(0),
+        geometry_capacity_(0),
+        geometry_object_count_(0),
+        instance_buf_(VK_NULL_HANDLE),
+        instance_mem_(VK_NULL_HANDLE),
+        skinning_(),
+        animate_(true),
+        animation_time_(0.0f),
+        forced_lod_(-1),
+        lod_pixel_error_(1.0f),
+        current_lod_(0),
+        lod_frame_time_{},
         camera_(),
         instance_layer_properties_(),
         instance_extension_names_(),
@@ -347,25 +395,67 @@ class render_engine {
         rtx_enabled_(false),
         rtx_(),
         rt_properties_{},
+        rt_as_properties_{},
         rt_descriptor_pool_(),
         rt_descriptor_set_(),
         rt_descriptor_layout_(),
         rt_storage_image_(),
+        rt_statistics_image_(),
+        rt_gbuffer_{},
+        rt_history_{},
         rt_constants_(),
         rt_shader_groups_(),
         rt_pipeline_(),
         rt_pipeline_layout_(),
-        rt_shader_binding_table_()
+        rt_shader_binding_table_(),
+        rt_secondary_lod_(0),
+        rt_prefer_fast_build_(false),
+        rt_cluster_culling_(false),
+        rt_instance_budget_(65536),
+        rt_cluster_distance_(50.0f),
+        rt_build_milliseconds_(0.0),
+        rt_scratch_budget_(256),
+        rt_rebuild_interval_(0),
+        rt_refits_(0),
+        rt_rebuilt_(false),
+        rq_shader_stage_{},
+        rq_pipeline_(),
+        raster_shadows_(false),
+        raster_shadow_shader_stages_{},
+        raster_shadow_pipeline_layout_(),
+        raster_shadow_pipeline_(),
+        rt_renderer_(rt_renderer_pipeline),
+        rt_renderer_ab_(false),
+        rt_wavefront_(),
+        rt_wavefront_sort_(true),
+        rt_hybrid_(),
+        rt_denoiser_(),
+        rt_denoise_(false),
+        rt_denoiser_iterations_(denoiser::MAX_ITERATIONS),
+        rt_upscaler_(),
+        rt_upscaler_mode_(upscaler::mode_temporal),
+        rt_render_scale_(100),
+        rt_render_size_(),
+        rt_frame_time_controller_(),
+        rt_frame_time_budget_(false),
+        rt_target_fps_(60),
+        rt_ray_counters_(),
+        rt_heatmap_(ray_counters::counter_clock),
+        gpu_timer_(),
+        frame_cpu_milliseconds_(0.0)
   //
   {
     std::cout << "Engine: Hello World." << std::endl;
   }
 
   bool init(const std::string &application_name, uint32_t application_version,
-            int width, int height, const std::string &title, bool rtx_enabled) {
+            int width, int height, const std::string &title, bool rtx_enabled,
+            const std::string &scene_name = "viking_room") {
+    init_start_ = std::chrono::steady_clock::now();
     application_name_ = application_name;
     application_version_ = application_version;
     rtx_enabled_ = rtx_enabled;
+    scene_name_ = scene_name;
 
     if (!init_glfw(width, height, title)) {
       std::cerr << "init_glfw() failed" << std::endl;
@@ -430,6 +520,14 @@ class render_engine {
       return false;
     }
 
+    if (!gpu_timer_.init(
+            memory_, gpu_properties_,
+            queue_props_[graphics_queue_family_index_].timestampValidBits,
+            timer_pass_count)) {
+      std::cerr << "gpu_timer.init() failed." << std::endl;
+      return false;
+    }
+
     if (rtx_enabled) {
       if (!init_ray_tracing()) {
         std::cerr << "init_ray_tracing() failed." << std::endl;
@@ -457,8 +555,9 @@ class render_engine {
       return false;
     }
 
-    if (!load_scene()) {
-      std::cerr << "load_scene() failed." << std::endl;
+    // Models show up as they load, the first frame does not wait for them.
+    if (!start_scene_load()) {
+      std::cerr << "start_scene_load() failed." << std::endl;
       return false;
     }
 
@@ -477,6 +576,8 @@ class render_engine {
   }
 
   void fini() {
+    fini_scene_stream();
+
     cleanup_swap_chain();
 
     cleanup_texture_sampler();
@@ -491,6 +592,8 @@ class render_engine {
 
     fini_pipeline_cache();
 
+    gpu_timer_.fini(memory_);
+
     fini_device();
 
     if (enable_validation_layer_) {
@@ -516,11 +619,26 @@ class render_engine {
     int ray_samples = rt_constants_.samples;
     int ray_max_iterations = rt_constants_.max_iterations;
     bool profile_temperature = rt_constants_.temperature;
-
-    float light_position[3] = {7.0f, 5.0f, -8.0f};
-    float light_intensity = 1.0f;
+    bool adaptive_sampling = rt_constants_.convergence_threshold > 0.0f;
+    float convergence_threshold = rt_constants_.convergence_threshold;
+    bool russian_roulette = rt_constants_.russian_roulette;
+    int secondary_lod = rt_secondary_lod_;
+    bool prefer_fast_build = rt_prefer_fast_build_;
+    int scratch_budget = rt_scratch_budget_;
+    int renderer = rt_renderer_;
+    bool raster_shadows = raster_shadows_;
+    bool denoise = rt_denoise_;
+    int render_scale = rt_render_scale_;
+    int upscaler_mode = rt_upscaler_mode_;
+    bool frame_time_budget = rt_frame_time_budget_;
+
+    // The light of the scene.
+    float light_position[3] = {rt_constants_.light_position.x,
+                               rt_constants_.light_position.y,
+                               rt_constants_.light_position.z};
+    float light_intensity = rt_constants_.light_intensity;
     enum light_mode { light_mode_point = 0, light_mode_directional = 1 };
-    int light_type = 1;  // point = 0, directional = 1;
+    int light_type = rt_constants_.light_type;  // point = 0, directional = 1;
 
     while (!platform_.should_close_window()) {
       platform_.poll_events();
@@ -532,9 +650,12 @@ class render_engine {
       if (camera_.is_updated()) {
         // std::cout << "Updating uniform buffer due to camera movement."
         //           << std::endl;
+        // Accumulated samples are reprojected, see reprojection.glsl.
+        update_uniform_buffer();
+      } else if (uniform_data_.data.previous_mvp != uniform_data_.data.mvp) {
+        // The camera stopped. Motion vectors are relative to the previous
+        // frame, that already had the current view.
         update_uniform_buffer();
-
-        reset_ray_tracing_frame_counter();
       }
 
       // Start the Dear ImGui frame.
@@ -542,6 +663,10 @@ class render_engine {
       ImGui_ImplGlfw_NewFrame();
       ImGui::NewFrame();
 
+      if (animate_) {
+        animation_time_ += ImGui::GetIO().DeltaTime;
+      }
+
       if (show_demo_window) {
         ImGui::ShowDemoWindow(&show_demo_window);
       }
@@ -558,8 +683,74 @@ class render_engine {
         ImGui::Text("Ray Tracing");
         if (rtx_enabled_) {
           ImGui::Checkbox("RTX", &rtx_on);
+          ImGui::SameLine();
+          ImGui::Checkbox("Raster shadows", &raster_shadows);
           ImGui::SliderInt("Samples", &ray_samples, 1, 32);
           ImGui::SliderInt("Depth", &ray_max_iterations, 1, 32);
+          ImGui::Checkbox("Frame time budget", &frame_time_budget);
+          if (frame_time_budget) {
+            // Samples, depth and render scale sliders are the limits.
+            ImGui::SliderInt("Target FPS", &rt_target_fps_, 15, 144);
+            const frame_time_controller::settings_t &chosen =
+                rt_frame_time_controller_.settings();
+            ImGui::Text("Chosen: %d%% scale, %d samples, depth %d",
+                        chosen.render_scale, chosen.samples,
+                        chosen.max_iterations);
+          }
+          ImGui::Checkbox("Russian roulette", &russian_roulette);
+          ImGui::Checkbox("Adaptive sampling", &adaptive_sampling);
+          if (adaptive_sampling) {
+            ImGui::SliderFloat("Error threshold", &convergence_threshold,
+                               0.001f, 0.1f, "%.3f",
+                               ImGuiSliderFlags_Logarithmic);
+          }
+
+          // Renderer
+          if (ImGui::RadioButton("RT pipeline",
+                                 renderer == rt_renderer_pipeline)) {
+            renderer = rt_renderer_pipeline;
+          }
+          ImGui::SameLine();
+          if (ImGui::RadioButton("Ray query",
+                                 renderer == rt_renderer_ray_query)) {
+            renderer = rt_renderer_ray_query;
+          }
+          ImGui::SameLine();
+          if (ImGui::RadioButton("Wavefront",
+                                 renderer == rt_renderer_wavefront)) {
+            renderer = rt_renderer_wavefront;
+          }
+          ImGui::SameLine();
+          if (ImGui::RadioButton("Hybrid", renderer == rt_renderer_hybrid)) {
+            renderer = rt_renderer_hybrid;
+          }
+          ImGui::SameLine();
+          ImGui::Checkbox("A/B", &rt_renderer_ab_);
+          if (renderer == rt_renderer_wavefront) {
+            ImGui::Checkbox("Sort rays", &rt_wavefront_sort_);
+          }
+          ImGui::Checkbox("Denoiser", &denoise);
+          if (denoise) {
+            ImGui::SliderInt("Filter iterations", &rt_denoiser_iterations_, 1,
+                             denoiser::MAX_ITERATIONS);
+          }
+          ImGui::SliderInt("Render scale", &render_scale, 50, 100, "%d%%");
+          if (render_scale < 100 || frame_time_budget) {
+            if (ImGui::RadioButton("Bilinear",
+                                   upscaler_mode == upscaler::mode_bilinear)) {
+              upscaler_mode = upscaler::mode_bilinear;
+            }
+            ImGui::SameLine();
+            if (ImGui::RadioButton(
+                    "Edge-aware", upscaler_mode == upscaler::mode_edge_aware)) {
+              upscaler_mode = upscaler::mode_edge_aware;
+            }
+            ImGui::SameLine();
+            if (ImGui::RadioButton("Temporal",
+                                   upscaler_mode == upscaler::mode_temporal)) {
+              upscaler_mode = upscaler::mode_temporal;
+            }
+          }
 
           // Light  options
           if (ImGui::CollapsingHeader("Light")) {
@@ -576,14 +767,72 @@ class render_engine {
             }
           }
 
+          // Acceleration structure options
+          if (ImGui::CollapsingHeader("Acceleration structures")) {
+            if (ImGui::RadioButton("Fast trace", !prefer_fast_build)) {
+              prefer_fast_build = false;
+            }
+            ImGui::SameLine();
+            if (ImGui::RadioButton("Fast build", prefer_fast_build)) {
+              prefer_fast_build = true;
+            }
+            // BLASes are built concurrently within the scratch budget.
+            ImGui::SliderInt("Scratch budget", &scratch_budget, 1, 4096,
+                             "%d MiB", ImGuiSliderFlags_Logarithmic);
+            ImGui::Checkbox("Cluster culling", &rt_cluster_culling_);
+            if (rt_cluster_culling_) {
+              ImGui::SliderInt("Instance budget", &rt_instance_budget_, 1,
+                               1 << 20, "%d", ImGuiSliderFlags_Logarithmic);
+              ImGui::SliderFloat("Nearby distance", &rt_cluster_distance_,
+                                 0.0f, 1000.0f, "%.1f",
+                                 ImGuiSliderFlags_Logarithmic);
+            }
+          }
+
           // Debug
           if (ImGui::CollapsingHeader("Debug")) {
             ImGui::Checkbox("Pixel temperature", &profile_temperature);
+            // Heat map of a per pixel counter, drawn as traced.
+            for (int c = 0; c < ray_counters::counter_count; ++c) {
+              const ray_counters::counter counter =
+                  static_cast<ray_counters::counter>(c);
+              if (c > 0) {
+                ImGui::SameLine();
+              }
+              if (ImGui::RadioButton(ray_counters::name(counter),
+                                     rt_heatmap_ == counter)) {
+                rt_heatmap_ = counter;
+              }
+            }
           }
         } else {
           ImGui::Text("RTX not supported");
         }
 
+        // Skinned objects
+        if (skinning_.enabled() && ImGui::CollapsingHeader("Animation")) {
+          ImGui::Checkbox("Animate", &animate_);
+          if (rtx_enabled_) {
+            // Refits are cheap but trace slower as the vertices move away
+            // from the last build.
+            ImGui::SliderInt("AS rebuild interval", &rt_rebuild_interval_, 0,
+                             240,
+                             rt_rebuild_interval_ > 0 ? "%d frames" : "Never");
+          }
+        }
+
+        // Level of detail options
+        if (ImGui::CollapsingHeader("Level of detail")) {
+          ImGui::SliderInt("Forced LOD", &forced_lod_, -1,
+                           constants::MAX_LODS - 1,
+                           forced_lod_ < 0 ? "Auto" : "%d");
+          ImGui::SliderFloat("Pixel error", &lod_pixel_error_, 0.1f, 16.0f);
+          if (rtx_enabled_) {
+            ImGui::SliderInt("Secondary rays LOD", &secondary_lod, 0,
+                             constants::MAX_LODS - 1);
+          }
+        }
+
         ImGui::End();
       }
 
@@ -612,17 +861,169 @@ class render_engine {
                     io.DisplaySize.y);
         ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
         ImGui::Text("%.3f ms/frame", 1000.0f / ImGui::GetIO().Framerate);
+        ImGui::Text("First frame: %.1f ms", first_frame_milliseconds_);
+        if (scene_stream_.active) {
+          const size_t total = scene_stream_.model_count;
+          const size_t added =
+              scene_stream_.models_added + scene_stream_.models_failed;
+          ImGui::Text("Loading scene: %zu of %zu models", added, total);
+          ImGui::ProgressBar(
+              total > 0 ? static_cast<float>(added) / total : 1.0f,
+              ImVec2(-1.0f, 0.0f));
+        } else {
+          ImGui::Text("Scene load: %.1f ms", scene_load_milliseconds_);
+        }
+        if (!rtx_on && gpu_timer_.enabled()) {
+          ImGui::Text("Raster: %.3f ms",
+                      gpu_timer_.milliseconds(timer_pass_raster));
+        }
+        if (skinning_.enabled() && gpu_timer_.enabled()) {
+          ImGui::Text("Animation: %zu objects, %u joints, %.3f ms",
+                      skinning_.object_count(), skinning_.joint_count(),
+                      gpu_timer_.milliseconds(timer_pass_animation));
+        }
 
         if (rtx_enabled_) {
           ImGui::Separator();
           ImGui::Text("Ray tracing");
           ImGui::Text("Accumulated frames: %d",
                       rtx_on ? rt_constants_.frame : 0);
+          ImGui::Text("Render size: %u x %u", rt_render_size_.width,
+                      rt_render_size_.height);
+          ImGui::Text("AS build: %.1f ms", rt_build_milliseconds_);
+          // The first batches, the others are alike.
+          static constexpr size_t BATCHES_SHOWN = 4;
+          const auto &batches = rtx_.build_batches();
+          for (size_t b = 0; b < batches.size() && b < BATCHES_SHOWN; ++b) {
+            ImGui::Text("  Batch %zu: %u BLASes, %.1f MiB, %.3f ms", b,
+                        batches[b].blas_count,
+                        batches[b].scratch_size / (1024.0 * 1024.0),
+                        batches[b].milliseconds);
+          }
+          if (batches.size() > BATCHES_SHOWN) {
+            ImGui::Text("  %zu more batches",
+                        batches.size() - BATCHES_SHOWN);
+          }
+          const auto &cache_stats = rtx_.cache_stats();
+          if (cache_stats.hits + cache_stats.misses > 0) {
+            ImGui::Text("AS cache: %u hits, %u misses", cache_stats.hits,
+                        cache_stats.misses);
+            ImGui::Text("AS cache: read %.1f ms, write %.1f ms",
+                        cache_stats.read_milliseconds,
+                        cache_stats.write_milliseconds);
+          }
+          if (gpu_timer_.enabled()) {
+            ImGui::Text("%s RT pipeline: %.3f ms",
+                        rt_renderer_ == rt_renderer_pipeline ? ">" : " ",
+                        gpu_timer_.milliseconds(rt_renderer_pipeline));
+            ImGui::Text("%s Ray query:   %.3f ms",
+                        rt_renderer_ == rt_renderer_ray_query ? ">" : " ",
+                        gpu_timer_.milliseconds(rt_renderer_ray_query));
+            ImGui::Text("%s Wavefront:   %.3f ms",
+                        rt_renderer_ == rt_renderer_wavefront ? ">" : " ",
+                        gpu_timer_.milliseconds(rt_renderer_wavefront));
+            ImGui::Text("%s Hybrid:      %.3f ms",
+                        rt_renderer_ == rt_renderer_hybrid ? ">" : " ",
+                        gpu_timer_.milliseconds(rt_renderer_hybrid));
+          }
+          if (rtx_on && rt_denoise_ && rt_denoiser_.timer_enabled()) {
+            ImGui::Text(
+                "Denoiser: temporal %.3f ms, filter %.3f ms",
+                rt_denoiser_.milliseconds(denoiser::pass_temporal),
+                rt_denoiser_.milliseconds(denoiser::pass_filter));
+          }
+          if (rtx_on && ray_tracing_upscaled() &&
+              rt_upscaler_.timer_enabled()) {
+            ImGui::Text("Upscaler: %.3f ms", rt_upscaler_.milliseconds());
+          }
+          if (rtx_on && rt_constants_.temperature) {
+            if (rt_ray_counters_.timer_enabled()) {
+              ImGui::Text("Ray counters: %.3f ms",
+                          rt_ray_counters_.milliseconds());
+            }
+            for (int c = 0; c < ray_counters::counter_count; ++c) {
+              const ray_counters::counter counter =
+                  static_cast<ray_counters::counter>(c);
+              ImGui::Text("%s %s: %.2f per pixel, max %u",
+                          rt_heatmap_ == counter ? ">" : " ",
+                          ray_counters::name(counter),
+                          rt_ray_counters_.average(counter),
+                          rt_ray_counters_.maximum(counter));
+            }
+            // Log2 histogram of the heat map counter, up to its last used
+            // bin.
+            const uint32_t *histogram =
+                rt_ray_counters_.histogram(rt_heatmap_);
+            float bins[ray_counters::HISTOGRAM_BINS] = {};
+            int bin_count = 1;
+            for (uint32_t i = 0; i < ray_counters::HISTOGRAM_BINS; ++i) {
+              bins[i] = static_cast<float>(histogram[i]);
+              if (histogram[i] > 0) {
+                bin_count = static_cast<int>(i) + 1;
+              }
+            }
+            ImGui::PlotHistogram("##heatmap", bins, bin_count, 0,
+                                 "Pixels per log2 bin", 0.0f, FLT_MAX,
+                                 ImVec2(0.0f, 60.0f));
+          }
+          if (rtx_on && rt_renderer_ == rt_renderer_wavefront &&
+              rt_wavefront_.timer_enabled()) {
+            // Throughput of each stage on the first sample of a frame.
+            const auto mrays_per_second = [](uint32_t rays, float ms) {
+              return ms > 0.0f ? rays / (1000.0f * ms) : 0.0f;
+            };
+            ImGui::Text("Camera rays: %u, %.1f Mrays/s",
+                        rt_wavefront_.camera_rays(),
+                        mrays_per_second(
+                            rt_wavefront_.camera_rays(),
+                            rt_wavefront_.milliseconds(
+                                wavefront_path_tracer::pass_generate)));
+            for (uint32_t i = 0; i < wavefront_path_tracer::MAX_BOUNCES; ++i) {
+              const uint32_t rays = rt_wavefront_.rays(i);
+              if (0 == rays) {
+                break;
+              }
+              const float sort_ms = rt_wavefront_.milliseconds(
+                  wavefront_path_tracer::pass_sort + i);
+              const float shade_ms = rt_wavefront_.milliseconds(
+                  wavefront_path_tracer::pass_shade + i);
+              ImGui::Text(
+                  "Bounce %u: %u rays, sort %.1f Mrays/s, trace %.1f Mrays/s",
+                  i, rays,
+                  rt_wavefront_sort_ ? mrays_per_second(rays, sort_ms) : 0.0f,
+                  mrays_per_second(rays, shade_ms));
+            }
+          }
+        }
+
+        if (rtx_on) {
+          ImGui::Separator();
+          const instance_clusters &clusters = rtx_.clusters();
+          ImGui::Text("TLAS: %zu of %zu instances, %zu of %zu clusters",
+                      rtx_.tlas_instance_count(), clusters.instance_count(),
+                      clusters.selected_cluster_count(),
+                      clusters.cluster_count());
+        }
+
+        if (!objects_.empty()) {
+          ImGui::Separator();
+          ImGui::Text("Level of detail");
+          const auto &lods = objects_[0].lods;
+          for (uint32_t i = 0; i < lods.size(); ++i) {
+            ImGui::Text("%s LOD %u: %u triangles, %.3f ms/frame",
+                        !rtx_on && i == current_lod_ ? ">" : " ", i,
+                        lods[i].index_count / 3, lod_frame_time_[i]);
+          }
         }
 
         ImGui::End();
       }
 
+      // Ray tracing waits for the first objects of the scene.
+      if (objects_.empty()) {
+        rtx_on = false;
+      }
+
       // Check for changes on settings options.
       // TODO: Refactor.
       if (rtx_on != prev_rtx_status) {
@@ -630,28 +1031,148 @@ class render_engine {
         force_recreate_swap_chain = true;
         std::cout << "RTX " << (rtx_on ? "ON" : "OFF") << "." << std::endl;
       }
-      if (ray_samples != rt_constants_.samples) {
-        rt_constants_.samples = ray_samples;
-        reset_ray_tracing_frame_counter();
+      if (frame_time_budget != rt_frame_time_budget_) {
+        // Start from the highest quality allowed by the sliders.
+        rt_frame_time_budget_ = frame_time_budget;
+        rt_frame_time_controller_.reset(
+            {render_scale, ray_samples, ray_max_iterations});
       }
-      if (ray_max_iterations != rt_constants_.max_iterations) {
-        rt_constants_.max_iterations = ray_max_iterations;
-        reset_ray_tracing_frame_counter();
+      if (rt_frame_time_budget_) {
+        if (rtx_on &&
+            rt_frame_time_controller_.update(
+                ray_tracing_milliseconds(), 1000.0f / rt_target_fps_,
+                {render_scale, ray_samples, ray_max_iterations})) {
+          const frame_time_controller::settings_t &chosen =
+              rt_frame_time_controller_.settings();
+          // Accumulation weights each frame by its samples, it goes on.
+          rt_constants_.samples = chosen.samples;
+          if (chosen.max_iterations != rt_constants_.max_iterations) {
+            rt_constants_.max_iterations = chosen.max_iterations;
+            reset_ray_tracing_frame_counter();
+          }
+          if (chosen.render_scale != rt_render_scale_) {
+            // Ray tracing images are created with the swap chain.
+            rt_render_scale_ = chosen.render_scale;
+            force_recreate_swap_chain = true;
+            reset_ray_tracing_frame_counter();
+          }
+        }
+      } else {
+        if (ray_samples != rt_constants_.samples) {
+          rt_constants_.samples = ray_samples;
+          reset_ray_tracing_frame_counter();
+        }
+        if (ray_max_iterations != rt_constants_.max_iterations) {
+          rt_constants_.max_iterations = ray_max_iterations;
+          reset_ray_tracing_frame_counter();
+        }
       }
       if (profile_temperature != rt_constants_.temperature) {
         rt_constants_.temperature = profile_temperature;
         reset_ray_tracing_frame_counter();
       }
+      if (russian_roulette != rt_constants_.russian_roulette) {
+        rt_constants_.russian_roulette = russian_roulette;
+        reset_ray_tracing_frame_counter();
+      }
+      {
+        // A threshold of 0 disables adaptive sampling.
+        const float threshold =
+            adaptive_sampling ? convergence_threshold : 0.0f;
+        if (threshold != rt_constants_.convergence_threshold) {
+          rt_constants_.convergence_threshold = threshold;
+          reset_ray_tracing_frame_counter();
+        }
+      }
+      if (static_cast<uint32_t>(secondary_lod) != rt_secondary_lod_) {
+        // Acceleration structures are built with the swap chain.
+        rt_secondary_lod_ = static_cast<uint32_t>(secondary_lod);
+        if (rtx_on) {
+          force_recreate_swap_chain = true;
+        }
+        reset_ray_tracing_frame_counter();
+      }
+      if (prefer_fast_build != rt_prefer_fast_build_) {
+        // Acceleration structures are built with the swap chain.
+        rt_prefer_fast_build_ = prefer_fast_build;
+        if (rtx_on) {
+          force_recreate_swap_chain = true;
+        }
+      }
+      if (scratch_budget != rt_scratch_budget_) {
+        rt_scratch_budget_ = scratch_budget;
+        if (rtx_on) {
+          force_recreate_swap_chain = true;
+        }
+      }
+      if (rt_renderer_ab_) {
+        // Alternate renderers and keep tracing, so that all are timed under
+        // the same load. Their images differ: the hybrid renderer only traces
+        // shadows and reflections over the rasterized visibility buffer.
+        renderer = (rt_renderer_ + 1) % rt_renderer_count;
+        reset_ray_tracing_frame_counter();
+      }
+      if (renderer != rt_renderer_) {
+        rt_renderer_ = static_cast<rt_renderer>(renderer);
+      }
+      if (raster_shadows != raster_shadows_) {
+        // The TLAS is built with the swap chain when the rasterizer uses it.
+        raster_shadows_ = raster_shadows;
+        if (!rtx_on) {
+          force_recreate_swap_chain = true;
+        }
+        invalidate_raster_commands();
+      }
+      if (denoise != rt_denoise_) {
+        // The history is stale after being off.
+        rt_denoise_ = denoise;
+        rt_denoiser_.reset();
+      }
+      if (!rt_frame_time_budget_ && render_scale != rt_render_scale_ &&
+          !ImGui::IsAnyItemActive()) {
+        // Ray tracing images are created with the swap chain, once the slider
+        // is released.
+        rt_render_scale_ = render_scale;
+        if (rtx_on) {
+          force_recreate_swap_chain = true;
+        }
+        reset_ray_tracing_frame_counter();
+      }
+      if (upscaler_mode != rt_upscaler_mode_) {
+        rt_upscaler_mode_ = static_cast<upscaler::mode>(upscaler_mode);
+      }
+
+      // Objects loaded since the last frame are shown from the next one.
+      static constexpr bool wait_for_scene = false;
+      bool first_objects = false;
+      if (!stream_scene(wait_for_scene, first_objects)) {
+        std::cerr << "Scene streaming failed." << std::endl;
+        break;
+      }
+      if (first_objects) {
+        force_recreate_swap_chain = true;
+      }
 
       if (!render_frame(force_recreate_swap_chain, rtx_on)) {
         std::cerr << "Rendering frame failed." << std::endl;
         break;
       }
+      if (!rtx_on) {
+        // Moving average of the frame time of the drawn level of detail.
+        float &lod_frame_time = lod_frame_time_[current_lod_];
+        const float frame_time = 1000.0f * ImGui::GetIO().DeltaTime;
+        lod_frame_time = lod_frame_time > 0.0f
+                             ? 0.95f * lod_frame_time + 0.05f * frame_time
+                             : frame_time;
+      }
       if (rt_constants_.light_position !=
           glm::vec3(light_position[0], light_position[1], light_position[2])) {
         rt_constants_.light_position =
             glm::vec3(light_position[0], light_position[1], light_position[2]);
         reset_ray_tracing_frame_counter();
+        if (raster_shadows_) {
+          invalidate_raster_commands();
+        }
       }
       if (rt_constants_.light_intensity != light_intensity) {
         rt_constants_.light_intensity = light_intensity;
@@ -660,6 +1181,9 @@ class render_engine {
       if (rt_constants_.light_type != light_type) {
         rt_constants_.light_type = light_type;
         reset_ray_tracing_frame_counter();
+        if (raster_shadows_) {
+          invalidate_raster_commands();
+        }
       }
 
       if (force_recreate_swap_chain) {
@@ -673,6 +1197,205 @@ class render_engine {
     return true;
   }
 
+  // Ray tracers, see rt_renderer.
+  static constexpr int renderer_count() { return rt_renderer_count; }
+
+  // Name of a ray tracer, as given to the benchmark.
+  static const char *renderer_name(int renderer) {
+    static const char *names[rt_renderer_count] = {"pipeline", "ray_query",
+                                                   "wavefront", "hybrid"};
+    return renderer >= 0 && renderer < rt_renderer_count ? names[renderer]
+                                                         : "unknown";
+  }
+
+  // Draw a scripted camera path with fixed settings and report the times of
+  // every frame, without UI nor user input. Ray tracing settings that change
+  // the work per frame, such as adaptive sampling or the frame time budget,
+  // are off.
+  bool benchmark(const benchmark_settings_t &settings,
+                 benchmark_report_t &report) {
+    camera_path path;
+    if (!path.init(settings.path)) {
+      return false;
+    }
+
+    const bool rtx_on =
+        benchmark_settings_t::mode_ray_tracing == settings.render_mode;
+    if (rtx_on && !rtx_enabled_) {
+      std::cerr << "Ray tracing benchmark without ray tracing support."
+                << std::endl;
+      return false;
+    }
+    if (settings.renderer < 0 || settings.renderer >= rt_renderer_count) {
+      std::cerr << "Unknown renderer " << settings.renderer << "."
+                << std::endl;
+      return false;
+    }
+    if (settings.frames <= 0 || settings.warmup_frames < 0) {
+      std::cerr << "Invalid number of frames." << std::endl;
+      return false;
+    }
+    if (settings.rebuild_interval < 0) {
+      std::cerr << "Invalid rebuild interval." << std::endl;
+      return false;
+    }
+
+    rt_renderer_ = static_cast<rt_renderer>(settings.renderer);
+    rt_renderer_ab_ = false;
+    rt_constants_.samples = settings.samples;
+    rt_constants_.max_iterations = settings.max_iterations;
+    rt_constants_.convergence_threshold = 0.0f;
+    rt_constants_.temperature = false;
+    rt_denoise_ = false;
+    rt_render_scale_ = 100;
+    rt_frame_time_budget_ = false;
+    rt_rebuild_interval_ = settings.rebuild_interval;
+    rt_scratch_budget_ = settings.scratch_budget;
+    animate_ = true;
+    reset_ray_tracing_frame_counter();
+
+    // Frames are measured over the whole scene.
+    static constexpr bool wait_for_scene = true;
+    bool first_objects = false;
+    if (!stream_scene(wait_for_scene, first_objects)) {
+      std::cerr << "Scene loading failed." << std::endl;
+      return false;
+    }
+    if (rtx_on && objects_.empty()) {
+      std::cerr << "Ray tracing benchmark of an empty scene." << std::endl;
+      return false;
+    }
+
+    if (rtx_on || first_objects) {
+      // Builds the acceleration structures.
+      if (!recreate_swap_chain(rtx_on)) {
+        std::cerr << "recreate_swap_chain() failed." << std::endl;
+        return false;
+      }
+    }
+
+    const uint32_t frame_count =
+        static_cast<uint32_t>(settings.warmup_frames + settings.frames);
+    std::vector<benchmark_frame_t> frames(frame_count);
+
+    // GPU times of a frame are read when its frame in flight is reused.
+    static constexpr uint32_t none = UINT32_MAX;
+    uint32_t pending[constants::MAX_FRAMES_IN_FLIGHT];
+    std::fill(pending, pending + constants::MAX_FRAMES_IN_FLIGHT, none);
+    const uint32_t timer_pass = rtx_on ? rt_renderer_ : timer_pass_raster;
+    const auto read_gpu_times = [&](benchmark_frame_t &times) {
+      times.gpu_milliseconds = gpu_timer_.last_milliseconds(timer_pass);
+      times.animation_milliseconds =
+          gpu_timer_.last_milliseconds(timer_pass_animation);
+      times.pass_milliseconds.resize(timer_pass_count);
+      for (uint32_t pass = 0; pass < timer_pass_count; ++pass) {
+        times.pass_milliseconds[pass] = gpu_timer_.last_milliseconds(pass);
+      }
+    };
+
+    uint32_t frame = 0;
+    while (frame < frame_count) {
+      if (platform_.should_close_window()) {
+        std::cerr << "Window closed during the benchmark." << std::endl;
+        return false;
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+
+      platform_.poll_events();
+
+      const float t = frame_count > 1 ? static_cast<float>(frame) /
+                                            static_cast<float>(frame_count - 1)
+                                      : 0.0f;
+      const camera_pose_t pose = path.pose(t);
+      // Clips play at a fixed rate, whatever the frame times.
+      animation_time_ = static_cast<float>(frame) / 60.0f;
+      camera_.set_pose(pose.rotation, pose.distance, pose.center);
+      if (camera_.is_updated() ||
+          uniform_data_.data.previous_mvp != uniform_data_.data.mvp) {
+        update_uniform_buffer();
+      }
+
+      // Dear ImGui draws nothing, but render_frame() ends its frame.
+      ImGui_ImplVulkan_NewFrame();
+      ImGui_ImplGlfw_NewFrame();
+      ImGui::NewFrame();
+
+      const uint32_t frame_in_flight = current_frame_;
+      static constexpr bool force_recreate_swap_chain = false;
+      if (!render_frame(force_recreate_swap_chain, rtx_on)) {
+        std::cerr << "Rendering frame failed." << std::endl;
+        return false;
+      }
+
+      if (none != pending[frame_in_flight]) {
+        read_gpu_times(frames[pending[frame_in_flight]]);
+        pending[frame_in_flight] = none;
+      }
+
+      // No frame is submitted when the swap chain is recreated.
+      if (current_frame_ == frame_in_flight) {
+        ImGui::EndFrame();
+        continue;
+      }
+
+      frames[frame].frame_milliseconds =
+          std::chrono::duration<double, std::milli>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+      frames[frame].cpu_milliseconds = frame_cpu_milliseconds_;
+      frames[frame].gpu_milliseconds = 0.0f;
+      frames[frame].animation_milliseconds = 0.0f;
+      frames[frame].rebuilt = rt_rebuilt_;
+      pending[frame_in_flight] = frame;
+      ++frame;
+    }
+
+    vkDeviceWaitIdle(device_);
+    for (uint32_t i = 0; i < constants::MAX_FRAMES_IN_FLIGHT; ++i) {
+      if (none != pending[i]) {
+        gpu_timer_.read(memory_, i);
+        read_gpu_times(frames[pending[i]]);
+      }
+    }
+
+    report.scene = scene_name_;
+    report.path = settings.path;
+    report.mode = rtx_on ? "ray_tracing" : "raster";
+    report.renderer = rtx_on ? renderer_name(rt_renderer_) : "raster";
+    for (uint32_t pass = 0; pass < timer_pass_count; ++pass) {
+      report.gpu_passes.push_back(timer_pass_name(pass));
+    }
+    report.device = gpu_properties_.deviceName;
+    report.width = window_size_.width;
+    report.height = window_size_.height;
+    report.samples = settings.samples;
+    report.max_iterations = settings.max_iterations;
+    report.gpu_timer = gpu_timer_.enabled();
+    report.scene_load_milliseconds = scene_load_milliseconds_;
+    report.acceleration_structure_build_milliseconds =
+        rtx_on ? rt_build_milliseconds_ : -1.0;
+    report.acceleration_structure_cache_hits =
+        rtx_on ? rtx_.cache_stats().hits : 0;
+    report.acceleration_structure_cache_misses =
+        rtx_on ? rtx_.cache_stats().misses : 0;
+    report.scratch_budget = settings.scratch_budget;
+    if (rtx_on) {
+      for (const auto &batch : rtx_.build_batches()) {
+        report.build_batches.push_back(
+            {batch.blas_count, batch.scratch_size, batch.milliseconds});
+      }
+    }
+    report.animated = skinning_.enabled();
+    report.rebuild_interval = settings.rebuild_interval;
+    report.device_memory_bytes = device_memory_usage();
+    report.host_memory_bytes = benchmark_report_t::host_resident_bytes();
+    report.frames.assign(frames.begin() + settings.warmup_frames,
+                         frames.end());
+
+    return true;
+  }
+
  private:
   bool render_frame(bool force_recreate_swap_chain, bool rtx_on) {
     VkResult res;
@@ -686,6 +1409,13 @@ class render_engine {
       return false;
     }
 
+    // Commands of this frame in flight are done, its timestamps are ready.
+    gpu_timer_.read(memory_, current_frame_);
+    rt_wavefront_.read(memory_, current_frame_);
+    rt_denoiser_.read(memory_, current_frame_);
+    rt_upscaler_.read(memory_, current_frame_);
+    rt_ray_counters_.read(memory_, current_frame_);
+
     if (force_recreate_swap_chain) {
       if (!recreate_swap_chain(rtx_on)) {
         std::cerr << "Failed to force recreate swap chain before acquiring "
@@ -719,26 +1449,75 @@ class render_engine {
       return false;
     }
 
-    if (images_in_flight_[current_buffer_] != VK_NULL_HANDLE) {
-      // Wait for the image to be available.
-      res = vkWaitForFences(device_, 1, &images_in_flight_[current_buffer_],
-                            wait_all, timeout);
-    }
-    images_in_flight_[current_buffer_] = in_flight_fences_[current_frame_];
-
-    // Begin render pass.
+    // Command buffers are per frame in flight, not per swap chain image, so
+    // the frame fence is the only wait. Its pool is reset as a whole.
     //
+    const auto cpu_start = std::chrono::steady_clock::now();
+
+    res = vkResetCommandPool(device_, frame_command_pools_[current_frame_], 0);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to reset frame command pool: " << res << std::endl;
+      return false;
+    }
 
     if (!execute_begin_command_buffer()) {
       std::cerr << "execute_begin_command_buffer() failed." << std::endl;
       return false;
     }
 
+    gpu_timer_.reset(command_buffers_[current_frame_], current_frame_);
+
+    if (rtx_on && (rt_cluster_culling_ || rtx_.clusters().culled()) &&
+        !cull_instance_clusters(command_buffers_[current_frame_])) {
+      std::cerr << "Instance clusters culling failed." << std::endl;
+      return false;
+    }
+
+    if (!animate(command_buffers_[current_frame_])) {
+      std::cerr << "animate() failed." << std::endl;
+      return false;
+    }
+
     if (rtx_on) {
-      ray_trace(command_buffers_[current_buffer_]);
+      ray_trace(command_buffers_[current_frame_]);
 
-      copy_ray_tracing_output_to_swap_chain(command_buffers_[current_buffer_],
-                                            buffers_[current_buffer_].image);
+      if (rt_constants_.temperature) {
+        rt_ray_counters_.draw_heatmap(command_buffers_[current_frame_],
+                                      current_frame_, rt_render_size_,
+                                      rt_descriptor_set_, rt_heatmap_);
+      }
+
+      // The heat map is shown as traced.
+      const bool denoise = rt_denoise_ && !rt_constants_.temperature;
+      if (denoise) {
+        rt_denoiser_.denoise(command_buffers_[current_frame_], current_frame_,
+                             rt_render_size_, rt_descriptor_set_,
+                             static_cast<uint32_t>(rt_denoiser_iterations_));
+      }
+
+      const bool upscale = ray_tracing_upscaled();
+      if (upscale) {
+        // Temporal upscaling splats the raw samples of each frame, that the
+        // denoised image and the heat map have not.
+        const upscaler::mode mode =
+            denoise || rt_constants_.temperature
+                ? upscaler::mode_edge_aware
+                : rt_upscaler_mode_;
+        rt_upscaler_.upscale(
+            command_buffers_[current_frame_], current_frame_, window_size_,
+            rt_descriptor_set_,
+            denoise ? upscaler::source_denoised : upscaler::source_ray_traced,
+            mode, uniform_data_.data.previous_mvp != uniform_data_.data.mvp,
+            rt_constants_.frame);
+      }
+
+      const storage_image_t &rt_output =
+          upscale ? rt_upscaler_.output()
+                  : denoise ? rt_denoiser_.output() : rt_storage_image_;
+      blit_ray_tracing_output_to_swap_chain(
+          command_buffers_[current_frame_], rt_output,
+          upscale ? window_size_ : rt_render_size_,
+          buffers_[current_buffer_].image);
 
       //  ImGui::Render();
     }
@@ -769,69 +1548,39 @@ class render_engine {
     // render_pass_begin_info.clearValueCount = 0;
     // render_pass_begin_info.pClearValues = nullptr;
 
-    vkCmdBeginRenderPass(command_buffers_[current_buffer_],
-                         &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    // The render pass only executes secondary command buffers: the raster
+    // draw, pre-recorded, and Dear ImGui.
+    vkCmdBeginRenderPass(command_buffers_[current_frame_],
+                         &render_pass_begin_info,
+                         VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
+    std::vector<VkCommandBuffer> secondary_command_buffers;
     if (!rtx_on) {
-      // Bind the graphic pipeline.
-      //
-      vkCmdBindPipeline(command_buffers_[current_buffer_],
-                        VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
-      static constexpr uint32_t first_set = 0;
-      static constexpr uint32_t dynamic_offset_count = 0;
-      static constexpr uint32_t *dynamic_offsets = nullptr;
-      vkCmdBindDescriptorSets(
-          command_buffers_[current_buffer_], VK_PIPELINE_BIND_POINT_GRAPHICS,
-          pipeline_layout_, first_set, constants::NUM_DESCRIPTOR_SETS,
-          descriptor_set_.data(), dynamic_offset_count, dynamic_offsets);
-
-      // Bind the vertex buffer.
-      //
-      const VkDeviceSize offsets[1] = {objects_[0].vertex_offset};
-      static constexpr uint32_t first_binding = 0;
-      static constexpr uint32_t binding_count = 1;
-
-      vkCmdBindVertexBuffers(command_buffers_[current_buffer_], first_binding,
-                             binding_count, &objects_[0].vertex_buf, offsets);
-
-      // Bind the index vertex buffer.
-      //
-      vkCmdBindIndexBuffer(command_buffers_[current_buffer_],
-                           objects_[0].index_buf, objects_[0].index_offset,
-                           VK_INDEX_TYPE_UINT32);
-
-      // Set the viewport and the scissors rectangle.
-      //
-      init_viewports();
-      init_scissors();
-
-      // Draw the vertices.
-      //
+      if (!record_raster_commands()) {
+        std::cerr << "record_raster_commands() failed." << std::endl;
+        return false;
+      }
+      secondary_command_buffers.push_back(
+          raster_commands_[current_frame_].command_buffer);
+    }
 
-      uint32_t index_count = static_cast<uint32_t>(objects_[0].indices.size());
-      uint32_t instance_count = 1;
-      uint32_t first_vertex = 0;
-      uint32_t vertex_offset = 0;
-      uint32_t first_instance = 0;
-      vkCmdDrawIndexed(command_buffers_[current_buffer_], index_count,
-                       instance_count, first_vertex, vertex_offset,
-                       first_instance);
+    if (!record_imgui_commands()) {
+      std::cerr << "record_imgui_commands() failed." << std::endl;
+      return false;
     }
+    secondary_command_buffers.push_back(imgui_command_buffers_[current_frame_]);
 
-    // Record dear imgui primitives into command buffer.
-    //
-    ImGui::Render();
-    ImDrawData *imgui_draw_data = ImGui::GetDrawData();
-    ImGui_ImplVulkan_RenderDrawData(imgui_draw_data,
-                                    command_buffers_[current_buffer_]);
+    vkCmdExecuteCommands(
+        command_buffers_[current_frame_],
+        static_cast<uint32_t>(secondary_command_buffers.size()),
+        secondary_command_buffers.data());
 
     vkCmdEndRenderPass(
-        command_buffers_[current_buffer_]);  // End of render pass.
-    //}
+        command_buffers_[current_frame_]);  // End of render pass.
 
     // Submit the command buffer.
     //
-    res = vkEndCommandBuffer(command_buffers_[current_buffer_]);
+    res = vkEndCommandBuffer(command_buffers_[current_frame_]);
     if (VK_SUCCESS != res) {
       std::cerr << "Failed to complete recording of command buffer: " << res
                 << std::endl;
@@ -849,7 +1598,7 @@ class render_engine {
     submit_info.pWaitSemaphores = &image_acquire_semaphores_[current_frame_];
     submit_info.pWaitDstStageMask = &pipeline_stage_flags;
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &command_buffers_[current_buffer_];
+    submit_info.pCommandBuffers = &command_buffers_[current_frame_];
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores =
         &render_finished_semaphores_[current_frame_];
@@ -865,6 +1614,9 @@ class render_engine {
                 << std::endl;
       return false;
     }
+    frame_cpu_milliseconds_ = std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - cpu_start)
+                                  .count();
 
     // Present the swapchain buffer to the display.
     //
@@ -890,6 +1642,15 @@ class render_engine {
 
     current_frame_ = (current_frame_ + 1) % constants::MAX_FRAMES_IN_FLIGHT;
 
+    if (0.0 == first_frame_milliseconds_) {
+      first_frame_milliseconds_ = std::chrono::duration<double, std::milli>(
+                                      std::chrono::steady_clock::now() -
+                                      init_start_)
+                                      .count();
+      std::cout << "First frame after " << first_frame_milliseconds_
+                << " ms." << std::endl;
+    }
+
     return true;
   }
 
@@ -1027,10 +1788,18 @@ class render_engine {
     device_extension_names_.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
     // Ray Tracing
+    //
+    // Buffer device address, SPIR-V 1.4 and float controls are core in Vulkan
+    // 1.2. Deferred host operations are required by acceleration structures
+    // even if they are not used.
     if (rtx_enabled) {
       device_extension_names_.push_back(
-          VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
-      device_extension_names_.push_back(VK_NV_RAY_TRACING_EXTENSION_NAME);
+          VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME);
+      device_extension_names_.push_back(
+          VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME);
+      device_extension_names_.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+      device_extension_names_.push_back(
+          VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
     }
 
     std::cout << "Required device extensions:" << std::endl;
@@ -1098,7 +1867,7 @@ class render_engine {
     application_info.applicationVersion = application_version_;
     application_info.pEngineName = engine_name_.c_str();
     application_info.engineVersion = engine_version_;
-    application_info.apiVersion = VK_API_VERSION_1_1;
+    application_info.apiVersion = VK_API_VERSION_1_2;
 
     VkInstanceCreateInfo instance_create_info = {};
     instance_create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -1225,8 +1994,18 @@ class render_engine {
   }
 
   bool init_ray_tracing() {
+    rt_as_properties_.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+
     rt_properties_.sType =
-        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PROPERTIES_NV;
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+    rt_properties_.pNext = &rt_as_properties_;
+
+    // Serialized acceleration structures are only valid for the driver that
+    // serialized them.
+    VkPhysicalDeviceIDProperties id_properties{};
+    id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    rt_as_properties_.pNext = &id_properties;
 
     VkPhysicalDeviceProperties2 properties2{};
     properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
@@ -1236,6 +2015,21 @@ class render_engine {
 
     print_ray_tracing_properties();
 
+    if (rt_properties_.maxRayRecursionDepth < RT_MAX_RECURSION_DEPTH) {
+      std::cerr << "Max ray recursion depth " << RT_MAX_RECURSION_DEPTH
+                << " not supported." << std::endl;
+      return false;
+    }
+
+    rt_as_properties_.pNext = nullptr;
+    rtx_.set_properties(rt_as_properties_);
+    rtx_.set_timestamp_properties(
+        gpu_properties_.limits.timestampPeriod,
+        gpu_properties_.limits.timestampComputeAndGraphics
+            ? queue_props_[graphics_queue_family_index_].timestampValidBits
+            : 0);
+    rtx_.cache().init(RT_CACHE_DIRECTORY, id_properties.driverUUID);
+
     if (!ray_tracing_extensions::load(device_)) {
       std::cerr << "Failed to load ray tracing functions." << std::endl;
       return false;
@@ -1245,6 +2039,8 @@ class render_engine {
     rt_constants_.samples = 8;
     rt_constants_.max_iterations = 8;
     rt_constants_.temperature = false;
+    rt_constants_.convergence_threshold = 0.01f;
+    rt_constants_.russian_roulette = true;
 
     return true;
   }
@@ -1253,22 +2049,29 @@ class render_engine {
     std::cout << "Ray Tracing properties:" << std::endl;
     std::cout << " - Shader header size: "
               << rt_properties_.shaderGroupHandleSize << " bytes." << std::endl;
-    std::cout << " - Max recursion depth: " << rt_properties_.maxRecursionDepth
-              << std::endl;
+    std::cout << " - Max recursion depth: "
+              << rt_properties_.maxRayRecursionDepth << std::endl;
     std::cout << " - Max stride between shader groups in the SBT: "
               << rt_properties_.maxShaderGroupStride << " bytes." << std::endl;
     std::cout << " - Alignment for the base of the SBTs: "
               << rt_properties_.shaderGroupBaseAlignment << " bytes."
               << std::endl;
+    std::cout << " - Alignment for the shader headers in the SBT: "
+              << rt_properties_.shaderGroupHandleAlignment << " bytes."
+              << std::endl;
     std::cout << " - Max geometries in the BLAS: "
-              << rt_properties_.maxGeometryCount << std::endl;
-    std::cout << " - Max instances in the BLAS: "
-              << rt_properties_.maxInstanceCount << std::endl;
+              << rt_as_properties_.maxGeometryCount << std::endl;
+    std::cout << " - Max instances in the TLAS: "
+              << rt_as_properties_.maxInstanceCount << std::endl;
     std::cout << " - Max triangles in the BLAS: "
-              << rt_properties_.maxTriangleCount << std::endl;
+              << rt_as_properties_.maxPrimitiveCount << std::endl;
     std::cout << " - Max acceleration structures in a descriptor set: "
-              << rt_properties_.maxDescriptorSetAccelerationStructures
+              << rt_as_properties_.maxDescriptorSetAccelerationStructures
               << std::endl;
+    std::cout
+        << " - Alignment for the scratch buffers: "
+        << rt_as_properties_.minAccelerationStructureScratchOffsetAlignment
+        << " bytes." << std::endl;
   }
 
   bool init_device_extension_properties(layer_properties_t &layer_properties) {
@@ -1305,6 +2108,52 @@ class render_engine {
     return true;
   }
 
+  bool device_extension_supported(const char *extension_name) {
+    uint32_t extension_count = 0;
+    VkResult res = vkEnumerateDeviceExtensionProperties(
+        gpus_[0], nullptr, &extension_count, nullptr);
+    if (VK_SUCCESS != res) {
+      return false;
+    }
+
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    res = vkEnumerateDeviceExtensionProperties(
+        gpus_[0], nullptr, &extension_count, extensions.data());
+    if (VK_SUCCESS != res && VK_INCOMPLETE != res) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < extension_count; ++i) {
+      if (0 == strcmp(extensions[i].extensionName, extension_name)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Device memory used by the process on all heaps, -1 if unknown.
+  int64_t device_memory_usage() const {
+    if (!memory_budget_supported_) {
+      return -1;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+    budget.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    properties.pNext = &budget;
+    vkGetPhysicalDeviceMemoryProperties2(gpus_[0], &properties);
+
+    int64_t usage = 0;
+    for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount;
+         ++i) {
+      usage += static_cast<int64_t>(budget.heapUsage[i]);
+    }
+    return usage;
+  }
+
   bool init_swapchain_extension() {
     // Find queues that support present.
     VkBool32 *pSupportsPresent =
@@ -1405,6 +2254,13 @@ class render_engine {
   }
 
   bool init_device() {
+    // Device memory usage, as reported by benchmarks, is optional.
+    memory_budget_supported_ =
+        device_extension_supported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memory_budget_supported_) {
+      device_extension_names_.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
     VkDeviceQueueCreateInfo device_queue_create_info = {};
     float queue_priorities[1] = {0.0};
     device_queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
@@ -1424,9 +2280,40 @@ class render_engine {
             ? device_extension_names_.data()
             : nullptr;
 
-    VkPhysicalDeviceFeatures device_features{};
-    device_features.samplerAnisotropy = VK_TRUE;
-    device_create_info.pEnabledFeatures = &device_features;
+    VkPhysicalDeviceFeatures2 device_features{};
+    device_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    device_features.features.samplerAnisotropy = VK_TRUE;
+    device_create_info.pNext = &device_features;
+    device_create_info.pEnabledFeatures = nullptr;
+
+    // Ray tracing features. Acceleration structures are built from, and
+    // reference, buffers by their device address.
+    VkPhysicalDeviceVulkan12Features vulkan12_features{};
+    vulkan12_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12_features.bufferDeviceAddress = VK_TRUE;
+
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR as_features{};
+    as_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    as_features.accelerationStructure = VK_TRUE;
+
+    VkPhysicalDeviceRayTracingPipelineFeaturesKHR rt_pipeline_features{};
+    rt_pipeline_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
+    rt_pipeline_features.rayTracingPipeline = VK_TRUE;
+
+    VkPhysicalDeviceRayQueryFeaturesKHR ray_query_features{};
+    ray_query_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+    ray_query_features.rayQuery = VK_TRUE;
+
+    if (rtx_enabled_) {
+      device_features.pNext = &vulkan12_features;
+      vulkan12_features.pNext = &as_features;
+      as_features.pNext = &rt_pipeline_features;
+      rt_pipeline_features.pNext = &ray_query_features;
+    }
 
     if (enable_validation_layer_) {
       device_create_info.enabledLayerCount = validation_layer_names_.size();
@@ -1473,32 +2360,76 @@ class render_engine {
       return false;
     }
 
-    return true;
-  }
-
-  void fini_command_pool() {
-    std::cout << "fini_command_pool." << std::endl;
+    // Command buffers recorded every frame are reset with their pool.
+    //
+    command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    frame_command_pools_.resize(constants::MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i < constants::MAX_FRAMES_IN_FLIGHT; ++i) {
+      res = vkCreateCommandPool(device_, &command_pool_create_info,
+                                allocation_callbacks_,
+                                &frame_command_pools_[i]);
+      if (VK_SUCCESS != res) {
+        std::cerr << "Failed to create frame command pool " << i << ": "
+                  << res << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void fini_command_pool() {
+    std::cout << "fini_command_pool." << std::endl;
+    for (auto pool : frame_command_pools_) {
+      vkDestroyCommandPool(device_, pool, allocation_callbacks_);
+    }
+    frame_command_pools_.clear();
     vkDestroyCommandPool(device_, command_pool_, allocation_callbacks_);
     command_pool_ = VK_NULL_HANDLE;
   }
 
   bool init_command_buffer() {
-    // One command buffer per framebuffer.
+    // One primary and one Dear ImGui command buffer per frame in flight, from
+    // the pool of the frame. The raster draw is pre-recorded in a secondary
+    // command buffer per frame in flight too.
     //
     VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
     command_buffer_allocate_info.sType =
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     command_buffer_allocate_info.pNext = nullptr;
-    command_buffer_allocate_info.commandPool = command_pool_;
-    command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    command_buffer_allocate_info.commandBufferCount = swap_chain_image_count_;
+    command_buffer_allocate_info.commandBufferCount = 1;
 
-    command_buffers_.resize(swap_chain_image_count_);
-    VkResult res = vkAllocateCommandBuffers(
-        device_, &command_buffer_allocate_info, command_buffers_.data());
-    if (VK_SUCCESS != res) {
-      std::cerr << "Failed to create command buffer: " << res << std::endl;
-      return false;
+    command_buffers_.resize(constants::MAX_FRAMES_IN_FLIGHT);
+    imgui_command_buffers_.resize(constants::MAX_FRAMES_IN_FLIGHT);
+    raster_commands_.resize(constants::MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i < constants::MAX_FRAMES_IN_FLIGHT; ++i) {
+      command_buffer_allocate_info.commandPool = frame_command_pools_[i];
+      command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      VkResult res = vkAllocateCommandBuffers(
+          device_, &command_buffer_allocate_info, &command_buffers_[i]);
+      if (VK_SUCCESS != res) {
+        std::cerr << "Failed to create command buffer: " << res << std::endl;
+        return false;
+      }
+
+      command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      res = vkAllocateCommandBuffers(device_, &command_buffer_allocate_info,
+                                     &imgui_command_buffers_[i]);
+      if (VK_SUCCESS != res) {
+        std::cerr << "Failed to create imgui command buffer: " << res
+                  << std::endl;
+        return false;
+      }
+
+      command_buffer_allocate_info.commandPool = command_pool_;
+      res = vkAllocateCommandBuffers(device_, &command_buffer_allocate_info,
+                                     &raster_commands_[i].command_buffer);
+      if (VK_SUCCESS != res) {
+        std::cerr << "Failed to create raster command buffer: " << res
+                  << std::endl;
+        return false;
+      }
+      raster_commands_[i].valid = false;
     }
 
     return true;
@@ -1506,16 +2437,205 @@ class render_engine {
 
   void fini_command_buffer() {
     std::cout << "fini_command_buffer." << std::endl;
-    vkFreeCommandBuffers(device_, command_pool_, swap_chain_image_count_,
-                         command_buffers_.data());
+    for (uint32_t i = 0; i < command_buffers_.size(); ++i) {
+      vkFreeCommandBuffers(device_, frame_command_pools_[i], 1,
+                           &command_buffers_[i]);
+      vkFreeCommandBuffers(device_, frame_command_pools_[i], 1,
+                           &imgui_command_buffers_[i]);
+      vkFreeCommandBuffers(device_, command_pool_, 1,
+                           &raster_commands_[i].command_buffer);
+    }
     command_buffers_.clear();
+    imgui_command_buffers_.clear();
+    raster_commands_.clear();
+  }
+
+  // Record the raster draw of the objects into the secondary command buffer
+  // of the frame in flight, unless the one recorded before draws the same
+  // levels of detail.
+  bool record_raster_commands() {
+    raster_commands_t &raster = raster_commands_[current_frame_];
+
+    // Draw all the instances of an object at the level of detail that fits
+    // the instance closest to the camera. The stats show the level of the
+    // first object.
+    //
+    bool changed = !raster.valid || raster.lods.size() != objects_.size();
+    raster.lods.resize(objects_.size());
+    for (size_t i = 0; i < objects_.size(); ++i) {
+      const uint32_t lod_index = select_lod(objects_[i]);
+      changed = changed || lod_index != raster.lods[i];
+      raster.lods[i] = lod_index;
+    }
+    if (!raster.lods.empty()) {
+      current_lod_ = raster.lods[0];
+    }
+
+    if (!changed) {
+      // The timestamps are written by the commands recorded before.
+      gpu_timer_.mark_written(current_frame_, timer_pass_raster);
+      return true;
+    }
+
+    // Any framebuffer of the render pass.
+    VkCommandBufferInheritanceInfo inheritance_info = {};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.pNext = nullptr;
+    inheritance_info.renderPass = render_pass_;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = VK_NULL_HANDLE;
+
+    VkCommandBufferBeginInfo command_buffer_begin_info = {};
+    command_buffer_begin_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.pNext = nullptr;
+    command_buffer_begin_info.flags =
+        VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    command_buffer_begin_info.pInheritanceInfo = &inheritance_info;
+
+    VkCommandBuffer cmd_buf = raster.command_buffer;
+    VkResult res = vkBeginCommandBuffer(cmd_buf, &command_buffer_begin_info);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to begin raster command buffer: " << res
+                << std::endl;
+      return false;
+    }
+
+    gpu_timer_.begin(cmd_buf, current_frame_, timer_pass_raster);
+
+    // Bind the graphic pipeline.
+    //
+    static constexpr uint32_t first_set = 0;
+    static constexpr uint32_t dynamic_offset_count = 0;
+    static constexpr uint32_t *dynamic_offsets = nullptr;
+    if (raster_shadows_on()) {
+      // The light is recorded with the draws, that are recorded again when
+      // it changes.
+      vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        raster_shadow_pipeline_);
+      const VkDescriptorSet sets[] = {descriptor_set_[0], rt_descriptor_set_};
+      vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              raster_shadow_pipeline_layout_, first_set, 2,
+                              sets, dynamic_offset_count, dynamic_offsets);
+      static constexpr uint32_t offset = 0;
+      vkCmdPushConstants(cmd_buf, raster_shadow_pipeline_layout_,
+                         VK_SHADER_STAGE_FRAGMENT_BIT, offset,
+                         static_cast<uint32_t>(sizeof(rt_constants_)),
+                         &rt_constants_);
+    } else {
+      vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
+      vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              pipeline_layout_, first_set,
+                              constants::NUM_DESCRIPTOR_SETS,
+                              descriptor_set_.data(), dynamic_offset_count,
+                              dynamic_offsets);
+    }
+
+    // Set the viewport and the scissors rectangle.
+    //
+    init_viewports(cmd_buf);
+    init_scissors(cmd_buf);
+
+    // Bind the transforms of all the instances.
+    //
+    static constexpr uint32_t instance_binding = 1;
+    static constexpr uint32_t instance_binding_count = 1;
+    const VkDeviceSize instance_offset = 0;
+    vkCmdBindVertexBuffers(cmd_buf, instance_binding, instance_binding_count,
+                           &instance_buf_, &instance_offset);
+
+    for (size_t i = 0; i < objects_.size(); ++i) {
+      const object_model_t &object = objects_[i];
+
+      // Bind the vertex buffer.
+      //
+      const VkDeviceSize offsets[1] = {object.vertex_offset};
+      static constexpr uint32_t first_binding = 0;
+      static constexpr uint32_t binding_count = 1;
+
+      vkCmdBindVertexBuffers(cmd_buf, first_binding, binding_count,
+                             &geometry_buf_, offsets);
+
+      // Bind the index vertex buffer.
+      //
+      vkCmdBindIndexBuffer(cmd_buf, geometry_buf_, object.index_offset,
+                           VK_INDEX_TYPE_UINT32);
+
+      const lod_t &lod = object.lods[raster.lods[i]];
+
+      uint32_t index_count = lod.index_count;
+      uint32_t instance_count = static_cast<uint32_t>(object.transforms.size());
+      uint32_t first_index = lod.first_index;
+      uint32_t vertex_offset = 0;
+      uint32_t first_instance = object.first_instance;
+      vkCmdDrawIndexed(cmd_buf, index_count, instance_count, first_index,
+                       vertex_offset, first_instance);
+    }
+
+    gpu_timer_.end(cmd_buf, current_frame_, timer_pass_raster);
+
+    res = vkEndCommandBuffer(cmd_buf);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to end raster command buffer: " << res
+                << std::endl;
+      return false;
+    }
+    raster.valid = true;
+
+    return true;
+  }
+
+  // The pre-recorded raster draws are recorded again before their next use.
+  void invalidate_raster_commands() {
+    for (auto &raster : raster_commands_) {
+      raster.valid = false;
+    }
+  }
+
+  // Record the dear imgui primitives of the frame into its secondary command
+  // buffer.
+  bool record_imgui_commands() {
+    VkCommandBufferInheritanceInfo inheritance_info = {};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.pNext = nullptr;
+    inheritance_info.renderPass = render_pass_;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = framebuffers_[current_buffer_];
+
+    VkCommandBufferBeginInfo command_buffer_begin_info = {};
+    command_buffer_begin_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.pNext = nullptr;
+    command_buffer_begin_info.flags =
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+        VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    command_buffer_begin_info.pInheritanceInfo = &inheritance_info;
+
+    VkCommandBuffer cmd_buf = imgui_command_buffers_[current_frame_];
+    VkResult res = vkBeginCommandBuffer(cmd_buf, &command_buffer_begin_info);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to begin imgui command buffer: " << res
+                << std::endl;
+      return false;
+    }
+
+    ImGui::Render();
+    ImDrawData *imgui_draw_data = ImGui::GetDrawData();
+    ImGui_ImplVulkan_RenderDrawData(imgui_draw_data, cmd_buf);
+
+    res = vkEndCommandBuffer(cmd_buf);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to end imgui command buffer: " << res << std::endl;
+      return false;
+    }
+
+    return true;
   }
 
   bool init_sync_objects() {
     image_acquire_semaphores_.resize(constants::MAX_FRAMES_IN_FLIGHT);
     render_finished_semaphores_.resize(constants::MAX_FRAMES_IN_FLIGHT);
     in_flight_fences_.resize(constants::MAX_FRAMES_IN_FLIGHT);
-    images_in_flight_.resize(swap_chain_image_count_);
 
     VkSemaphoreCreateInfo semaphore_create_info = {};
     semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1664,16 +2784,17 @@ class render_engine {
     ImGui::DestroyContext();
   }
 
-  // TODO: Return command_buffers_[current_buffer_]?
+  // TODO: Return command_buffers_[current_frame_]?
   bool execute_begin_command_buffer() {
     VkCommandBufferBeginInfo command_buffer_begin_info = {};
     command_buffer_begin_info.sType =
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     command_buffer_begin_info.pNext = nullptr;
-    command_buffer_begin_info.flags = 0;
+    command_buffer_begin_info.flags =
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     command_buffer_begin_info.pInheritanceInfo = nullptr;
 
-    VkResult res = vkBeginCommandBuffer(command_buffers_[current_buffer_],
+    VkResult res = vkBeginCommandBuffer(command_buffers_[current_frame_],
                                         &command_buffer_begin_info);
     if (VK_SUCCESS != res) {
       std::cerr << "Failed to begin command buffer: " << res << std::endl;
@@ -1753,7 +2874,9 @@ class render_engine {
       return false;
     }
 
-    if (rtx_on) {
+    // The raster shadows trace against the TLAS. There is nothing to trace
+    // until the first objects of the scene are loaded.
+    if (!objects_.empty() && (rtx_on || (rtx_enabled_ && raster_shadows_))) {
       if (!create_ray_tracing()) {
         std::cerr << "create_ray_tracing() failed." << std::endl;
         return false;
@@ -2177,6 +3300,7 @@ class render_engine {
   bool update_uniform_buffer() {
     // Get new values.
     //
+    uniform_data_.data.previous_mvp = uniform_data_.data.mvp;
     uniform_data_.data.mvp = camera_.mvp();
     uniform_data_.data.inverse_view = camera_.inverse_view();
     uniform_data_.data.inverse_projection = camera_.inverse_projection();
@@ -2206,8 +3330,9 @@ class render_engine {
     layout_bindings[0].binding = 0;
     layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     layout_bindings[0].descriptorCount = 1;
-    layout_bindings[0].stageFlags =
-        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_NV;
+    layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                                    VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+                                    VK_SHADER_STAGE_COMPUTE_BIT;
     layout_bindings[0].pImmutableSamplers = nullptr;
 
     // Fragment shader.
@@ -2215,8 +3340,9 @@ class render_engine {
     layout_bindings[1].descriptorType =
         VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     layout_bindings[1].descriptorCount = 1;
-    layout_bindings[1].stageFlags =
-        VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+    layout_bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT |
+                                    VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
+                                    VK_SHADER_STAGE_COMPUTE_BIT;
     layout_bindings[1].pImmutableSamplers = nullptr;
 
     VkDescriptorSetLayoutCreateInfo descriptor_layout = {};
@@ -2463,34 +3589,52 @@ class render_engine {
     framebuffers_ = nullptr;
   }
 
-  bool init_vertex_buffer(object_model_t &object) {
-    // Map GPU memory and copy vertex data.
-    //
-
-    const void *vertex_data = object.vertices.data();
-    uint32_t vertex_data_size = sizeof(Vertex) * object.vertices.size();
+  // Acceleration structures are built from the vertex and index buffers,
+  // which they read through their device addresses.
+  static VkBufferUsageFlags ray_tracing_geometry_buffer_usage() {
+    return VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+           VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+  }
 
-    VkBufferUsageFlags usage =
-        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;  // Ray tracing needs to use  the
-                                             // buffer as storage.
+  // Offsets of the vertices and indices of each object in the geometry
+  // buffer. Enough for vertex and index bindings, storage buffer offsets and
+  // acceleration structure build inputs.
+  static constexpr VkDeviceSize GEOMETRY_ALIGNMENT = 256;
 
-    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    if (!memory_.create_buffer_and_copy(vertex_data_size, usage, properties,
-                                        object.vertex_buf, object.vertex_mem,
-                                        vertex_data)) {
-      std::cerr << "Failed to create vertex buffer and copy vertex data."
-                << std::endl;
-      return false;
+  // The vertices and indices of the objects are staged together and copied
+  // with a single submission to one device local buffer, so that vertex
+  // fetches and ray tracing shaders don't read host memory.
+  //
+  // Objects are appended as the scene streams in: only those added since the
+  // last call are staged, after the ones already in the buffer. When they
+  // don't fit, the buffer is created again at least twice as large and its
+  // contents are copied on the device. relocated then tells that the buffer
+  // and its device address changed.
+  bool append_geometry(bool &relocated) {
+    relocated = false;
+
+    const auto align = [](VkDeviceSize offset) {
+      return (offset + GEOMETRY_ALIGNMENT - 1) & ~(GEOMETRY_ALIGNMENT - 1);
+    };
+    VkDeviceSize geometry_size = geometry_size_;
+    for (size_t i = geometry_object_count_; i < objects_.size(); ++i) {
+      object_model_t &object = objects_[i];
+      object.vertex_offset = align(geometry_size);
+      geometry_size =
+          object.vertex_offset + sizeof(Vertex) * object.vertices.size();
+      object.index_offset = align(geometry_size);
+      geometry_size =
+          object.index_offset + sizeof(uint32_t) * object.indices.size();
+    }
+    if (geometry_size == geometry_size_) {
+      geometry_object_count_ = objects_.size();
+      return true;
     }
 
-    return true;
-  }
-
-  bool init_vertex_index_buffer(object_model_t &object) {
-    VkDeviceSize buffer_size =
-        sizeof(object.indices[0]) * object.indices.size();
+    // The new objects, from the offset of the first one.
+    const VkDeviceSize first_offset =
+        objects_[geometry_object_count_].vertex_offset;
+    const VkDeviceSize staging_size = geometry_size - first_offset;
 
     VkBuffer staging_buffer;
     VkDeviceMemory staging_buffer_memory;
@@ -2498,210 +3642,760 @@ class render_engine {
     VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
     VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    if (!memory_.create_buffer_and_copy(buffer_size, usage, properties,
-                                        staging_buffer, staging_buffer_memory,
-                                        object.indices.data())) {
-      std::cerr << "Failed to create vertex index staging buffer." << std::endl;
+    if (!memory_.create_buffer(staging_size, usage, properties, staging_buffer,
+                               staging_buffer_memory)) {
+      std::cerr << "Failed to create geometry staging buffer." << std::endl;
       return false;
     }
 
-    usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-            VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;  // Ray tracing needs to use
-                                                 // the buffer as storage.
+    void *mapped_data;
+    static constexpr VkDeviceSize map_offset = 0;
+    static constexpr VkMemoryMapFlags map_flags = 0;
+    VkResult res = vkMapMemory(device_, staging_buffer_memory, map_offset,
+                               staging_size, map_flags, &mapped_data);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to map geometry staging buffer: " << res
+                << std::endl;
+      return false;
+    }
+    for (size_t i = geometry_object_count_; i < objects_.size(); ++i) {
+      const object_model_t &object = objects_[i];
+      char *data = static_cast<char *>(mapped_data) - first_offset;
+      memcpy(data + object.vertex_offset, object.vertices.data(),
+             sizeof(Vertex) * object.vertices.size());
+      memcpy(data + object.index_offset, object.indices.data(),
+             sizeof(uint32_t) * object.indices.size());
+    }
+    vkUnmapMemory(device_, staging_buffer_memory);
+
+    // The previous buffer is copied to the new one, then destroyed.
+    VkBuffer previous_buf = VK_NULL_HANDLE;
+    VkDeviceMemory previous_mem = VK_NULL_HANDLE;
+    if (geometry_size > geometry_capacity_) {
+      previous_buf = geometry_buf_;
+      previous_mem = geometry_mem_;
+      const VkDeviceSize capacity =
+          std::max(geometry_size, 2 * geometry_capacity_);
+
+      usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+              VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+              VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;  // Ray tracing needs to use
+                                                   // the buffer as storage.
+      if (rtx_enabled_) {
+        usage |= ray_tracing_geometry_buffer_usage();
+      }
 
-    properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+      properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+      if (!memory_.create_buffer(capacity, usage, properties, geometry_buf_,
+                                 geometry_mem_)) {
+        std::cerr << "Failed to create geometry buffer." << std::endl;
+        return false;
+      }
+      geometry_capacity_ = capacity;
+      relocated = VK_NULL_HANDLE != previous_buf;
+    }
 
-    if (!memory_.create_buffer(buffer_size, usage, properties, object.index_buf,
-                               object.index_mem)) {
-      std::cerr << "Failed to create vertex index buffer." << std::endl;
+    VkCommandBuffer command_buffer;
+    if (!begin_single_time_commands(command_buffer, device_, command_pool_)) {
+      std::cerr << "Geometry upload: begin of single time command failed."
+                << std::endl;
       return false;
     }
 
-    // Set offset of index data.
-    object.index_offset = 0;
+    static constexpr uint32_t region_count = 1;
+    if (relocated) {
+      VkBufferCopy copy_region{};
+      copy_region.size = geometry_size_;
+      vkCmdCopyBuffer(command_buffer, previous_buf, geometry_buf_,
+                      region_count, &copy_region);
+    }
+
+    VkBufferCopy copy_region{};
+    copy_region.dstOffset = first_offset;
+    copy_region.size = staging_size;
+    vkCmdCopyBuffer(command_buffer, staging_buffer, geometry_buf_,
+                    region_count, &copy_region);
 
-    if (!copy_buffer(staging_buffer, object.index_buf, buffer_size)) {
-      std::cerr << "Failed to copy vertex index staging buffer to vertex "
-                   "index buffer."
+    if (!end_single_time_commands(command_buffer, device_, command_pool_,
+                                  graphics_queue_)) {
+      std::cerr << "Geometry upload: end of single time command failed."
                 << std::endl;
       return false;
     }
 
     vkDestroyBuffer(device_, staging_buffer, allocation_callbacks_);
     vkFreeMemory(device_, staging_buffer_memory, allocation_callbacks_);
+    vkDestroyBuffer(device_, previous_buf, allocation_callbacks_);
+    vkFreeMemory(device_, previous_mem, allocation_callbacks_);
+
+    geometry_size_ = geometry_size;
+    geometry_object_count_ = objects_.size();
 
     return true;
   }
 
+  void fini_geometry_buffer() {
+    vkDestroyBuffer(device_, geometry_buf_, allocation_callbacks_);
+    geometry_buf_ = VK_NULL_HANDLE;
+    vkFreeMemory(device_, geometry_mem_, allocation_callbacks_);
+    geometry_mem_ = VK_NULL_HANDLE;
+    geometry_size_ = 0;
+    geometry_capacity_ = 0;
+    geometry_object_count_ = 0;
+  }
+
   void fini_vertex_buffer() {
     std::cout << "fini_vertex_buffer." << std::endl;
 
-    for (auto &object : objects_) {
-      vkDestroyBuffer(device_, object.index_buf, allocation_callbacks_);
-      vkFreeMemory(device_, object.index_mem, allocation_callbacks_);
-
-      vkDestroyBuffer(device_, object.vertex_buf, allocation_callbacks_);
-      vkFreeMemory(device_, object.vertex_mem, allocation_callbacks_);
-    }
+    skinning_.fini(memory_);
+    fini_instance_buffer();
+    fini_geometry_buffer();
     objects_.clear();
   }
 
-  bool load_scene() {
-    // Example of translation + scaling + rotation.
-    //
-    // glm::mat4 transform = glm::mat4(1.0f);
-    // glm::vec3 translation = glm::vec3(-5.0, 0, 0);
-    // transform = glm::translate(transform, translation);
-    // float scale_factor = 1.0f;
-    // transform = glm::scale(transform, glm::vec3(scale_factor));
-    // float rotation_degrees = glm::radians(0.0f);
-    // glm::vec3 rotation_axis = glm::vec3(0, 1, 0);
-    // transform = glm::rotate(transform, rotation_degrees, rotation_axis);
-
-    // Viking room
-    //
-    glm::mat4 viking_room_transform = glm::mat4(1.0f);
-    std::string viking_room_model_path("assets/models/viking_room.obj");
-    std::string viking_room_texture_path("assets/textures/viking_room.png");
-    if (!load_model(viking_room_model_path, viking_room_transform)) {
-      return false;
-    }
-    if (!load_texture(viking_room_texture_path)) {
-      return false;
+  // Per instance attributes of the rasterizer. Instances of an object are
+  // consecutive, from its first_instance on.
+  bool init_instance_buffer() {
+    std::vector<RasterInstance> instances;
+    for (auto &object : objects_) {
+      object.first_instance = static_cast<uint32_t>(instances.size());
+      for (const auto &transform : object.transforms) {
+        instances.push_back({transform, object.textured ? 1.0f : 0.0f});
+      }
     }
 
-    // Venus
-    //
-    // glm::vec3 venus_translation = glm::vec3(0, 0.1, -1.0);
-    // glm::mat4 venus_transform =
-    //    glm::translate(glm::mat4(1.0f), venus_translation);
-    // std::string venus_model_path("assets/models/venus.obj");
-    // if (!load_model(venus_model_path, venus_transform)) {
-    //  return false;
-    //}
-
-    // Lucy
-    //
-    // glm::mat4 lucy_translation = glm::vec3(5.0, 0, 0);
-    // glm::mat4 lucy_transform = glm::translate(glm::mat4(1.0f),
-    // lucy_translation); std::string
-    // lucy_model_path("assets/models/lucy.obj"); if
-    // (!load_model(venus_model_path, venus_transform)) {
-    //  return false;
-    //}
+    fini_instance_buffer();
+    invalidate_raster_commands();
+    if (instances.empty()) {
+      return true;
+    }
 
-    // Rungholt city
-    //
-    // glm::mat4 rungholt_transform = glm::mat4(1.0f);
-    // std::string rungholt_model_path("assets/models/rungholt.obj");
-    // std::string rungholt_texture_path("assets/textures/rungholt-RGBA.png");
-    // if (!load_model(rungholt_model_path, rungholt_transform)) {
-    //   return false;
-    // }
-    // if (!load_texture(rungholt_texture_path)) {
-    //   return false;
-    // }
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (!memory_.create_buffer_and_copy(
+            sizeof(RasterInstance) * instances.size(), usage, properties,
+            instance_buf_, instance_mem_, instances.data())) {
+      std::cerr << "Failed to create instance buffer." << std::endl;
+      return false;
+    }
 
     return true;
   }
 
-  bool load_model(const std::string &model_path) {
-    std::vector<glm::mat4> instances_transformation;
-    instances_transformation.emplace_back(1.0f);
-    return load_model(model_path, instances_transformation);
+  void fini_instance_buffer() {
+    vkDestroyBuffer(device_, instance_buf_, allocation_callbacks_);
+    instance_buf_ = VK_NULL_HANDLE;
+    vkFreeMemory(device_, instance_mem_, allocation_callbacks_);
+    instance_mem_ = VK_NULL_HANDLE;
   }
 
-  bool load_model(const std::string &model_path,
-                  const glm::mat4 &transformation) {
-    std::vector<glm::mat4> instances_transformation;
-    instances_transformation.push_back(transformation);
-    return load_model(model_path, instances_transformation);
+  // Scene file of a scene name, see scene.h. Names ending in .json are
+  // paths.
+  static std::string scene_path(const std::string &scene_name) {
+    const std::string extension = ".json";
+    if (scene_name.size() > extension.size() &&
+        0 == scene_name.compare(scene_name.size() - extension.size(),
+                                extension.size(), extension)) {
+      return scene_name;
+    }
+    return "assets/scenes/" + scene_name + extension;
   }
 
-  bool load_model(const std::string &model_path,
-                  const std::vector<glm::mat4> &instances_transformation) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
+  // Models of a scene are added at most this often while it loads, every
+  // addition waits for the frames in flight to append to the buffers and
+  // rebuild the TLAS.
+  static constexpr int STREAM_INTERVAL_MILLISECONDS = 250;
+
+  // Read the scene file and start loading its models and its texture in the
+  // background, see stream_scene(). The light and the camera are set right
+  // away, and a white texture is bound until the scene one is decoded.
+  bool start_scene_load() {
+    // init() may be called again after a failure.
+    fini_scene_stream();
+
+    scene_stream_t &stream = scene_stream_;
+    stream.start = std::chrono::steady_clock::now();
+    stream.last_upload = stream.start;
+    if (!stream.scene.load(scene_path(scene_name_))) {
+      return false;
+    }
+    const scene_t &scene = stream.scene;
+    const size_t model_count = scene.models.size();
+
+    // Instances of a model share its geometry. Models without instances are
+    // not loaded.
+    stream.transforms.resize(model_count);
+    stream.materials.resize(model_count);
+    for (const scene_instance_t &instance : scene.instances) {
+      stream.transforms[instance.model].push_back(instance.transform);
+      stream.materials[instance.model].push_back(
+          instance.material < 0 ? material_t()
+                                : scene.materials[instance.material].material);
+    }
+
+    // A single texture is bound, the one of the first textured model.
+    for (size_t i = 0; i < model_count; ++i) {
+      const int model_texture = scene.models[i].texture;
+      if (stream.transforms[i].empty() || model_texture < 0) {
+        continue;
+      }
+      if (stream.texture < 0) {
+        stream.texture = model_texture;
+      } else if (stream.texture != model_texture) {
+        std::cerr << "Only one texture is supported, "
+                  << scene.textures[model_texture].name << " is ignored."
+                  << std::endl;
+      }
+    }
 
-    std::cout << "Loading model " << model_path << "... " << std::flush;
+    // Models are parsed, or read from their cache, and the texture decoded
+    // concurrently. Vulkan objects are created from this thread as they are
+    // done. glTF models bring their own meshes, node hierarchy and
+    // materials.
+    stream.objects.resize(model_count);
+    stream.gltf_models.resize(model_count);
+    stream.gltf.resize(model_count);
+    stream.models_loaded.resize(model_count);
+    stream.model_results.resize(model_count);
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < model_count; ++i) {
+      if (stream.transforms[i].empty()) {
+        std::cout << "Model " << scene.models[i].name
+                  << " has no instances, skipped." << std::endl;
+        continue;
+      }
+      ++stream.model_count;
+      stream.gltf[i] = gltf_loader::is_gltf(scene.models[i].path);
+      stream.models_loaded[i] = stream.model_results[i].get_future();
+      pending.push_back(i);
+    }
+
+    // A fixed set of workers, whatever the size of the scene, each taking
+    // the next model not started yet.
+    const auto next = std::make_shared<std::atomic<size_t>>(0);
+    const auto load = [&stream, pending, next]() {
+      for (size_t p = (*next)++; p < pending.size(); p = (*next)++) {
+        const size_t i = pending[p];
+        const std::string &path = stream.scene.models[i].path;
+        stream.model_results[i].set_value(
+            stream.gltf[i] ? gltf_loader::load(path, stream.gltf_models[i])
+                           : prepare_model(path, stream.objects[i]));
+      }
+    };
+    const size_t worker_count = std::min<size_t>(
+        pending.size(), std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t w = 0; w < worker_count; ++w) {
+      stream.workers.push_back(std::async(std::launch::async, load));
+    }
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-                          model_path.c_str())) {
-      std::cerr << "Failed to load model: " << warn << ", " << err << "."
-                << std::endl;
+    if (stream.texture >= 0) {
+      stream.texture_loaded =
+          std::async(std::launch::async, decode_texture,
+                     std::cref(scene.textures[stream.texture].path),
+                     std::ref(stream.texture_data));
+    }
+
+    // Untextured models are white.
+    texture_data_t white;
+    white.width = 1;
+    white.height = 1;
+    white.pixels.assign(4, 255);
+    if (!load_texture(white)) {
       return false;
     }
 
-    objects_.emplace_back();
+    rt_constants_.light_type = scene.light.type;
+    rt_constants_.light_position = scene.light.position;
+    rt_constants_.light_intensity = scene.light.intensity;
 
-    uint32_t index = objects_.size() - 1;
-    for (auto &transformation : instances_transformation) {
-      // Test
-      objects_instances_.emplace_back();
-      objects_instances_.back().index = index;
-      objects_instances_.back().transform = transformation;
-      objects_.back().transforms.push_back(transformation);
+    camera_.set_pose(scene.camera.rotation, scene.camera.distance,
+                     scene.camera.center);
+
+    stream.active = true;
+
+    return true;
+  }
+
+  // Add the models of the scene that are done loading, and bind the scene
+  // texture once decoded. With wait, blocks until the whole scene is loaded.
+  //
+  // Models are appended to the buffers and to the acceleration structures,
+  // and the descriptors are written again in place. first_objects tells
+  // whether the scene was empty until now. The swap chain must then be
+  // re-created, as the ray tracing resources are created with it once there
+  // is something to trace.
+  bool stream_scene(bool wait, bool &first_objects) {
+    first_objects = false;
+    scene_stream_t &stream = scene_stream_;
+    if (!stream.active) {
+      return true;
+    }
+    if (!wait && std::chrono::steady_clock::now() - stream.last_upload <
+                     std::chrono::milliseconds(STREAM_INTERVAL_MILLISECONDS)) {
+      return true;
     }
 
-    std::unordered_map<Vertex, uint32_t> unique_vertices;
+    const auto ready = [wait](std::future<bool> &loaded) {
+      if (wait) {
+        loaded.wait();
+        return true;
+      }
+      return std::future_status::ready ==
+             loaded.wait_for(std::chrono::seconds(0));
+    };
 
-    for (const auto &shape : shapes) {
-      for (const auto &index : shape.mesh.indices) {
-        Vertex vertex{};
+    // Without a scene texture, the image of the first textured glTF model
+    // is bound. glTF models are then added in order, so that it is the same
+    // model whichever loads first.
+    bool gltf_pending = false;
+    bool added = false;
+    for (size_t i = 0; i < stream.models_loaded.size(); ++i) {
+      std::future<bool> &model_loaded = stream.models_loaded[i];
+      // Not loaded, or already added.
+      if (!model_loaded.valid()) {
+        continue;
+      }
+      const bool ordered = stream.gltf[i] && stream.texture < 0;
+      if (ordered && gltf_pending) {
+        continue;
+      }
+      if (!ready(model_loaded)) {
+        gltf_pending = gltf_pending || ordered;
+        continue;
+      }
+      if (!model_loaded.get()) {
+        std::cerr << "Failed to load model " << stream.scene.models[i].name
+                  << ", skipped." << std::endl;
+        ++stream.models_failed;
+        continue;
+      }
+      add_scene_model(i);
+      ++stream.models_added;
+      added = true;
+    }
 
-        vertex.pos = {attrib.vertices[3 * index.vertex_index + 0],
-                      attrib.vertices[3 * index.vertex_index + 1],
-                      attrib.vertices[3 * index.vertex_index + 2]};
+    bool texture_decoded = false;
+    if (stream.texture_loaded.valid() && ready(stream.texture_loaded)) {
+      texture_decoded = stream.texture_loaded.get();
+      if (!texture_decoded) {
+        std::cerr << "Failed to decode the scene texture, models stay white."
+                  << std::endl;
+      }
+    }
 
-        if (!attrib.normals.empty()) {
-          vertex.normal = {attrib.normals[3 * index.normal_index + 0],
-                           attrib.normals[3 * index.normal_index + 1],
-                           attrib.normals[3 * index.normal_index + 2]};
-        }
+    if (added || texture_decoded) {
+      // Only the frames in flight use the resources replaced here: the
+      // texture, and once objects are drawn the instance buffer, the
+      // geometry buffer when it grows and the ray tracing structures. The
+      // first objects only create them.
+      const bool replaced = texture_decoded || 0 != geometry_object_count_;
+      if (replaced && !wait_for_frames_in_flight()) {
+        return false;
+      }
 
-        if (!attrib.texcoords.empty()) {
-          vertex.tex_coord = {
-              attrib.texcoords[2 * index.texcoord_index + 0],
-              1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+      if (added) {
+        first_objects = 0 == geometry_object_count_ && !objects_.empty();
+        if (!upload_objects()) {
+          return false;
         }
+      }
 
-        if (unique_vertices.count(vertex) == 0) {
-          unique_vertices[vertex] =
-              static_cast<uint32_t>(objects_.back().vertices.size());
-          objects_.back().vertices.push_back(vertex);
+      if (texture_decoded) {
+        cleanup_texture_image_view();
+        cleanup_texture_image();
+        if (!load_texture(stream.texture_data)) {
+          return false;
         }
-        objects_.back().indices.push_back(unique_vertices[vertex]);
+        stream.texture_data = texture_data_t();
+        update_texture_descriptor();
       }
-    }
 
-    if (!init_vertex_buffer(objects_.back())) {
-      std::cerr << "init_vertex_buffer() failed." << std::endl;
-      return false;
+      stream.last_upload = std::chrono::steady_clock::now();
     }
 
-    if (!init_vertex_index_buffer(objects_.back())) {
-      std::cerr << "init_vertex_index_buffer() failed." << std::endl;
-      return false;
+    if (stream.models_added + stream.models_failed == stream.model_count &&
+        !stream.texture_loaded.valid()) {
+      scene_load_milliseconds_ = std::chrono::duration<double, std::milli>(
+                                     std::chrono::steady_clock::now() -
+                                     stream.start)
+                                     .count();
+      std::cout << "Scene " << scene_name_ << " loaded in "
+                << scene_load_milliseconds_ << " ms." << std::endl;
+      if (stream.models_failed > 0) {
+        std::cerr << stream.models_failed << " of " << stream.model_count
+                  << " models failed to load." << std::endl;
+      }
+      fini_scene_stream();
     }
 
-    std::cout << " Loaded " << objects_.back().vertices.size()
-              << " vertices and " << objects_.back().indices.size()
-              << " indices." << std::endl;
-
     return true;
   }
 
-  bool init_descriptor_pool() {
-    static constexpr uint32_t pool_descriptor_count = 1000;
-    VkDescriptorPoolSize descriptor_pool_size[] = {
-        {VK_DESCRIPTOR_TYPE_SAMPLER, pool_descriptor_count},
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, pool_descriptor_count},
-        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, pool_descriptor_count},
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, pool_descriptor_count},
-        {VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, pool_descriptor_count},
+  // Wait for the models and the texture still loading, they write to the
+  // scene stream.
+  void fini_scene_stream() {
+    for (std::future<void> &worker : scene_stream_.workers) {
+      worker.wait();
+    }
+    if (scene_stream_.texture_loaded.valid()) {
+      scene_stream_.texture_loaded.wait();
+    }
+    scene_stream_ = scene_stream_t();
+  }
+
+  // Wait for the frames submitted by render_frame(), not for the whole
+  // device.
+  bool wait_for_frames_in_flight() {
+    VkResult res = vkWaitForFences(
+        device_, static_cast<uint32_t>(in_flight_fences_.size()),
+        in_flight_fences_.data(), VK_TRUE, UINT64_MAX);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to wait for the frames in flight: " << res
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Add the objects of a loaded model of the streamed scene, with its
+  // instances.
+  void add_scene_model(size_t i) {
+    scene_stream_t &stream = scene_stream_;
+    const scene_t &scene = stream.scene;
+
+    if (stream.gltf[i]) {
+      const scene_animation_t &animation = scene.models[i].animation;
+      if (animation.enabled) {
+        std::cerr << "glTF models play their own skins, the animation of "
+                  << scene.models[i].name << " is ignored." << std::endl;
+      }
+
+      // The image of the model is decoded while it is already shown.
+      gltf_model_t &model = stream.gltf_models[i];
+      if (stream.texture < 0 && stream.gltf_texture < 0 &&
+          (!model.image_path.empty() || !model.image_data.empty())) {
+        stream.gltf_texture = static_cast<int>(i);
+        if (model.image_path.empty()) {
+          stream.texture_loaded = std::async(
+              std::launch::async, decode_embedded_texture,
+              std::cref(model.image_data), std::ref(stream.texture_data));
+        } else {
+          stream.texture_loaded = std::async(
+              std::launch::async, decode_texture, std::cref(model.image_path),
+              std::ref(stream.texture_data));
+        }
+      }
+
+      add_gltf_model(std::move(model), scene, i,
+                     stream.texture >= 0
+                         ? scene.models[i].texture == stream.texture
+                         : stream.gltf_texture == static_cast<int>(i));
+      return;
+    }
+
+    object_model_t &object = stream.objects[i];
+    const scene_animation_t &animation = scene.models[i].animation;
+    if (animation.enabled) {
+      object.skin = skin_t::bend(
+          object.vertices, object.aabb_min, object.aabb_max,
+          static_cast<uint32_t>(animation.joints), animation.angle,
+          animation.period);
+
+      // Bent vertices stay within the length of the object from its base,
+      // the bounds grow so that culling keeps them.
+      const glm::vec3 extent = object.aabb_max - object.aabb_min;
+      const float length =
+          std::max(extent.x, std::max(extent.y, extent.z));
+      object.aabb_min -= glm::vec3(length);
+      object.aabb_max += glm::vec3(length);
+    }
+
+    object.textured =
+        stream.texture >= 0 && scene.models[i].texture == stream.texture;
+    add_object(std::move(object), stream.transforms[i], stream.materials[i]);
+  }
+
+  bool load_model(const std::string &model_path) {
+    std::vector<glm::mat4> instances_transformation;
+    instances_transformation.emplace_back(1.0f);
+    return load_model(model_path, instances_transformation);
+  }
+
+  bool load_model(const std::string &model_path,
+                  const glm::mat4 &transformation) {
+    std::vector<glm::mat4> instances_transformation;
+    instances_transformation.push_back(transformation);
+    return load_model(model_path, instances_transformation);
+  }
+
+  bool load_model(const std::string &model_path,
+                  const std::vector<glm::mat4> &instances_transformation) {
+    object_model_t object{};
+    if (!prepare_model(model_path, object)) {
+      return false;
+    }
+
+    // Models loaded alone sample the bound texture.
+    object.textured = true;
+
+    add_object(std::move(object), instances_transformation);
+    return upload_objects();
+  }
+
+  // Geometry, levels of detail and bounds of a model. Touches no Vulkan nor
+  // engine state, so that models load concurrently.
+  static bool prepare_model(const std::string &model_path,
+                            object_model_t &object) {
+    // Parsing the model and generating its levels of detail is slow, so the
+    // result is cached next to the model.
+    const bool cached = mesh_cache::load(model_path, object);
+    if (!cached) {
+      const bool loaded = ply_loader::is_ply(model_path)
+                              ? ply_loader::load(model_path, object)
+                              : load_obj(model_path, object);
+      if (!loaded) {
+        return false;
+      }
+
+      if (!mesh_simplifier::generate_lods(object.vertices, object.indices,
+                                          object.lods)) {
+        std::cerr << "Failed to generate levels of detail of " << model_path
+                  << "." << std::endl;
+        return false;
+      }
+
+      if (!mesh_cache::store(model_path, object)) {
+        // Not fatal, the model will be processed again on next load.
+        std::cerr << "Failed to cache model " << model_path << "."
+                  << std::endl;
+      }
+    }
+
+    object.aabb_min = glm::vec3(std::numeric_limits<float>::max());
+    object.aabb_max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const auto &vertex : object.vertices) {
+      object.aabb_min = glm::min(object.aabb_min, vertex.pos);
+      object.aabb_max = glm::max(object.aabb_max, vertex.pos);
+    }
+
+    // A single write, models load concurrently.
+    std::ostringstream log;
+    log << "Loaded model " << model_path << (cached ? " (cached)" : "")
+        << ": " << object.vertices.size() << " vertices and "
+        << object.indices.size() << " indices." << std::endl;
+    for (uint32_t i = 0; i < object.lods.size(); ++i) {
+      log << "  LOD " << i << ": " << object.lods[i].index_count / 3
+          << " triangles, error " << object.lods[i].error << "." << std::endl;
+    }
+    std::cout << log.str() << std::flush;
+
+    return true;
+  }
+
+  // One object per mesh of a glTF model, with an instance per node of the
+  // model in each instance of the scene model. The material of a scene
+  // instance overrides the glTF ones. textured tells whether the bound
+  // texture is the one of the model.
+  void add_gltf_model(gltf_model_t &&model, const scene_t &scene,
+                      size_t scene_model, bool textured) {
+    const bool scene_textured = scene.models[scene_model].texture >= 0;
+    for (size_t m = 0; m < model.meshes.size(); ++m) {
+      std::vector<glm::mat4> mesh_transforms;
+      std::vector<material_t> mesh_materials;
+      for (const scene_instance_t &instance : scene.instances) {
+        if (instance.model != static_cast<int>(scene_model)) {
+          continue;
+        }
+        for (const gltf_instance_t &node : model.instances) {
+          if (node.mesh != m) {
+            continue;
+          }
+          mesh_transforms.push_back(instance.transform * node.transform);
+          mesh_materials.push_back(
+              instance.material < 0
+                  ? node.material
+                  : scene.materials[instance.material].material);
+        }
+      }
+      if (mesh_transforms.empty()) {
+        continue;
+      }
+
+      object_model_t &object = model.meshes[m];
+      object.textured = textured && (scene_textured || object.textured);
+      add_object(std::move(object), mesh_transforms, mesh_materials);
+    }
+  }
+
+  // Instances past the end of instances_material get the default material.
+  void add_object(object_model_t &&object,
+                  const std::vector<glm::mat4> &instances_transformation,
+                  const std::vector<material_t> &instances_material = {}) {
+    objects_.push_back(std::move(object));
+
+    uint32_t index = objects_.size() - 1;
+    for (auto &transformation : instances_transformation) {
+      // Test
+      objects_instances_.emplace_back();
+      objects_instances_.back().index = index;
+      objects_instances_.back().transform = transformation;
+      objects_.back().transforms.push_back(transformation);
+    }
+    objects_.back().materials = instances_material;
+    objects_.back().materials.resize(objects_.back().transforms.size());
+  }
+
+  // Add the objects added since the last upload to the buffers, and to the
+  // acceleration structures when they exist. Nothing may be in use.
+  bool upload_objects() {
+    const size_t first_object = geometry_object_count_;
+    bool relocated = false;
+    if (!append_geometry(relocated)) {
+      std::cerr << "append_geometry() failed." << std::endl;
+      return false;
+    }
+
+    if (!init_instance_buffer()) {
+      std::cerr << "init_instance_buffer() failed." << std::endl;
+      return false;
+    }
+
+    // Skinned vertices are written over the geometry buffer, which the
+    // skinning descriptors refer to.
+    bool skinned = relocated;
+    for (size_t i = first_object; i < objects_.size(); ++i) {
+      skinned = skinned || !objects_[i].skin.empty();
+    }
+    if (skinned) {
+      skinning_.fini(memory_);
+      if (!skinning_.init(memory_, objects_, geometry_buf_)) {
+        std::cerr << "skinning.init() failed." << std::endl;
+        return false;
+      }
+    }
+
+    // The structures are created with the swap chain once there are
+    // objects, then grow with them.
+    if (VK_NULL_HANDLE != rtx_.get_tlas() &&
+        !add_ray_tracing_objects(first_object)) {
+      std::cerr << "add_ray_tracing_objects() failed." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  static bool load_obj(const std::string &model_path,
+                       object_model_t &object) {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
+
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
+                          model_path.c_str())) {
+      std::cerr << "Failed to load model: " << warn << ", " << err << "."
+                << std::endl;
+      return false;
+    }
+
+    std::unordered_map<Vertex, uint32_t> unique_vertices;
+
+    for (const auto &shape : shapes) {
+      for (const auto &index : shape.mesh.indices) {
+        Vertex vertex{};
+
+        vertex.pos = {attrib.vertices[3 * index.vertex_index + 0],
+                      attrib.vertices[3 * index.vertex_index + 1],
+                      attrib.vertices[3 * index.vertex_index + 2]};
+
+        if (!attrib.normals.empty()) {
+          vertex.normal = {attrib.normals[3 * index.normal_index + 0],
+                           attrib.normals[3 * index.normal_index + 1],
+                           attrib.normals[3 * index.normal_index + 2]};
+        }
+
+        if (!attrib.texcoords.empty()) {
+          vertex.tex_coord = {
+              attrib.texcoords[2 * index.texcoord_index + 0],
+              1.0f - attrib.texcoords[2 * index.texcoord_index + 1]};
+        }
+
+        if (unique_vertices.count(vertex) == 0) {
+          unique_vertices[vertex] =
+              static_cast<uint32_t>(object.vertices.size());
+          object.vertices.push_back(vertex);
+        }
+        object.indices.push_back(unique_vertices[vertex]);
+      }
+    }
+
+    return true;
+  }
+
+  // Select the coarsest level of detail of the object whose simplification
+  // error covers less than lod_pixel_error_ pixels on screen.
+  uint32_t select_lod(const object_model_t &object) const {
+    const uint32_t lod_count = static_cast<uint32_t>(object.lods.size());
+    if (forced_lod_ >= 0) {
+      return std::min(static_cast<uint32_t>(forced_lod_), lod_count - 1);
+    }
+
+    const glm::vec3 center = 0.5f * (object.aabb_min + object.aabb_max);
+    const glm::vec3 size = object.aabb_max - object.aabb_min;
+    const float extent = std::max(size.x, std::max(size.y, size.z));
+    const float radius = 0.5f * glm::length(size);
+
+    // Pixels covered by one unit of length at one unit of distance.
+    const float pixels_per_unit =
+        static_cast<float>(window_size_.height) /
+        (2.0f * std::tan(0.5f * glm::radians(camera_.fov())));
+
+    // Use the instance closest to the camera.
+    const glm::vec3 eye = camera_.position();
+    float distance = std::numeric_limits<float>::max();
+    float scale = 1.0f;
+    for (const auto &transform : object.transforms) {
+      const float instance_scale =
+          std::max(glm::length(glm::vec3(transform[0])),
+                   std::max(glm::length(glm::vec3(transform[1])),
+                            glm::length(glm::vec3(transform[2]))));
+      const glm::vec3 instance_center =
+          glm::vec3(transform * glm::vec4(center, 1.0f));
+      const float instance_distance =
+          glm::length(instance_center - eye) - radius * instance_scale;
+      if (instance_distance < distance) {
+        distance = instance_distance;
+        scale = instance_scale;
+      }
+    }
+
+    if (distance <= 0.0f) {
+      // The camera is inside the object bounds.
+      return 0;
+    }
+
+    for (uint32_t lod = lod_count - 1; lod > 0; --lod) {
+      const float error = object.lods[lod].error * extent * scale;
+      if (error * pixels_per_unit / distance <= lod_pixel_error_) {
+        return lod;
+      }
+    }
+
+    return 0;
+  }
+
+  bool init_descriptor_pool() {
+    static constexpr uint32_t pool_descriptor_count = 1000;
+    VkDescriptorPoolSize descriptor_pool_size[] = {
+        {VK_DESCRIPTOR_TYPE_SAMPLER, pool_descriptor_count},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, pool_descriptor_count},
+        {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, pool_descriptor_count},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, pool_descriptor_count},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, pool_descriptor_count},
         {VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, pool_descriptor_count},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, pool_descriptor_count},
         {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, pool_descriptor_count},
@@ -2793,6 +4487,31 @@ class render_engine {
     return true;
   }
 
+  // Point the texture descriptor to the current texture, after it was
+  // replaced. The pre-recorded raster draws bind the descriptor set.
+  void update_texture_descriptor() {
+    VkDescriptorImageInfo image_info{};
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    image_info.imageView = texture_image_view_;
+    image_info.sampler = texture_sampler_;
+
+    VkWriteDescriptorSet write_descriptor_set{};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = descriptor_set_[0];
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write_descriptor_set.pImageInfo = &image_info;
+    write_descriptor_set.dstArrayElement = 0;
+    write_descriptor_set.dstBinding = 1;
+
+    uint32_t descriptor_copy_count = 0;
+    const VkCopyDescriptorSet *descriptor_copies = nullptr;
+    vkUpdateDescriptorSets(device_, 1, &write_descriptor_set,
+                           descriptor_copy_count, descriptor_copies);
+    invalidate_raster_commands();
+  }
+
   bool init_pipeline_cache() {
     VkPipelineCacheCreateInfo pipeline_cache_create_info = {};
     pipeline_cache_create_info.sType =
@@ -2822,6 +4541,15 @@ class render_engine {
   bool init_pipeline() {
     std::cout << "Hi pipeline." << std::endl;
 
+    return create_raster_pipeline(pipeline_layout_, shader_stages_create_info_,
+                                  pipeline_);
+  }
+
+  // Graphics pipeline of the rasterizer, drawing into the render pass with
+  // the vertex and fragment shader stages.
+  bool create_raster_pipeline(VkPipelineLayout layout,
+                              const VkPipelineShaderStageCreateInfo stages[2],
+                              VkPipeline &raster_pipeline) {
     VkDynamicState dynamic_states[2];  // Viewport + scissor.
     memset(dynamic_states, 0, sizeof(dynamic_states));
 
@@ -2842,13 +4570,21 @@ class render_engine {
     vi.pNext = nullptr;
     vi.flags = 0;
 
-    VkVertexInputBindingDescription vertex_input_binding =
-        Vertex::get_binding_description();
-    vi.vertexBindingDescriptionCount = 1;
-    vi.pVertexBindingDescriptions = &vertex_input_binding;
+    // Vertices and, one per instance, their transform.
+    const VkVertexInputBindingDescription vertex_input_bindings[] = {
+        Vertex::get_binding_description(),
+        RasterInstance::get_binding_description()};
+    vi.vertexBindingDescriptionCount = 2;
+    vi.pVertexBindingDescriptions = vertex_input_bindings;
 
+    std::vector<VkVertexInputAttributeDescription> vertex_input_attributes =
+        Vertex::get_attribute_descriptions();
     const std::vector<VkVertexInputAttributeDescription>
-        vertex_input_attributes = Vertex::get_attribute_descriptions();
+        instance_input_attributes =
+            RasterInstance::get_attribute_descriptions();
+    vertex_input_attributes.insert(vertex_input_attributes.end(),
+                                   instance_input_attributes.begin(),
+                                   instance_input_attributes.end());
     vi.vertexAttributeDescriptionCount =
         static_cast<uint32_t>(vertex_input_attributes.size());
     vi.pVertexAttributeDescriptions = vertex_input_attributes.data();
@@ -2965,7 +4701,7 @@ class render_engine {
     VkGraphicsPipelineCreateInfo pipeline;
     pipeline.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipeline.pNext = nullptr;
-    pipeline.layout = pipeline_layout_;
+    pipeline.layout = layout;
     pipeline.basePipelineHandle = VK_NULL_HANDLE;
     pipeline.basePipelineIndex = 0;
     pipeline.flags = 0;
@@ -2978,15 +4714,16 @@ class render_engine {
     pipeline.pDynamicState = &pipeline_dynamic_state_create_info;
     pipeline.pViewportState = &vp;
     pipeline.pDepthStencilState = &ds;
-    pipeline.pStages = shader_stages_create_info_;
+    pipeline.pStages = stages;
     pipeline.stageCount = 2;
     pipeline.renderPass = render_pass_;
     pipeline.subpass = 0;
 
     static constexpr uint32_t create_info_count = 1;
-    VkResult res =
-        vkCreateGraphicsPipelines(device_, pipeline_cache_, create_info_count,
-                                  &pipeline, allocation_callbacks_, &pipeline_);
+    VkResult res = vkCreateGraphicsPipelines(device_, pipeline_cache_,
+                                             create_info_count, &pipeline,
+                                             allocation_callbacks_,
+                                             &raster_pipeline);
     if (VK_SUCCESS != res) {
       std::cerr << "Failed to create pipeline: " << res << std::endl;
       return false;
@@ -3006,11 +4743,24 @@ class render_engine {
     // TODO: BLAS, TLAS and more don't need to be rebuilt on window resize.
     // Generate ray tracing structures.
     bool update = false;
+    VkBuildAccelerationStructureFlagsKHR build_flags =
+        rt_prefer_fast_build_
+            ? VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR
+            : VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    rtx_.set_scratch_budget(static_cast<VkDeviceSize>(rt_scratch_budget_)
+                            << 20);
+    const auto build_start = std::chrono::steady_clock::now();
     if (!rtx_.build_acceleration_structures(
-            memory_, command_pool_, graphics_queue_, objects_, update)) {
+            memory_, command_pool_, graphics_queue_, objects_,
+            memory_.get_buffer_device_address(geometry_buf_),
+            rt_secondary_lod_, build_flags, update)) {
       std::cerr << "Failed to generate ray tracing structures." << std::endl;
       return false;
     }
+    rt_build_milliseconds_ = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - build_start)
+                                 .count();
+    rt_refits_ = 0;
 
     if (!rt_descriptor_pool_.init(memory_)) {
       std::cerr << "Failed to create ray tracing descriptor pool." << std::endl;
@@ -3023,11 +4773,22 @@ class render_engine {
       return false;
     }
 
+    rt_render_size_ = ray_tracing_render_size();
+
     if (!init_ray_tracing_storage_image()) {
       std::cerr << "Failed to create ray tracing storage image." << std::endl;
       return false;
     }
 
+    // The counters buffer is bound to the ray tracing descriptor set.
+    if (!rt_ray_counters_.init(
+            memory_, gpu_properties_,
+            queue_props_[graphics_queue_family_index_].timestampValidBits,
+            rt_render_size_, rt_descriptor_layout_)) {
+      std::cerr << "Failed to create ray counters." << std::endl;
+      return false;
+    }
+
     if (!init_ray_tracing_descriptor_set()) {
       std::cerr << "Failed to create ray tracing descriptor set." << std::endl;
       return false;
@@ -3038,6 +4799,49 @@ class render_engine {
       return false;
     }
 
+    if (!init_ray_query_pipeline()) {
+      std::cerr << "Failed to create ray query pipeline." << std::endl;
+      return false;
+    }
+
+    if (!init_raster_shadow_pipeline()) {
+      std::cerr << "Failed to create raster shadow pipeline." << std::endl;
+      return false;
+    }
+
+    if (!rt_wavefront_.init(
+            memory_, gpu_properties_,
+            queue_props_[graphics_queue_family_index_].timestampValidBits,
+            rt_render_size_, rt_descriptor_layout_, descriptor_layout_[0],
+            RT_PUSH_CONSTANT_STAGES)) {
+      std::cerr << "Failed to create wavefront path tracer." << std::endl;
+      return false;
+    }
+
+    if (!rt_hybrid_.init(memory_, rt_render_size_, depth_buffer_.format,
+                         rt_descriptor_layout_, descriptor_layout_[0],
+                         RT_PUSH_CONSTANT_STAGES)) {
+      std::cerr << "Failed to create hybrid renderer." << std::endl;
+      return false;
+    }
+
+    if (!rt_denoiser_.init(
+            memory_, gpu_properties_,
+            queue_props_[graphics_queue_family_index_].timestampValidBits,
+            rt_render_size_, rt_storage_image_.format, rt_descriptor_layout_)) {
+      std::cerr << "Failed to create denoiser." << std::endl;
+      return false;
+    }
+
+    if (!rt_upscaler_.init(
+            memory_, gpu_properties_,
+            queue_props_[graphics_queue_family_index_].timestampValidBits,
+            window_size_, rt_storage_image_, rt_denoiser_.output(),
+            rt_descriptor_layout_)) {
+      std::cerr << "Failed to create upscaler." << std::endl;
+      return false;
+    }
+
     if (!init_ray_tracing_shader_binding_table()) {
       std::cerr << "Failed to create ray tracing shader binding table."
                 << std::endl;
@@ -3052,14 +4856,16 @@ class render_engine {
   bool init_ray_tracing_descriptor_layout() {
     // TLAS descriptor layout.
     //
-    // Usable by camera rays (raygen) and bouncing rays on closest-hit.
+    // Usable by camera rays (raygen) and bouncing rays on closest-hit, by the
+    // ray query compute shader, and by the shadow rays of the rasterizer.
     VkDescriptorSetLayoutBinding acceleration_structure_layout_binding{};
     acceleration_structure_layout_binding.binding = 0;
     acceleration_structure_layout_binding.descriptorType =
-        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
+        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
     acceleration_structure_layout_binding.descriptorCount = 1;
     acceleration_structure_layout_binding.stageFlags =
-        VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
+        VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
     // Storage image descriptor layout.
     //
@@ -3068,27 +4874,68 @@ class render_engine {
     output_image_layout_binding.descriptorType =
         VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
     output_image_layout_binding.descriptorCount = 1;
-    output_image_layout_binding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+    output_image_layout_binding.stageFlags =
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
 
-    // Vertices descriptor layout.
+    // Instance table descriptor layout.
     //
-    VkDescriptorSetLayoutBinding vertices_layout_binding{};
-    vertices_layout_binding.binding = 2;
-    vertices_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    vertices_layout_binding.descriptorCount = 1;
-    vertices_layout_binding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
-
-    // Indices descriptor layout.
+    // Geometry and material of each instance, indexed by its custom index.
+    VkDescriptorSetLayoutBinding instances_layout_binding{};
+    instances_layout_binding.binding = 2;
+    instances_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instances_layout_binding.descriptorCount = 1;
+    instances_layout_binding.stageFlags =
+        VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Statistics image descriptor layout.
     //
-    VkDescriptorSetLayoutBinding indices_layout_binding{};
-    indices_layout_binding.binding = 3;
-    indices_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    indices_layout_binding.descriptorCount = 1;
-    indices_layout_binding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+    VkDescriptorSetLayoutBinding statistics_image_layout_binding{};
+    statistics_image_layout_binding.binding = 4;
+    statistics_image_layout_binding.descriptorType =
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    statistics_image_layout_binding.descriptorCount = 1;
+    statistics_image_layout_binding.stageFlags =
+        VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
 
     std::vector<VkDescriptorSetLayoutBinding> layout_bindings(
         {acceleration_structure_layout_binding, output_image_layout_binding,
-         vertices_layout_binding, indices_layout_binding});
+         instances_layout_binding, statistics_image_layout_binding});
+
+    // G-buffer descriptor layouts.
+    //
+    for (uint32_t i = 0; i < rt_gbuffer_count; ++i) {
+      VkDescriptorSetLayoutBinding gbuffer_layout_binding{};
+      gbuffer_layout_binding.binding = RT_GBUFFER_BINDING + i;
+      gbuffer_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      gbuffer_layout_binding.descriptorCount = 1;
+      gbuffer_layout_binding.stageFlags =
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+      layout_bindings.push_back(gbuffer_layout_binding);
+    }
+
+    // History descriptor layouts.
+    //
+    for (uint32_t i = 0; i < rt_history_count; ++i) {
+      VkDescriptorSetLayoutBinding history_layout_binding{};
+      history_layout_binding.binding = RT_HISTORY_BINDING + i;
+      history_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      history_layout_binding.descriptorCount = 1;
+      history_layout_binding.stageFlags =
+          VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+      layout_bindings.push_back(history_layout_binding);
+    }
+
+    // Ray counters descriptor layout.
+    //
+    // Closest hits count the hits and shadow rays.
+    VkDescriptorSetLayoutBinding counters_layout_binding{};
+    counters_layout_binding.binding = RT_COUNTERS_BINDING;
+    counters_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    counters_layout_binding.descriptorCount = 1;
+    counters_layout_binding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+                                         VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
+                                         VK_SHADER_STAGE_COMPUTE_BIT;
+    layout_bindings.push_back(counters_layout_binding);
 
     VkDescriptorSetLayoutCreateInfo descriptor_layout_create_info{};
     descriptor_layout_create_info.sType =
@@ -3129,53 +4976,244 @@ class render_engine {
     // Create the storage image to where the ray tracing shaders will write.
     //
 
-    VkExtent2D window_size = platform_.window_size();
-
     VkFormat color_format = VK_FORMAT_B8G8R8A8_UNORM;
     if (!find_ray_tracing_storage_image_format(color_format)) {
       std::cerr << "Failed to find a storage image format." << std::endl;
       return false;
     }
-    rt_storage_image_.format = color_format;  // TODO: refactor.
 
-    if (!helpers::create_image(
-            memory_, window_size.width, window_size.height, color_format,
-            VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-                VK_IMAGE_USAGE_STORAGE_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, rt_storage_image_.image,
-            rt_storage_image_.mem)) {
+    if (!create_ray_tracing_image(color_format,
+                                  VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                                      VK_IMAGE_USAGE_STORAGE_BIT,
+                                  rt_storage_image_)) {
       std::cerr << "Failed to create ray tracing storage image." << std::endl;
       return false;
     }
 
-    if (!helpers::create_image_view(memory_, rt_storage_image_.image,
-                                    color_format, VK_IMAGE_ASPECT_COLOR_BIT,
-                                    rt_storage_image_.view)) {
-      std::cerr << "Failed to create ray tracing storage image view."
+    // Per pixel statistics of the accumulated samples, for adaptive sampling.
+    //
+    if (!create_ray_tracing_image(
+            VK_FORMAT_R32G32B32A32_SFLOAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            rt_statistics_image_)) {
+      std::cerr << "Failed to create ray tracing statistics image."
                 << std::endl;
       return false;
     }
 
-    if (!transition_image_layout(rt_storage_image_.image, color_format,
+    // G-buffer.
+    //
+    const VkFormat gbuffer_formats[rt_gbuffer_count] = {
+        VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT,
+        VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+    for (uint32_t i = 0; i < rt_gbuffer_count; ++i) {
+      if (!create_ray_tracing_image(
+              gbuffer_formats[i],
+              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+              rt_gbuffer_[i])) {
+        std::cerr << "Failed to create ray tracing G-buffer." << std::endl;
+        return false;
+      }
+    }
+
+    // History, copies of the images above.
+    //
+    const VkFormat history_formats[rt_history_count] = {
+        rt_storage_image_.format, rt_statistics_image_.format,
+        rt_gbuffer_[rt_gbuffer_normal_depth].format};
+    for (uint32_t i = 0; i < rt_history_count; ++i) {
+      if (!create_ray_tracing_image(
+              history_formats[i],
+              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+              rt_history_[i])) {
+        std::cerr << "Failed to create ray tracing history." << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void fini_ray_tracing_storage_image() {
+    for (storage_image_t &history : rt_history_) {
+      destroy_ray_tracing_image(history);
+    }
+    for (storage_image_t &gbuffer : rt_gbuffer_) {
+      destroy_ray_tracing_image(gbuffer);
+    }
+    destroy_ray_tracing_image(rt_statistics_image_);
+    destroy_ray_tracing_image(rt_storage_image_);
+  }
+
+  // The ray traced image goes through the upscaler pass, instead of being
+  // blitted as is.
+  bool ray_tracing_upscaled() const {
+    return rt_upscaler_mode_ != upscaler::mode_bilinear &&
+           (rt_render_size_.width != window_size_.width ||
+            rt_render_size_.height != window_size_.height);
+  }
+
+  // Averaged GPU time of the ray tracing passes of a frame.
+  float ray_tracing_milliseconds() const {
+    float milliseconds = gpu_timer_.milliseconds(rt_renderer_);
+    if (rt_denoise_ && !rt_constants_.temperature) {
+      milliseconds += rt_denoiser_.milliseconds(denoiser::pass_temporal) +
+                      rt_denoiser_.milliseconds(denoiser::pass_filter);
+    }
+    if (ray_tracing_upscaled()) {
+      milliseconds += rt_upscaler_.milliseconds();
+    }
+    if (rt_constants_.temperature) {
+      milliseconds += rt_ray_counters_.milliseconds();
+    }
+    return milliseconds;
+  }
+
+  // Size traced, a fraction of the window size to trade resolution for
+  // frame rate. The upscaler fills the rest.
+  VkExtent2D ray_tracing_render_size() {
+    const VkExtent2D window_size = platform_.window_size();
+
+    VkExtent2D render_size{};
+    render_size.width =
+        std::max(1u, window_size.width * rt_render_scale_ / 100u);
+    render_size.height =
+        std::max(1u, window_size.height * rt_render_scale_ / 100u);
+    return render_size;
+  }
+
+  // Create a render sized image in general layout for the ray tracing shaders.
+  bool create_ray_tracing_image(VkFormat format, VkImageUsageFlags usage,
+                                storage_image_t &storage_image) {
+    storage_image.format = format;
+
+    if (!helpers::create_image(memory_, rt_render_size_.width,
+                               rt_render_size_.height,
+                               format, VK_IMAGE_TILING_OPTIMAL, usage,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                               storage_image.image, storage_image.mem)) {
+      std::cerr << "Failed to create ray tracing image." << std::endl;
+      return false;
+    }
+
+    if (!helpers::create_image_view(memory_, storage_image.image, format,
+                                    VK_IMAGE_ASPECT_COLOR_BIT,
+                                    storage_image.view)) {
+      std::cerr << "Failed to create ray tracing image view." << std::endl;
+      return false;
+    }
+
+    if (!transition_image_layout(storage_image.image, format,
                                  VK_IMAGE_LAYOUT_UNDEFINED,
                                  VK_IMAGE_LAYOUT_GENERAL)) {
-      std::cerr << "Failed to transit ray tracing storage image." << std::endl;
+      std::cerr << "Failed to transit ray tracing image." << std::endl;
       return false;
     }
 
     return true;
   }
 
-  void fini_ray_tracing_storage_image() {
-    vkDestroyImageView(device_, rt_storage_image_.view, allocation_callbacks_);
-    rt_storage_image_.view = VK_NULL_HANDLE;
+  void destroy_ray_tracing_image(storage_image_t &storage_image) {
+    vkDestroyImageView(device_, storage_image.view, allocation_callbacks_);
+    storage_image.view = VK_NULL_HANDLE;
 
-    vkDestroyImage(device_, rt_storage_image_.image, allocation_callbacks_);
-    rt_storage_image_.image = VK_NULL_HANDLE;
+    vkDestroyImage(device_, storage_image.image, allocation_callbacks_);
+    storage_image.image = VK_NULL_HANDLE;
 
-    vkFreeMemory(device_, rt_storage_image_.mem, allocation_callbacks_);
-    rt_storage_image_.mem = VK_NULL_HANDLE;
+    vkFreeMemory(device_, storage_image.mem, allocation_callbacks_);
+    storage_image.mem = VK_NULL_HANDLE;
+  }
+
+  // Keep in the TLAS the instance clusters in view or near the camera, within
+  // the instance budget. With culling off, all of them are put back. The
+  // TLAS is rebuilt by the command buffer of the frame.
+  bool cull_instance_clusters(VkCommandBuffer cmd_buf) {
+    const float nearby_distance = rt_cluster_culling_
+                                      ? rt_cluster_distance_
+                                      : std::numeric_limits<float>::max();
+    const uint32_t instance_budget =
+        rt_cluster_culling_ ? static_cast<uint32_t>(rt_instance_budget_)
+                            : std::numeric_limits<uint32_t>::max();
+    bool rebuilt = false;
+    if (!rtx_.cull_instances(memory_, cmd_buf, current_frame_,
+                             camera_.mvp(), camera_.position(),
+                             nearby_distance, instance_budget, rebuilt)) {
+      return false;
+    }
+
+    if (rebuilt) {
+      reset_ray_tracing_frame_counter();
+    }
+
+    return true;
+  }
+
+  // Build the acceleration structures of the objects from first_object on,
+  // and rebuild the TLAS with all the instances. The others are kept.
+  bool add_ray_tracing_objects(size_t first_object) {
+    const auto build_start = std::chrono::steady_clock::now();
+    if (!rtx_.add_objects(memory_, command_pool_, graphics_queue_, objects_,
+                          static_cast<uint32_t>(first_object),
+                          memory_.get_buffer_device_address(geometry_buf_))) {
+      std::cerr << "Failed to add ray tracing objects." << std::endl;
+      return false;
+    }
+    rt_build_milliseconds_ = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - build_start)
+                                 .count();
+
+    update_ray_tracing_tlas_descriptor();
+    update_ray_tracing_instance_table_descriptor();
+    reset_ray_tracing_frame_counter();
+
+    return true;
+  }
+
+  // Point the TLAS descriptor to the current TLAS, after it was re-created.
+  void update_ray_tracing_tlas_descriptor() {
+    VkWriteDescriptorSetAccelerationStructureKHR write_descriptor_set_as_info{};
+    write_descriptor_set_as_info.sType =
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+    write_descriptor_set_as_info.accelerationStructureCount = 1;
+    write_descriptor_set_as_info.pAccelerationStructures = &rtx_.get_tlas();
+
+    VkWriteDescriptorSet write_descriptor_set_as{};
+    write_descriptor_set_as.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set_as.pNext = &write_descriptor_set_as_info;
+    write_descriptor_set_as.dstSet = rt_descriptor_set_;
+    write_descriptor_set_as.dstBinding = 0;
+    write_descriptor_set_as.descriptorCount = 1;
+    write_descriptor_set_as.descriptorType =
+        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+
+    uint32_t descriptor_copy_count = 0;
+    const VkCopyDescriptorSet *descriptor_copies = nullptr;
+    vkUpdateDescriptorSets(device_, 1, &write_descriptor_set_as,
+                           descriptor_copy_count, descriptor_copies);
+  }
+
+  // Point the instance table descriptor to the current table, after objects
+  // were added.
+  void update_ray_tracing_instance_table_descriptor() {
+    VkDescriptorBufferInfo instances_descriptor_info{};
+    instances_descriptor_info.buffer = rtx_.get_instance_table();
+    instances_descriptor_info.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write_descriptor_set_instances{};
+    write_descriptor_set_instances.sType =
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set_instances.dstSet = rt_descriptor_set_;
+    write_descriptor_set_instances.dstBinding = 2;
+    write_descriptor_set_instances.descriptorCount = 1;
+    write_descriptor_set_instances.descriptorType =
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_descriptor_set_instances.pBufferInfo = &instances_descriptor_info;
+
+    uint32_t descriptor_copy_count = 0;
+    const VkCopyDescriptorSet *descriptor_copies = nullptr;
+    vkUpdateDescriptorSets(device_, 1, &write_descriptor_set_instances,
+                           descriptor_copy_count, descriptor_copies);
   }
 
   bool init_ray_tracing_descriptor_set() {
@@ -3196,9 +5234,9 @@ class render_engine {
 
     // TLAS descriptor.
     //
-    VkWriteDescriptorSetAccelerationStructureNV write_descriptor_set_as_info{};
+    VkWriteDescriptorSetAccelerationStructureKHR write_descriptor_set_as_info{};
     write_descriptor_set_as_info.sType =
-        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_NV;
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
     write_descriptor_set_as_info.accelerationStructureCount = 1;
     write_descriptor_set_as_info.pAccelerationStructures = &rtx_.get_tlas();
 
@@ -3210,7 +5248,7 @@ class render_engine {
     write_descriptor_set_as.dstBinding = 0;
     write_descriptor_set_as.descriptorCount = 1;
     write_descriptor_set_as.descriptorType =
-        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
+        VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
 
     //  Storage image descriptor.
     //
@@ -3229,41 +5267,98 @@ class render_engine {
     write_descriptor_set_storage_image.pImageInfo =
         &output_image_descriptor_info;
 
-    // Vertices descriptor.
+    //  Statistics image descriptor.
     //
-    // TODO: Add more objects.
-    VkDescriptorBufferInfo vertices_descriptor_info{};
-    vertices_descriptor_info.buffer = objects_[0].vertex_buf;
-    vertices_descriptor_info.range = VK_WHOLE_SIZE;
+    VkDescriptorImageInfo statistics_image_descriptor_info{};
+    statistics_image_descriptor_info.imageView = rt_statistics_image_.view;
+    statistics_image_descriptor_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
-    VkWriteDescriptorSet write_descriptor_set_vertices{};
-    write_descriptor_set_vertices.sType =
+    VkWriteDescriptorSet write_descriptor_set_statistics_image{};
+    write_descriptor_set_statistics_image.sType =
         VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_descriptor_set_vertices.dstSet = rt_descriptor_set_;
-    write_descriptor_set_vertices.dstBinding = 2;
-    write_descriptor_set_vertices.descriptorCount = 1;
-    write_descriptor_set_vertices.descriptorType =
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    write_descriptor_set_vertices.pBufferInfo = &vertices_descriptor_info;
+    write_descriptor_set_statistics_image.dstSet = rt_descriptor_set_;
+    write_descriptor_set_statistics_image.dstBinding = 4;
+    write_descriptor_set_statistics_image.descriptorCount = 1;
+    write_descriptor_set_statistics_image.descriptorType =
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write_descriptor_set_statistics_image.pImageInfo =
+        &statistics_image_descriptor_info;
 
-    // Indices descriptor.
+    // Instance table descriptor.
     //
-    VkDescriptorBufferInfo indices_descriptor_info{};
-    indices_descriptor_info.buffer = objects_[0].index_buf;
-    indices_descriptor_info.range = VK_WHOLE_SIZE;
-
-    VkWriteDescriptorSet write_descriptor_set_indices{};
-    write_descriptor_set_indices.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_descriptor_set_indices.dstSet = rt_descriptor_set_;
-    write_descriptor_set_indices.dstBinding = 3;
-    write_descriptor_set_indices.descriptorCount = 1;
-    write_descriptor_set_indices.descriptorType =
+    VkDescriptorBufferInfo instances_descriptor_info{};
+    instances_descriptor_info.buffer = rtx_.get_instance_table();
+    instances_descriptor_info.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write_descriptor_set_instances{};
+    write_descriptor_set_instances.sType =
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set_instances.dstSet = rt_descriptor_set_;
+    write_descriptor_set_instances.dstBinding = 2;
+    write_descriptor_set_instances.descriptorCount = 1;
+    write_descriptor_set_instances.descriptorType =
         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    write_descriptor_set_indices.pBufferInfo = &indices_descriptor_info;
+    write_descriptor_set_instances.pBufferInfo = &instances_descriptor_info;
 
     std::vector<VkWriteDescriptorSet> write_descriptor_sets(
         {write_descriptor_set_as, write_descriptor_set_storage_image,
-         write_descriptor_set_vertices, write_descriptor_set_indices});
+         write_descriptor_set_instances,
+         write_descriptor_set_statistics_image});
+
+    // G-buffer descriptors.
+    //
+    VkDescriptorImageInfo gbuffer_descriptor_infos[rt_gbuffer_count] = {};
+    for (uint32_t i = 0; i < rt_gbuffer_count; ++i) {
+      gbuffer_descriptor_infos[i].imageView = rt_gbuffer_[i].view;
+      gbuffer_descriptor_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+      VkWriteDescriptorSet write_descriptor_set_gbuffer{};
+      write_descriptor_set_gbuffer.sType =
+          VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write_descriptor_set_gbuffer.dstSet = rt_descriptor_set_;
+      write_descriptor_set_gbuffer.dstBinding = RT_GBUFFER_BINDING + i;
+      write_descriptor_set_gbuffer.descriptorCount = 1;
+      write_descriptor_set_gbuffer.descriptorType =
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      write_descriptor_set_gbuffer.pImageInfo = &gbuffer_descriptor_infos[i];
+      write_descriptor_sets.push_back(write_descriptor_set_gbuffer);
+    }
+
+    // History descriptors.
+    //
+    VkDescriptorImageInfo history_descriptor_infos[rt_history_count] = {};
+    for (uint32_t i = 0; i < rt_history_count; ++i) {
+      history_descriptor_infos[i].imageView = rt_history_[i].view;
+      history_descriptor_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+      VkWriteDescriptorSet write_descriptor_set_history{};
+      write_descriptor_set_history.sType =
+          VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write_descriptor_set_history.dstSet = rt_descriptor_set_;
+      write_descriptor_set_history.dstBinding = RT_HISTORY_BINDING + i;
+      write_descriptor_set_history.descriptorCount = 1;
+      write_descriptor_set_history.descriptorType =
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      write_descriptor_set_history.pImageInfo = &history_descriptor_infos[i];
+      write_descriptor_sets.push_back(write_descriptor_set_history);
+    }
+
+    // Ray counters descriptor.
+    //
+    VkDescriptorBufferInfo counters_descriptor_info{};
+    counters_descriptor_info.buffer = rt_ray_counters_.buffer();
+    counters_descriptor_info.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write_descriptor_set_counters{};
+    write_descriptor_set_counters.sType =
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set_counters.dstSet = rt_descriptor_set_;
+    write_descriptor_set_counters.dstBinding = RT_COUNTERS_BINDING;
+    write_descriptor_set_counters.descriptorCount = 1;
+    write_descriptor_set_counters.descriptorType =
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_descriptor_set_counters.pBufferInfo = &counters_descriptor_info;
+    write_descriptor_sets.push_back(write_descriptor_set_counters);
 
     uint32_t descriptor_copy_count = 0;
     const VkCopyDescriptorSet *descriptor_copies = nullptr;
@@ -3319,9 +5414,7 @@ class render_engine {
     pipeline_layout_create_info.pSetLayouts = layouts.data();
 
     VkPushConstantRange push_constant{};
-    push_constant.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV |
-                               VK_SHADER_STAGE_MISS_BIT_NV |
-                               VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+    push_constant.stageFlags = RT_PUSH_CONSTANT_STAGES;
     push_constant.offset = 0;
     push_constant.size = sizeof(rt_constants_);
 
@@ -3347,27 +5440,28 @@ class render_engine {
   }
 
   bool init_ray_tracing_shaders(
-      std::vector<VkRayTracingShaderGroupCreateInfoNV> &groups) {
+      std::vector<VkRayTracingShaderGroupCreateInfoKHR> &groups) {
     // Load shaders.
     //
 
     rt_shader_groups_.emplace_back();
     if (!load_shader(raytrace_rgen, sizeof(raytrace_rgen),
-                     rt_shader_groups_.back(), VK_SHADER_STAGE_RAYGEN_BIT_NV)) {
+                     rt_shader_groups_.back(),
+                     VK_SHADER_STAGE_RAYGEN_BIT_KHR)) {
       std::cerr << "Failed to load ray tracing raygen shader." << std::endl;
       return false;
     }
 
     rt_shader_groups_.emplace_back();
     if (!load_shader(raytrace_rmiss, sizeof(raytrace_rmiss),
-                     rt_shader_groups_.back(), VK_SHADER_STAGE_MISS_BIT_NV)) {
+                     rt_shader_groups_.back(), VK_SHADER_STAGE_MISS_BIT_KHR)) {
       std::cerr << "Failed to load ray tracing miss shader." << std::endl;
       return false;
     }
 
     rt_shader_groups_.emplace_back();
     if (!load_shader(raytrace_shadow_rmiss, sizeof(raytrace_shadow_rmiss),
-                     rt_shader_groups_.back(), VK_SHADER_STAGE_MISS_BIT_NV)) {
+                     rt_shader_groups_.back(), VK_SHADER_STAGE_MISS_BIT_KHR)) {
       std::cerr << "Failed to load ray tracing shadow miss shader."
                 << std::endl;
       return false;
@@ -3376,7 +5470,7 @@ class render_engine {
     rt_shader_groups_.emplace_back();
     if (!load_shader(raytrace_rchit, sizeof(raytrace_rchit),
                      rt_shader_groups_.back(),
-                     VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV)) {
+                     VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR)) {
       std::cerr << "Failed to load ray tracing closes hit shader." << std::endl;
       return false;
     }
@@ -3385,22 +5479,22 @@ class render_engine {
     //
 
     for (uint32_t i = 0; i < rt_shader_groups_.size(); ++i) {
-      VkRayTracingShaderGroupCreateInfoNV group{};
-      group.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_NV;
-      group.generalShader = VK_SHADER_UNUSED_NV;
-      group.closestHitShader = VK_SHADER_UNUSED_NV;
-      group.anyHitShader = VK_SHADER_UNUSED_NV;
-      group.intersectionShader = VK_SHADER_UNUSED_NV;
-
-      if (rt_shader_groups_[i].stage == VK_SHADER_STAGE_RAYGEN_BIT_NV) {
-        group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_NV;
+      VkRayTracingShaderGroupCreateInfoKHR group{};
+      group.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR;
+      group.generalShader = VK_SHADER_UNUSED_KHR;
+      group.closestHitShader = VK_SHADER_UNUSED_KHR;
+      group.anyHitShader = VK_SHADER_UNUSED_KHR;
+      group.intersectionShader = VK_SHADER_UNUSED_KHR;
+
+      if (rt_shader_groups_[i].stage == VK_SHADER_STAGE_RAYGEN_BIT_KHR) {
+        group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
         group.generalShader = i;
-      } else if (rt_shader_groups_[i].stage == VK_SHADER_STAGE_MISS_BIT_NV) {
-        group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_NV;
+      } else if (rt_shader_groups_[i].stage == VK_SHADER_STAGE_MISS_BIT_KHR) {
+        group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR;
         group.generalShader = i;
       } else if (rt_shader_groups_[i].stage ==
-                 VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV) {
-        group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_NV;
+                 VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR) {
+        group.type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
         group.closestHitShader = i;
       } else {
         std::cerr << "Unknown shader stage bit " << rt_shader_groups_[i].stage
@@ -3428,30 +5522,32 @@ class render_engine {
       return false;
     }
 
-    std::vector<VkRayTracingShaderGroupCreateInfoNV> groups{};
+    std::vector<VkRayTracingShaderGroupCreateInfoKHR> groups{};
     if (!init_ray_tracing_shaders(groups)) {
       std::cerr << "Failed to init ray tracing shaders." << std::endl;
       return false;
     }
 
-    VkRayTracingPipelineCreateInfoNV rt_pipeline_create_info{};
+    VkRayTracingPipelineCreateInfoKHR rt_pipeline_create_info{};
     rt_pipeline_create_info.sType =
-        VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_NV;
+        VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
     rt_pipeline_create_info.stageCount =
         static_cast<uint32_t>(rt_shader_groups_.size());
     rt_pipeline_create_info.pStages = rt_shader_groups_.data();
     rt_pipeline_create_info.groupCount = static_cast<uint32_t>(groups.size());
     rt_pipeline_create_info.pGroups = groups.data();
-    rt_pipeline_create_info.maxRecursionDepth = 2;  // Normal ray + shadow ray.
+    rt_pipeline_create_info.maxPipelineRayRecursionDepth =
+        RT_MAX_RECURSION_DEPTH;
     rt_pipeline_create_info.layout = rt_pipeline_layout_;
 
     // TODO: rt_pipeline_cache_ or re-use pipeline_cache_?
     VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    VkDeferredOperationKHR deferred_operation = VK_NULL_HANDLE;
     static constexpr uint32_t create_info_count = 1;
 
-    VkResult res = vkCreateRayTracingPipelinesNV(
-        device_, pipeline_cache, create_info_count, &rt_pipeline_create_info,
-        allocation_callbacks_, &rt_pipeline_);
+    VkResult res = vkCreateRayTracingPipelinesKHR(
+        device_, deferred_operation, pipeline_cache, create_info_count,
+        &rt_pipeline_create_info, allocation_callbacks_, &rt_pipeline_);
     if (VK_SUCCESS != res) {
       std::cerr << "Failed to create ray tracing pipeline: " << res
                 << std::endl;
@@ -3469,12 +5565,167 @@ class render_engine {
     fini_ray_tracing_pipeline_layout();
   }
 
+  bool init_ray_query_pipeline() {
+    if (!load_shader(raytrace_comp, sizeof(raytrace_comp), rq_shader_stage_,
+                     VK_SHADER_STAGE_COMPUTE_BIT)) {
+      std::cerr << "Failed to load ray query compute shader." << std::endl;
+      return false;
+    }
+
+    VkComputePipelineCreateInfo rq_pipeline_create_info{};
+    rq_pipeline_create_info.sType =
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    rq_pipeline_create_info.stage = rq_shader_stage_;
+    rq_pipeline_create_info.layout = rt_pipeline_layout_;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+
+    VkResult res = vkCreateComputePipelines(
+        device_, pipeline_cache, create_info_count, &rq_pipeline_create_info,
+        allocation_callbacks_, &rq_pipeline_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create ray query pipeline: " << res << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void fini_ray_query_pipeline() {
+    vkDestroyPipeline(device_, rq_pipeline_, allocation_callbacks_);
+    rq_pipeline_ = VK_NULL_HANDLE;
+
+    vkDestroyShaderModule(device_, rq_shader_stage_.module,
+                          allocation_callbacks_);
+    rq_shader_stage_.module = VK_NULL_HANDLE;
+  }
+
+  // The raster pipeline, with the scene descriptor set and the ray tracing
+  // one, and the light of the RT constants pushed to the fragment shader.
+  bool init_raster_shadow_pipeline() {
+    raster_shadow_shader_stages_[0] = shader_stages_create_info_[0];
+    if (!load_shader(draw_cube_shadow_frag, sizeof(draw_cube_shadow_frag),
+                     raster_shadow_shader_stages_[1],
+                     VK_SHADER_STAGE_FRAGMENT_BIT)) {
+      std::cerr << "Failed to load raster shadow fragment shader."
+                << std::endl;
+      return false;
+    }
+
+    const VkDescriptorSetLayout set_layouts[] = {descriptor_layout_[0],
+                                                 rt_descriptor_layout_};
+
+    VkPushConstantRange push_constant_range{};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(ray_tracing_constants_t);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 2;
+    pipeline_layout_create_info.pSetLayouts = set_layouts;
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+
+    VkResult res = vkCreatePipelineLayout(
+        device_, &pipeline_layout_create_info, allocation_callbacks_,
+        &raster_shadow_pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create raster shadow pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    return create_raster_pipeline(raster_shadow_pipeline_layout_,
+                                  raster_shadow_shader_stages_,
+                                  raster_shadow_pipeline_);
+  }
+
+  void fini_raster_shadow_pipeline() {
+    vkDestroyPipeline(device_, raster_shadow_pipeline_, allocation_callbacks_);
+    raster_shadow_pipeline_ = VK_NULL_HANDLE;
+
+    vkDestroyPipelineLayout(device_, raster_shadow_pipeline_layout_,
+                            allocation_callbacks_);
+    raster_shadow_pipeline_layout_ = VK_NULL_HANDLE;
+
+    // The vertex shader is the one of the raster pipeline.
+    vkDestroyShaderModule(device_, raster_shadow_shader_stages_[1].module,
+                          allocation_callbacks_);
+    raster_shadow_shader_stages_[1].module = VK_NULL_HANDLE;
+  }
+
+  // Whether the raster draws trace shadow rays, when the ray tracing
+  // resources they use are created.
+  bool raster_shadows_on() const {
+    return raster_shadows_ && VK_NULL_HANDLE != raster_shadow_pipeline_;
+  }
+
+  static VkDeviceSize align_up(VkDeviceSize size, VkDeviceSize alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
   bool init_ray_tracing_shader_binding_table() {
-    VkDeviceSize sbt_size =
-        rt_properties_.shaderGroupHandleSize * rt_shader_groups_.size();
+    // The SBT holds one region per kind of shader group: raygen, miss and hit.
+    // Each region starts at shaderGroupBaseAlignment and its records are
+    // shaderGroupHandleAlignment apart.
+    //
+    static constexpr uint32_t raygen_group_count = 1;
+    static constexpr uint32_t miss_group_count = 2;  // Normal + shadow.
+    static constexpr uint32_t hit_group_count = 1;
+    const uint32_t group_count =
+        static_cast<uint32_t>(rt_shader_groups_.size());
+    if (group_count !=
+        raygen_group_count + miss_group_count + hit_group_count) {
+      std::cerr << "Unexpected number of shader groups: " << group_count << "."
+                << std::endl;
+      return false;
+    }
+
+    const uint32_t handle_size = rt_properties_.shaderGroupHandleSize;
+    const VkDeviceSize handle_stride =
+        align_up(handle_size, rt_properties_.shaderGroupHandleAlignment);
+    const VkDeviceSize base_alignment = rt_properties_.shaderGroupBaseAlignment;
+
+    // The stride of the raygen region must be equal to its size.
+    rt_shader_binding_table_.raygen.stride =
+        align_up(handle_stride, base_alignment);
+    rt_shader_binding_table_.raygen.size =
+        rt_shader_binding_table_.raygen.stride;
+
+    rt_shader_binding_table_.miss.stride = handle_stride;
+    rt_shader_binding_table_.miss.size =
+        align_up(miss_group_count * handle_stride, base_alignment);
+
+    rt_shader_binding_table_.hit.stride = handle_stride;
+    rt_shader_binding_table_.hit.size =
+        align_up(hit_group_count * handle_stride, base_alignment);
+
+    rt_shader_binding_table_.callable = {};
+
+    const VkDeviceSize sbt_size = rt_shader_binding_table_.raygen.size +
+                                  rt_shader_binding_table_.miss.size +
+                                  rt_shader_binding_table_.hit.size;
 
-    if (!memory_.create_buffer(sbt_size, VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
-                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    // Recover shader handles.
+    //
+    std::vector<uint8_t> handles(group_count * handle_size);
+    static constexpr uint32_t first_group = 0;
+    VkResult res = vkGetRayTracingShaderGroupHandlesKHR(
+        device_, rt_pipeline_, first_group, group_count, handles.size(),
+        handles.data());
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to get shader group handles: " << res << std::endl;
+      return false;
+    }
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
+                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (!memory_.create_buffer(sbt_size, usage, properties,
                                rt_shader_binding_table_.buffer,
                                rt_shader_binding_table_.mem)) {
       std::cerr << "Failed to create ray tracing shader binding table buffer."
@@ -3482,27 +5733,46 @@ class render_engine {
       return false;
     }
 
-    // Recover shader handles and copy the to SBT buffer respecting
-    // shaderGroupHandleSize alingment.
+    const VkDeviceAddress sbt_address =
+        memory_.get_buffer_device_address(rt_shader_binding_table_.buffer);
+    rt_shader_binding_table_.raygen.deviceAddress = sbt_address;
+    rt_shader_binding_table_.miss.deviceAddress =
+        rt_shader_binding_table_.raygen.deviceAddress +
+        rt_shader_binding_table_.raygen.size;
+    rt_shader_binding_table_.hit.deviceAddress =
+        rt_shader_binding_table_.miss.deviceAddress +
+        rt_shader_binding_table_.miss.size;
+
+    // Copy the shader handles to the SBT buffer, each one at its region.
     //
     void *sbt_data;
     VkDeviceSize offset = 0;
     VkMemoryMapFlags flags = 0;
-    vkMapMemory(device_, rt_shader_binding_table_.mem, offset, sbt_size, flags,
-                &sbt_data);
-    for (uint32_t i = 0; i < rt_shader_groups_.size(); ++i) {
-      uint32_t first_group = i;
-      static constexpr uint32_t group_count = 1;
-      uint8_t *sbt_ptr = static_cast<uint8_t *>(sbt_data) +
-                         i * rt_properties_.shaderGroupHandleSize;
-      VkResult res = vkGetRayTracingShaderGroupHandlesNV(
-          device_, rt_pipeline_, first_group, group_count,
-          rt_properties_.shaderGroupHandleSize, static_cast<void *>(sbt_ptr));
-      if (VK_SUCCESS != res) {
-        std::cerr << "Failed to bind shader handle #" << i << " to SBT: " << res
-                  << std::endl;
-        return false;
-      }
+    res = vkMapMemory(device_, rt_shader_binding_table_.mem, offset, sbt_size,
+                      flags, &sbt_data);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to map shader binding table: " << res << std::endl;
+      return false;
+    }
+    uint8_t *sbt_ptr = static_cast<uint8_t *>(sbt_data);
+    const uint8_t *handle = handles.data();
+
+    // Raygen group.
+    memcpy(sbt_ptr, handle, handle_size);
+    handle += handle_size;
+    sbt_ptr += rt_shader_binding_table_.raygen.size;
+
+    // Miss groups.
+    for (uint32_t i = 0; i < miss_group_count; ++i) {
+      memcpy(sbt_ptr + i * handle_stride, handle, handle_size);
+      handle += handle_size;
+    }
+    sbt_ptr += rt_shader_binding_table_.miss.size;
+
+    // Hit groups.
+    for (uint32_t i = 0; i < hit_group_count; ++i) {
+      memcpy(sbt_ptr + i * handle_stride, handle, handle_size);
+      handle += handle_size;
     }
     vkUnmapMemory(device_, rt_shader_binding_table_.mem);
 
@@ -3518,24 +5788,98 @@ class render_engine {
     rt_shader_binding_table_.buffer = VK_NULL_HANDLE;
   }
 
-  void reset_ray_tracing_frame_counter() { rt_constants_.frame = -1; }
+  // Skin the animated objects at animation_time_ and refit their
+  // acceleration structures when they are in use, building them again every
+  // rt_rebuild_interval_ frames. Paused objects keep their last pose.
+  bool animate(VkCommandBuffer cmd_buf) {
+    rt_rebuilt_ = false;
+    if (!skinning_.enabled() || !animate_) {
+      return true;
+    }
+
+    gpu_timer_.begin(cmd_buf, current_frame_, timer_pass_animation);
+
+    skinning_.skin(cmd_buf, current_frame_, objects_, animation_time_,
+                   rtx_enabled_);
+
+    // Only built while ray tracing or tracing raster shadows.
+    if (rtx_.dynamic()) {
+      ++rt_refits_;
+      rt_rebuilt_ =
+          rt_rebuild_interval_ > 0 && rt_refits_ >= rt_rebuild_interval_;
+      if (rt_rebuilt_) {
+        rt_refits_ = 0;
+      }
+      if (!rtx_.refit(memory_, cmd_buf, rt_rebuilt_)) {
+        std::cerr << "Failed to refit acceleration structures." << std::endl;
+        return false;
+      }
+    }
 
-  void update_ray_tracing_frame_counter() {
-    rt_constants_.frame =
-        std::min(MAX_ACCUMULATED_FRAMES, rt_constants_.frame + 1);
+    gpu_timer_.end(cmd_buf, current_frame_, timer_pass_animation);
+
+    // Moving geometry invalidates the accumulated samples.
+    reset_ray_tracing_frame_counter();
+
+    return true;
   }
 
+  void reset_ray_tracing_frame_counter() { rt_constants_.frame = -1; }
+
+  // Pixels stop accumulating on their own once converged, see
+  // convergence.glsl.
+  void update_ray_tracing_frame_counter() { ++rt_constants_.frame; }
+
   void ray_trace(VkCommandBuffer cmd_buf) {
     update_ray_tracing_frame_counter();
 
-    if (rt_constants_.frame >= MAX_ACCUMULATED_FRAMES) {
+    // RT constants.
+    rt_constants_.clear_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    // rt_constants_.light_position = glm::vec3(-5.0f, 0.0f, -5.0f);
+    // rt_constants_.light_intensity = 1.0f;
+    // rt_constants_.light_type = 1;  // point = 0, directional = 1;
+
+    if (rt_constants_.frame > 0 &&
+        uniform_data_.data.previous_mvp != uniform_data_.data.mvp) {
+      save_ray_tracing_history(cmd_buf);
+    }
+
+    if (rt_constants_.temperature) {
+      rt_ray_counters_.clear(cmd_buf);
+    }
+
+    gpu_timer_.begin(cmd_buf, current_frame_, rt_renderer_);
+
+    if (rt_renderer_ == rt_renderer_wavefront) {
+      rt_wavefront_.trace(cmd_buf, current_frame_, rt_render_size_,
+                          rt_descriptor_set_, descriptor_set_[0],
+                          rt_constants_, RT_PUSH_CONSTANT_STAGES,
+                          rt_wavefront_sort_);
+
+      gpu_timer_.end(cmd_buf, current_frame_, rt_renderer_);
       return;
     }
 
+    if (rt_renderer_ == rt_renderer_hybrid) {
+      rt_hybrid_.render(cmd_buf, rt_render_size_, rt_descriptor_set_,
+                        descriptor_set_[0], rt_constants_,
+                        RT_PUSH_CONSTANT_STAGES, objects_, geometry_buf_,
+                        instance_buf_);
+
+      gpu_timer_.end(cmd_buf, current_frame_, rt_renderer_);
+      return;
+    }
+
+    const VkPipelineBindPoint bind_point =
+        rt_renderer_ == rt_renderer_ray_query
+            ? VK_PIPELINE_BIND_POINT_COMPUTE
+            : VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR;
+
     // Bind pipeline.
     //
-    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
-                      rt_pipeline_);
+    vkCmdBindPipeline(cmd_buf, bind_point,
+                      rt_renderer_ == rt_renderer_ray_query ? rq_pipeline_
+                                                            : rt_pipeline_);
 
     // Bind descriptor sets.
     //
@@ -3545,112 +5889,126 @@ class render_engine {
 
     // TODO: Move rt_descriptor_set_ to descriptor_set_[1].
     std::vector<VkDescriptorSet> sets({rt_descriptor_set_, descriptor_set_[0]});
-    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
-                            rt_pipeline_layout_, first_set,
-                            static_cast<uint32_t>(sets.size()), sets.data(),
-                            dynamic_offset_count, dynamic_offsets);
+    vkCmdBindDescriptorSets(cmd_buf, bind_point, rt_pipeline_layout_,
+                            first_set, static_cast<uint32_t>(sets.size()),
+                            sets.data(), dynamic_offset_count,
+                            dynamic_offsets);
 
     // Push constants.
     //
-    rt_constants_.clear_color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-    // rt_constants_.light_position = glm::vec3(-5.0f, 0.0f, -5.0f);
-    // rt_constants_.light_intensity = 1.0f;
-    // rt_constants_.light_type = 1;  // point = 0, directional = 1;
-
     uint32_t offset = 0;
-    vkCmdPushConstants(
-        cmd_buf, rt_pipeline_layout_,
-        VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV |
-            VK_SHADER_STAGE_MISS_BIT_NV,
-        offset, static_cast<uint32_t>(sizeof(rt_constants_)), &rt_constants_);
-
-    VkDeviceSize raygen_shader_binding_offset =
-        0 * rt_properties_.shaderGroupHandleSize;
-    VkDeviceSize miss_shader_binding_offset =
-        1 * rt_properties_.shaderGroupHandleSize;
-    // 2 miss shaders.
-    VkDeviceSize hit_shader_binding_offset =
-        3 * rt_properties_.shaderGroupHandleSize;
-
-    VkDeviceSize binding_stride = rt_properties_.shaderGroupHandleSize;
-
-    VkBuffer callable_sbt_buffer = VK_NULL_HANDLE;
-    VkDeviceSize callable_sb_offset = 0;
-    VkDeviceSize callable_sb_stride = 0;
+    vkCmdPushConstants(cmd_buf, rt_pipeline_layout_, RT_PUSH_CONSTANT_STAGES,
+                       offset, static_cast<uint32_t>(sizeof(rt_constants_)),
+                       &rt_constants_);
 
     uint32_t depth = 1;  // depth of the ray trace query dimensions.
 
-    vkCmdTraceRaysNV(
-        cmd_buf,
-        // raygen
-        rt_shader_binding_table_.buffer, raygen_shader_binding_offset,
-        // miss
-        rt_shader_binding_table_.buffer, miss_shader_binding_offset,
-        binding_stride,
-        // hit
-        rt_shader_binding_table_.buffer, hit_shader_binding_offset,
-        binding_stride,
-        // callable
-        callable_sbt_buffer, callable_sb_offset, callable_sb_stride,
-        // dimensions
-        window_size_.width, window_size_.height, depth);
-  }
-
-  void copy_ray_tracing_output_to_swap_chain(VkCommandBuffer cmd_buf,
-                                             VkImage swap_chain_image) {
-    // Copy ray tracing output image to swap chain image.
-    //
-
-    helpers::transition_image_layout(cmd_buf, swap_chain_image, format_,
-                                     VK_IMAGE_LAYOUT_UNDEFINED,
-                                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-    helpers::transition_image_layout(
-        cmd_buf, rt_storage_image_.image, rt_storage_image_.format,
-        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-    // VkImageSubresourceRange subresource_range{};
-    // subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    // subresource_range.baseMipLevel = 0;
-    // subresource_range.levelCount = 1;
-    // subresource_range.baseArrayLayer = 0;
-    // subresource_range.layerCount = 1;
+    if (rt_renderer_ == rt_renderer_ray_query) {
+      vkCmdDispatch(
+          cmd_buf,
+          (rt_render_size_.width + RQ_WORKGROUP_SIZE - 1) / RQ_WORKGROUP_SIZE,
+          (rt_render_size_.height + RQ_WORKGROUP_SIZE - 1) / RQ_WORKGROUP_SIZE,
+          depth);
+    } else {
+      vkCmdTraceRaysKHR(cmd_buf, &rt_shader_binding_table_.raygen,
+                        &rt_shader_binding_table_.miss,
+                        &rt_shader_binding_table_.hit,
+                        &rt_shader_binding_table_.callable,
+                        rt_render_size_.width, rt_render_size_.height, depth);
+    }
 
-    VkOffset3D offset_3d{};
-    offset_3d.x = 0;
-    offset_3d.y = 0;
-    offset_3d.z = 0;
+    gpu_timer_.end(cmd_buf, current_frame_, rt_renderer_);
+  }
 
-    VkExtent3D extent_3d{};
-    extent_3d.width = window_size_.width;
-    extent_3d.height = window_size_.height;
-    extent_3d.depth = 1;
+  // Copy the accumulation of the previous frame, that the ray tracers
+  // reproject after a camera move.
+  void save_ray_tracing_history(VkCommandBuffer cmd_buf) {
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd_buf,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier,
+                         0, nullptr, 0, nullptr);
+
+    const storage_image_t *sources[rt_history_count] = {
+        &rt_storage_image_, &rt_statistics_image_,
+        &rt_gbuffer_[rt_gbuffer_normal_depth]};
 
     VkImageCopy image_copy{};
     image_copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_copy.srcSubresource.mipLevel = 0;
-    image_copy.srcSubresource.baseArrayLayer = 0;
     image_copy.srcSubresource.layerCount = 1;
-    image_copy.srcOffset = offset_3d;
     image_copy.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_copy.dstSubresource.mipLevel = 0;
-    image_copy.dstSubresource.baseArrayLayer = 0;
     image_copy.dstSubresource.layerCount = 1;
-    image_copy.dstOffset = offset_3d;
-    image_copy.extent = extent_3d;
+    image_copy.extent.width = rt_render_size_.width;
+    image_copy.extent.height = rt_render_size_.height;
+    image_copy.extent.depth = 1;
+
+    static constexpr uint32_t region_count = 1;
+    for (uint32_t i = 0; i < rt_history_count; ++i) {
+      vkCmdCopyImage(cmd_buf, sources[i]->image, VK_IMAGE_LAYOUT_GENERAL,
+                     rt_history_[i].image, VK_IMAGE_LAYOUT_GENERAL,
+                     region_count, &image_copy);
+    }
+
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+  }
+
+  // Blit the ray tracing output to the swap chain image, with a linear filter
+  // when it is smaller than the window.
+  void blit_ray_tracing_output_to_swap_chain(
+      VkCommandBuffer cmd_buf, const storage_image_t &rt_output_image,
+      VkExtent2D rt_output_size, VkImage swap_chain_image) {
+    helpers::transition_image_layout(cmd_buf, swap_chain_image, format_,
+                                     VK_IMAGE_LAYOUT_UNDEFINED,
+                                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    helpers::transition_image_layout(
+        cmd_buf, rt_output_image.image, rt_output_image.format,
+        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
-    uint32_t region_count = 1;
-    vkCmdCopyImage(cmd_buf, rt_storage_image_.image,
+    VkImageBlit image_blit{};
+    image_blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_blit.srcSubresource.mipLevel = 0;
+    image_blit.srcSubresource.baseArrayLayer = 0;
+    image_blit.srcSubresource.layerCount = 1;
+    image_blit.srcOffsets[1].x = static_cast<int32_t>(rt_output_size.width);
+    image_blit.srcOffsets[1].y = static_cast<int32_t>(rt_output_size.height);
+    image_blit.srcOffsets[1].z = 1;
+    image_blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_blit.dstSubresource.mipLevel = 0;
+    image_blit.dstSubresource.baseArrayLayer = 0;
+    image_blit.dstSubresource.layerCount = 1;
+    image_blit.dstOffsets[1].x = static_cast<int32_t>(window_size_.width);
+    image_blit.dstOffsets[1].y = static_cast<int32_t>(window_size_.height);
+    image_blit.dstOffsets[1].z = 1;
+
+    const bool scaled = rt_output_size.width != window_size_.width ||
+                        rt_output_size.height != window_size_.height;
+
+    static constexpr uint32_t region_count = 1;
+    vkCmdBlitImage(cmd_buf, rt_output_image.image,
                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swap_chain_image,
                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, region_count,
-                   &image_copy);
+                   &image_blit,
+                   scaled ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
 
     helpers::transition_image_layout(cmd_buf, swap_chain_image, format_,
                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
 
     helpers::transition_image_layout(
-        cmd_buf, rt_storage_image_.image, rt_storage_image_.format,
+        cmd_buf, rt_output_image.image, rt_output_image.format,
         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
   }
 
@@ -3659,6 +6017,13 @@ class render_engine {
     rt_descriptor_pool_.fini(memory_);
     fini_ray_tracing_descriptor_layout();
     fini_ray_tracing_storage_image();
+    rt_wavefront_.fini(memory_);
+    rt_hybrid_.fini(memory_);
+    rt_denoiser_.fini(memory_);
+    rt_upscaler_.fini(memory_);
+    rt_ray_counters_.fini(memory_);
+    fini_raster_shadow_pipeline();
+    fini_ray_query_pipeline();
     fini_ray_tracing_pipeline();
     fini_ray_tracing_shader_binding_table();
   }
@@ -3672,6 +6037,7 @@ class render_engine {
   std::vector<VkPhysicalDevice> gpus_;
   std::vector<VkQueueFamilyProperties> queue_props_;
   VkPhysicalDeviceMemoryProperties memory_properties_;
+  bool memory_budget_supported_;  // VK_EXT_memory_budget.
   VkDevice device_;
   memory memory_;
   VkQueue graphics_queue_;
@@ -3689,13 +6055,28 @@ class render_engine {
   std::vector<swap_chain_buffer_t> buffers_;
   uint32_t current_buffer_;
 
+  // Pool of the single time commands and of the pre-recorded raster draws.
   VkCommandPool command_pool_;
+
+  // Per frame in flight, reset as a whole once the frame fence is signaled.
+  // The primary command buffers and the Dear ImGui secondary ones are
+  // recorded every frame.
+  std::vector<VkCommandPool> frame_command_pools_;
   std::vector<VkCommandBuffer> command_buffers_;
+  std::vector<VkCommandBuffer> imgui_command_buffers_;
+
+  // Raster draw of the objects, per frame in flight. Recorded again only when
+  // the levels of detail change or it is invalidated.
+  struct raster_commands_t {
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    bool valid = false;
+    std::vector<uint32_t> lods;  // Level of detail drawn of each object.
+  };
+  std::vector<raster_commands_t> raster_commands_;
 
   std::vector<VkSemaphore> image_acquire_semaphores_;
   std::vector<VkSemaphore> render_finished_semaphores_;
   std::vector<VkFence> in_flight_fences_;
-  std::vector<VkFence> images_in_flight_;
   uint32_t current_frame_;
 
   depth_buffer_t depth_buffer_;
@@ -3712,14 +6093,77 @@ class render_engine {
 
   uniform_data_t uniform_data_;
 
+  // Decoded texture, before its upload.
+  struct texture_data_t {
+    int width = 0;
+    int height = 0;
+    std::vector<stbi_uc> pixels;  // RGBA.
+  };
+
   VkImage texture_image_;
   VkDeviceMemory texture_image_memory_;
   VkImageView texture_image_view_;
   VkSampler texture_sampler_;
 
+  // Scene models and texture loading in the background while frames are
+  // drawn, see start_scene_load() and stream_scene(). Futures refer to the
+  // other members, that are sized before they are launched.
+  struct scene_stream_t {
+    bool active = false;
+    scene_t scene;
+    // Instances of each scene model, none when the model is not loaded.
+    std::vector<std::vector<glm::mat4>> transforms;
+    std::vector<std::vector<material_t>> materials;
+    std::vector<object_model_t> objects;
+    std::vector<gltf_model_t> gltf_models;
+    std::vector<bool> gltf;
+    std::vector<std::future<bool>> models_loaded;
+    std::vector<std::promise<bool>> model_results;
+    std::vector<std::future<void>> workers;  // Set models_loaded.
+    std::vector<bool> added;
+    size_t model_count = 0;  // Models with instances.
+    size_t models_added = 0;
+    size_t models_failed = 0;  // Logged and skipped.
+    int texture = -1;       // Scene texture.
+    int gltf_texture = -1;  // glTF model whose image is bound.
+    texture_data_t texture_data;
+    std::future<bool> texture_loaded;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last_upload;
+  };
+
+  std::string scene_name_;
+  scene_stream_t scene_stream_;
+  std::chrono::steady_clock::time_point init_start_;
+  double scene_load_milliseconds_;  // Wall time, models and textures.
+  double first_frame_milliseconds_;  // Wall time from init().
   std::vector<object_model_t> objects_;
   std::vector<object_instance_t> objects_instances_;
 
+  // Vertices and indices of all the objects, at their offsets. Objects
+  // are appended, see append_geometry().
+  VkBuffer geometry_buf_;
+  VkDeviceMemory geometry_mem_;
+  VkDeviceSize geometry_size_;      // Used, up to the last object.
+  VkDeviceSize geometry_capacity_;  // Size of the buffer.
+  size_t geometry_object_count_;    // Objects in the buffer, the first ones.
+
+  // Per instance attributes of all the objects, see RasterInstance.
+  VkBuffer instance_buf_;
+  VkDeviceMemory instance_mem_;
+
+  // Skinned objects, posed at animation_time_ while animate_.
+  skinning skinning_;
+  bool animate_;
+  float animation_time_;  // Seconds.
+
+  // Level of detail selection.
+  //
+  int forced_lod_;          // Level used by the raster path, -1 for auto.
+  float lod_pixel_error_;   // Maximum simplification error on screen.
+  uint32_t current_lod_;    // Level drawn on the last frame.
+  float lod_frame_time_[constants::MAX_LODS];  // Average ms/frame per level.
+
   camera camera_;
 
   std::vector<layer_properties_t> instance_layer_properties_;
@@ -3747,20 +6191,117 @@ class render_engine {
   //
   bool rtx_enabled_;
   ray_tracer rtx_;
-  VkPhysicalDeviceRayTracingPropertiesNV rt_properties_;
+  VkPhysicalDeviceRayTracingPipelinePropertiesKHR rt_properties_;
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR rt_as_properties_;
   rt_descriptor_pool rt_descriptor_pool_;
   VkDescriptorSet rt_descriptor_set_;
   VkDescriptorSetLayout rt_descriptor_layout_;
   storage_image_t rt_storage_image_;
+  storage_image_t rt_statistics_image_;
+  // G-buffer of the camera rays, written by the ray tracers for the denoiser
+  // and the upscaler.
+  enum rt_gbuffer {
+    rt_gbuffer_normal_depth = 0,  // World normal and hit distance.
+    rt_gbuffer_albedo = 1,
+    rt_gbuffer_motion = 2,  // Pixels to the hit on the previous frame.
+    rt_gbuffer_sample = 3,  // Samples of this frame, not accumulated.
+    rt_gbuffer_count = 4
+  };
+  storage_image_t rt_gbuffer_[rt_gbuffer_count];
+  static constexpr uint32_t RT_GBUFFER_BINDING = 5;  // First binding.
+  // Copy of the accumulation when the camera moves, see reprojection.glsl.
+  enum rt_history {
+    rt_history_image = 0,
+    rt_history_statistics = 1,
+    rt_history_normal_depth = 2,
+    rt_history_count = 3
+  };
+  storage_image_t rt_history_[rt_history_count];
+  static constexpr uint32_t RT_HISTORY_BINDING = 9;  // First binding.
   ray_tracing_constants_t rt_constants_;
   std::vector<VkPipelineShaderStageCreateInfo> rt_shader_groups_;
   VkPipeline rt_pipeline_;
   VkPipelineLayout rt_pipeline_layout_;
   shader_binding_table_t rt_shader_binding_table_;
-  static constexpr int MAX_ACCUMULATED_FRAMES = 1000;
+  uint32_t rt_secondary_lod_;  // Level of detail for shadow and bounce rays.
+  bool rt_prefer_fast_build_;  // Trade trace performance for build time.
+
+  // Instance clusters culling, see instance_clusters.h.
+  bool rt_cluster_culling_;
+  int rt_instance_budget_;      // Instances in the TLAS, at most.
+  float rt_cluster_distance_;   // Clusters closer are kept out of view too.
+  double rt_build_milliseconds_;  // Wall time of the last build.
+  int rt_scratch_budget_;  // MiB of scratch of the concurrent BLAS builds.
+  // Acceleration structures of skinned objects are refit every frame, and
+  // built again every rt_rebuild_interval_ frames, never when 0.
+  int rt_rebuild_interval_;
+  int rt_refits_;    // Since the last build.
+  bool rt_rebuilt_;  // Whether the last animated frame built them again.
+  // Ray query renderer. Compute shader with inline ray tracing that shares
+  // the descriptor sets and pipeline layout of the ray tracing pipeline.
+  VkPipelineShaderStageCreateInfo rq_shader_stage_;
+  VkPipeline rq_pipeline_;
+  // Rasterizer with ray traced shadows. The raster pipeline with a fragment
+  // shader that traces a shadow ray per fragment with a ray query, created
+  // with the ray tracing descriptor set that holds the TLAS.
+  bool raster_shadows_;
+  VkPipelineShaderStageCreateInfo raster_shadow_shader_stages_[2];
+  VkPipelineLayout raster_shadow_pipeline_layout_;
+  VkPipeline raster_shadow_pipeline_;
+  static constexpr uint32_t RQ_WORKGROUP_SIZE = 8;  // Same as raytrace.comp.
+  enum rt_renderer {
+    rt_renderer_pipeline = 0,   // VK_KHR_ray_tracing_pipeline.
+    rt_renderer_ray_query = 1,  // VK_KHR_ray_query from compute.
+    rt_renderer_wavefront = 2,  // VK_KHR_ray_query, one dispatch per bounce.
+    rt_renderer_hybrid = 3,     // Rasterized visibility, then ray queries.
+    rt_renderer_count = 4
+  };
+  // GPU timer passes: one per ray tracer, then the rasterizer, then the
+  // skinning and refits of the animated objects.
+  static constexpr uint32_t timer_pass_raster = rt_renderer_count;
+  static constexpr uint32_t timer_pass_animation = rt_renderer_count + 1;
+  static constexpr uint32_t timer_pass_count = rt_renderer_count + 2;
+  static const char *timer_pass_name(uint32_t pass) {
+    if (timer_pass_raster == pass) {
+      return "raster";
+    }
+    if (timer_pass_animation == pass) {
+      return "animation";
+    }
+    return renderer_name(static_cast<int>(pass));
+  }
+  rt_renderer rt_renderer_;
+  bool rt_renderer_ab_;  // Alternate renderers each frame to compare them.
+  wavefront_path_tracer rt_wavefront_;
+  bool rt_wavefront_sort_;  // Sort rays by material and direction.
+  hybrid_renderer rt_hybrid_;
+  denoiser rt_denoiser_;
+  bool rt_denoise_;
+  int rt_denoiser_iterations_;  // A-trous filter iterations.
+  upscaler rt_upscaler_;
+  upscaler::mode rt_upscaler_mode_;
+  int rt_render_scale_;        // Percentage of the window size traced.
+  VkExtent2D rt_render_size_;  // Size of the ray tracing images.
+  frame_time_controller rt_frame_time_controller_;
+  bool rt_frame_time_budget_;  // Render scale, samples and depth are chosen.
+  int rt_target_fps_;
+  ray_counters rt_ray_counters_;
+  ray_counters::counter rt_heatmap_;  // Counter of the pixel temperature.
+  static constexpr uint32_t RT_COUNTERS_BINDING = 12;
+  // Stages that use the RT constants.
+  static constexpr VkShaderStageFlags RT_PUSH_CONSTANT_STAGES =
+      VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_MISS_BIT_KHR |
+      VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_COMPUTE_BIT;
+  gpu_timer gpu_timer_;  // One pass per renderer, raster and animation.
+  static constexpr uint32_t RT_MAX_RECURSION_DEPTH = 2;  // Normal + shadow.
+  // Serialized static BLASes, see acceleration_structure_cache.h.
+  static constexpr const char *RT_CACHE_DIRECTORY = "assets/cache";
   //
   // End of Ray Tracing stuff.
 
+  // CPU time of recording and submitting the last frame.
+  double frame_cpu_milliseconds_;
+
   static bool init_global_extension_properties(
       layer_properties_t &layer_properties) {
     char *layer_name = layer_properties.properties.layerName;
@@ -3799,17 +6340,49 @@ class render_engine {
     return supported_features.samplerAnisotropy;
   }
 
-  bool create_texture_image(const std::string &texture_path) {
-    int texture_width, texture_height, texture_channels;
+  // RGBA pixels of a texture. Touches no Vulkan nor engine state, so that
+  // textures decode concurrently.
+  static bool decode_texture(const std::string &texture_path,
+                             texture_data_t &texture) {
+    int texture_channels;
     stbi_uc *pixels =
-        stbi_load(texture_path.c_str(), &texture_width, &texture_height,
+        stbi_load(texture_path.c_str(), &texture.width, &texture.height,
                   &texture_channels, STBI_rgb_alpha);
     if (!pixels) {
-      std::cerr << "Failed to load texture." << std::endl;
+      std::cerr << "Failed to load texture " << texture_path << "."
+                << std::endl;
       return false;
     }
 
-    VkDeviceSize image_size = texture_width * texture_height * 4;
+    texture.pixels.assign(pixels, pixels + texture.width * texture.height * 4);
+    stbi_image_free(pixels);
+
+    return true;
+  }
+
+  // RGBA pixels of an encoded image, as embedded in glTF models.
+  static bool decode_embedded_texture(const std::vector<uint8_t> &encoded,
+                                      texture_data_t &texture) {
+    int texture_channels;
+    stbi_uc *pixels = stbi_load_from_memory(
+        encoded.data(), static_cast<int>(encoded.size()), &texture.width,
+        &texture.height, &texture_channels, STBI_rgb_alpha);
+    if (!pixels) {
+      std::cerr << "Failed to decode embedded texture: "
+                << stbi_failure_reason() << "." << std::endl;
+      return false;
+    }
+
+    texture.pixels.assign(pixels, pixels + texture.width * texture.height * 4);
+    stbi_image_free(pixels);
+
+    return true;
+  }
+
+  bool create_texture_image(const texture_data_t &texture) {
+    const int texture_width = texture.width;
+    const int texture_height = texture.height;
+    VkDeviceSize image_size = texture.pixels.size();
     VkBuffer staging_buffer;
     VkDeviceMemory staging_buffer_memory;
     VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
@@ -3817,13 +6390,11 @@ class render_engine {
                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     if (!memory_.create_buffer_and_copy(image_size, usage, properties,
                                         staging_buffer, staging_buffer_memory,
-                                        pixels)) {
+                                        texture.pixels.data())) {
       std::cerr << "Failed to create texture buffer." << std::endl;
       return false;
     }
 
-    stbi_image_free(pixels);
-
     // VkFormat texture_format = VK_FORMAT_R8G8B8A8_SRGB;
     VkFormat texture_format = VK_FORMAT_R8G8B8A8_UNORM;
 
@@ -3895,8 +6466,8 @@ class render_engine {
     texture_image_view_ = VK_NULL_HANDLE;
   }
 
-  bool load_texture(const std::string &texture_path) {
-    if (!create_texture_image(texture_path)) {
+  bool load_texture(const texture_data_t &texture) {
+    if (!create_texture_image(texture)) {
       std::cerr << "create_texture_image() failed." << std::endl;
       return false;
     }
@@ -3949,7 +6520,7 @@ class render_engine {
     texture_sampler_ = VK_NULL_HANDLE;
   }
 
-  void init_viewports() {
+  void init_viewports(VkCommandBuffer cmd_buf) {
     VkExtent2D window_size = platform_.window_size();
     viewport_.height = window_size.height;
     viewport_.width = window_size.width;
@@ -3959,11 +6530,11 @@ class render_engine {
     viewport_.y = 0;
 
     static constexpr uint32_t first_viewport = 0;
-    vkCmdSetViewport(command_buffers_[current_buffer_], first_viewport,
+    vkCmdSetViewport(cmd_buf, first_viewport,
                      constants::NUM_VIEWPORTS_AND_SCISSORS, &viewport_);
   }
 
-  void init_scissors() {
+  void init_scissors(VkCommandBuffer cmd_buf) {
     VkExtent2D window_size = platform_.window_size();
     scissor_.extent.height = window_size.height;
     scissor_.extent.width = window_size.width;
@@ -3971,7 +6542,7 @@ class render_engine {
     scissor_.offset.y = 0;
 
     static constexpr uint32_t first_scissor = 0;
-    vkCmdSetScissor(command_buffers_[current_buffer_], first_scissor,
+    vkCmdSetScissor(cmd_buf, first_scissor,
                     constants::NUM_VIEWPORTS_AND_SCISSORS, &scissor_);
   }
 
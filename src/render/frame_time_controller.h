@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+
+namespace rtx {
+
+// Chooses the render scale, samples per pixel and ray depth that hold the ray
+// tracing GPU time of a frame within a budget.
+//
+// A PI controller on the relative error of the measured time decides when to
+// lower or raise the quality, one step at a time. Quality is lowered first
+// on the samples, whose loss accumulation recovers, then on the render scale,
+// that the upscaler recovers, and last on the depth, that biases the image.
+// It is raised in the opposite order, only when the step is expected to fit
+// the budget, so that it does not oscillate between two steps.
+class frame_time_controller {
+ public:
+  struct settings_t {
+    int render_scale;  // Percentage of the window size.
+    int samples;
+    int max_iterations;
+
+    bool operator!=(const settings_t &other) const {
+      return render_scale != other.render_scale || samples != other.samples ||
+             max_iterations != other.max_iterations;
+    }
+  };
+
+  static constexpr int MIN_RENDER_SCALE = 50;
+  static constexpr int RENDER_SCALE_STEP = 10;
+  static constexpr int MIN_MAX_ITERATIONS = 2;  // One bounce.
+
+  frame_time_controller() : settings_(), integral_(0.0f), cooldown_(0) {}
+
+  // Start from the highest quality allowed.
+  void reset(const settings_t &limits) {
+    settings_ = limits;
+    integral_ = 0.0f;
+    cooldown_ = COOLDOWN_FRAMES;
+  }
+
+  // Feed the averaged GPU time of the last frames. The limits are the highest
+  // quality allowed. Returns whether the settings changed.
+  bool update(float milliseconds, float target_milliseconds,
+              const settings_t &limits) {
+    const settings_t previous = settings_;
+
+    // Lowered limits apply right away.
+    settings_.render_scale =
+        std::min(settings_.render_scale, limits.render_scale);
+    settings_.samples = std::min(settings_.samples, limits.samples);
+    settings_.max_iterations =
+        std::min(settings_.max_iterations, limits.max_iterations);
+
+    // Wait for the averaged time to reflect the last change.
+    if (cooldown_ > 0) {
+      --cooldown_;
+      return settings_ != previous;
+    }
+
+    if (milliseconds <= 0.0f || target_milliseconds <= 0.0f) {
+      return settings_ != previous;
+    }
+
+    // Positive while there is time left.
+    const float error =
+        (target_milliseconds - milliseconds) / target_milliseconds;
+    integral_ =
+        std::max(-MAX_INTEGRAL, std::min(integral_ + error, MAX_INTEGRAL));
+    const float output = KP * error + KI * integral_;
+
+    bool stepped = false;
+    if (output < -HYSTERESIS) {
+      stepped = lower();
+    } else if (output > HYSTERESIS) {
+      stepped = raise(milliseconds, target_milliseconds, limits);
+    }
+
+    if (stepped) {
+      integral_ = 0.0f;
+      cooldown_ = COOLDOWN_FRAMES;
+    }
+
+    return settings_ != previous;
+  }
+
+  const settings_t &settings() const { return settings_; }
+
+ private:
+  static constexpr float KP = 1.0f;
+  static constexpr float KI = 0.05f;
+  static constexpr float MAX_INTEGRAL = 20.0f;
+
+  // Dead band of the controller output around the target.
+  static constexpr float HYSTERESIS = 0.1f;
+
+  // Frames for the averaged GPU time to settle after a change.
+  static constexpr int COOLDOWN_FRAMES = 30;
+
+  bool lower() {
+    if (settings_.samples > 1) {
+      settings_.samples /= 2;
+      return true;
+    }
+    if (settings_.render_scale > MIN_RENDER_SCALE) {
+      settings_.render_scale = std::max(
+          MIN_RENDER_SCALE, settings_.render_scale - RENDER_SCALE_STEP);
+      return true;
+    }
+    if (settings_.max_iterations > MIN_MAX_ITERATIONS) {
+      --settings_.max_iterations;
+      return true;
+    }
+    return false;
+  }
+
+  // Raise one step if its estimated time, proportional to the traced rays,
+  // fits the budget with the hysteresis margin.
+  bool raise(float milliseconds, float target_milliseconds,
+             const settings_t &limits) {
+    const float budget = target_milliseconds * (1.0f - HYSTERESIS);
+
+    settings_t next = settings_;
+    float cost = 1.0f;
+    if (settings_.max_iterations < limits.max_iterations) {
+      // Upper bound, paths may end before.
+      next.max_iterations = settings_.max_iterations + 1;
+      cost = static_cast<float>(next.max_iterations) /
+             static_cast<float>(settings_.max_iterations);
+    } else if (settings_.render_scale < limits.render_scale) {
+      next.render_scale = std::min(limits.render_scale,
+                                   settings_.render_scale + RENDER_SCALE_STEP);
+      const float ratio = static_cast<float>(next.render_scale) /
+                          static_cast<float>(settings_.render_scale);
+      cost = ratio * ratio;
+    } else if (settings_.samples < limits.samples) {
+      next.samples = std::min(limits.samples, settings_.samples * 2);
+      cost = static_cast<float>(next.samples) /
+             static_cast<float>(settings_.samples);
+    } else {
+      return false;
+    }
+
+    if (milliseconds * cost > budget) {
+      return false;
+    }
+
+    settings_ = next;
+    return true;
+  }
+
+  settings_t settings_;
+  float integral_;  // Of the relative error, in frames.
+  int cooldown_;    // Frames left before the next step.
+};
+
+}  // namespace rtx
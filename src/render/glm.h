@@ -7,4 +7,7 @@
 // perspective, translate, rotate.
 #include <glm/gtc/matrix_transform.hpp>
 
+// quat, slerp, mat4_cast, angleAxis.
+#include <glm/gtc/quaternion.hpp>
+
 #include <glm/gtx/hash.hpp>
@@ -0,0 +1,1289 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "glm.h"
+#include "json.h"
+#include "mapped_file.h"
+#include "mesh_simplifier.h"
+#include "object.h"
+#include "skin.h"
+#include "vertex.h"
+#include "vertex_normals.h"
+
+namespace rtx {
+
+// Placement of a mesh of a glTF model by a node of its scene.
+struct gltf_instance_t {
+  uint32_t mesh = 0;  // Index in the meshes of the model.
+  glm::mat4 transform = glm::mat4(1.0f);
+  material_t material;
+};
+
+struct gltf_model_t {
+  // One object per triangle primitive of the glTF meshes, with its levels of
+  // detail, bounds and skin.
+  std::vector<object_model_t> meshes;
+  std::vector<gltf_instance_t> instances;
+
+  // Base color image of the textured meshes, either a file or the encoded
+  // bytes of an image embedded in the model. Both empty if untextured.
+  std::string image_path;
+  std::vector<uint8_t> image_data;
+};
+
+// Loader of glTF 2.0 models, .gltf with external or embedded buffers, or
+// binary .glb.
+//
+// Model files and external buffers are memory mapped, and accessors are
+// decoded straight from the mapped bytes into the vertices and indices of the
+// objects. Vertex buffers interleaved exactly like Vertex are copied whole.
+// Primitives are decoded, and their levels of detail generated, on a pool of
+// threads.
+//
+// The node hierarchy of the default scene becomes instances. Materials map
+// their base color to the diffuse color, and metals reflect. Skins and their
+// animations become the skin of the objects, cubic spline keys keep their
+// values only. Morph targets, cameras and lights are ignored.
+class gltf_loader {
+ public:
+  static bool is_gltf(const std::string &path) {
+    std::string extension;
+    const size_t dot = path.find_last_of('.');
+    if (std::string::npos != dot) {
+      extension = path.substr(dot);
+    }
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return ".gltf" == extension || ".glb" == extension;
+  }
+
+  // Touches no Vulkan nor engine state, so that models load concurrently.
+  static bool load(const std::string &path, gltf_model_t &model) {
+    gltf_loader loader(path);
+    if (!loader.read(model)) {
+      std::cerr << "Failed to load glTF model " << path << "." << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  static constexpr uint32_t GLB_MAGIC = 0x46546C67;  // glTF
+  static constexpr uint32_t GLB_VERSION = 2;
+  static constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+  static constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+  static constexpr uint32_t COMPONENT_BYTE = 5120;
+  static constexpr uint32_t COMPONENT_UNSIGNED_BYTE = 5121;
+  static constexpr uint32_t COMPONENT_SHORT = 5122;
+  static constexpr uint32_t COMPONENT_UNSIGNED_SHORT = 5123;
+  static constexpr uint32_t COMPONENT_UNSIGNED_INT = 5125;
+  static constexpr uint32_t COMPONENT_FLOAT = 5126;
+
+  static constexpr int64_t MODE_TRIANGLES = 4;
+
+  struct buffer_t {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+  };
+
+  struct view_t {
+    size_t buffer = 0;
+    size_t offset = 0;
+    size_t size = 0;
+    size_t stride = 0;  // 0 if tightly packed.
+  };
+
+  struct accessor_t {
+    const uint8_t *data = nullptr;  // First element, null if all zeros.
+    int64_t view = -1;
+    size_t offset = 0;  // Of the first element in its view.
+    size_t stride = 0;
+    size_t count = 0;
+    uint32_t component_type = 0;
+    uint32_t components = 0;
+    bool normalized = false;
+  };
+
+  struct material_data_t {
+    material_t material;
+    bool textured = false;  // Samples the image of the model.
+  };
+
+  struct node_t {
+    int64_t parent = -1;
+    std::vector<int64_t> children;
+    int64_t mesh = -1;
+    int64_t skin = -1;
+    joint_transform_t local;
+    glm::mat4 world = glm::mat4(1.0f);
+    int depth = -1;  // In the hierarchy, -1 if unreachable.
+  };
+
+  // Skeleton and clips of a glTF skin, in joint order of skin_t.
+  struct skin_data_t {
+    skin_t skeleton;  // Without vertices.
+    std::vector<uint32_t> joint_of_index;  // Of the glTF joint indices.
+    glm::mat4 transform = glm::mat4(1.0f);  // Of the skeleton root.
+  };
+
+  explicit gltf_loader(const std::string &path)
+      : path_(path),
+        directory_(directory(path)),
+        file_(),
+        external_files_(),
+        decoded_buffers_(),
+        document_(),
+        buffers_(),
+        views_(),
+        accessors_(),
+        materials_(),
+        image_(-1),
+        nodes_(),
+        mesh_objects_(),
+        object_materials_(),
+        skins_() {}
+
+  bool read(gltf_model_t &model) {
+    if (!file_.open(path_)) {
+      return false;
+    }
+
+    std::string json_text;
+    buffer_t binary_chunk;
+    if (file_.size() >= 12 && GLB_MAGIC == read_u32(file_.data())) {
+      if (!read_glb(json_text, binary_chunk)) {
+        return false;
+      }
+    } else {
+      json_text.assign(reinterpret_cast<const char *>(file_.data()),
+                       file_.size());
+    }
+
+    std::string error;
+    if (!json_value::parse(json_text, document_, error)) {
+      std::cerr << "Failed to parse " << path_ << ": " << error << "."
+                << std::endl;
+      return false;
+    }
+    if (!document_.is_object()) {
+      std::cerr << path_ << " is not a JSON object." << std::endl;
+      return false;
+    }
+
+    const json_value *asset = document_.find("asset");
+    const json_value *version = asset ? asset->find("version") : nullptr;
+    if (!version || !version->is_string() ||
+        0 != version->string().compare(0, 2, "2.")) {
+      std::cerr << path_ << " is not a glTF 2.0 model." << std::endl;
+      return false;
+    }
+    const std::vector<json_value> &required =
+        array(document_, "extensionsRequired");
+    if (!required.empty()) {
+      std::cerr << path_ << " requires the unsupported extension "
+                << required[0].string() << "." << std::endl;
+      return false;
+    }
+
+    if (!read_buffers(binary_chunk) || !read_views() || !read_accessors() ||
+        !read_materials() || !read_image(model) || !read_nodes() ||
+        !read_meshes(model) || !read_skins() || !instance_nodes(model)) {
+      return false;
+    }
+
+    size_t vertex_count = 0;
+    size_t index_count = 0;
+    for (const object_model_t &object : model.meshes) {
+      vertex_count += object.vertices.size();
+      index_count += object.indices.size();
+    }
+
+    // A single write, models load concurrently.
+    std::ostringstream log;
+    log << "Loaded glTF model " << path_ << ": " << model.meshes.size()
+        << " meshes, " << model.instances.size() << " instances, "
+        << vertex_count << " vertices and " << index_count << " indices."
+        << std::endl;
+    std::cout << log.str() << std::flush;
+
+    return true;
+  }
+
+  // Header, JSON chunk and optional binary chunk.
+  bool read_glb(std::string &json_text, buffer_t &binary_chunk) const {
+    const uint8_t *data = file_.data();
+    const size_t size = file_.size();
+    const uint32_t version = read_u32(data + 4);
+    const size_t length = std::min<size_t>(read_u32(data + 8), size);
+    if (GLB_VERSION != version) {
+      std::cerr << path_ << " is a GLB file of version " << version << "."
+                << std::endl;
+      return false;
+    }
+
+    size_t offset = 12;
+    bool has_json = false;
+    while (offset + 8 <= length) {
+      const size_t chunk_size = read_u32(data + offset);
+      const uint32_t chunk_type = read_u32(data + offset + 4);
+      offset += 8;
+      if (chunk_size > length - offset) {
+        std::cerr << path_ << " is truncated." << std::endl;
+        return false;
+      }
+      if (GLB_CHUNK_JSON == chunk_type && !has_json) {
+        json_text.assign(reinterpret_cast<const char *>(data + offset),
+                         chunk_size);
+        has_json = true;
+      } else if (GLB_CHUNK_BIN == chunk_type && !binary_chunk.data) {
+        binary_chunk.data = data + offset;
+        binary_chunk.size = chunk_size;
+      }
+      // Chunks are 4 byte aligned.
+      offset += (chunk_size + 3) & ~size_t(3);
+    }
+
+    if (!has_json) {
+      std::cerr << path_ << " has no JSON chunk." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Buffers without uri are the binary chunk of a GLB file. Others are
+  // mapped files, or base64 data URIs.
+  bool read_buffers(const buffer_t &binary_chunk) {
+    for (const json_value &buffer : array(document_, "buffers")) {
+      const int64_t byte_length = integer(buffer, "byteLength", -1);
+      const json_value *uri = buffer.find("uri");
+      buffer_t span;
+      if (!uri) {
+        span = binary_chunk;
+      } else if (!uri->is_string()) {
+        std::cerr << "Invalid buffer uri in " << path_ << "." << std::endl;
+        return false;
+      } else if (0 == uri->string().compare(0, 5, "data:")) {
+        decoded_buffers_.emplace_back();
+        if (!decode_data_uri(uri->string(), decoded_buffers_.back())) {
+          return false;
+        }
+        span.data = decoded_buffers_.back().data();
+        span.size = decoded_buffers_.back().size();
+      } else {
+        external_files_.emplace_back(new mapped_file());
+        mapped_file &file = *external_files_.back();
+        if (!file.open(directory_ + decode_uri(uri->string()))) {
+          return false;
+        }
+        span.data = file.data();
+        span.size = file.size();
+      }
+
+      if (byte_length < 0 || span.size < static_cast<size_t>(byte_length)) {
+        std::cerr << "Buffer " << buffers_.size() << " of " << path_
+                  << " is shorter than its byteLength." << std::endl;
+        return false;
+      }
+      span.size = static_cast<size_t>(byte_length);
+      buffers_.push_back(span);
+    }
+
+    return true;
+  }
+
+  bool read_views() {
+    for (const json_value &view_json : array(document_, "bufferViews")) {
+      const int64_t buffer = integer(view_json, "buffer", -1);
+      const int64_t offset = integer(view_json, "byteOffset", 0);
+      const int64_t size = integer(view_json, "byteLength", -1);
+      const int64_t stride = integer(view_json, "byteStride", 0);
+      if (buffer < 0 || static_cast<size_t>(buffer) >= buffers_.size() ||
+          offset < 0 || size < 0 || stride < 0 ||
+          static_cast<size_t>(offset + size) > buffers_[buffer].size) {
+        std::cerr << "Invalid buffer view " << views_.size() << " in "
+                  << path_ << "." << std::endl;
+        return false;
+      }
+
+      view_t view;
+      view.buffer = static_cast<size_t>(buffer);
+      view.offset = static_cast<size_t>(offset);
+      view.size = static_cast<size_t>(size);
+      view.stride = static_cast<size_t>(stride);
+      views_.push_back(view);
+    }
+
+    return true;
+  }
+
+  bool read_accessors() {
+    for (const json_value &accessor_json : array(document_, "accessors")) {
+      accessor_t accessor;
+      accessor.view = integer(accessor_json, "bufferView", -1);
+      const int64_t offset = integer(accessor_json, "byteOffset", 0);
+      const int64_t count = integer(accessor_json, "count", -1);
+      accessor.component_type = static_cast<uint32_t>(
+          integer(accessor_json, "componentType", 0));
+      accessor.components = component_count(accessor_json);
+      if (const json_value *normalized = accessor_json.find("normalized")) {
+        accessor.normalized = normalized->boolean();
+      }
+
+      const size_t component_size = component_bytes(accessor.component_type);
+      if (offset < 0 || count < 0 || 0 == component_size ||
+          0 == accessor.components ||
+          accessor.view >= static_cast<int64_t>(views_.size())) {
+        std::cerr << "Invalid accessor " << accessors_.size() << " in "
+                  << path_ << "." << std::endl;
+        return false;
+      }
+      if (accessor_json.find("sparse")) {
+        std::cerr << "Sparse accessor " << accessors_.size() << " of "
+                  << path_ << " is not supported." << std::endl;
+        return false;
+      }
+
+      accessor.offset = static_cast<size_t>(offset);
+      accessor.count = static_cast<size_t>(count);
+      const size_t element_size = component_size * accessor.components;
+      accessor.stride = element_size;
+
+      // Accessors without view are zeros.
+      if (accessor.view >= 0) {
+        const view_t &view = views_[accessor.view];
+        if (view.stride > 0) {
+          accessor.stride = view.stride;
+        }
+        if (accessor.count > 0 &&
+            accessor.offset + accessor.stride * (accessor.count - 1) +
+                    element_size >
+                view.size) {
+          std::cerr << "Accessor " << accessors_.size() << " of " << path_
+                    << " overflows its buffer view." << std::endl;
+          return false;
+        }
+        accessor.data =
+            buffers_[view.buffer].data + view.offset + accessor.offset;
+      }
+
+      accessors_.push_back(accessor);
+    }
+
+    return true;
+  }
+
+  // Base color factor and texture of the metallic roughness model. The model
+  // binds a single image, materials with another one are left untextured.
+  bool read_materials() {
+    const std::vector<json_value> &textures = array(document_, "textures");
+    const size_t image_count = array(document_, "images").size();
+
+    for (const json_value &material_json : array(document_, "materials")) {
+      glm::vec4 base_color(1.0f);
+      float metallic = 1.0f;
+      float roughness = 1.0f;
+      int64_t texture = -1;
+      if (const json_value *pbr = material_json.find("pbrMetallicRoughness")) {
+        numbers(*pbr, "baseColorFactor", 4, &base_color.x);
+        metallic = number(*pbr, "metallicFactor", metallic);
+        roughness = number(*pbr, "roughnessFactor", roughness);
+        if (const json_value *t = pbr->find("baseColorTexture")) {
+          texture = integer(*t, "index", -1);
+        }
+      }
+
+      material_data_t data;
+      data.material.diffuse = glm::vec3(base_color);
+      if (metallic >= 0.5f) {
+        data.material.illumination = 3;
+        data.material.specular = data.material.diffuse * metallic;
+      } else {
+        data.material.illumination = 2;
+        data.material.specular = glm::vec3(1.0f - roughness);
+      }
+
+      int64_t image = -1;
+      if (texture >= 0 && static_cast<size_t>(texture) < textures.size()) {
+        image = integer(textures[texture], "source", -1);
+      }
+      if (image >= 0 && static_cast<size_t>(image) < image_count) {
+        if (image_ < 0) {
+          image_ = image;
+        }
+        data.textured = image == image_;
+        if (!data.textured) {
+          std::cerr << "Only one texture is supported, image " << image
+                    << " of " << path_ << " is ignored." << std::endl;
+        }
+      }
+
+      materials_.push_back(data);
+    }
+
+    return true;
+  }
+
+  bool read_image(gltf_model_t &model) const {
+    if (image_ < 0) {
+      return true;
+    }
+
+    const json_value &image = array(document_, "images")[image_];
+    if (const json_value *uri = image.find("uri")) {
+      if (0 == uri->string().compare(0, 5, "data:")) {
+        return decode_data_uri(uri->string(), model.image_data);
+      }
+      model.image_path = directory_ + decode_uri(uri->string());
+      return true;
+    }
+
+    const int64_t view = integer(image, "bufferView", -1);
+    if (view < 0 || static_cast<size_t>(view) >= views_.size()) {
+      std::cerr << "Image " << image_ << " of " << path_
+                << " has neither uri nor buffer view." << std::endl;
+      return false;
+    }
+    const uint8_t *data =
+        buffers_[views_[view].buffer].data + views_[view].offset;
+    model.image_data.assign(data, data + views_[view].size);
+
+    return true;
+  }
+
+  // Local transforms, the hierarchy, and the world transforms from the
+  // roots.
+  bool read_nodes() {
+    const std::vector<json_value> &nodes = array(document_, "nodes");
+    nodes_.resize(nodes.size());
+
+    for (size_t n = 0; n < nodes.size(); ++n) {
+      node_t &node = nodes_[n];
+      node.mesh = integer(nodes[n], "mesh", -1);
+      node.skin = integer(nodes[n], "skin", -1);
+
+      glm::mat4 matrix(1.0f);
+      if (numbers(nodes[n], "matrix", 16, &matrix[0][0])) {
+        node.local = decompose(matrix);
+      } else {
+        glm::vec4 rotation(0.0f, 0.0f, 0.0f, 1.0f);
+        numbers(nodes[n], "translation", 3, &node.local.translation.x);
+        numbers(nodes[n], "rotation", 4, &rotation.x);
+        numbers(nodes[n], "scale", 3, &node.local.scale.x);
+        node.local.rotation =
+            glm::quat(rotation.w, rotation.x, rotation.y, rotation.z);
+      }
+
+      for (const json_value &child_json : array(nodes[n], "children")) {
+        const int64_t child = child_json.is_number()
+                                  ? static_cast<int64_t>(child_json.number())
+                                  : -1;
+        if (child < 0 || static_cast<size_t>(child) >= nodes.size() ||
+            static_cast<size_t>(child) == n) {
+          std::cerr << "Invalid child of node " << n << " in " << path_
+                    << "." << std::endl;
+          return false;
+        }
+        node.children.push_back(child);
+      }
+    }
+
+    for (size_t n = 0; n < nodes_.size(); ++n) {
+      for (int64_t child : nodes_[n].children) {
+        if (nodes_[child].parent >= 0) {
+          std::cerr << "Node " << child << " of " << path_
+                    << " has several parents." << std::endl;
+          return false;
+        }
+        nodes_[child].parent = static_cast<int64_t>(n);
+      }
+    }
+
+    std::vector<int64_t> stack;
+    for (size_t n = 0; n < nodes_.size(); ++n) {
+      if (nodes_[n].parent < 0) {
+        nodes_[n].world = nodes_[n].local.matrix();
+        nodes_[n].depth = 0;
+        stack.push_back(static_cast<int64_t>(n));
+      }
+    }
+    while (!stack.empty()) {
+      const node_t &node = nodes_[stack.back()];
+      stack.pop_back();
+      for (int64_t child : node.children) {
+        nodes_[child].world = node.world * nodes_[child].local.matrix();
+        nodes_[child].depth = node.depth + 1;
+        stack.push_back(child);
+      }
+    }
+
+    return true;
+  }
+
+  // Decode the triangle primitives of every mesh, one object each, on a pool
+  // of threads.
+  bool read_meshes(gltf_model_t &model) {
+    const std::vector<json_value> &meshes = array(document_, "meshes");
+    mesh_objects_.resize(meshes.size());
+
+    std::vector<const json_value *> primitives;
+    for (size_t m = 0; m < meshes.size(); ++m) {
+      for (const json_value &primitive : array(meshes[m], "primitives")) {
+        if (MODE_TRIANGLES != integer(primitive, "mode", MODE_TRIANGLES)) {
+          std::cerr << "Primitive of mesh " << m << " of " << path_
+                    << " is not a triangle list, skipped." << std::endl;
+          continue;
+        }
+        mesh_objects_[m].push_back(primitives.size());
+        primitives.push_back(&primitive);
+        object_materials_.push_back(integer(primitive, "material", -1));
+      }
+    }
+
+    model.meshes.resize(primitives.size());
+    std::atomic<size_t> next_primitive(0);
+    auto decode = [&]() {
+      bool decoded = true;
+      for (size_t p = next_primitive++; p < primitives.size();
+           p = next_primitive++) {
+        if (!read_primitive(*primitives[p], model.meshes[p])) {
+          decoded = false;
+        }
+      }
+      return decoded;
+    };
+
+    const size_t worker_count = std::min<size_t>(
+        primitives.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::future<bool>> workers;
+    for (size_t w = 0; w < worker_count; ++w) {
+      workers.push_back(std::async(std::launch::async, decode));
+    }
+    bool decoded = true;
+    for (std::future<bool> &worker : workers) {
+      if (!worker.get()) {
+        decoded = false;
+      }
+    }
+
+    return decoded;
+  }
+
+  // Vertices, indices, skin influences, levels of detail and bounds of a
+  // primitive. Only reads the loader, primitives decode concurrently.
+  bool read_primitive(const json_value &primitive,
+                      object_model_t &object) const {
+    const json_value *attributes = primitive.find("attributes");
+    const accessor_t *position =
+        attributes ? find_accessor(*attributes, "POSITION") : nullptr;
+    if (!position || COMPONENT_FLOAT != position->component_type ||
+        3 != position->components) {
+      std::cerr << "Primitive of " << path_ << " has no float positions."
+                << std::endl;
+      return false;
+    }
+    const size_t count = position->count;
+
+    const accessor_t *normal = find_accessor(*attributes, "NORMAL");
+    const accessor_t *tex_coord = find_accessor(*attributes, "TEXCOORD_0");
+    if ((normal && (normal->count < count || 3 != normal->components)) ||
+        (tex_coord &&
+         (tex_coord->count < count || 2 != tex_coord->components))) {
+      std::cerr << "Primitive of " << path_ << " has invalid attributes."
+                << std::endl;
+      return false;
+    }
+
+    object.vertices.resize(count);
+    if (interleaved_like_vertex(*position, normal, tex_coord)) {
+      memcpy(object.vertices.data(), position->data, sizeof(Vertex) * count);
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        Vertex &vertex = object.vertices[i];
+        read_element(*position, i, 3, &vertex.pos.x);
+        vertex.normal = glm::vec3(0.0f);
+        if (normal) {
+          read_element(*normal, i, 3, &vertex.normal.x);
+        }
+        vertex.tex_coord = glm::vec2(0.0f);
+        if (tex_coord) {
+          read_element(*tex_coord, i, 2, &vertex.tex_coord.x);
+        }
+      }
+    }
+
+    if (const accessor_t *indices = find_accessor(primitive, "indices")) {
+      if (1 != indices->components ||
+          (COMPONENT_UNSIGNED_BYTE != indices->component_type &&
+           COMPONENT_UNSIGNED_SHORT != indices->component_type &&
+           COMPONENT_UNSIGNED_INT != indices->component_type)) {
+        std::cerr << "Primitive of " << path_ << " has invalid indices."
+                  << std::endl;
+        return false;
+      }
+      object.indices.resize(indices->count);
+      if (COMPONENT_UNSIGNED_INT == indices->component_type &&
+          sizeof(uint32_t) == indices->stride && indices->data) {
+        memcpy(object.indices.data(), indices->data,
+               sizeof(uint32_t) * indices->count);
+      } else {
+        for (size_t i = 0; i < indices->count; ++i) {
+          object.indices[i] = read_index(*indices, i);
+        }
+      }
+      for (uint32_t index : object.indices) {
+        if (index >= count) {
+          std::cerr << "Primitive of " << path_
+                    << " indexes past its vertices." << std::endl;
+          return false;
+        }
+      }
+    } else {
+      object.indices.resize(count);
+      std::iota(object.indices.begin(), object.indices.end(), 0u);
+    }
+    object.indices.resize(object.indices.size() - object.indices.size() % 3);
+
+    if (!normal) {
+      vertex_normals::compute(object.vertices, object.indices);
+    }
+
+    const accessor_t *joints = find_accessor(*attributes, "JOINTS_0");
+    const accessor_t *weights = find_accessor(*attributes, "WEIGHTS_0");
+    if (joints && weights && 4 == joints->components &&
+        4 == weights->components && joints->count >= count &&
+        weights->count >= count) {
+      // Indices in the joints of the glTF skin, remapped once the skin of
+      // the object is known.
+      object.skin.joints.resize(count);
+      object.skin.weights.resize(count);
+      for (size_t i = 0; i < count; ++i) {
+        glm::vec4 j(0.0f);
+        glm::vec4 w(0.0f);
+        read_element(*joints, i, 4, &j.x);
+        read_element(*weights, i, 4, &w.x);
+        const float sum = w.x + w.y + w.z + w.w;
+        object.skin.joints[i] = glm::uvec4(
+            static_cast<uint32_t>(j.x), static_cast<uint32_t>(j.y),
+            static_cast<uint32_t>(j.z), static_cast<uint32_t>(j.w));
+        object.skin.weights[i] =
+            sum > 0.0f ? w / sum : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+      }
+    }
+
+    const int64_t material = integer(primitive, "material", -1);
+    object.textured = tex_coord && material >= 0 &&
+                      static_cast<size_t>(material) < materials_.size() &&
+                      materials_[material].textured;
+
+    if (!mesh_simplifier::generate_lods(object.vertices, object.indices,
+                                        object.lods)) {
+      std::cerr << "Failed to generate levels of detail of a mesh of "
+                << path_ << "." << std::endl;
+      return false;
+    }
+
+    object.aabb_min = glm::vec3(std::numeric_limits<float>::max());
+    object.aabb_max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const Vertex &vertex : object.vertices) {
+      object.aabb_min = glm::min(object.aabb_min, vertex.pos);
+      object.aabb_max = glm::max(object.aabb_max, vertex.pos);
+    }
+
+    return true;
+  }
+
+  // Whether the positions, normals and texture coordinates share a buffer
+  // view laid out exactly like an array of Vertex.
+  static bool interleaved_like_vertex(const accessor_t &position,
+                                      const accessor_t *normal,
+                                      const accessor_t *tex_coord) {
+    return normal && tex_coord && position.data && position.view >= 0 &&
+           normal->view == position.view &&
+           tex_coord->view == position.view &&
+           sizeof(Vertex) == position.stride &&
+           COMPONENT_FLOAT == normal->component_type &&
+           COMPONENT_FLOAT == tex_coord->component_type &&
+           normal->offset == position.offset + offsetof(Vertex, normal) &&
+           tex_coord->offset == position.offset + offsetof(Vertex, tex_coord);
+  }
+
+  // Skeletons of the skins, with their joints sorted so that parents go
+  // first, and the clips of the animations that move them.
+  bool read_skins() {
+    for (const json_value &skin_json : array(document_, "skins")) {
+      const std::vector<json_value> &joints = array(skin_json, "joints");
+      std::vector<int64_t> joint_nodes;
+      for (const json_value &joint : joints) {
+        const int64_t node =
+            joint.is_number() ? static_cast<int64_t>(joint.number()) : -1;
+        if (node < 0 || static_cast<size_t>(node) >= nodes_.size() ||
+            nodes_[node].depth < 0) {
+          std::cerr << "Invalid joint of skin " << skins_.size() << " in "
+                    << path_ << "." << std::endl;
+          return false;
+        }
+        joint_nodes.push_back(node);
+      }
+      if (joint_nodes.empty()) {
+        std::cerr << "Skin " << skins_.size() << " of " << path_
+                  << " has no joints." << std::endl;
+        return false;
+      }
+
+      // Parents before children, by depth in the hierarchy.
+      std::vector<size_t> order(joint_nodes.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return nodes_[joint_nodes[a]].depth < nodes_[joint_nodes[b]].depth;
+      });
+
+      skin_data_t skin;
+      skin.joint_of_index.resize(order.size());
+      std::unordered_map<int64_t, uint32_t> joint_of_node;
+      for (uint32_t j = 0; j < order.size(); ++j) {
+        skin.joint_of_index[order[j]] = j;
+        joint_of_node[joint_nodes[order[j]]] = j;
+      }
+
+      const accessor_t *inverse_binds =
+          find_accessor(skin_json, "inverseBindMatrices");
+      if (inverse_binds &&
+          (COMPONENT_FLOAT != inverse_binds->component_type ||
+           16 != inverse_binds->components ||
+           inverse_binds->count < order.size())) {
+        std::cerr << "Invalid inverse bind matrices of skin " << skins_.size()
+                  << " in " << path_ << "." << std::endl;
+        return false;
+      }
+
+      for (uint32_t j = 0; j < order.size(); ++j) {
+        const node_t &node = nodes_[joint_nodes[order[j]]];
+        int parent = -1;
+        for (int64_t a = node.parent; a >= 0 && parent < 0;
+             a = nodes_[a].parent) {
+          const auto found = joint_of_node.find(a);
+          if (joint_of_node.end() != found) {
+            parent = static_cast<int>(found->second);
+          }
+        }
+        skin.skeleton.parents.push_back(parent);
+        skin.skeleton.rest.push_back(node.local);
+
+        glm::mat4 inverse_bind(1.0f);
+        if (inverse_binds) {
+          read_element(*inverse_binds, order[j], 16, &inverse_bind[0][0]);
+        }
+        skin.skeleton.inverse_bind_matrices.push_back(inverse_bind);
+      }
+
+      // Joint poses are relative to the parent of the first root joint,
+      // which places the skinned meshes.
+      const int64_t root_parent = nodes_[joint_nodes[order[0]]].parent;
+      if (root_parent >= 0) {
+        skin.transform = nodes_[root_parent].world;
+      }
+
+      if (!read_clips(joint_of_node, skin.skeleton.clips)) {
+        return false;
+      }
+
+      skins_.push_back(std::move(skin));
+    }
+
+    return true;
+  }
+
+  // Channels of each animation that target the joints of a skin.
+  bool read_clips(const std::unordered_map<int64_t, uint32_t> &joint_of_node,
+                  std::vector<animation_clip_t> &clips) const {
+    const std::vector<json_value> &animations =
+        array(document_, "animations");
+    for (size_t a = 0; a < animations.size(); ++a) {
+      animation_clip_t clip;
+      const json_value *name = animations[a].find("name");
+      clip.name = name && name->is_string()
+                      ? name->string()
+                      : "animation " + std::to_string(a);
+
+      const std::vector<json_value> &samplers =
+          array(animations[a], "samplers");
+      for (const json_value &channel_json : array(animations[a], "channels")) {
+        const json_value *target = channel_json.find("target");
+        const int64_t sampler = integer(channel_json, "sampler", -1);
+        if (!target || sampler < 0 ||
+            static_cast<size_t>(sampler) >= samplers.size()) {
+          std::cerr << "Invalid channel of animation " << a << " in "
+                    << path_ << "." << std::endl;
+          return false;
+        }
+
+        const auto joint = joint_of_node.find(integer(*target, "node", -1));
+        const json_value *path = target->find("path");
+        if (joint_of_node.end() == joint || !path) {
+          continue;
+        }
+        animation_channel_t channel;
+        channel.joint = joint->second;
+        if ("translation" == path->string()) {
+          channel.property = animation_channel_t::path_translation;
+        } else if ("rotation" == path->string()) {
+          channel.property = animation_channel_t::path_rotation;
+        } else if ("scale" == path->string()) {
+          channel.property = animation_channel_t::path_scale;
+        } else {
+          continue;  // Morph target weights.
+        }
+
+        if (!read_channel(samplers[sampler], channel)) {
+          std::cerr << "Invalid sampler of animation " << a << " in "
+                    << path_ << "." << std::endl;
+          return false;
+        }
+        if (!channel.times.empty()) {
+          clip.duration = std::max(clip.duration, channel.times.back());
+          clip.channels.push_back(std::move(channel));
+        }
+      }
+
+      if (!clip.channels.empty()) {
+        clips.push_back(std::move(clip));
+      }
+    }
+
+    return true;
+  }
+
+  // Keys of a sampler. Step keys are doubled so that linear sampling holds
+  // the previous value until the next key.
+  bool read_channel(const json_value &sampler,
+                    animation_channel_t &channel) const {
+    const accessor_t *input = find_accessor(sampler, "input");
+    const accessor_t *output = find_accessor(sampler, "output");
+    const uint32_t components =
+        animation_channel_t::path_rotation == channel.property ? 4 : 3;
+    if (!input || !output || 1 != input->components ||
+        components != output->components) {
+      return false;
+    }
+
+    std::string interpolation = "LINEAR";
+    if (const json_value *i = sampler.find("interpolation")) {
+      interpolation = i->string();
+    }
+    const bool cubic = "CUBICSPLINE" == interpolation;
+    const bool step = "STEP" == interpolation;
+    if (output->count < input->count * (cubic ? 3 : 1)) {
+      return false;
+    }
+
+    for (size_t k = 0; k < input->count; ++k) {
+      float time = 0.0f;
+      read_element(*input, k, 1, &time);
+      // Cubic spline keys are an in tangent, a value and an out tangent.
+      glm::vec4 value(0.0f);
+      read_element(*output, cubic ? 3 * k + 1 : k, components, &value.x);
+      if (step && !channel.values.empty()) {
+        channel.times.push_back(time);
+        channel.values.push_back(channel.values.back());
+      }
+      channel.times.push_back(time);
+      channel.values.push_back(value);
+    }
+
+    return true;
+  }
+
+  // Instances of the meshes of the nodes of the default scene, and the
+  // skeletons of their skins.
+  bool instance_nodes(gltf_model_t &model) {
+    std::vector<int64_t> stack;
+    const std::vector<json_value> &scenes = array(document_, "scenes");
+    const int64_t scene = integer(document_, "scene", 0);
+    if (scene >= 0 && static_cast<size_t>(scene) < scenes.size()) {
+      for (const json_value &root : array(scenes[scene], "nodes")) {
+        const int64_t node =
+            root.is_number() ? static_cast<int64_t>(root.number()) : -1;
+        if (node >= 0 && static_cast<size_t>(node) < nodes_.size()) {
+          stack.push_back(node);
+        }
+      }
+    } else {
+      for (size_t n = 0; n < nodes_.size(); ++n) {
+        if (nodes_[n].parent < 0) {
+          stack.push_back(static_cast<int64_t>(n));
+        }
+      }
+    }
+
+    while (!stack.empty()) {
+      const node_t &node = nodes_[stack.back()];
+      stack.pop_back();
+      stack.insert(stack.end(), node.children.begin(), node.children.end());
+      if (node.mesh < 0 ||
+          static_cast<size_t>(node.mesh) >= mesh_objects_.size()) {
+        continue;
+      }
+
+      const bool skinned =
+          node.skin >= 0 && static_cast<size_t>(node.skin) < skins_.size();
+      for (size_t index : mesh_objects_[node.mesh]) {
+        object_model_t &object = model.meshes[index];
+        if (skinned && !attach_skin(skins_[node.skin], object)) {
+          return false;
+        }
+
+        gltf_instance_t instance;
+        instance.mesh = static_cast<uint32_t>(index);
+        // Skinned meshes follow their joints, not their node.
+        instance.transform =
+            skinned ? skins_[node.skin].transform : node.world;
+        const int64_t material = object_materials_[index];
+        if (material >= 0 &&
+            static_cast<size_t>(material) < materials_.size()) {
+          instance.material = materials_[material].material;
+        }
+        model.instances.push_back(instance);
+      }
+    }
+
+    // Influences of meshes used without skin.
+    for (object_model_t &object : model.meshes) {
+      if (object.skin.parents.empty()) {
+        object.skin = skin_t();
+      }
+    }
+
+    return true;
+  }
+
+  // Skeleton of the skin for the influences of the object. The first skin
+  // of a mesh wins.
+  bool attach_skin(const skin_data_t &skin, object_model_t &object) const {
+    if (object.skin.joints.empty() || !object.skin.parents.empty()) {
+      return true;
+    }
+
+    for (glm::uvec4 &joints : object.skin.joints) {
+      for (uint32_t *joint : {&joints.x, &joints.y, &joints.z, &joints.w}) {
+        if (*joint >= skin.joint_of_index.size()) {
+          std::cerr << "Mesh of " << path_
+                    << " is influenced by a joint past its skin." << std::endl;
+          return false;
+        }
+        *joint = skin.joint_of_index[*joint];
+      }
+    }
+    object.skin.parents = skin.skeleton.parents;
+    object.skin.inverse_bind_matrices = skin.skeleton.inverse_bind_matrices;
+    object.skin.rest = skin.skeleton.rest;
+    object.skin.clips = skin.skeleton.clips;
+
+    // The pose is not known before the clips play, the bounds grow by the
+    // extent of the object so that culling keeps it.
+    const glm::vec3 extent = object.aabb_max - object.aabb_min;
+    const float length = std::max(extent.x, std::max(extent.y, extent.z));
+    object.aabb_min -= glm::vec3(length);
+    object.aabb_max += glm::vec3(length);
+
+    return true;
+  }
+
+  // Accessor of an index member, nullptr if missing or invalid.
+  const accessor_t *find_accessor(const json_value &object,
+                                  const char *key) const {
+    const int64_t index = integer(object, key, -1);
+    if (index < 0 || static_cast<size_t>(index) >= accessors_.size()) {
+      return nullptr;
+    }
+    return &accessors_[index];
+  }
+
+  // The first components of an element as floats. Normalized integers map
+  // to [0, 1] or [-1, 1].
+  static void read_element(const accessor_t &accessor, size_t index,
+                           uint32_t components, float *values) {
+    const uint8_t *element = element_data(accessor, index);
+    components = std::min(components, accessor.components);
+    for (uint32_t c = 0; c < components; ++c) {
+      values[c] = read_component(accessor, element, c);
+    }
+  }
+
+  // Integers are not rounded through floats.
+  static uint32_t read_index(const accessor_t &accessor, size_t index) {
+    const uint8_t *element = element_data(accessor, index);
+    if (!element) {
+      return 0;
+    }
+    switch (accessor.component_type) {
+      case COMPONENT_UNSIGNED_INT: {
+        uint32_t value;
+        memcpy(&value, element, sizeof(value));
+        return value;
+      }
+      case COMPONENT_UNSIGNED_SHORT: {
+        uint16_t value;
+        memcpy(&value, element, sizeof(value));
+        return value;
+      }
+      case COMPONENT_UNSIGNED_BYTE:
+        return element[0];
+    }
+    return 0;
+  }
+
+  // Bytes of an element, nullptr if the accessor is all zeros.
+  static const uint8_t *element_data(const accessor_t &accessor,
+                                     size_t index) {
+    return accessor.data ? accessor.data + accessor.stride * index : nullptr;
+  }
+
+  static float read_component(const accessor_t &accessor,
+                              const uint8_t *element, uint32_t c) {
+    if (!element) {
+      return 0.0f;
+    }
+    const bool normalized = accessor.normalized;
+    switch (accessor.component_type) {
+      case COMPONENT_FLOAT: {
+        float value;
+        memcpy(&value, element + sizeof(value) * c, sizeof(value));
+        return value;
+      }
+      case COMPONENT_UNSIGNED_INT: {
+        uint32_t value;
+        memcpy(&value, element + sizeof(value) * c, sizeof(value));
+        return static_cast<float>(value);
+      }
+      case COMPONENT_UNSIGNED_SHORT: {
+        uint16_t value;
+        memcpy(&value, element + sizeof(value) * c, sizeof(value));
+        return normalized ? value / 65535.0f : value;
+      }
+      case COMPONENT_SHORT: {
+        int16_t value;
+        memcpy(&value, element + sizeof(value) * c, sizeof(value));
+        return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+      }
+      case COMPONENT_UNSIGNED_BYTE:
+        return normalized ? element[c] / 255.0f : element[c];
+      case COMPONENT_BYTE: {
+        const int8_t value = static_cast<int8_t>(element[c]);
+        return normalized ? std::max(value / 127.0f, -1.0f) : value;
+      }
+    }
+    return 0.0f;
+  }
+
+  static size_t component_bytes(uint32_t component_type) {
+    switch (component_type) {
+      case COMPONENT_BYTE:
+      case COMPONENT_UNSIGNED_BYTE:
+        return 1;
+      case COMPONENT_SHORT:
+      case COMPONENT_UNSIGNED_SHORT:
+        return 2;
+      case COMPONENT_UNSIGNED_INT:
+      case COMPONENT_FLOAT:
+        return 4;
+    }
+    return 0;
+  }
+
+  // Of the type of an accessor, 0 if unknown.
+  static uint32_t component_count(const json_value &accessor) {
+    const json_value *type = accessor.find("type");
+    if (!type) {
+      return 0;
+    }
+    const std::string &name = type->string();
+    if ("SCALAR" == name) {
+      return 1;
+    }
+    if ("VEC2" == name) {
+      return 2;
+    }
+    if ("VEC3" == name) {
+      return 3;
+    }
+    if ("VEC4" == name || "MAT2" == name) {
+      return 4;
+    }
+    if ("MAT3" == name) {
+      return 9;
+    }
+    if ("MAT4" == name) {
+      return 16;
+    }
+    return 0;
+  }
+
+  // Translation, rotation and scale of a node matrix without shear.
+  static joint_transform_t decompose(const glm::mat4 &matrix) {
+    joint_transform_t transform;
+    transform.translation = glm::vec3(matrix[3]);
+    glm::mat3 rotation(matrix);
+    for (int c = 0; c < 3; ++c) {
+      const float scale = glm::length(rotation[c]);
+      transform.scale[c] = scale;
+      if (scale > 0.0f) {
+        rotation[c] /= scale;
+      }
+    }
+    transform.rotation = glm::normalize(glm::quat_cast(rotation));
+    return transform;
+  }
+
+  // Little endian, like the hosts of the engine.
+  static uint32_t read_u32(const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  // Number member, missing if absent.
+  static int64_t integer(const json_value &object, const char *key,
+                         int64_t missing) {
+    const json_value *value = object.find(key);
+    return value && value->is_number() ? static_cast<int64_t>(value->number())
+                                       : missing;
+  }
+
+  static float number(const json_value &object, const char *key,
+                      float missing) {
+    const json_value *value = object.find(key);
+    return value && value->is_number() ? static_cast<float>(value->number())
+                                       : missing;
+  }
+
+  // Array of count numbers. Returns false, leaving values untouched, if the
+  // member is missing or not such an array.
+  static bool numbers(const json_value &object, const char *key, size_t count,
+                      float *values) {
+    const json_value *value = object.find(key);
+    if (!value || !value->is_array() || value->values().size() != count) {
+      return false;
+    }
+    for (const json_value &number : value->values()) {
+      if (!number.is_number()) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < count; ++i) {
+      values[i] = static_cast<float>(value->values()[i].number());
+    }
+    return true;
+  }
+
+  // Elements of an array member, empty if missing.
+  static const std::vector<json_value> &array(const json_value &object,
+                                              const char *key) {
+    static const std::vector<json_value> empty;
+    const json_value *value = object.find(key);
+    return value && value->is_array() ? value->values() : empty;
+  }
+
+  // Bytes of a base64 data URI.
+  bool decode_data_uri(const std::string &uri,
+                       std::vector<uint8_t> &bytes) const {
+    const std::string marker = ";base64,";
+    const size_t start = uri.find(marker);
+    if (std::string::npos == start) {
+      std::cerr << "Only base64 data URIs are supported in " << path_ << "."
+                << std::endl;
+      return false;
+    }
+
+    bytes.clear();
+    bytes.reserve((uri.size() - start) * 3 / 4);
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (size_t i = start + marker.size(); i < uri.size(); ++i) {
+      const char c = uri[i];
+      int value;
+      if ('A' <= c && c <= 'Z') {
+        value = c - 'A';
+      } else if ('a' <= c && c <= 'z') {
+        value = c - 'a' + 26;
+      } else if ('0' <= c && c <= '9') {
+        value = c - '0' + 52;
+      } else if ('+' == c) {
+        value = 62;
+      } else if ('/' == c) {
+        value = 63;
+      } else if ('=' == c) {
+        break;
+      } else {
+        std::cerr << "Invalid base64 data URI in " << path_ << "."
+                  << std::endl;
+        return false;
+      }
+      bits = (bits << 6) | static_cast<uint32_t>(value);
+      bit_count += 6;
+      if (bit_count >= 8) {
+        bit_count -= 8;
+        bytes.push_back(static_cast<uint8_t>(bits >> bit_count));
+      }
+    }
+
+    return true;
+  }
+
+  // Relative path of a URI, with its escaped characters.
+  static std::string decode_uri(const std::string &uri) {
+    std::string path;
+    for (size_t i = 0; i < uri.size(); ++i) {
+      if ('%' == uri[i] && i + 2 < uri.size()) {
+        path.push_back(static_cast<char>(
+            std::strtol(uri.substr(i + 1, 2).c_str(), nullptr, 16)));
+        i += 2;
+      } else {
+        path.push_back(uri[i]);
+      }
+    }
+    return path;
+  }
+
+  static std::string directory(const std::string &path) {
+    const size_t slash = path.find_last_of("/\\");
+    return std::string::npos == slash ? "" : path.substr(0, slash + 1);
+  }
+
+  std::string path_;
+  std::string directory_;
+  mapped_file file_;
+  std::vector<std::unique_ptr<mapped_file>> external_files_;
+  std::vector<std::vector<uint8_t>> decoded_buffers_;  // Of data URIs.
+  json_value document_;
+
+  std::vector<buffer_t> buffers_;
+  std::vector<view_t> views_;
+  std::vector<accessor_t> accessors_;
+  std::vector<material_data_t> materials_;
+  int64_t image_;  // Base color image of the textured materials.
+  std::vector<node_t> nodes_;
+  std::vector<std::vector<size_t>> mesh_objects_;  // Per glTF mesh.
+  std::vector<int64_t> object_materials_;  // Per object, -1 if default.
+  std::vector<skin_data_t> skins_;
+};
+
+}  // namespace rtx
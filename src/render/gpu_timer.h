@@ -0,0 +1,172 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "constants.h"
+#include "memory.h"
+
+namespace rtx {
+
+// GPU time of render passes measured with timestamp queries.
+//
+// Each frame in flight owns a begin and an end query per pass, so results are
+// read without stalling once the fence of the frame has been waited.
+class gpu_timer {
+ public:
+  gpu_timer()
+      : query_pool_(),
+        pass_count_(0),
+        timestamp_period_(0.0f),
+        timestamp_mask_(0),
+        written_(),
+        milliseconds_(),
+        last_milliseconds_() {}
+
+  bool init(memory &mem, const VkPhysicalDeviceProperties &properties,
+            uint32_t timestamp_valid_bits, uint32_t pass_count) {
+    pass_count_ = pass_count;
+    written_.assign(constants::MAX_FRAMES_IN_FLIGHT * pass_count_, false);
+    milliseconds_.assign(pass_count_, 0.0f);
+    last_milliseconds_.assign(pass_count_, 0.0f);
+
+    if (!properties.limits.timestampComputeAndGraphics ||
+        0 == timestamp_valid_bits) {
+      std::cout << "GPU timestamps not supported. GPU timer disabled."
+                << std::endl;
+      return true;
+    }
+
+    timestamp_period_ = properties.limits.timestampPeriod;
+    timestamp_mask_ = timestamp_valid_bits >= 64
+                          ? UINT64_MAX
+                          : (uint64_t(1) << timestamp_valid_bits) - 1;
+
+    VkQueryPoolCreateInfo query_pool_create_info{};
+    query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_create_info.queryCount =
+        constants::MAX_FRAMES_IN_FLIGHT * pass_count_ * QUERIES_PER_PASS;
+
+    VkResult res =
+        vkCreateQueryPool(mem.get_device(), &query_pool_create_info,
+                          mem.get_allocation_callbacks(), &query_pool_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create timestamp query pool: " << res
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void fini(memory &mem) {
+    vkDestroyQueryPool(mem.get_device(), query_pool_,
+                       mem.get_allocation_callbacks());
+    query_pool_ = VK_NULL_HANDLE;
+  }
+
+  bool enabled() const { return VK_NULL_HANDLE != query_pool_; }
+
+  // Read the results of a frame. Call after waiting for its fence.
+  void read(memory &mem, uint32_t frame) {
+    if (!enabled()) {
+      return;
+    }
+
+    for (uint32_t pass = 0; pass < pass_count_; ++pass) {
+      last_milliseconds_[pass] = 0.0f;
+      if (!written_[frame * pass_count_ + pass]) {
+        continue;
+      }
+      written_[frame * pass_count_ + pass] = false;
+
+      uint64_t timestamps[QUERIES_PER_PASS] = {};
+      VkResult res = vkGetQueryPoolResults(
+          mem.get_device(), query_pool_, first_query(frame, pass),
+          QUERIES_PER_PASS, sizeof(timestamps), timestamps, sizeof(uint64_t),
+          VK_QUERY_RESULT_64_BIT);
+      if (VK_SUCCESS != res) {
+        continue;
+      }
+
+      const uint64_t ticks = (timestamps[1] - timestamps[0]) & timestamp_mask_;
+      const float ms = static_cast<float>(ticks) * timestamp_period_ * 1e-6f;
+      last_milliseconds_[pass] = ms;
+
+      // Moving average.
+      float &average = milliseconds_[pass];
+      average = average > 0.0f ? 0.95f * average + 0.05f * ms : ms;
+    }
+  }
+
+  // Reset the queries of a frame. Record before any begin() of the frame.
+  void reset(VkCommandBuffer cmd_buf, uint32_t frame) {
+    if (!enabled()) {
+      return;
+    }
+
+    vkCmdResetQueryPool(cmd_buf, query_pool_, first_query(frame, 0),
+                        pass_count_ * QUERIES_PER_PASS);
+
+    for (uint32_t pass = 0; pass < pass_count_; ++pass) {
+      written_[frame * pass_count_ + pass] = false;
+    }
+  }
+
+  void begin(VkCommandBuffer cmd_buf, uint32_t frame, uint32_t pass) {
+    if (!enabled()) {
+      return;
+    }
+
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        query_pool_, first_query(frame, pass));
+  }
+
+  void end(VkCommandBuffer cmd_buf, uint32_t frame, uint32_t pass) {
+    if (!enabled()) {
+      return;
+    }
+
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        query_pool_, first_query(frame, pass) + 1);
+    written_[frame * pass_count_ + pass] = true;
+  }
+
+  // The begin and end queries of a pass are written by commands recorded in
+  // an earlier frame and submitted again.
+  void mark_written(uint32_t frame, uint32_t pass) {
+    if (!enabled()) {
+      return;
+    }
+
+    written_[frame * pass_count_ + pass] = true;
+  }
+
+  // Averaged GPU time of a pass, 0 if never measured.
+  float milliseconds(uint32_t pass) const { return milliseconds_[pass]; }
+
+  // GPU time of a pass in the last frame read, 0 if it did not run.
+  float last_milliseconds(uint32_t pass) const {
+    return last_milliseconds_[pass];
+  }
+
+ private:
+  static constexpr uint32_t QUERIES_PER_PASS = 2;
+
+  uint32_t first_query(uint32_t frame, uint32_t pass) const {
+    return (frame * pass_count_ + pass) * QUERIES_PER_PASS;
+  }
+
+  VkQueryPool query_pool_;
+  uint32_t pass_count_;
+  float timestamp_period_;  // Nanoseconds per tick.
+  uint64_t timestamp_mask_;
+  std::vector<bool> written_;
+  std::vector<float> milliseconds_;
+  std::vector<float> last_milliseconds_;
+};
+
+}  // namespace rtx
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace rtx {
+
+// Value of a JSON document, enough for scene descriptions.
+//
+// Objects keep their members in document order. Parsing stops at the first
+// error, reported with its line.
+class json_value {
+ public:
+  enum type {
+    type_null = 0,
+    type_boolean = 1,
+    type_number = 2,
+    type_string = 3,
+    type_array = 4,
+    type_object = 5
+  };
+
+  json_value()
+      : type_(type_null), boolean_(false), number_(0.0), string_(),
+        values_(), keys_() {}
+
+  static bool parse(const std::string &text, json_value &value,
+                    std::string &error) {
+    parser p(text);
+    value = json_value();
+    if (!p.parse_value(value, 0) || !p.end()) {
+      error = p.error();
+      return false;
+    }
+    return true;
+  }
+
+  type get_type() const { return type_; }
+  bool is_null() const { return type_null == type_; }
+  bool is_boolean() const { return type_boolean == type_; }
+  bool is_number() const { return type_number == type_; }
+  bool is_string() const { return type_string == type_; }
+  bool is_array() const { return type_array == type_; }
+  bool is_object() const { return type_object == type_; }
+
+  bool boolean() const { return boolean_; }
+  double number() const { return number_; }
+  const std::string &string() const { return string_; }
+
+  // Elements of an array, values of the members of an object.
+  const std::vector<json_value> &values() const { return values_; }
+  const std::vector<std::string> &keys() const { return keys_; }
+
+  // Member of an object, nullptr if missing.
+  const json_value *find(const std::string &key) const {
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      if (keys_[i] == key) {
+        return &values_[i];
+      }
+    }
+    return nullptr;
+  }
+
+ private:
+  class parser {
+   public:
+    explicit parser(const std::string &text)
+        : text_(text), position_(0), error_() {}
+
+    bool parse_value(json_value &value, int depth) {
+      if (depth > MAX_DEPTH) {
+        return fail("too deeply nested");
+      }
+
+      skip_whitespace();
+      if (position_ >= text_.size()) {
+        return fail("unexpected end");
+      }
+
+      const char c = text_[position_];
+      if ('{' == c) {
+        return parse_object(value, depth);
+      }
+      if ('[' == c) {
+        return parse_array(value, depth);
+      }
+      if ('"' == c) {
+        value.type_ = type_string;
+        return parse_string(value.string_);
+      }
+      if ('-' == c || ('0' <= c && c <= '9')) {
+        return parse_number(value);
+      }
+      if (literal("true")) {
+        value.type_ = type_boolean;
+        value.boolean_ = true;
+        return true;
+      }
+      if (literal("false")) {
+        value.type_ = type_boolean;
+        value.boolean_ = false;
+        return true;
+      }
+      if (literal("null")) {
+        value.type_ = type_null;
+        return true;
+      }
+
+      return fail("unexpected character");
+    }
+
+    // Only whitespace after the document.
+    bool end() {
+      if (!error_.empty()) {
+        return false;
+      }
+      skip_whitespace();
+      return position_ >= text_.size() || fail("trailing characters");
+    }
+
+    const std::string &error() const { return error_; }
+
+   private:
+    static constexpr int MAX_DEPTH = 64;
+
+    bool parse_object(json_value &value, int depth) {
+      value.type_ = type_object;
+      ++position_;  // {
+
+      skip_whitespace();
+      if (consume('}')) {
+        return true;
+      }
+
+      do {
+        skip_whitespace();
+        if (position_ >= text_.size() || '"' != text_[position_]) {
+          return fail("expected a member name");
+        }
+        std::string key;
+        if (!parse_string(key)) {
+          return false;
+        }
+
+        skip_whitespace();
+        if (!consume(':')) {
+          return fail("expected ':'");
+        }
+
+        value.keys_.push_back(key);
+        value.values_.emplace_back();
+        if (!parse_value(value.values_.back(), depth + 1)) {
+          return false;
+        }
+
+        skip_whitespace();
+      } while (consume(','));
+
+      return consume('}') || fail("expected ',' or '}'");
+    }
+
+    bool parse_array(json_value &value, int depth) {
+      value.type_ = type_array;
+      ++position_;  // [
+
+      skip_whitespace();
+      if (consume(']')) {
+        return true;
+      }
+
+      do {
+        value.values_.emplace_back();
+        if (!parse_value(value.values_.back(), depth + 1)) {
+          return false;
+        }
+        skip_whitespace();
+      } while (consume(','));
+
+      return consume(']') || fail("expected ',' or ']'");
+    }
+
+    bool parse_string(std::string &s) {
+      ++position_;  // "
+
+      while (position_ < text_.size()) {
+        const char c = text_[position_++];
+        if ('"' == c) {
+          return true;
+        }
+        if (static_cast<unsigned char>(c) < 0x20) {
+          return fail("control character in string");
+        }
+        if ('\\' != c) {
+          s += c;
+          continue;
+        }
+
+        if (position_ >= text_.size()) {
+          break;
+        }
+        const char escaped = text_[position_++];
+        switch (escaped) {
+          case '"':
+          case '\\':
+          case '/':
+            s += escaped;
+            break;
+          case 'b':
+            s += '\b';
+            break;
+          case 'f':
+            s += '\f';
+            break;
+          case 'n':
+            s += '\n';
+            break;
+          case 'r':
+            s += '\r';
+            break;
+          case 't':
+            s += '\t';
+            break;
+          case 'u': {
+            uint32_t code_point = 0;
+            if (!parse_hex(code_point)) {
+              return fail("invalid unicode escape");
+            }
+            append_utf8(code_point, s);
+            break;
+          }
+          default:
+            return fail("invalid escape");
+        }
+      }
+
+      return fail("unterminated string");
+    }
+
+    // Code points of the basic multilingual plane, surrogate pairs are not
+    // combined.
+    bool parse_hex(uint32_t &code_point) {
+      if (position_ + 4 > text_.size()) {
+        return false;
+      }
+      for (int i = 0; i < 4; ++i) {
+        const char c = text_[position_++];
+        code_point <<= 4;
+        if ('0' <= c && c <= '9') {
+          code_point |= c - '0';
+        } else if ('a' <= c && c <= 'f') {
+          code_point |= c - 'a' + 10;
+        } else if ('A' <= c && c <= 'F') {
+          code_point |= c - 'A' + 10;
+        } else {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    static void append_utf8(uint32_t code_point, std::string &s) {
+      if (code_point < 0x80) {
+        s += static_cast<char>(code_point);
+      } else if (code_point < 0x800) {
+        s += static_cast<char>(0xc0 | (code_point >> 6));
+        s += static_cast<char>(0x80 | (code_point & 0x3f));
+      } else {
+        s += static_cast<char>(0xe0 | (code_point >> 12));
+        s += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+        s += static_cast<char>(0x80 | (code_point & 0x3f));
+      }
+    }
+
+    bool parse_number(json_value &value) {
+      const char *begin = text_.c_str() + position_;
+      char *end = nullptr;
+      value.type_ = type_number;
+      value.number_ = std::strtod(begin, &end);
+      if (end == begin) {
+        return fail("invalid number");
+      }
+      position_ += end - begin;
+      return true;
+    }
+
+    bool literal(const char *word) {
+      const std::string w(word);
+      if (0 != text_.compare(position_, w.size(), w)) {
+        return false;
+      }
+      position_ += w.size();
+      return true;
+    }
+
+    bool consume(char c) {
+      if (position_ < text_.size() && c == text_[position_]) {
+        ++position_;
+        return true;
+      }
+      return false;
+    }
+
+    void skip_whitespace() {
+      while (position_ < text_.size() &&
+             (' ' == text_[position_] || '\t' == text_[position_] ||
+              '\n' == text_[position_] || '\r' == text_[position_])) {
+        ++position_;
+      }
+    }
+
+    bool fail(const char *message) {
+      if (error_.empty()) {
+        size_t line = 1;
+        for (size_t i = 0; i < position_ && i < text_.size(); ++i) {
+          if ('\n' == text_[i]) {
+            ++line;
+          }
+        }
+        error_ = std::string(message) + " at line " + std::to_string(line);
+      }
+      return false;
+    }
+
+    const std::string &text_;
+    size_t position_;
+    std::string error_;
+  };
+
+  type type_;
+  bool boolean_;
+  double number_;
+  std::string string_;
+  std::vector<json_value> values_;
+  std::vector<std::string> keys_;
+};
+
+}  // namespace rtx
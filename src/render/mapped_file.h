@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RTX_MAPPED_FILE_MMAP 1
+#endif
+
+namespace rtx {
+
+// Read only view of the bytes of a file.
+//
+// The file is memory mapped where the platform allows it, so that loaders
+// copy what they need straight from the page cache. Elsewhere it is read
+// whole into memory.
+class mapped_file {
+ public:
+  mapped_file() : data_(nullptr), size_(0), mapped_(false), contents_() {}
+  ~mapped_file() { close(); }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  bool open(const std::string &path) {
+    close();
+
+#ifdef RTX_MAPPED_FILE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Failed to open " << path << "." << std::endl;
+      return false;
+    }
+    struct stat info {};
+    if (0 != fstat(fd, &info)) {
+      std::cerr << "Failed to stat " << path << "." << std::endl;
+      ::close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    if (size_ > 0) {
+      void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (MAP_FAILED == data) {
+        std::cerr << "Failed to map " << path << "." << std::endl;
+        ::close(fd);
+        size_ = 0;
+        return false;
+      }
+      // Loaders mostly walk the file front to back.
+      madvise(data, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const uint8_t *>(data);
+      mapped_ = true;
+    }
+    // The mapping outlives the descriptor.
+    ::close(fd);
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+      std::cerr << "Failed to open " << path << "." << std::endl;
+      return false;
+    }
+    contents_.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(contents_.data()),
+                   contents_.size())) {
+      std::cerr << "Failed to read " << path << "." << std::endl;
+      contents_.clear();
+      return false;
+    }
+    data_ = contents_.data();
+    size_ = contents_.size();
+#endif
+
+    return true;
+  }
+
+  void close() {
+#ifdef RTX_MAPPED_FILE_MMAP
+    if (mapped_) {
+      munmap(const_cast<uint8_t *>(data_), size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    contents_.clear();
+  }
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const uint8_t *data_;
+  size_t size_;
+  bool mapped_;
+  std::vector<uint8_t> contents_;  // When the file is not mapped.
+};
+
+}  // namespace rtx
@@ -21,7 +21,8 @@ class memory {
 
   bool allocate_memory(const VkMemoryRequirements &memory_requirements,
                        const VkMemoryPropertyFlags &properties,
-                       VkDeviceMemory &memory) {
+                       VkDeviceMemory &memory,
+                       VkMemoryAllocateFlags allocate_flags = 0) {
     std::cout << "allocating memory (" << memory_requirements.size << " bytes)"
               << std::endl;
     // Allocate the memory.
@@ -30,6 +31,16 @@ class memory {
     memory_allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     memory_allocate_info.allocationSize = memory_requirements.size;
 
+    // Buffers whose device address is queried need memory allocated with the
+    // device address flag.
+    VkMemoryAllocateFlagsInfo memory_allocate_flags_info{};
+    if (allocate_flags) {
+      memory_allocate_flags_info.sType =
+          VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+      memory_allocate_flags_info.flags = allocate_flags;
+      memory_allocate_info.pNext = &memory_allocate_flags_info;
+    }
+
     if (!memory_type_from_properties(memory_requirements.memoryTypeBits,
                                      properties,
                                      &memory_allocate_info.memoryTypeIndex)) {
@@ -67,7 +78,13 @@ class memory {
     VkMemoryRequirements memory_requirements;
     vkGetBufferMemoryRequirements(device_, buffer, &memory_requirements);
 
-    if (!allocate_memory(memory_requirements, properties, buffer_memory)) {
+    VkMemoryAllocateFlags allocate_flags = 0;
+    if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+      allocate_flags |= VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+    }
+
+    if (!allocate_memory(memory_requirements, properties, buffer_memory,
+                         allocate_flags)) {
       std::cerr << "Failed to allocate buffer." << std::endl;
       return false;
     }
@@ -117,6 +134,16 @@ class memory {
     return true;
   }
 
+  // The buffer must have been created with
+  // VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT.
+  VkDeviceAddress get_buffer_device_address(VkBuffer buffer) const {
+    VkBufferDeviceAddressInfo buffer_device_address_info{};
+    buffer_device_address_info.sType =
+        VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    buffer_device_address_info.buffer = buffer;
+    return vkGetBufferDeviceAddress(device_, &buffer_device_address_info);
+  }
+
   VkDevice get_device() const { return device_; }
   const VkAllocationCallbacks *get_allocation_callbacks() const {
     return allocation_callbacks_;
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "constants.h"
+#include "mapped_file.h"
+#include "mesh_codec.h"
+#include "object.h"
+#include "vertex.h"
+
+namespace rtx {
+
+// Binary cache of processed meshes.
+//
+// Parsing and deduplicating an OBJ model and generating its levels of detail
+// is much slower than reading back the result. The cache file is stored next
+// to the model and it is discarded when the model file changes. Vertices and
+// indices are compressed by mesh_codec, so that loading large models from a
+// cold disk is bound by their decoding rather than by the reads.
+class mesh_cache {
+ public:
+  static std::string cache_path(const std::string &model_path) {
+    return model_path + ".rtxmesh";
+  }
+
+  // Load the vertices, indices and levels of detail of a model from its cache
+  // file. Returns false if there is no valid cache for the model.
+  static bool load(const std::string &model_path, object_model_t &object) {
+    header_t source_header{};
+    if (!read_source_info(model_path, source_header)) {
+      return false;
+    }
+
+    std::error_code error;
+    if (!std::filesystem::exists(cache_path(model_path), error)) {
+      return false;
+    }
+
+    // Decoded straight from the mapped file.
+    mapped_file file;
+    if (!file.open(cache_path(model_path)) ||
+        file.size() < sizeof(header_t)) {
+      return false;
+    }
+
+    header_t header{};
+    memcpy(&header, file.data(), sizeof(header));
+    if (0 != memcmp(header.magic, MAGIC, sizeof(header.magic)) ||
+        VERSION != header.version ||
+        source_header.source_size != header.source_size ||
+        source_header.source_time != header.source_time) {
+      std::cout << "Mesh cache of " << model_path << " is stale." << std::endl;
+      return false;
+    }
+
+    // Sizes and counts are checked against the file before anything is
+    // allocated, one at a time so that they cannot overflow.
+    uint64_t remaining = file.size() - sizeof(header);
+    const bool lods_fit = header.lod_count <= remaining / sizeof(lod_t);
+    const uint64_t lods_size = lods_fit ? sizeof(lod_t) * header.lod_count : 0;
+    remaining -= lods_size;
+    const bool vertices_fit = lods_fit && header.vertex_bytes <= remaining;
+    remaining -= vertices_fit ? header.vertex_bytes : 0;
+    if (!vertices_fit || header.index_bytes > remaining) {
+      std::cerr << "Mesh cache of " << model_path << " is truncated."
+                << std::endl;
+      return false;
+    }
+    if (header.vertex_count > mesh_codec::max_vertices(header.vertex_bytes) ||
+        header.index_count > mesh_codec::max_indices(header.index_bytes)) {
+      std::cerr << "Mesh cache of " << model_path << " is corrupt."
+                << std::endl;
+      return false;
+    }
+
+    std::vector<Vertex> vertices(header.vertex_count);
+    std::vector<uint32_t> indices(header.index_count);
+    std::vector<lod_t> lods(header.lod_count);
+
+    const uint8_t *data = file.data() + sizeof(header);
+    memcpy(lods.data(), data, lods_size);
+    data += lods_size;
+    const bool decoded =
+        mesh_codec::decode_vertices(data, header.vertex_bytes, vertices) &&
+        mesh_codec::decode_indices(data + header.vertex_bytes,
+                                   header.index_bytes, indices);
+    if (!decoded || !valid(vertices, indices, lods)) {
+      std::cerr << "Mesh cache of " << model_path << " is corrupt."
+                << std::endl;
+      return false;
+    }
+
+    object.vertices.swap(vertices);
+    object.indices.swap(indices);
+    object.lods.swap(lods);
+
+    return true;
+  }
+
+  // Store the vertices, indices and levels of detail of a model.
+  static bool store(const std::string &model_path,
+                    const object_model_t &object) {
+    header_t header{};
+    if (!read_source_info(model_path, header)) {
+      return false;
+    }
+
+    std::vector<uint8_t> vertex_data;
+    std::vector<uint8_t> index_data;
+    mesh_codec::encode_vertices(object.vertices, vertex_data);
+    mesh_codec::encode_indices(object.indices, index_data);
+
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.vertex_count = object.vertices.size();
+    header.index_count = object.indices.size();
+    header.lod_count = object.lods.size();
+    header.vertex_bytes = vertex_data.size();
+    header.index_bytes = index_data.size();
+
+    std::ofstream file(cache_path(model_path),
+                       std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      std::cerr << "Failed to open mesh cache of " << model_path << "."
+                << std::endl;
+      return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(object.lods.data()),
+               sizeof(lod_t) * object.lods.size());
+    file.write(reinterpret_cast<const char *>(vertex_data.data()),
+               vertex_data.size());
+    file.write(reinterpret_cast<const char *>(index_data.data()),
+               index_data.size());
+
+    if (!file) {
+      std::cerr << "Failed to write mesh cache of " << model_path << "."
+                << std::endl;
+      return false;
+    }
+
+    const double raw_size =
+        static_cast<double>(sizeof(Vertex) * object.vertices.size() +
+                            sizeof(uint32_t) * object.indices.size());
+    std::ostringstream log;
+    log << "Cached model " << model_path << ", geometry compressed to "
+        << std::fixed << std::setprecision(1)
+        << 100.0 * (vertex_data.size() + index_data.size()) /
+               std::max(raw_size, 1.0)
+        << "%." << std::endl;
+    std::cout << log.str() << std::flush;
+
+    return true;
+  }
+
+ private:
+  static constexpr char MAGIC[8] = {'R', 'T', 'X', 'M', 'E', 'S', 'H', '\0'};
+
+  // Bump it every time the layout of the cache or of the cached data changes.
+  static constexpr uint32_t VERSION = 2;
+
+  struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+
+    // Size and modification time of the model file the cache was built from.
+    uint64_t source_size;
+    int64_t source_time;
+
+    uint64_t vertex_count;
+    uint64_t index_count;
+    uint64_t lod_count;
+
+    // Of the compressed vertices and indices, after the levels of detail.
+    uint64_t vertex_bytes;
+    uint64_t index_bytes;
+  };
+
+  // Indices within the vertices. Levels of detail follow each other in the
+  // indices as mesh_simplifier appends them, from the full resolution level
+  // 0 that every user of an object expects, and are whole triangles. There
+  // are at most constants::MAX_LODS of them, the engine keeps per level
+  // statistics.
+  static bool valid(const std::vector<Vertex> &vertices,
+                    const std::vector<uint32_t> &indices,
+                    const std::vector<lod_t> &lods) {
+    for (uint32_t index : indices) {
+      if (index >= vertices.size()) {
+        return false;
+      }
+    }
+    if (lods.empty() || lods.size() > constants::MAX_LODS) {
+      return false;
+    }
+    uint64_t next_index = 0;
+    for (const lod_t &lod : lods) {
+      if (lod.first_index != next_index || 0 != lod.index_count % 3) {
+        return false;
+      }
+      next_index += lod.index_count;
+    }
+    return next_index == indices.size();
+  }
+
+  static bool read_source_info(const std::string &model_path,
+                               header_t &header) {
+    std::error_code error;
+
+    const auto size = std::filesystem::file_size(model_path, error);
+    if (error) {
+      std::cerr << "Failed to get size of " << model_path << ": "
+                << error.message() << std::endl;
+      return false;
+    }
+
+    const auto time = std::filesystem::last_write_time(model_path, error);
+    if (error) {
+      std::cerr << "Failed to get modification time of " << model_path << ": "
+                << error.message() << std::endl;
+      return false;
+    }
+
+    header.source_size = static_cast<uint64_t>(size);
+    header.source_time =
+        static_cast<int64_t>(time.time_since_epoch().count());
+
+    return true;
+  }
+};
+
+}  // namespace rtx
@@ -0,0 +1,579 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RTX_MESH_CODEC_SSE2 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RTX_MESH_CODEC_AVX2 1
+#endif
+
+#include "vertex.h"
+
+namespace rtx {
+
+// Lossless compression of vertex and index buffers, for the mesh cache.
+//
+// Vertices are split in blocks of 256. Within a block, each of the 32 bytes
+// of a Vertex is stored as a column: the difference of the byte with the one
+// of the previous vertex, zigzag encoded so that small changes either way are
+// small numbers. Columns are cut in groups of 16 bytes, each packed with 0, 2,
+// 4 or 8 bits per byte, the fewest that fit. Neighboring vertices are close,
+// so the high bytes of their floats barely change and pack tightly.
+// Decoding is a handful of SSE2 instructions per group: unpack, undo the
+// zigzag, then a prefix sum. With AVX2, two groups decode at once in 32 byte
+// registers. Blocks are independent and decode on a pool of threads.
+//
+// Indices are coded one byte each in the common cases. Meshes are indexed in
+// order of first use, so a new vertex is coded as such. Triangles share
+// edges with their recent neighbors, so an index among the last 15 distinct
+// ones is coded by its position. Others are a varint of the difference with
+// the previous index. Chunks of indices are independent and decode
+// concurrently.
+class mesh_codec {
+ public:
+  static void encode_vertices(const std::vector<Vertex> &vertices,
+                              std::vector<uint8_t> &encoded) {
+    const size_t block_count =
+        (vertices.size() + BLOCK_VERTICES - 1) / BLOCK_VERTICES;
+    encoded.assign(sizeof(uint64_t) * (block_count + 1), 0);
+
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(vertices.data());
+    for (size_t b = 0; b < block_count; ++b) {
+      write_offset(encoded, b);
+      const size_t first = b * BLOCK_VERTICES;
+      const size_t count =
+          std::min<size_t>(BLOCK_VERTICES, vertices.size() - first);
+      encode_vertex_block(bytes + VERTEX_SIZE * first, count, encoded);
+    }
+    write_offset(encoded, block_count);
+  }
+
+  // Returns false if encoded is corrupt.
+  static bool decode_vertices(const uint8_t *encoded, size_t size,
+                              std::vector<Vertex> &vertices) {
+    const size_t block_count =
+        (vertices.size() + BLOCK_VERTICES - 1) / BLOCK_VERTICES;
+    if (size < sizeof(uint64_t) * (block_count + 1)) {
+      return false;
+    }
+
+    uint8_t *bytes = reinterpret_cast<uint8_t *>(vertices.data());
+    const size_t job_count =
+        (block_count + JOB_VERTEX_BLOCKS - 1) / JOB_VERTEX_BLOCKS;
+    return parallel_for(job_count, [&](size_t job) {
+      const size_t last_block =
+          std::min(block_count, (job + 1) * JOB_VERTEX_BLOCKS);
+      for (size_t b = job * JOB_VERTEX_BLOCKS; b < last_block; ++b) {
+        const uint64_t begin = read_offset(encoded, b);
+        const uint64_t end = read_offset(encoded, b + 1);
+        if (begin > end || end > size) {
+          return false;
+        }
+        const size_t first = b * BLOCK_VERTICES;
+        const size_t count =
+            std::min<size_t>(BLOCK_VERTICES, vertices.size() - first);
+        if (!decode_vertex_block(encoded + begin, encoded + end, count,
+                                 bytes + VERTEX_SIZE * first)) {
+          return false;
+        }
+      }
+      return true;
+    });
+  }
+
+  // Most vertices that size encoded bytes may hold, so that the decoded
+  // buffer is bounded before it is allocated. A block takes at least its
+  // offset and a widths header per column.
+  static uint64_t max_vertices(uint64_t size) {
+    if (size < sizeof(uint64_t)) {
+      return 0;
+    }
+    return (size - sizeof(uint64_t)) / MIN_BLOCK_SIZE * BLOCK_VERTICES;
+  }
+
+  static void encode_indices(const std::vector<uint32_t> &indices,
+                             std::vector<uint8_t> &encoded) {
+    const size_t chunk_count =
+        (indices.size() + CHUNK_INDICES - 1) / CHUNK_INDICES;
+    encoded.assign(sizeof(index_chunk_t) * chunk_count, 0);
+
+    uint32_t next = 0;
+    for (size_t c = 0; c < chunk_count; ++c) {
+      index_chunk_t chunk{};
+      chunk.offset = encoded.size();
+      chunk.next = next;
+      memcpy(encoded.data() + sizeof(chunk) * c, &chunk, sizeof(chunk));
+
+      index_state_t state;
+      const size_t last =
+          std::min(indices.size(), (c + 1) * CHUNK_INDICES);
+      for (size_t i = c * CHUNK_INDICES; i < last; ++i) {
+        const uint32_t index = indices[i];
+        const int position = state.find(index);
+        if (index == next) {
+          encoded.push_back(0);
+          state.push(index);
+        } else if (position > 0) {
+          encoded.push_back(static_cast<uint8_t>(position));
+        } else {
+          const int64_t delta =
+              static_cast<int64_t>(index) - static_cast<int64_t>(state.last);
+          write_varint(encoded, zigzag(delta) + FIFO_SIZE);
+          state.push(index);
+        }
+        state.last = index;
+        next = std::max(next, index + 1);
+      }
+    }
+  }
+
+  // Most indices that size encoded bytes may hold, one byte each at least.
+  static uint64_t max_indices(uint64_t size) { return size; }
+
+  // Returns false if encoded is corrupt.
+  static bool decode_indices(const uint8_t *encoded, size_t size,
+                             std::vector<uint32_t> &indices) {
+    const size_t chunk_count =
+        (indices.size() + CHUNK_INDICES - 1) / CHUNK_INDICES;
+    if (size < sizeof(index_chunk_t) * chunk_count) {
+      return false;
+    }
+
+    return parallel_for(chunk_count, [&](size_t c) {
+      index_chunk_t chunk;
+      memcpy(&chunk, encoded + sizeof(chunk) * c, sizeof(chunk));
+      const uint64_t end = c + 1 < chunk_count
+                               ? read_chunk_offset(encoded, c + 1)
+                               : size;
+      if (chunk.offset > end || end > size) {
+        return false;
+      }
+
+      const uint8_t *p = encoded + chunk.offset;
+      const uint8_t *p_end = encoded + end;
+      uint32_t next = chunk.next;
+      index_state_t state;
+      const size_t last = std::min(indices.size(), (c + 1) * CHUNK_INDICES);
+      for (size_t i = c * CHUNK_INDICES; i < last; ++i) {
+        if (p >= p_end) {
+          return false;
+        }
+        const uint8_t code = *p;
+        uint32_t index;
+        if (0 == code) {
+          ++p;
+          index = next;
+          state.push(index);
+        } else if (code < FIFO_SIZE) {
+          ++p;
+          index = state.at(code);
+        } else {
+          uint64_t value = 0;
+          if (!read_varint(p, p_end, value)) {
+            return false;
+          }
+          index = static_cast<uint32_t>(static_cast<int64_t>(state.last) +
+                                        unzigzag(value - FIFO_SIZE));
+          state.push(index);
+        }
+        indices[i] = index;
+        state.last = index;
+        next = std::max(next, index + 1);
+      }
+      return true;
+    });
+  }
+
+ private:
+  static constexpr size_t VERTEX_SIZE = sizeof(Vertex);
+  static constexpr size_t BLOCK_VERTICES = 256;
+  static constexpr size_t GROUP_SIZE = 16;
+  static constexpr size_t JOB_VERTEX_BLOCKS = 16;
+  static constexpr size_t MIN_BLOCK_SIZE =
+      sizeof(uint64_t) + VERTEX_SIZE * sizeof(uint32_t);
+
+  static constexpr size_t CHUNK_INDICES = 3 * 16384;
+  static constexpr uint32_t FIFO_SIZE = 16;
+
+  static_assert(0 == VERTEX_SIZE % GROUP_SIZE,
+                "Vertex columns are transposed 16 at a time.");
+
+  struct index_chunk_t {
+    uint64_t offset;  // Of the coded indices in the stream.
+    uint32_t next;    // First vertex not indexed by previous chunks.
+    uint32_t reserved;
+  };
+
+  // Last distinct indices of a chunk, most recent first by position.
+  struct index_state_t {
+    uint32_t fifo[FIFO_SIZE];
+    uint32_t head = 0;
+    uint32_t last = 0;
+
+    index_state_t() { std::fill(fifo, fifo + FIFO_SIZE, ~0u); }
+
+    void push(uint32_t index) {
+      head = (head + 1) % FIFO_SIZE;
+      fifo[head] = index;
+    }
+
+    // Position 1 is the last pushed index.
+    uint32_t at(uint32_t position) const {
+      return fifo[(head + FIFO_SIZE + 1 - position) % FIFO_SIZE];
+    }
+
+    // Position of index, 0 if not among the last FIFO_SIZE - 1.
+    int find(uint32_t index) const {
+      for (uint32_t position = 1; position < FIFO_SIZE; ++position) {
+        if (at(position) == index) {
+          return static_cast<int>(position);
+        }
+      }
+      return 0;
+    }
+  };
+
+  static void encode_vertex_block(const uint8_t *vertices, size_t count,
+                                  std::vector<uint8_t> &encoded) {
+    const size_t group_count = (count + GROUP_SIZE - 1) / GROUP_SIZE;
+    for (size_t k = 0; k < VERTEX_SIZE; ++k) {
+      const size_t header = encoded.size();
+      encoded.resize(header + sizeof(uint32_t));
+      uint32_t widths = 0;
+
+      uint8_t previous = 0;
+      for (size_t g = 0; g < group_count; ++g) {
+        // The last group repeats the last vertex, zero deltas.
+        uint8_t values[GROUP_SIZE];
+        uint8_t largest = 0;
+        for (size_t i = 0; i < GROUP_SIZE; ++i) {
+          const size_t v = std::min(g * GROUP_SIZE + i, count - 1);
+          const uint8_t byte = vertices[VERTEX_SIZE * v + k];
+          const uint8_t delta = static_cast<uint8_t>(byte - previous);
+          values[i] = static_cast<uint8_t>((delta << 1) ^
+                                           (delta & 0x80 ? 0xff : 0));
+          largest = std::max(largest, values[i]);
+          previous = byte;
+        }
+
+        uint32_t width = 3;
+        if (0 == largest) {
+          width = 0;
+        } else if (largest < 4) {
+          width = 1;
+        } else if (largest < 16) {
+          width = 2;
+        }
+        widths |= width << (2 * g);
+        switch (width) {
+          case 1:
+            for (size_t j = 0; j < 4; ++j) {
+              encoded.push_back(static_cast<uint8_t>(
+                  values[j] | values[j + 4] << 2 | values[j + 8] << 4 |
+                  values[j + 12] << 6));
+            }
+            break;
+          case 2:
+            for (size_t j = 0; j < 8; ++j) {
+              encoded.push_back(
+                  static_cast<uint8_t>(values[j] | values[j + 8] << 4));
+            }
+            break;
+          case 3:
+            encoded.insert(encoded.end(), values, values + GROUP_SIZE);
+            break;
+        }
+      }
+
+      memcpy(encoded.data() + header, &widths, sizeof(widths));
+    }
+  }
+
+  static bool decode_vertex_block(const uint8_t *p, const uint8_t *end,
+                                  size_t count, uint8_t *vertices) {
+    static constexpr size_t PAYLOAD_SIZE[4] = {0, 4, 8, 16};
+
+    alignas(16) uint8_t columns[VERTEX_SIZE][BLOCK_VERTICES];
+    alignas(16) uint8_t rows[BLOCK_VERTICES][VERTEX_SIZE];
+    const size_t group_count = (count + GROUP_SIZE - 1) / GROUP_SIZE;
+    for (size_t k = 0; k < VERTEX_SIZE; ++k) {
+      if (end - p < static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+        return false;
+      }
+      uint32_t widths;
+      memcpy(&widths, p, sizeof(widths));
+      p += sizeof(widths);
+
+      uint8_t previous = 0;
+      size_t g = 0;
+#ifdef RTX_MESH_CODEC_AVX2
+      for (; g + 1 < group_count; g += 2) {
+        const uint32_t width = (widths >> (2 * g)) & 3;
+        const uint32_t next_width = (widths >> (2 * g + 2)) & 3;
+        const size_t size = PAYLOAD_SIZE[width];
+        if (end - p <
+            static_cast<ptrdiff_t>(size + PAYLOAD_SIZE[next_width])) {
+          return false;
+        }
+        uint8_t *groups = &columns[k][g * GROUP_SIZE];
+        decode_groups(p, width, p + size, next_width, previous, groups);
+        previous = groups[2 * GROUP_SIZE - 1];
+        p += size + PAYLOAD_SIZE[next_width];
+      }
+#endif
+      for (; g < group_count; ++g) {
+        const uint32_t width = (widths >> (2 * g)) & 3;
+        if (end - p < static_cast<ptrdiff_t>(PAYLOAD_SIZE[width])) {
+          return false;
+        }
+        uint8_t *group = &columns[k][g * GROUP_SIZE];
+        decode_group(p, width, previous, group);
+        previous = group[GROUP_SIZE - 1];
+        p += PAYLOAD_SIZE[width];
+      }
+    }
+
+    for (size_t g = 0; g < group_count; ++g) {
+      for (size_t k = 0; k < VERTEX_SIZE; k += GROUP_SIZE) {
+        transpose(&columns[k][g * GROUP_SIZE], BLOCK_VERTICES,
+                  &rows[g * GROUP_SIZE][k], VERTEX_SIZE);
+      }
+    }
+    memcpy(vertices, rows, VERTEX_SIZE * count);
+
+    return true;
+  }
+
+#ifdef RTX_MESH_CODEC_SSE2
+  // Zigzag encoded deltas of a group, one per byte.
+  static __m128i unpack_group(const uint8_t *payload, uint32_t width) {
+    __m128i zigzag = _mm_setzero_si128();
+    switch (width) {
+      case 1: {
+        uint32_t bits;
+        memcpy(&bits, payload, sizeof(bits));
+        const __m128i x = _mm_cvtsi32_si128(static_cast<int>(bits));
+        const __m128i mask = _mm_set1_epi8(3);
+        const __m128i a = _mm_and_si128(x, mask);
+        const __m128i b = _mm_and_si128(_mm_srli_epi16(x, 2), mask);
+        const __m128i c = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+        const __m128i d = _mm_and_si128(_mm_srli_epi16(x, 6), mask);
+        zigzag = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b),
+                                    _mm_unpacklo_epi32(c, d));
+        break;
+      }
+      case 2: {
+        const __m128i x =
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(payload));
+        const __m128i mask = _mm_set1_epi8(15);
+        zigzag = _mm_unpacklo_epi64(
+            _mm_and_si128(x, mask),
+            _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+        break;
+      }
+      case 3:
+        zigzag = _mm_loadu_si128(reinterpret_cast<const __m128i *>(payload));
+        break;
+    }
+    return zigzag;
+  }
+
+  // 16 values of a group, each the previous one plus its delta.
+  static void decode_group(const uint8_t *payload, uint32_t width,
+                           uint8_t previous, uint8_t *group) {
+    const __m128i zigzag = unpack_group(payload, width);
+
+    // (z >> 1) ^ -(z & 1), per byte.
+    const __m128i half =
+        _mm_and_si128(_mm_srli_epi16(zigzag, 1), _mm_set1_epi8(0x7f));
+    const __m128i sign = _mm_sub_epi8(
+        _mm_setzero_si128(), _mm_and_si128(zigzag, _mm_set1_epi8(1)));
+    __m128i x = _mm_xor_si128(half, sign);
+
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi8(x, _mm_set1_epi8(static_cast<char>(previous)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(group), x);
+  }
+
+#ifdef RTX_MESH_CODEC_AVX2
+  // 32 values of two consecutive groups, a group per 16 byte lane. Shifts
+  // stay within lanes, so the prefix sum of the first lane is carried into
+  // the second one after.
+  static void decode_groups(const uint8_t *payload, uint32_t width,
+                            const uint8_t *next_payload, uint32_t next_width,
+                            uint8_t previous, uint8_t *groups) {
+    const __m128i first = unpack_group(payload, width);
+    const __m128i second = unpack_group(next_payload, next_width);
+    const __m256i zigzag =
+        _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+
+    // (z >> 1) ^ -(z & 1), per byte.
+    const __m256i half =
+        _mm256_and_si256(_mm256_srli_epi16(zigzag, 1), _mm256_set1_epi8(0x7f));
+    const __m256i sign = _mm256_sub_epi8(
+        _mm256_setzero_si256(), _mm256_and_si256(zigzag, _mm256_set1_epi8(1)));
+    __m256i x = _mm256_xor_si256(half, sign);
+
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 1));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 2));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+
+    // The last sum of each lane in all its bytes, then the first lane's in
+    // the second lane only.
+    const __m256i last = _mm256_shuffle_epi8(x, _mm256_set1_epi8(15));
+    x = _mm256_add_epi8(x, _mm256_permute2x128_si256(last, last, 0x08));
+    x = _mm256_add_epi8(x, _mm256_set1_epi8(static_cast<char>(previous)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(groups), x);
+  }
+#endif
+
+  // 16 rows of 16 bytes into 16 columns. Each pass interleaves the rows i
+  // and i + 8, four passes transpose.
+  static void transpose(const uint8_t *in, size_t in_stride, uint8_t *out,
+                        size_t out_stride) {
+    __m128i r[GROUP_SIZE];
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+      r[i] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(in + in_stride * i));
+    }
+    for (int pass = 0; pass < 4; ++pass) {
+      __m128i t[GROUP_SIZE];
+      for (size_t i = 0; i < GROUP_SIZE / 2; ++i) {
+        t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + GROUP_SIZE / 2]);
+        t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + GROUP_SIZE / 2]);
+      }
+      std::copy(t, t + GROUP_SIZE, r);
+    }
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + out_stride * i),
+                       r[i]);
+    }
+  }
+#else
+  static void decode_group(const uint8_t *payload, uint32_t width,
+                           uint8_t previous, uint8_t *group) {
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+      uint8_t zigzag = 0;
+      switch (width) {
+        case 1:
+          zigzag = (payload[i % 4] >> (2 * (i / 4))) & 3;
+          break;
+        case 2:
+          zigzag = (payload[i % 8] >> (4 * (i / 8))) & 15;
+          break;
+        case 3:
+          zigzag = payload[i];
+          break;
+      }
+      previous = static_cast<uint8_t>(previous + ((zigzag >> 1) ^
+                                                  -(zigzag & 1)));
+      group[i] = previous;
+    }
+  }
+
+  static void transpose(const uint8_t *in, size_t in_stride, uint8_t *out,
+                        size_t out_stride) {
+    for (size_t i = 0; i < GROUP_SIZE; ++i) {
+      for (size_t j = 0; j < GROUP_SIZE; ++j) {
+        out[out_stride * j + i] = in[in_stride * i + j];
+      }
+    }
+  }
+#endif
+
+  // Runs job(0) to job(count - 1) on a pool of threads, false if any fails.
+  template <typename F>
+  static bool parallel_for(size_t count, const F &job) {
+    std::atomic<size_t> next_job(0);
+    std::atomic<bool> succeeded(true);
+    auto work = [&]() {
+      for (size_t j = next_job++; j < count && succeeded; j = next_job++) {
+        if (!job(j)) {
+          succeeded = false;
+        }
+      }
+    };
+
+    const size_t worker_count = std::min<size_t>(
+        count, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::future<void>> workers;
+    for (size_t w = 1; w < worker_count; ++w) {
+      workers.push_back(std::async(std::launch::async, work));
+    }
+    work();
+    for (std::future<void> &worker : workers) {
+      worker.get();
+    }
+
+    return succeeded;
+  }
+
+  static void write_offset(std::vector<uint8_t> &encoded, size_t block) {
+    const uint64_t offset = encoded.size();
+    memcpy(encoded.data() + sizeof(offset) * block, &offset, sizeof(offset));
+  }
+
+  static uint64_t read_offset(const uint8_t *encoded, size_t block) {
+    uint64_t offset;
+    memcpy(&offset, encoded + sizeof(offset) * block, sizeof(offset));
+    return offset;
+  }
+
+  static uint64_t read_chunk_offset(const uint8_t *encoded, size_t chunk) {
+    index_chunk_t c;
+    memcpy(&c, encoded + sizeof(c) * chunk, sizeof(c));
+    return c.offset;
+  }
+
+  static uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^
+           static_cast<uint64_t>(value >> 63);
+  }
+
+  static int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+
+  static void write_varint(std::vector<uint8_t> &encoded, uint64_t value) {
+    while (value >= 0x80) {
+      encoded.push_back(static_cast<uint8_t>(value | 0x80));
+      value >>= 7;
+    }
+    encoded.push_back(static_cast<uint8_t>(value));
+  }
+
+  static bool read_varint(const uint8_t *&p, const uint8_t *end,
+                          uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p >= end) {
+        return false;
+      }
+      const uint8_t byte = *p++;
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (0 == (byte & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+}  // namespace rtx
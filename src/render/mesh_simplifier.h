@@ -0,0 +1,531 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "glm.h"
+
+#include "constants.h"
+#include "object.h"
+#include "vertex.h"
+
+namespace rtx {
+
+// Mesh simplification based on quadric error metrics. See Garland and
+// Heckbert, "Surface Simplification Using Quadric Error Metrics".
+//
+// Edges are always collapsed onto one of their existing vertices, so the
+// simplified triangles reference the same vertices as the original mesh. That
+// allows every level of detail of an object to share a single vertex buffer.
+class mesh_simplifier {
+ public:
+  // Simplify the triangle list until it has at most target_index_count
+  // indices or until the next collapse would introduce an error bigger than
+  // target_error. Errors are relative to the extent of the mesh, so 0.01
+  // means 1% of its size.
+  static bool simplify(const std::vector<Vertex> &vertices,
+                       const std::vector<uint32_t> &indices,
+                       size_t target_index_count, float target_error,
+                       std::vector<uint32_t> &result, float &result_error) {
+    result = indices;
+    result_error = 0.0f;
+
+    if (0 != indices.size() % 3) {
+      std::cerr << "Simplifier: index count is not a multiple of 3."
+                << std::endl;
+      return false;
+    }
+
+    if (result.size() <= target_index_count || vertices.empty()) {
+      return true;
+    }
+
+    // Work with positions scaled to the unit cube so errors are relative to
+    // the mesh extent.
+    //
+    std::vector<glm::vec3> positions;
+    normalize_positions(vertices, positions);
+
+    // Vertices sharing their position with others are the result of texture
+    // or normal seams. Moving them would tear the mesh apart.
+    //
+    std::vector<uint32_t> position_ids;
+    std::vector<uint8_t> seams;
+    find_seams(vertices, position_ids, seams);
+
+    std::vector<quadric_t> quadrics(vertices.size());
+    init_quadrics(positions, position_ids, result, quadrics);
+
+    const double max_error =
+        static_cast<double>(target_error) * static_cast<double>(target_error);
+    double pass_max_error = 0.0;
+
+    std::vector<uint32_t> remap(vertices.size());
+    std::vector<uint8_t> kinds(vertices.size());
+    std::vector<uint8_t> locked(vertices.size());
+    std::unordered_map<uint64_t, uint32_t> edges;
+    std::vector<uint32_t> adjacency_offsets;
+    std::vector<uint32_t> adjacency;
+    std::vector<collapse_t> collapses;
+
+    while (result.size() > target_index_count) {
+      classify_vertices(result, position_ids, seams, kinds, edges);
+      build_adjacency(result, vertices.size(), adjacency_offsets, adjacency);
+
+      // Evaluate the cost of every allowed collapse.
+      //
+      collapses.clear();
+      for (size_t i = 0; i < result.size(); i += 3) {
+        for (uint32_t e = 0; e < 3; ++e) {
+          const uint32_t v0 = result[i + e];
+          const uint32_t v1 = result[i + (e + 1) % 3];
+
+          for (uint32_t direction = 0; direction < 2; ++direction) {
+            const uint32_t from = direction ? v1 : v0;
+            const uint32_t to = direction ? v0 : v1;
+            if (!is_collapse_allowed(from, to, kinds, position_ids, edges)) {
+              continue;
+            }
+
+            quadric_t q = quadrics[from];
+            q.add(quadrics[to]);
+
+            collapse_t collapse;
+            collapse.from = from;
+            collapse.to = to;
+            collapse.error = q.error(positions[to]);
+            collapses.push_back(collapse);
+          }
+        }
+      }
+
+      if (collapses.empty()) {
+        break;
+      }
+
+      std::sort(collapses.begin(), collapses.end(),
+                [](const collapse_t &a, const collapse_t &b) {
+                  return a.error < b.error;
+                });
+
+      // Every interior collapse removes two triangles. Limit the amount of
+      // collapses per pass to avoid overshooting the target.
+      const size_t triangles_to_remove =
+          (result.size() - target_index_count) / 3;
+      const size_t collapse_limit =
+          std::max<size_t>(1, triangles_to_remove / 2);
+
+      for (uint32_t v = 0; v < remap.size(); ++v) {
+        remap[v] = v;
+      }
+      std::fill(locked.begin(), locked.end(), 0);
+
+      size_t collapse_count = 0;
+      for (const auto &collapse : collapses) {
+        if (collapse.error > max_error) {
+          break;
+        }
+
+        if (locked[collapse.from] || locked[collapse.to]) {
+          continue;
+        }
+
+        if (has_triangle_flip(collapse.from, collapse.to, positions, result,
+                              adjacency_offsets, adjacency)) {
+          continue;
+        }
+
+        // Lock the neighbourhood of the collapsed vertex, so the flip test
+        // stays valid for the rest of collapses of this pass.
+        for (uint32_t a = adjacency_offsets[collapse.from];
+             a < adjacency_offsets[collapse.from + 1]; ++a) {
+          const uint32_t triangle = adjacency[a];
+          locked[result[triangle + 0]] = 1;
+          locked[result[triangle + 1]] = 1;
+          locked[result[triangle + 2]] = 1;
+        }
+
+        remap[collapse.from] = collapse.to;
+        quadrics[collapse.to].add(quadrics[collapse.from]);
+        pass_max_error = std::max(pass_max_error, collapse.error);
+
+        if (++collapse_count >= collapse_limit) {
+          break;
+        }
+      }
+
+      if (0 == collapse_count) {
+        break;
+      }
+
+      // Apply the collapses and drop the triangles that became degenerate.
+      //
+      size_t write = 0;
+      for (size_t i = 0; i < result.size(); i += 3) {
+        const uint32_t a = remap[result[i + 0]];
+        const uint32_t b = remap[result[i + 1]];
+        const uint32_t c = remap[result[i + 2]];
+        if (a == b || b == c || c == a) {
+          continue;
+        }
+        result[write + 0] = a;
+        result[write + 1] = b;
+        result[write + 2] = c;
+        write += 3;
+      }
+      result.resize(write);
+    }
+
+    result_error = static_cast<float>(std::sqrt(pass_max_error));
+
+    return true;
+  }
+
+  // Build a chain of levels of detail for the object. Each level targets half
+  // the triangles of the previous one. The indices of every level are
+  // appended to object.indices and described in object.lods.
+  static bool generate_lods(const std::vector<Vertex> &vertices,
+                            std::vector<uint32_t> &indices,
+                            std::vector<lod_t> &lods) {
+    lods.clear();
+
+    lod_t lod0;
+    lod0.first_index = 0;
+    lod0.index_count = static_cast<uint32_t>(indices.size());
+    lod0.error = 0.0f;
+    lods.push_back(lod0);
+
+    std::vector<uint32_t> source(indices);
+    std::vector<uint32_t> simplified;
+    float accumulated_error = 0.0f;
+
+    while (lods.size() < constants::MAX_LODS) {
+      const size_t target_index_count = (source.size() / 6) * 3;
+      if (target_index_count < MIN_LOD_INDEX_COUNT) {
+        break;
+      }
+
+      float error = 0.0f;
+      if (!simplify(vertices, source, target_index_count, MAX_LOD_ERROR,
+                    simplified, error)) {
+        std::cerr << "Failed to simplify LOD " << lods.size() << "."
+                  << std::endl;
+        return false;
+      }
+
+      // Stop when the simplifier can't make meaningful progress.
+      if (simplified.size() * 10 > source.size() * 9) {
+        break;
+      }
+
+      accumulated_error += error;
+
+      lod_t lod;
+      lod.first_index = static_cast<uint32_t>(indices.size());
+      lod.index_count = static_cast<uint32_t>(simplified.size());
+      lod.error = accumulated_error;
+      lods.push_back(lod);
+
+      indices.insert(indices.end(), simplified.begin(), simplified.end());
+      source.swap(simplified);
+    }
+
+    return true;
+  }
+
+ private:
+  // Lower bound of indices of the coarsest level of detail.
+  static constexpr size_t MIN_LOD_INDEX_COUNT = 3 * 64;
+
+  // Maximum relative error introduced by each level of detail.
+  static constexpr float MAX_LOD_ERROR = 0.05f;
+
+  // Weight of the planes that keep open borders in place.
+  static constexpr double BORDER_WEIGHT = 10.0;
+
+  enum vertex_kind : uint8_t {
+    kind_manifold = 0,  // Free to move.
+    kind_border = 1,    // Only moves along its open border.
+    kind_locked = 2,    // Seams and non-manifold vertices never move.
+  };
+
+  struct collapse_t {
+    uint32_t from;
+    uint32_t to;
+    double error;
+  };
+
+  // Symmetric 4x4 matrix accumulating the squared distances to a set of
+  // planes, weighted by the area of the triangles defining them.
+  struct quadric_t {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+
+    void add_plane(double a, double b, double c, double d, double w) {
+      a00 += w * a * a;
+      a01 += w * a * b;
+      a02 += w * a * c;
+      a03 += w * a * d;
+      a11 += w * b * b;
+      a12 += w * b * c;
+      a13 += w * b * d;
+      a22 += w * c * c;
+      a23 += w * c * d;
+      a33 += w * d * d;
+      weight += w;
+    }
+
+    void add(const quadric_t &q) {
+      a00 += q.a00;
+      a01 += q.a01;
+      a02 += q.a02;
+      a03 += q.a03;
+      a11 += q.a11;
+      a12 += q.a12;
+      a13 += q.a13;
+      a22 += q.a22;
+      a23 += q.a23;
+      a33 += q.a33;
+      weight += q.weight;
+    }
+
+    // Mean squared distance from p to the planes.
+    double error(const glm::vec3 &p) const {
+      const double x = p.x;
+      const double y = p.y;
+      const double z = p.z;
+      double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z +
+                 2 * a03 * x + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y +
+                 a22 * z * z + 2 * a23 * z + a33;
+      e = std::max(e, 0.0);
+      return weight > 0 ? e / weight : e;
+    }
+  };
+
+  static uint64_t edge_key(uint32_t a, uint32_t b) {
+    return a < b ? (static_cast<uint64_t>(a) << 32) | b
+                 : (static_cast<uint64_t>(b) << 32) | a;
+  }
+
+  static void normalize_positions(const std::vector<Vertex> &vertices,
+                                  std::vector<glm::vec3> &positions) {
+    glm::vec3 min_position = vertices[0].pos;
+    glm::vec3 max_position = vertices[0].pos;
+    for (const auto &vertex : vertices) {
+      min_position = glm::min(min_position, vertex.pos);
+      max_position = glm::max(max_position, vertex.pos);
+    }
+
+    const glm::vec3 size = max_position - min_position;
+    const float extent = std::max(size.x, std::max(size.y, size.z));
+    const float scale = extent > 0.0f ? 1.0f / extent : 0.0f;
+
+    positions.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      positions[i] = (vertices[i].pos - min_position) * scale;
+    }
+  }
+
+  static void find_seams(const std::vector<Vertex> &vertices,
+                         std::vector<uint32_t> &position_ids,
+                         std::vector<uint8_t> &seams) {
+    std::unordered_map<glm::vec3, uint32_t> unique_positions;
+    std::vector<uint32_t> position_users;
+
+    position_ids.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      auto it = unique_positions.find(vertices[i].pos);
+      if (it == unique_positions.end()) {
+        uint32_t id = static_cast<uint32_t>(position_users.size());
+        unique_positions.emplace(vertices[i].pos, id);
+        position_users.push_back(0);
+        position_ids[i] = id;
+      } else {
+        position_ids[i] = it->second;
+      }
+      ++position_users[position_ids[i]];
+    }
+
+    seams.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      seams[i] = position_users[position_ids[i]] > 1 ? 1 : 0;
+    }
+  }
+
+  static void init_quadrics(const std::vector<glm::vec3> &positions,
+                            const std::vector<uint32_t> &position_ids,
+                            const std::vector<uint32_t> &indices,
+                            std::vector<quadric_t> &quadrics) {
+    // Count how many triangles use each edge to find the open borders.
+    std::unordered_map<uint64_t, uint32_t> edges;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      for (uint32_t e = 0; e < 3; ++e) {
+        const uint32_t a = position_ids[indices[i + e]];
+        const uint32_t b = position_ids[indices[i + (e + 1) % 3]];
+        ++edges[edge_key(a, b)];
+      }
+    }
+
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      const uint32_t v[3] = {indices[i + 0], indices[i + 1], indices[i + 2]};
+      const glm::vec3 p0 = positions[v[0]];
+      const glm::vec3 p1 = positions[v[1]];
+      const glm::vec3 p2 = positions[v[2]];
+
+      glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+      const float length = glm::length(normal);
+      if (length <= 0.0f) {
+        continue;  // Degenerate triangle.
+      }
+      normal /= length;
+      const double area = 0.5 * length;
+      const double d = -glm::dot(normal, p0);
+
+      for (uint32_t k = 0; k < 3; ++k) {
+        quadrics[v[k]].add_plane(normal.x, normal.y, normal.z, d, area);
+      }
+
+      // Keep open borders in place with a plane perpendicular to the
+      // triangle that contains the border edge.
+      for (uint32_t e = 0; e < 3; ++e) {
+        const uint32_t a = v[e];
+        const uint32_t b = v[(e + 1) % 3];
+        if (1 != edges[edge_key(position_ids[a], position_ids[b])]) {
+          continue;
+        }
+
+        const glm::vec3 edge = positions[b] - positions[a];
+        const float edge_length = glm::length(edge);
+        if (edge_length <= 0.0f) {
+          continue;
+        }
+        const glm::vec3 border_normal =
+            glm::normalize(glm::cross(edge, normal));
+        const double border_d = -glm::dot(border_normal, positions[a]);
+        const double w = edge_length * edge_length * BORDER_WEIGHT;
+
+        quadrics[a].add_plane(border_normal.x, border_normal.y,
+                              border_normal.z, border_d, w);
+        quadrics[b].add_plane(border_normal.x, border_normal.y,
+                              border_normal.z, border_d, w);
+      }
+    }
+  }
+
+  static void classify_vertices(const std::vector<uint32_t> &indices,
+                                const std::vector<uint32_t> &position_ids,
+                                const std::vector<uint8_t> &seams,
+                                std::vector<uint8_t> &kinds,
+                                std::unordered_map<uint64_t, uint32_t> &edges) {
+    edges.clear();
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      for (uint32_t e = 0; e < 3; ++e) {
+        const uint32_t a = position_ids[indices[i + e]];
+        const uint32_t b = position_ids[indices[i + (e + 1) % 3]];
+        ++edges[edge_key(a, b)];
+      }
+    }
+
+    for (size_t v = 0; v < kinds.size(); ++v) {
+      kinds[v] = seams[v] ? kind_locked : kind_manifold;
+    }
+
+    for (size_t i = 0; i < indices.size(); i += 3) {
+      for (uint32_t e = 0; e < 3; ++e) {
+        const uint32_t a = indices[i + e];
+        const uint32_t b = indices[i + (e + 1) % 3];
+        const uint32_t count =
+            edges[edge_key(position_ids[a], position_ids[b])];
+        if (count == 2) {
+          continue;
+        }
+
+        const uint8_t kind = count == 1 ? kind_border : kind_locked;
+        kinds[a] = std::max(kinds[a], kind);
+        kinds[b] = std::max(kinds[b], kind);
+      }
+    }
+  }
+
+  static bool is_collapse_allowed(
+      uint32_t from, uint32_t to, const std::vector<uint8_t> &kinds,
+      const std::vector<uint32_t> &position_ids,
+      const std::unordered_map<uint64_t, uint32_t> &edges) {
+    switch (kinds[from]) {
+      case kind_manifold:
+        return true;
+      case kind_border: {
+        // Border vertices only slide along their border.
+        auto it = edges.find(edge_key(position_ids[from], position_ids[to]));
+        return it != edges.end() && 1 == it->second &&
+               kinds[to] != kind_manifold;
+      }
+      default:
+        return false;
+    }
+  }
+
+  static void build_adjacency(const std::vector<uint32_t> &indices,
+                              size_t vertex_count,
+                              std::vector<uint32_t> &offsets,
+                              std::vector<uint32_t> &adjacency) {
+    offsets.assign(vertex_count + 1, 0);
+    for (uint32_t index : indices) {
+      ++offsets[index + 1];
+    }
+    for (size_t v = 0; v < vertex_count; ++v) {
+      offsets[v + 1] += offsets[v];
+    }
+
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    adjacency.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+      const uint32_t triangle = static_cast<uint32_t>(i - i % 3);
+      adjacency[fill[indices[i]]++] = triangle;
+    }
+  }
+
+  // Whether moving the vertex from onto the vertex to would flip the
+  // orientation of any of the triangles around it.
+  static bool has_triangle_flip(uint32_t from, uint32_t to,
+                                const std::vector<glm::vec3> &positions,
+                                const std::vector<uint32_t> &indices,
+                                const std::vector<uint32_t> &offsets,
+                                const std::vector<uint32_t> &adjacency) {
+    for (uint32_t a = offsets[from]; a < offsets[from + 1]; ++a) {
+      const uint32_t triangle = adjacency[a];
+      const uint32_t v[3] = {indices[triangle + 0], indices[triangle + 1],
+                             indices[triangle + 2]};
+
+      if (v[0] == to || v[1] == to || v[2] == to) {
+        continue;  // The triangle will collapse.
+      }
+
+      glm::vec3 p[3] = {positions[v[0]], positions[v[1]], positions[v[2]]};
+      const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+      for (uint32_t k = 0; k < 3; ++k) {
+        if (v[k] == from) {
+          p[k] = positions[to];
+        }
+      }
+      const glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+      if (glm::dot(before, after) <= 0.0f) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+};
+
+}  // namespace rtx
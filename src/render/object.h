@@ -6,27 +6,38 @@
 
 #include "glm.h"
 
+#include "skin.h"
 #include "vertex.h"
 
 namespace rtx {
 
+// Level of detail of an object. All the levels share the vertices of the
+// object and their indices are stored one after another in its index buffer.
+struct lod_t {
+  uint32_t first_index;  // Position of the first index of the level.
+  uint32_t index_count;
+  float error;  // Simplification error, relative to the object extent.
+};
+
+// Surface of an instance, as in material.glsl.
+struct material_t {
+  int illumination = 2;  // 3 reflects.
+  glm::vec3 diffuse = glm::vec3(0.8f);
+  glm::vec3 specular = glm::vec3(0.8f);
+};
+
 struct object_model_t {
   // Vertex
   //
   std::vector<Vertex> vertices;
-  VkBuffer vertex_buf;  // Buffer containing the vertex coordinates.
-  VkDeviceSize
-      vertex_offset;  // Offset of the first vertex inside the vertex buffer.
-  VkDeviceMemory vertex_mem;
+  VkDeviceSize vertex_offset = 0;  // Of the first vertex, in bytes, inside
+                                   // the geometry buffer of the engine.
 
   // Index
   //
-  std::vector<uint32_t> indices;
-  VkBuffer index_buf;  // Buffer containing the vertex indices describing the
-                       // triangles.
-                       // TODO: Merge with vertex buffer.
-  VkDeviceSize index_offset;  // Offset of the first index inside the buffer.
-  VkDeviceMemory index_mem;
+  std::vector<uint32_t> indices;  // Describing the triangles.
+  VkDeviceSize index_offset = 0;  // Of the first index, in bytes, inside the
+                                  // geometry buffer of the engine.
 
   // Transform
   // VkBuffer transform_buf; // Buffer containing a 4x4 transform matrix in GPU
@@ -35,7 +46,33 @@ struct object_model_t {
   //                                // transform buffer.
   // VkDeviceMemory transform_mem;
 
+  // Instances of the object, each with its own transform and material. All
+  // of them share the geometry of the object.
+  //
   std::vector<glm::mat4> transforms;
+  std::vector<material_t> materials;
+
+  // Position of the first instance in the buffer of instance transforms of
+  // the rasterizer.
+  uint32_t first_instance = 0;
+
+  // Whether the instances sample the bound texture. Otherwise they are white.
+  bool textured = false;
+
+  // Levels of detail, from the full resolution mesh to the coarsest one.
+  //
+  std::vector<lod_t> lods;
+
+  // Bounding box in object space.
+  //
+  glm::vec3 aabb_min;
+  glm::vec3 aabb_max;
+
+  // Joints, weights and clips of animated objects, empty for static ones.
+  // Skinned vertices are written over the vertices of the object in the
+  // geometry buffer of the engine every frame.
+  //
+  skin_t skin;
 };
 
 // TODO: Delete
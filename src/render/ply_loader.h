@@ -0,0 +1,514 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <future>
+#include <initializer_list>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glm.h"
+#include "mapped_file.h"
+#include "object.h"
+#include "vertex.h"
+#include "vertex_normals.h"
+
+namespace rtx {
+
+// Loader of binary PLY models, as 3D scans usually ship.
+//
+// The file is memory mapped and its vertices decoded in chunks, on a pool of
+// threads, straight into the vertices of the object. PLY faces are already
+// indexed, so unlike OBJ there is no deduplication. Polygons are fanned into
+// triangles, and normals are computed when the file has none. Vertex colors
+// and other elements are skipped.
+class ply_loader {
+ public:
+  static bool is_ply(const std::string &path) {
+    std::string extension;
+    const size_t dot = path.find_last_of('.');
+    if (std::string::npos != dot) {
+      extension = path.substr(dot);
+    }
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return ".ply" == extension;
+  }
+
+  static bool load(const std::string &path, object_model_t &object) {
+    mapped_file file;
+    if (!file.open(path)) {
+      return false;
+    }
+
+    std::vector<element_t> elements;
+    size_t offset = 0;
+    bool big_endian = false;
+    if (!read_header(file, elements, offset, big_endian)) {
+      std::cerr << "Invalid PLY header in " << path << "." << std::endl;
+      return false;
+    }
+
+    bool has_vertices = false;
+    bool has_normals = false;
+    for (const element_t &element : elements) {
+      bool read = true;
+      if ("vertex" == element.name && !has_vertices) {
+        read = read_vertices(file, element, big_endian, offset,
+                             object.vertices, has_normals);
+        has_vertices = true;
+      } else if ("face" == element.name) {
+        read = read_faces(file, element, big_endian, offset, object.indices);
+      } else {
+        read = skip(file, element, big_endian, offset);
+      }
+      if (!read) {
+        std::cerr << "PLY model " << path << " is truncated or invalid."
+                  << std::endl;
+        return false;
+      }
+    }
+
+    // Faces may come before the vertices.
+    for (uint32_t index : object.indices) {
+      if (index >= object.vertices.size()) {
+        std::cerr << "PLY model " << path << " indexes past its vertices."
+                  << std::endl;
+        return false;
+      }
+    }
+
+    if (!has_normals) {
+      vertex_normals::compute(object.vertices, object.indices);
+    }
+
+    return true;
+  }
+
+ private:
+  enum scalar_type {
+    type_int8 = 0,
+    type_uint8 = 1,
+    type_int16 = 2,
+    type_uint16 = 3,
+    type_int32 = 4,
+    type_uint32 = 5,
+    type_float32 = 6,
+    type_float64 = 7,
+    type_unknown = 8
+  };
+
+  struct property_t {
+    std::string name;
+    scalar_type type = type_unknown;
+    bool list = false;
+    scalar_type count_type = type_unknown;  // Of lists.
+    size_t offset = 0;  // In elements of fixed size.
+  };
+
+  struct element_t {
+    std::string name;
+    size_t count = 0;
+    std::vector<property_t> properties;
+    size_t size = 0;  // In bytes, 0 if some property is a list.
+  };
+
+  // Decoded by each worker at once.
+  static constexpr size_t VERTEX_CHUNK = 1 << 16;
+
+  // Lines up to end_header. offset is set to the first byte of the data.
+  static bool read_header(const mapped_file &file,
+                          std::vector<element_t> &elements, size_t &offset,
+                          bool &big_endian) {
+    const char *text = reinterpret_cast<const char *>(file.data());
+    if (file.size() < 4 || 0 != memcmp(text, "ply", 3) ||
+        ('\n' != text[3] && '\r' != text[3])) {
+      return false;
+    }
+
+    size_t line_start = 0;
+    bool has_format = false;
+    while (line_start < file.size()) {
+      const char *line_end = static_cast<const char *>(
+          memchr(text + line_start, '\n', file.size() - line_start));
+      if (!line_end) {
+        return false;
+      }
+      std::string line(text + line_start, line_end);
+      if (!line.empty() && '\r' == line.back()) {
+        line.pop_back();
+      }
+      line_start = line_end - text + 1;
+
+      std::istringstream words(line);
+      std::string keyword;
+      words >> keyword;
+      if ("format" == keyword) {
+        std::string format;
+        words >> format;
+        if ("binary_little_endian" == format) {
+          big_endian = false;
+        } else if ("binary_big_endian" == format) {
+          big_endian = true;
+        } else {
+          std::cerr << "Only binary PLY models are supported, not " << format
+                    << "." << std::endl;
+          return false;
+        }
+        has_format = true;
+      } else if ("element" == keyword) {
+        element_t element;
+        words >> element.name >> element.count;
+        if (!words) {
+          return false;
+        }
+        elements.push_back(element);
+      } else if ("property" == keyword) {
+        if (elements.empty()) {
+          return false;
+        }
+        property_t property;
+        std::string type;
+        words >> type;
+        if ("list" == type) {
+          std::string count_type;
+          words >> count_type >> type;
+          property.list = true;
+          property.count_type = parse_type(count_type);
+          if (type_unknown == property.count_type) {
+            return false;
+          }
+        }
+        property.type = parse_type(type);
+        words >> property.name;
+        if (!words || type_unknown == property.type) {
+          return false;
+        }
+        elements.back().properties.push_back(property);
+      } else if ("end_header" == keyword) {
+        offset = line_start;
+        break;
+      }
+    }
+
+    if (!has_format || 0 == offset) {
+      return false;
+    }
+
+    for (element_t &element : elements) {
+      for (property_t &property : element.properties) {
+        if (property.list) {
+          element.size = 0;
+          break;
+        }
+        property.offset = element.size;
+        element.size += type_size(property.type);
+      }
+    }
+
+    return true;
+  }
+
+  static scalar_type parse_type(const std::string &name) {
+    if ("char" == name || "int8" == name) {
+      return type_int8;
+    }
+    if ("uchar" == name || "uint8" == name) {
+      return type_uint8;
+    }
+    if ("short" == name || "int16" == name) {
+      return type_int16;
+    }
+    if ("ushort" == name || "uint16" == name) {
+      return type_uint16;
+    }
+    if ("int" == name || "int32" == name) {
+      return type_int32;
+    }
+    if ("uint" == name || "uint32" == name) {
+      return type_uint32;
+    }
+    if ("float" == name || "float32" == name) {
+      return type_float32;
+    }
+    if ("double" == name || "float64" == name) {
+      return type_float64;
+    }
+    return type_unknown;
+  }
+
+  static size_t type_size(scalar_type type) {
+    switch (type) {
+      case type_int8:
+      case type_uint8:
+        return 1;
+      case type_int16:
+      case type_uint16:
+        return 2;
+      case type_int32:
+      case type_uint32:
+      case type_float32:
+        return 4;
+      case type_float64:
+        return 8;
+      case type_unknown:
+        break;
+    }
+    return 0;
+  }
+
+  // Scalar at data, swapped from big endian if needed.
+  static double read_scalar(const uint8_t *data, scalar_type type,
+                            bool big_endian) {
+    uint8_t bytes[8];
+    const size_t size = type_size(type);
+    memcpy(bytes, data, size);
+    if (big_endian) {
+      std::reverse(bytes, bytes + size);
+    }
+    switch (type) {
+      case type_int8:
+        return static_cast<int8_t>(bytes[0]);
+      case type_uint8:
+        return bytes[0];
+      case type_int16: {
+        int16_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+      }
+      case type_uint16: {
+        uint16_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+      }
+      case type_int32: {
+        int32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+      }
+      case type_uint32: {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+      }
+      case type_float32: {
+        float value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+      }
+      case type_float64: {
+        double value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+      }
+      case type_unknown:
+        break;
+    }
+    return 0.0;
+  }
+
+  // Position of the property named by one of names, -1 if missing.
+  static int find_property(const element_t &element,
+                           std::initializer_list<const char *> names) {
+    for (size_t p = 0; p < element.properties.size(); ++p) {
+      for (const char *name : names) {
+        if (element.properties[p].name == name) {
+          return static_cast<int>(p);
+        }
+      }
+    }
+    return -1;
+  }
+
+  static bool read_vertices(const mapped_file &file, const element_t &element,
+                            bool big_endian, size_t &offset,
+                            std::vector<Vertex> &vertices,
+                            bool &has_normals) {
+    // Vertices with lists have no fixed size, and no use here.
+    if (0 == element.size ||
+        element.count > (file.size() - offset) / element.size) {
+      return false;
+    }
+
+    const int x = find_property(element, {"x"});
+    const int y = find_property(element, {"y"});
+    const int z = find_property(element, {"z"});
+    const int nx = find_property(element, {"nx"});
+    const int ny = find_property(element, {"ny"});
+    const int nz = find_property(element, {"nz"});
+    const int u = find_property(element, {"u", "s", "texture_u", "texture_s"});
+    const int v = find_property(element, {"v", "t", "texture_v", "texture_t"});
+    if (x < 0 || y < 0 || z < 0) {
+      return false;
+    }
+    has_normals = nx >= 0 && ny >= 0 && nz >= 0;
+    const bool has_tex_coords = u >= 0 && v >= 0;
+
+    const uint8_t *data = file.data() + offset;
+    auto read = [&](const uint8_t *vertex, int property) {
+      const property_t &p = element.properties[property];
+      if (type_float32 == p.type && !big_endian) {
+        float value;
+        memcpy(&value, vertex + p.offset, sizeof(value));
+        return value;
+      }
+      return static_cast<float>(read_scalar(vertex + p.offset, p.type,
+                                            big_endian));
+    };
+
+    vertices.resize(element.count);
+    std::atomic<size_t> next_chunk(0);
+    const size_t chunk_count =
+        (element.count + VERTEX_CHUNK - 1) / VERTEX_CHUNK;
+    auto decode = [&]() {
+      for (size_t chunk = next_chunk++; chunk < chunk_count;
+           chunk = next_chunk++) {
+        const size_t first = chunk * VERTEX_CHUNK;
+        const size_t last = std::min(first + VERTEX_CHUNK, element.count);
+        for (size_t i = first; i < last; ++i) {
+          const uint8_t *source = data + element.size * i;
+          Vertex &vertex = vertices[i];
+          vertex.pos = glm::vec3(read(source, x), read(source, y),
+                                 read(source, z));
+          vertex.normal = has_normals
+                              ? glm::vec3(read(source, nx), read(source, ny),
+                                          read(source, nz))
+                              : glm::vec3(0.0f);
+          // Bottom left origin, like OBJ.
+          vertex.tex_coord =
+              has_tex_coords
+                  ? glm::vec2(read(source, u), 1.0f - read(source, v))
+                  : glm::vec2(0.0f);
+        }
+      }
+    };
+
+    const size_t worker_count = std::min<size_t>(
+        chunk_count, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::future<void>> workers;
+    for (size_t w = 1; w < worker_count; ++w) {
+      workers.push_back(std::async(std::launch::async, decode));
+    }
+    decode();
+    for (std::future<void> &worker : workers) {
+      worker.get();
+    }
+
+    offset += element.size * element.count;
+    return true;
+  }
+
+  // Whether a list count or an index, read as a double whatever its type,
+  // is a whole number from 0 to max. Converting anything else, NaN
+  // included, is undefined.
+  static bool whole(double value, double max) {
+    return value >= 0.0 && value <= max && std::floor(value) == value;
+  }
+
+  // Faces are lists of vertex indices, fanned into triangles.
+  static bool read_faces(const mapped_file &file, const element_t &element,
+                         bool big_endian, size_t &offset,
+                         std::vector<uint32_t> &indices) {
+    const int face_indices =
+        find_property(element, {"vertex_indices", "vertex_index"});
+    if (face_indices < 0 || !element.properties[face_indices].list) {
+      return false;
+    }
+
+    indices.reserve(indices.size() + 3 * element.count);
+    const uint8_t *data = file.data();
+    const size_t size = file.size();
+    std::vector<uint32_t> polygon;
+    for (size_t f = 0; f < element.count; ++f) {
+      for (size_t p = 0; p < element.properties.size(); ++p) {
+        const property_t &property = element.properties[p];
+        size_t count = 1;
+        if (property.list) {
+          const size_t count_size = type_size(property.count_type);
+          if (count_size > size - offset) {
+            return false;
+          }
+          const double list_count =
+              read_scalar(data + offset, property.count_type, big_endian);
+          if (!whole(list_count, static_cast<double>(size))) {
+            return false;
+          }
+          count = static_cast<size_t>(list_count);
+          offset += count_size;
+        }
+
+        const size_t value_size = type_size(property.type);
+        if (count > (size - offset) / value_size) {
+          return false;
+        }
+        if (face_indices == static_cast<int>(p)) {
+          polygon.resize(count);
+          for (size_t i = 0; i < count; ++i) {
+            const double index = read_scalar(
+                data + offset + value_size * i, property.type, big_endian);
+            if (!whole(index, static_cast<double>(UINT32_MAX))) {
+              return false;
+            }
+            polygon[i] = static_cast<uint32_t>(index);
+          }
+          for (size_t i = 2; i < count; ++i) {
+            indices.push_back(polygon[0]);
+            indices.push_back(polygon[i - 1]);
+            indices.push_back(polygon[i]);
+          }
+        }
+        offset += value_size * count;
+      }
+    }
+
+    return true;
+  }
+
+  static bool skip(const mapped_file &file, const element_t &element,
+                   bool big_endian, size_t &offset) {
+    const size_t size = file.size();
+    if (element.size > 0) {
+      if (element.count > (size - offset) / element.size) {
+        return false;
+      }
+      offset += element.size * element.count;
+      return true;
+    }
+
+    for (size_t e = 0; e < element.count; ++e) {
+      for (const property_t &property : element.properties) {
+        size_t count = 1;
+        if (property.list) {
+          const size_t count_size = type_size(property.count_type);
+          if (count_size > size - offset) {
+            return false;
+          }
+          const double list_count = read_scalar(
+              file.data() + offset, property.count_type, big_endian);
+          if (!whole(list_count, static_cast<double>(size))) {
+            return false;
+          }
+          count = static_cast<size_t>(list_count);
+          offset += count_size;
+        }
+        const size_t value_size = type_size(property.type);
+        if (count > (size - offset) / value_size) {
+          return false;
+        }
+        offset += value_size * count;
+      }
+    }
+
+    return true;
+  }
+};
+
+}  // namespace rtx
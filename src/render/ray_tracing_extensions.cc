@@ -4,227 +4,247 @@
 
 #include <vulkan/vulkan.h>
 
-static PFN_vkCreateAccelerationStructureNV pfn_vkCreateAccelerationStructureNV =
+static PFN_vkCreateAccelerationStructureKHR
+    pfn_vkCreateAccelerationStructureKHR = 0;
+static PFN_vkDestroyAccelerationStructureKHR
+    pfn_vkDestroyAccelerationStructureKHR = 0;
+static PFN_vkGetAccelerationStructureBuildSizesKHR
+    pfn_vkGetAccelerationStructureBuildSizesKHR = 0;
+static PFN_vkGetAccelerationStructureDeviceAddressKHR
+    pfn_vkGetAccelerationStructureDeviceAddressKHR = 0;
+static PFN_vkCmdBuildAccelerationStructuresKHR
+    pfn_vkCmdBuildAccelerationStructuresKHR = 0;
+static PFN_vkCmdCopyAccelerationStructureKHR
+    pfn_vkCmdCopyAccelerationStructureKHR = 0;
+static PFN_vkCmdWriteAccelerationStructuresPropertiesKHR
+    pfn_vkCmdWriteAccelerationStructuresPropertiesKHR = 0;
+static PFN_vkCmdCopyAccelerationStructureToMemoryKHR
+    pfn_vkCmdCopyAccelerationStructureToMemoryKHR = 0;
+static PFN_vkCmdCopyMemoryToAccelerationStructureKHR
+    pfn_vkCmdCopyMemoryToAccelerationStructureKHR = 0;
+static PFN_vkGetDeviceAccelerationStructureCompatibilityKHR
+    pfn_vkGetDeviceAccelerationStructureCompatibilityKHR = 0;
+static PFN_vkCmdTraceRaysKHR pfn_vkCmdTraceRaysKHR = 0;
+static PFN_vkCreateRayTracingPipelinesKHR pfn_vkCreateRayTracingPipelinesKHR =
     0;
-static PFN_vkDestroyAccelerationStructureNV
-    pfn_vkDestroyAccelerationStructureNV = 0;
-static PFN_vkGetAccelerationStructureMemoryRequirementsNV
-    pfn_vkGetAccelerationStructureMemoryRequirementsNV = 0;
-static PFN_vkBindAccelerationStructureMemoryNV
-    pfn_vkBindAccelerationStructureMemoryNV = 0;
-static PFN_vkCmdBuildAccelerationStructureNV
-    pfn_vkCmdBuildAccelerationStructureNV = 0;
-static PFN_vkCmdCopyAccelerationStructureNV
-    pfn_vkCmdCopyAccelerationStructureNV = 0;
-static PFN_vkCmdTraceRaysNV pfn_vkCmdTraceRaysNV = 0;
-static PFN_vkCreateRayTracingPipelinesNV pfn_vkCreateRayTracingPipelinesNV = 0;
-static PFN_vkGetRayTracingShaderGroupHandlesNV
-    pfn_vkGetRayTracingShaderGroupHandlesNV = 0;
-static PFN_vkGetAccelerationStructureHandleNV
-    pfn_vkGetAccelerationStructureHandleNV = 0;
-static PFN_vkCmdWriteAccelerationStructuresPropertiesNV
-    pfn_vkCmdWriteAccelerationStructuresPropertiesNV = 0;
-static PFN_vkCompileDeferredNV pfn_vkCompileDeferredNV = 0;
-
-VKAPI_ATTR VkResult VKAPI_CALL vkCreateAccelerationStructureNV(
-    VkDevice device, const VkAccelerationStructureCreateInfoNV* pCreateInfo,
+static PFN_vkGetRayTracingShaderGroupHandlesKHR
+    pfn_vkGetRayTracingShaderGroupHandlesKHR = 0;
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateAccelerationStructureKHR(
+    VkDevice device, const VkAccelerationStructureCreateInfoKHR* pCreateInfo,
     const VkAllocationCallbacks* pAllocator,
-    VkAccelerationStructureNV* pAccelerationStructure) {
-  return pfn_vkCreateAccelerationStructureNV(device, pCreateInfo, pAllocator,
-                                             pAccelerationStructure);
+    VkAccelerationStructureKHR* pAccelerationStructure) {
+  return pfn_vkCreateAccelerationStructureKHR(device, pCreateInfo, pAllocator,
+                                              pAccelerationStructure);
 }
-VKAPI_ATTR void VKAPI_CALL vkDestroyAccelerationStructureNV(
-    VkDevice device, VkAccelerationStructureNV accelerationStructure,
+VKAPI_ATTR void VKAPI_CALL vkDestroyAccelerationStructureKHR(
+    VkDevice device, VkAccelerationStructureKHR accelerationStructure,
     const VkAllocationCallbacks* pAllocator) {
-  pfn_vkDestroyAccelerationStructureNV(device, accelerationStructure,
-                                       pAllocator);
-}
-VKAPI_ATTR void VKAPI_CALL vkGetAccelerationStructureMemoryRequirementsNV(
-    VkDevice device,
-    const VkAccelerationStructureMemoryRequirementsInfoNV* pInfo,
-    VkMemoryRequirements2KHR* pMemoryRequirements) {
-  pfn_vkGetAccelerationStructureMemoryRequirementsNV(device, pInfo,
-                                                     pMemoryRequirements);
+  pfn_vkDestroyAccelerationStructureKHR(device, accelerationStructure,
+                                        pAllocator);
 }
-VKAPI_ATTR VkResult VKAPI_CALL vkBindAccelerationStructureMemoryNV(
-    VkDevice device, uint32_t bindInfoCount,
-    const VkBindAccelerationStructureMemoryInfoNV* pBindInfos) {
-  return pfn_vkBindAccelerationStructureMemoryNV(device, bindInfoCount,
-                                                 pBindInfos);
+VKAPI_ATTR void VKAPI_CALL vkGetAccelerationStructureBuildSizesKHR(
+    VkDevice device, VkAccelerationStructureBuildTypeKHR buildType,
+    const VkAccelerationStructureBuildGeometryInfoKHR* pBuildInfo,
+    const uint32_t* pMaxPrimitiveCounts,
+    VkAccelerationStructureBuildSizesInfoKHR* pSizeInfo) {
+  pfn_vkGetAccelerationStructureBuildSizesKHR(device, buildType, pBuildInfo,
+                                              pMaxPrimitiveCounts, pSizeInfo);
 }
-VKAPI_ATTR void VKAPI_CALL vkCmdBuildAccelerationStructureNV(
-    VkCommandBuffer commandBuffer, const VkAccelerationStructureInfoNV* pInfo,
-    VkBuffer instanceData, VkDeviceSize instanceOffset, VkBool32 update,
-    VkAccelerationStructureNV dst, VkAccelerationStructureNV src,
-    VkBuffer scratch, VkDeviceSize scratchOffset) {
-  pfn_vkCmdBuildAccelerationStructureNV(commandBuffer, pInfo, instanceData,
-                                        instanceOffset, update, dst, src,
-                                        scratch, scratchOffset);
+VKAPI_ATTR VkDeviceAddress VKAPI_CALL
+vkGetAccelerationStructureDeviceAddressKHR(
+    VkDevice device, const VkAccelerationStructureDeviceAddressInfoKHR* pInfo) {
+  return pfn_vkGetAccelerationStructureDeviceAddressKHR(device, pInfo);
 }
-VKAPI_ATTR void VKAPI_CALL vkCmdCopyAccelerationStructureNV(
-    VkCommandBuffer commandBuffer, VkAccelerationStructureNV dst,
-    VkAccelerationStructureNV src, VkCopyAccelerationStructureModeNV mode) {
-  pfn_vkCmdCopyAccelerationStructureNV(commandBuffer, dst, src, mode);
+VKAPI_ATTR void VKAPI_CALL vkCmdBuildAccelerationStructuresKHR(
+    VkCommandBuffer commandBuffer, uint32_t infoCount,
+    const VkAccelerationStructureBuildGeometryInfoKHR* pInfos,
+    const VkAccelerationStructureBuildRangeInfoKHR* const* ppBuildRangeInfos) {
+  pfn_vkCmdBuildAccelerationStructuresKHR(commandBuffer, infoCount, pInfos,
+                                          ppBuildRangeInfos);
 }
-VKAPI_ATTR void VKAPI_CALL vkCmdTraceRaysNV(
-    VkCommandBuffer commandBuffer, VkBuffer raygenShaderBindingTableBuffer,
-    VkDeviceSize raygenShaderBindingOffset,
-    VkBuffer missShaderBindingTableBuffer, VkDeviceSize missShaderBindingOffset,
-    VkDeviceSize missShaderBindingStride, VkBuffer hitShaderBindingTableBuffer,
-    VkDeviceSize hitShaderBindingOffset, VkDeviceSize hitShaderBindingStride,
-    VkBuffer callableShaderBindingTableBuffer,
-    VkDeviceSize callableShaderBindingOffset,
-    VkDeviceSize callableShaderBindingStride, uint32_t width, uint32_t height,
-    uint32_t depth) {
-  pfn_vkCmdTraceRaysNV(commandBuffer, raygenShaderBindingTableBuffer,
-                       raygenShaderBindingOffset, missShaderBindingTableBuffer,
-                       missShaderBindingOffset, missShaderBindingStride,
-                       hitShaderBindingTableBuffer, hitShaderBindingOffset,
-                       hitShaderBindingStride, callableShaderBindingTableBuffer,
-                       callableShaderBindingOffset, callableShaderBindingStride,
-                       width, height, depth);
+VKAPI_ATTR void VKAPI_CALL vkCmdCopyAccelerationStructureKHR(
+    VkCommandBuffer commandBuffer,
+    const VkCopyAccelerationStructureInfoKHR* pInfo) {
+  pfn_vkCmdCopyAccelerationStructureKHR(commandBuffer, pInfo);
 }
-VKAPI_ATTR VkResult VKAPI_CALL vkCreateRayTracingPipelinesNV(
-    VkDevice device, VkPipelineCache pipelineCache, uint32_t createInfoCount,
-    const VkRayTracingPipelineCreateInfoNV* pCreateInfos,
-    const VkAllocationCallbacks* pAllocator, VkPipeline* pPipelines) {
-  return pfn_vkCreateRayTracingPipelinesNV(device, pipelineCache,
-                                           createInfoCount, pCreateInfos,
-                                           pAllocator, pPipelines);
-}
-VKAPI_ATTR VkResult VKAPI_CALL vkGetRayTracingShaderGroupHandlesNV(
-    VkDevice device, VkPipeline pipeline, uint32_t firstGroup,
-    uint32_t groupCount, size_t dataSize, void* pData) {
-  return pfn_vkGetRayTracingShaderGroupHandlesNV(device, pipeline, firstGroup,
-                                                 groupCount, dataSize, pData);
-}
-VKAPI_ATTR VkResult VKAPI_CALL vkGetAccelerationStructureHandleNV(
-    VkDevice device, VkAccelerationStructureNV accelerationStructure,
-    size_t dataSize, void* pData) {
-  return pfn_vkGetAccelerationStructureHandleNV(device, accelerationStructure,
-                                                dataSize, pData);
-}
-VKAPI_ATTR void VKAPI_CALL vkCmdWriteAccelerationStructuresPropertiesNV(
+VKAPI_ATTR void VKAPI_CALL vkCmdWriteAccelerationStructuresPropertiesKHR(
     VkCommandBuffer commandBuffer, uint32_t accelerationStructureCount,
-    const VkAccelerationStructureNV* pAccelerationStructures,
+    const VkAccelerationStructureKHR* pAccelerationStructures,
     VkQueryType queryType, VkQueryPool queryPool, uint32_t firstQuery) {
-  pfn_vkCmdWriteAccelerationStructuresPropertiesNV(
+  pfn_vkCmdWriteAccelerationStructuresPropertiesKHR(
       commandBuffer, accelerationStructureCount, pAccelerationStructures,
       queryType, queryPool, firstQuery);
 }
-VKAPI_ATTR VkResult VKAPI_CALL vkCompileDeferredNV(VkDevice device,
-                                                   VkPipeline pipeline,
-                                                   uint32_t shader) {
-  return pfn_vkCompileDeferredNV(device, pipeline, shader);
+VKAPI_ATTR void VKAPI_CALL vkCmdCopyAccelerationStructureToMemoryKHR(
+    VkCommandBuffer commandBuffer,
+    const VkCopyAccelerationStructureToMemoryInfoKHR* pInfo) {
+  pfn_vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, pInfo);
+}
+VKAPI_ATTR void VKAPI_CALL vkCmdCopyMemoryToAccelerationStructureKHR(
+    VkCommandBuffer commandBuffer,
+    const VkCopyMemoryToAccelerationStructureInfoKHR* pInfo) {
+  pfn_vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, pInfo);
+}
+VKAPI_ATTR void VKAPI_CALL vkGetDeviceAccelerationStructureCompatibilityKHR(
+    VkDevice device, const VkAccelerationStructureVersionInfoKHR* pVersionInfo,
+    VkAccelerationStructureCompatibilityKHR* pCompatibility) {
+  pfn_vkGetDeviceAccelerationStructureCompatibilityKHR(device, pVersionInfo,
+                                                       pCompatibility);
+}
+VKAPI_ATTR void VKAPI_CALL vkCmdTraceRaysKHR(
+    VkCommandBuffer commandBuffer,
+    const VkStridedDeviceAddressRegionKHR* pRaygenShaderBindingTable,
+    const VkStridedDeviceAddressRegionKHR* pMissShaderBindingTable,
+    const VkStridedDeviceAddressRegionKHR* pHitShaderBindingTable,
+    const VkStridedDeviceAddressRegionKHR* pCallableShaderBindingTable,
+    uint32_t width, uint32_t height, uint32_t depth) {
+  pfn_vkCmdTraceRaysKHR(commandBuffer, pRaygenShaderBindingTable,
+                        pMissShaderBindingTable, pHitShaderBindingTable,
+                        pCallableShaderBindingTable, width, height, depth);
+}
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateRayTracingPipelinesKHR(
+    VkDevice device, VkDeferredOperationKHR deferredOperation,
+    VkPipelineCache pipelineCache, uint32_t createInfoCount,
+    const VkRayTracingPipelineCreateInfoKHR* pCreateInfos,
+    const VkAllocationCallbacks* pAllocator, VkPipeline* pPipelines) {
+  return pfn_vkCreateRayTracingPipelinesKHR(device, deferredOperation,
+                                            pipelineCache, createInfoCount,
+                                            pCreateInfos, pAllocator,
+                                            pPipelines);
+}
+VKAPI_ATTR VkResult VKAPI_CALL vkGetRayTracingShaderGroupHandlesKHR(
+    VkDevice device, VkPipeline pipeline, uint32_t firstGroup,
+    uint32_t groupCount, size_t dataSize, void* pData) {
+  return pfn_vkGetRayTracingShaderGroupHandlesKHR(device, pipeline, firstGroup,
+                                                  groupCount, dataSize, pData);
 }
 
 bool rtx::ray_tracing_extensions::load(VkDevice device) {
-  pfn_vkCreateAccelerationStructureNV =
-      reinterpret_cast<PFN_vkCreateAccelerationStructureNV>(
-          vkGetDeviceProcAddr(device, "vkCreateAccelerationStructureNV"));
-  if (!pfn_vkCreateAccelerationStructureNV) {
-    std::cerr << "Failed to get function vkCreateAccelerationStructureNV."
+  pfn_vkCreateAccelerationStructureKHR =
+      reinterpret_cast<PFN_vkCreateAccelerationStructureKHR>(
+          vkGetDeviceProcAddr(device, "vkCreateAccelerationStructureKHR"));
+  if (!pfn_vkCreateAccelerationStructureKHR) {
+    std::cerr << "Failed to get function vkCreateAccelerationStructureKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkDestroyAccelerationStructureNV =
-      reinterpret_cast<PFN_vkDestroyAccelerationStructureNV>(
-          vkGetDeviceProcAddr(device, "vkDestroyAccelerationStructureNV"));
-  if (!pfn_vkDestroyAccelerationStructureNV) {
-    std::cerr << "Failed to get function vkDestroyAccelerationStructureNV."
+  pfn_vkDestroyAccelerationStructureKHR =
+      reinterpret_cast<PFN_vkDestroyAccelerationStructureKHR>(
+          vkGetDeviceProcAddr(device, "vkDestroyAccelerationStructureKHR"));
+  if (!pfn_vkDestroyAccelerationStructureKHR) {
+    std::cerr << "Failed to get function vkDestroyAccelerationStructureKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkGetAccelerationStructureMemoryRequirementsNV =
-      reinterpret_cast<PFN_vkGetAccelerationStructureMemoryRequirementsNV>(
-          vkGetDeviceProcAddr(
-              device, "vkGetAccelerationStructureMemoryRequirementsNV"));
-  if (!pfn_vkGetAccelerationStructureMemoryRequirementsNV) {
+  pfn_vkGetAccelerationStructureBuildSizesKHR =
+      reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(
+          vkGetDeviceProcAddr(device,
+                              "vkGetAccelerationStructureBuildSizesKHR"));
+  if (!pfn_vkGetAccelerationStructureBuildSizesKHR) {
     std::cerr << "Failed to get function "
-                 "vkGetAccelerationStructureMemoryRequirementsNV."
+                 "vkGetAccelerationStructureBuildSizesKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkBindAccelerationStructureMemoryNV =
-      reinterpret_cast<PFN_vkBindAccelerationStructureMemoryNV>(
-          vkGetDeviceProcAddr(device, "vkBindAccelerationStructureMemoryNV"));
-  if (!pfn_vkBindAccelerationStructureMemoryNV) {
+  pfn_vkGetAccelerationStructureDeviceAddressKHR =
+      reinterpret_cast<PFN_vkGetAccelerationStructureDeviceAddressKHR>(
+          vkGetDeviceProcAddr(device,
+                              "vkGetAccelerationStructureDeviceAddressKHR"));
+  if (!pfn_vkGetAccelerationStructureDeviceAddressKHR) {
     std::cerr << "Failed to get function "
-                 "vkBindAccelerationStructureMemoryNV."
+                 "vkGetAccelerationStructureDeviceAddressKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkCmdBuildAccelerationStructureNV =
-      reinterpret_cast<PFN_vkCmdBuildAccelerationStructureNV>(
-          vkGetDeviceProcAddr(device, "vkCmdBuildAccelerationStructureNV"));
-  if (!pfn_vkCmdBuildAccelerationStructureNV) {
-    std::cerr << "Failed to get function vkCmdBuildAccelerationStructureNV."
+  pfn_vkCmdBuildAccelerationStructuresKHR =
+      reinterpret_cast<PFN_vkCmdBuildAccelerationStructuresKHR>(
+          vkGetDeviceProcAddr(device, "vkCmdBuildAccelerationStructuresKHR"));
+  if (!pfn_vkCmdBuildAccelerationStructuresKHR) {
+    std::cerr << "Failed to get function vkCmdBuildAccelerationStructuresKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkCmdCopyAccelerationStructureNV =
-      reinterpret_cast<PFN_vkCmdCopyAccelerationStructureNV>(
-          vkGetDeviceProcAddr(device, "vkCmdCopyAccelerationStructureNV"));
-  if (!pfn_vkCmdCopyAccelerationStructureNV) {
-    std::cerr << "Failed to get function vkCmdCopyAccelerationStructureNV."
+  pfn_vkCmdCopyAccelerationStructureKHR =
+      reinterpret_cast<PFN_vkCmdCopyAccelerationStructureKHR>(
+          vkGetDeviceProcAddr(device, "vkCmdCopyAccelerationStructureKHR"));
+  if (!pfn_vkCmdCopyAccelerationStructureKHR) {
+    std::cerr << "Failed to get function vkCmdCopyAccelerationStructureKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkCmdTraceRaysNV = reinterpret_cast<PFN_vkCmdTraceRaysNV>(
-      vkGetDeviceProcAddr(device, "vkCmdTraceRaysNV"));
-  if (!pfn_vkCmdTraceRaysNV) {
-    std::cerr << "Failed to get function vkCmdTraceRaysNV." << std::endl;
+  pfn_vkCmdWriteAccelerationStructuresPropertiesKHR =
+      reinterpret_cast<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>(
+          vkGetDeviceProcAddr(device,
+                              "vkCmdWriteAccelerationStructuresPropertiesKHR"));
+  if (!pfn_vkCmdWriteAccelerationStructuresPropertiesKHR) {
+    std::cerr << "Failed to get function "
+                 "vkCmdWriteAccelerationStructuresPropertiesKHR."
+              << std::endl;
     return false;
   }
 
-  pfn_vkCreateRayTracingPipelinesNV =
-      reinterpret_cast<PFN_vkCreateRayTracingPipelinesNV>(
-          vkGetDeviceProcAddr(device, "vkCreateRayTracingPipelinesNV"));
-  if (!pfn_vkCreateRayTracingPipelinesNV) {
-    std::cerr << "Failed to get function vkCreateRayTracingPipelinesNV."
+  pfn_vkCmdCopyAccelerationStructureToMemoryKHR =
+      reinterpret_cast<PFN_vkCmdCopyAccelerationStructureToMemoryKHR>(
+          vkGetDeviceProcAddr(device,
+                              "vkCmdCopyAccelerationStructureToMemoryKHR"));
+  if (!pfn_vkCmdCopyAccelerationStructureToMemoryKHR) {
+    std::cerr << "Failed to get function "
+                 "vkCmdCopyAccelerationStructureToMemoryKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkGetRayTracingShaderGroupHandlesNV =
-      reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesNV>(
-          vkGetDeviceProcAddr(device, "vkGetRayTracingShaderGroupHandlesNV"));
-  if (!pfn_vkGetRayTracingShaderGroupHandlesNV) {
-    std::cerr << "Failed to get function vkGetRayTracingShaderGroupHandlesNV."
+  pfn_vkCmdCopyMemoryToAccelerationStructureKHR =
+      reinterpret_cast<PFN_vkCmdCopyMemoryToAccelerationStructureKHR>(
+          vkGetDeviceProcAddr(device,
+                              "vkCmdCopyMemoryToAccelerationStructureKHR"));
+  if (!pfn_vkCmdCopyMemoryToAccelerationStructureKHR) {
+    std::cerr << "Failed to get function "
+                 "vkCmdCopyMemoryToAccelerationStructureKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkGetAccelerationStructureHandleNV =
-      reinterpret_cast<PFN_vkGetAccelerationStructureHandleNV>(
-          vkGetDeviceProcAddr(device, "vkGetAccelerationStructureHandleNV"));
-  if (!pfn_vkGetAccelerationStructureHandleNV) {
-    std::cerr << "Failed to get function vkGetAccelerationStructureHandleNV."
+  pfn_vkGetDeviceAccelerationStructureCompatibilityKHR =
+      reinterpret_cast<PFN_vkGetDeviceAccelerationStructureCompatibilityKHR>(
+          vkGetDeviceProcAddr(
+              device, "vkGetDeviceAccelerationStructureCompatibilityKHR"));
+  if (!pfn_vkGetDeviceAccelerationStructureCompatibilityKHR) {
+    std::cerr << "Failed to get function "
+                 "vkGetDeviceAccelerationStructureCompatibilityKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkCmdWriteAccelerationStructuresPropertiesNV =
-      reinterpret_cast<PFN_vkCmdWriteAccelerationStructuresPropertiesNV>(
-          vkGetDeviceProcAddr(device,
-                              "vkCmdWriteAccelerationStructuresPropertiesNV"));
-  if (!pfn_vkCmdWriteAccelerationStructuresPropertiesNV) {
-    std::cerr << "Failed to get function "
-                 "vkCmdWriteAccelerationStructuresPropertiesNV."
+  pfn_vkCmdTraceRaysKHR = reinterpret_cast<PFN_vkCmdTraceRaysKHR>(
+      vkGetDeviceProcAddr(device, "vkCmdTraceRaysKHR"));
+  if (!pfn_vkCmdTraceRaysKHR) {
+    std::cerr << "Failed to get function vkCmdTraceRaysKHR." << std::endl;
+    return false;
+  }
+
+  pfn_vkCreateRayTracingPipelinesKHR =
+      reinterpret_cast<PFN_vkCreateRayTracingPipelinesKHR>(
+          vkGetDeviceProcAddr(device, "vkCreateRayTracingPipelinesKHR"));
+  if (!pfn_vkCreateRayTracingPipelinesKHR) {
+    std::cerr << "Failed to get function vkCreateRayTracingPipelinesKHR."
               << std::endl;
     return false;
   }
 
-  pfn_vkCompileDeferredNV = reinterpret_cast<PFN_vkCompileDeferredNV>(
-      vkGetDeviceProcAddr(device, "vkCompileDeferredNV"));
-  if (!pfn_vkCompileDeferredNV) {
-    std::cerr << "Failed to get function vkCompileDeferredNV." << std::endl;
+  pfn_vkGetRayTracingShaderGroupHandlesKHR =
+      reinterpret_cast<PFN_vkGetRayTracingShaderGroupHandlesKHR>(
+          vkGetDeviceProcAddr(device, "vkGetRayTracingShaderGroupHandlesKHR"));
+  if (!pfn_vkGetRayTracingShaderGroupHandlesKHR) {
+    std::cerr << "Failed to get function vkGetRayTracingShaderGroupHandlesKHR."
+              << std::endl;
     return false;
   }
 
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <vector>
 
 #include <vulkan/vulkan.h>
 
 #include "glm.h"
+#include "raytracing/acceleration_structure_cache.h"
 #include "raytracing/bottom_level_acceleration_structure.h"
 #include "raytracing/top_level_acceleration_structure.h"
 #include "single_time_command.h"
@@ -13,19 +17,59 @@ namespace rtx {
 // TODO: Rename to ray_tracer? create a separate ray_tracer?
 class acceleration_structure {
  public:
+  // Static BLASes are read from the files of the cache when they are found,
+  // and written to it when they are built.
+  acceleration_structure_cache &cache() { return cache_; }
+
+  // Use of the cache since the last generate(), appends included.
+  struct cache_stats_t {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    double read_milliseconds = 0.0;   // Reading and checking the files.
+    double write_milliseconds = 0.0;  // Serializing and writing them.
+  };
+  const cache_stats_t &cache_stats() const { return cache_stats_; }
+
+  // Scratch memory of the BLAS builds, at most. BLASes are built in batches
+  // whose scratch fits in the budget, a BLAS larger than the budget is built
+  // alone.
+  void set_scratch_budget(VkDeviceSize budget) { scratch_budget_ = budget; }
+
+  // Timestamps of the queue the structures are built on, to time the build
+  // batches. 0 valid bits disables the timing.
+  void set_timestamp_properties(float period, uint32_t valid_bits) {
+    timestamp_period_ = period;
+    timestamp_valid_bits_ = valid_bits;
+  }
+
+  // BLASes built concurrently by the last generate() or append().
+  struct build_batch_t {
+    uint32_t blas_count = 0;
+    VkDeviceSize scratch_size = 0;
+    float milliseconds = 0.0f;  // GPU time, 0 when not timed.
+  };
+  const std::vector<build_batch_t> &build_batches() const {
+    return build_batches_;
+  }
+
   // Each call to this method will create a separate BLAS. All objects passed
   // will go into the new BLAS.
-  bool add_objects(const std::vector<object_model_t> &objects) {
+  bool add_objects(VkDeviceAddress geometry_address,
+                   const std::vector<object_model_t> &objects) {
     // Create a new BLAS.
     blas_.emplace_back();
     bottom_level_acceleration_structure &blas = blas_.back();
 
     // Add objects to the BLAS.
     for (auto &object : objects) {
-      if (!blas.add_object(object)) {
+      static constexpr uint32_t lod = 0;
+      if (!blas.add_object(geometry_address, object, lod)) {
         std::cerr << "Failed to add object to BLAS." << std::endl;
         return false;
       }
+      if (!object.skin.empty()) {
+        blas.set_dynamic(true);
+      }
       for (auto &transform : object.transforms) {
         blas.add_transform(transform);
       }
@@ -34,16 +78,29 @@ class acceleration_structure {
     return true;
   }
 
-  bool add_object(const object_model_t &object) {
+  // Create a new BLAS with the given level of detail of the object. Its
+  // instances are only visible to the rays whose cull mask matches mask, and
+  // are the entries of the instance table from first_instance on. The BLAS of
+  // a skinned object is refit.
+  bool add_object(VkDeviceAddress geometry_address,
+                  const object_model_t &object, uint32_t lod, uint32_t mask,
+                  uint32_t first_instance) {
     // Create a new BLAS.
     blas_.emplace_back();
     bottom_level_acceleration_structure &blas = blas_.back();
 
     // Add object to the BLAS.
-    if (!blas.add_object(object)) {
+    if (!blas.add_object(geometry_address, object, lod)) {
       std::cerr << "Failed to add object to BLAS." << std::endl;
       return false;
     }
+    blas.set_mask(mask);
+    blas.set_first_instance(first_instance);
+    blas.set_dynamic(!object.skin.empty());
+    if (cache_.enabled() && !blas.is_dynamic()) {
+      blas.set_geometry_hash(
+          acceleration_structure_cache::geometry_hash(object, lod));
+    }
     for (auto &transform : object.transforms) {
       blas.add_transform(transform);
     }
@@ -51,35 +108,374 @@ class acceleration_structure {
     return true;
   }
 
-  bool generate(VkDevice device, memory &mem, VkCommandPool &command_pool,
-                VkQueue &graphics_queue, bool update_only) {
-    // Create the BLAS descriptors and compute the buffer sizes for each BLAS.
-    // Obtain the maximum scratch buffer size needed so only one scratch buffer
-    // will be created for all BLASs.
-    VkDeviceSize max_scratch_size = 0;
+  // build_flags chooses between a faster trace or a faster build of all the
+  // acceleration structures. The scratch memory handed to the builder must be
+  // aligned to scratch_alignment.
+  bool generate(memory &mem, VkCommandPool &command_pool,
+                VkQueue &graphics_queue,
+                VkBuildAccelerationStructureFlagsKHR build_flags,
+                VkDeviceSize scratch_alignment, bool update_only) {
+    // The TLAS build reuses the scratch buffer of the BLASes.
+    VkDeviceSize scratch_size = 0;
+    VkBuffer scratch_buffer = VK_NULL_HANDLE;
+    VkDeviceMemory scratch_buffer_memory = VK_NULL_HANDLE;
+    VkDeviceAddress scratch_address = 0;
+    static constexpr uint32_t first_blas = 0;
+    cache_stats_ = cache_stats_t();
+    const bool built =
+        build_blases(mem, command_pool, graphics_queue, build_flags,
+                     scratch_alignment, update_only, first_blas, scratch_size,
+                     scratch_buffer, scratch_buffer_memory, scratch_address) &&
+        build_tlas(mem, command_pool, graphics_queue, build_flags,
+                   scratch_alignment, update_only, all_instances(),
+                   scratch_size, scratch_buffer, scratch_buffer_memory,
+                   scratch_address);
+    destroy_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory);
+    if (!built) {
+      return false;
+    }
+
+    return create_refit_scratch(mem, scratch_alignment);
+  }
+
+  // Build the BLASes added since the last generate() or append(), the ones
+  // already built are kept, then rebuild the TLAS with all the instances.
+  // The previous TLAS must not be in use.
+  bool append(memory &mem, VkCommandPool &command_pool,
+              VkQueue &graphics_queue,
+              VkBuildAccelerationStructureFlagsKHR build_flags,
+              VkDeviceSize scratch_alignment) {
+    VkDeviceSize scratch_size = 0;
+    VkBuffer scratch_buffer = VK_NULL_HANDLE;
+    VkDeviceMemory scratch_buffer_memory = VK_NULL_HANDLE;
+    VkDeviceAddress scratch_address = 0;
+    static constexpr bool update_only = false;
+    const bool built =
+        build_blases(mem, command_pool, graphics_queue, build_flags,
+                     scratch_alignment, update_only, built_blas_count_,
+                     scratch_size, scratch_buffer, scratch_buffer_memory,
+                     scratch_address);
+    destroy_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory);
+
+    return built && rebuild_tlas(mem, command_pool, graphics_queue,
+                                 build_flags, scratch_alignment,
+                                 all_instances());
+  }
+
+  // Point the BLAS geometries read from the geometry buffer at from to the
+  // same offsets at to, once the buffer was copied there. Built BLASes don't
+  // read their geometries again, refits do.
+  void relocate_geometry(VkDeviceAddress from, VkDeviceAddress to) {
     for (auto &blas : blas_) {
-      if (!blas.create(device, mem.get_allocation_callbacks(), update_only)) {
-        std::cerr << "Failed to create BLAS descriptor." << std::endl;
+      blas.relocate_geometry(from, to);
+    }
+  }
+
+  // Build a new TLAS with only the given instances, indices in the order
+  // generate() and append() added them. The BLASes are kept. The previous
+  // TLAS is destroyed, it must not be in use. It is kept when there are no
+  // instances, a TLAS needs some.
+  bool rebuild_tlas(memory &mem, VkCommandPool &command_pool,
+                    VkQueue &graphics_queue,
+                    VkBuildAccelerationStructureFlagsKHR build_flags,
+                    VkDeviceSize scratch_alignment,
+                    const std::vector<uint32_t> &instances) {
+    if (instances.empty()) {
+      std::cerr << "TLAS rebuild without instances." << std::endl;
+      return false;
+    }
+
+    tlas_.destroy(mem.get_device(), mem.get_allocation_callbacks());
+
+    VkDeviceSize scratch_size = 0;
+    VkBuffer scratch_buffer = VK_NULL_HANDLE;
+    VkDeviceMemory scratch_buffer_memory = VK_NULL_HANDLE;
+    VkDeviceAddress scratch_address = 0;
+    static constexpr bool update_only = false;
+    const bool built =
+        build_tlas(mem, command_pool, graphics_queue, build_flags,
+                   scratch_alignment, update_only, instances, scratch_size,
+                   scratch_buffer, scratch_buffer_memory, scratch_address);
+    destroy_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory);
+
+    // The TLAS scratch size depends on its instances.
+    return built && create_refit_scratch(mem, scratch_alignment);
+  }
+
+  // Record a build of the TLAS with only the given instances, as
+  // rebuild_tlas(), into the command buffer of the frame in flight. The
+  // TLAS was created for all the instances and is built again in place, so
+  // it is neither re-created nor its descriptor written again, see
+  // top_level_acceleration_structure::rebuild().
+  bool record_tlas_rebuild(memory &mem, VkCommandBuffer command_buffer,
+                           uint32_t frame,
+                           const std::vector<uint32_t> &instances) {
+    if (instances.empty()) {
+      std::cerr << "TLAS rebuild without instances." << std::endl;
+      return false;
+    }
+
+    tlas_.clear_instances();
+    if (!add_tlas_instances(instances)) {
+      return false;
+    }
+
+    return tlas_.rebuild(mem, command_buffer, frame,
+                         refit_scratch_addresses_.back());
+  }
+
+  // Whether some BLASes are refit.
+  bool dynamic() const { return dynamic_; }
+
+  // Record the refit of the dynamic BLASes and then of the TLAS, or their
+  // build when rebuild. The vertices must have been written and made
+  // visible to the builds. The structures are made visible to the ray
+  // tracing, compute and fragment shaders.
+  //
+  // Scratch memory is persistent and every dynamic BLAS has its own, so the
+  // BLASes are refit concurrently and the previous frames must be done with
+  // the structures, as they are refit in place.
+  bool refit(memory &mem, VkCommandBuffer command_buffer, bool rebuild) {
+    if (!dynamic_) {
+      return true;
+    }
+
+    for (uint32_t i = 0; i < blas_.size(); ++i) {
+      if (blas_[i].is_dynamic() &&
+          !blas_[i].refit(command_buffer, refit_scratch_addresses_[i],
+                          rebuild)) {
+        std::cerr << "Failed to refit BLAS " << i << "." << std::endl;
         return false;
       }
+    }
 
-      VkDeviceSize scratch_size = 0;
-      if (!blas.compute_buffer_sizes(device, mem, scratch_size)) {
-        std::cerr << "Failed to compute BLAS scratch size." << std::endl;
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+        &memory_barrier, 0, nullptr, 0, nullptr);
+
+    if (!tlas_.refit(mem, command_buffer, refit_scratch_addresses_.back(),
+                     rebuild)) {
+      std::cerr << "Failed to refit TLAS." << std::endl;
+      return false;
+    }
+
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    return true;
+  }
+
+  size_t instance_count() const { return instances_.size(); }
+
+  size_t tlas_instance_count() const { return tlas_.num_instances(); }
+
+  void destroy(memory &mem) {
+    // Destroy TLAS.
+    tlas_.destroy(mem.get_device(), mem.get_allocation_callbacks());
+
+    // Destroy BLASses.
+    for (auto &blas : blas_) {
+      blas.destroy(mem.get_device(), mem.get_allocation_callbacks());
+    }
+    blas_.clear();
+    instances_.clear();
+    built_blas_count_ = 0;
+
+    destroy_scratch_buffer(mem, refit_scratch_buffer_,
+                           refit_scratch_buffer_memory_);
+    refit_scratch_addresses_.clear();
+    dynamic_ = false;
+  }
+
+  const VkAccelerationStructureKHR &get_tlas() const {
+    return tlas_.get_acceleration_structure();
+  }
+
+ private:
+  std::vector<bottom_level_acceleration_structure> blas_;  // TODO: blases_.
+  top_level_acceleration_structure tlas_;
+
+  // An instance is a transform of a BLAS.
+  struct instance_t {
+    uint32_t blas_id;
+    uint32_t transform;
+  };
+  std::vector<instance_t> instances_;  // All of them, in TLAS order.
+
+  // BLASes built by generate() and append(), the next ones are appended.
+  uint32_t built_blas_count_ = 0;
+
+  // Whether some BLASes are dynamic. The TLAS then allows updates.
+  bool dynamic_ = false;
+
+  acceleration_structure_cache cache_;
+  cache_stats_t cache_stats_;
+
+  VkDeviceSize scratch_budget_ = 256ull << 20;
+  std::vector<build_batch_t> build_batches_;
+  float timestamp_period_ = 0.0f;  // Nanoseconds per tick.
+  uint32_t timestamp_valid_bits_ = 0;
+
+  // Host visible buffer of serialized BLASes, each at its offset from the
+  // mapped pointer and from the device address.
+  struct serialized_buffer_t {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    uint8_t *mapped = nullptr;
+    VkDeviceAddress address = 0;
+    std::vector<VkDeviceSize> offsets;
+  };
+
+  // Scratch memory of the refits, a slice per dynamic BLAS and one for the
+  // TLAS. Addresses are per BLAS, 0 for static ones, then the TLAS one. The
+  // recorded TLAS rebuilds use the TLAS slice too, so it exists without
+  // dynamic BLASes.
+  VkBuffer refit_scratch_buffer_ = VK_NULL_HANDLE;
+  VkDeviceMemory refit_scratch_buffer_memory_ = VK_NULL_HANDLE;
+  std::vector<VkDeviceAddress> refit_scratch_addresses_;
+
+  // Indices of all the instances, see rebuild_tlas().
+  std::vector<uint32_t> all_instances() const {
+    std::vector<uint32_t> instances(instances_.size());
+    for (uint32_t i = 0; i < instances.size(); ++i) {
+      instances[i] = i;
+    }
+    return instances;
+  }
+
+  // Build the BLASes from first_blas on, those before are already built.
+  // The scratch buffer is created large enough for the largest batch, and
+  // kept for the TLAS build.
+  bool build_blases(memory &mem, VkCommandPool &command_pool,
+                    VkQueue &graphics_queue,
+                    VkBuildAccelerationStructureFlagsKHR build_flags,
+                    VkDeviceSize scratch_alignment, bool update_only,
+                    uint32_t first_blas, VkDeviceSize &scratch_size,
+                    VkBuffer &scratch_buffer,
+                    VkDeviceMemory &scratch_buffer_memory,
+                    VkDeviceAddress &scratch_address) {
+    VkDevice device = mem.get_device();
+
+    // The TLAS over refit BLASes is refit too.
+    dynamic_ = false;
+    for (const auto &blas : blas_) {
+      dynamic_ = dynamic_ || blas.is_dynamic();
+    }
+
+    // Static BLASes found in the cache are deserialized instead of built.
+    // The cache stats add up over the appends.
+    uint32_t hits = 0;
+    std::vector<std::vector<uint8_t>> serialized(blas_.size());
+    std::vector<uint32_t> uncached;  // Built BLASes to write to the cache.
+    const auto read_start = std::chrono::steady_clock::now();
+    for (uint32_t i = first_blas; i < blas_.size(); ++i) {
+      bottom_level_acceleration_structure &blas = blas_[i];
+      if (update_only || 0 == blas.get_geometry_hash()) {
+        continue;
+      }
+      const uint64_t key =
+          acceleration_structure_cache::key(blas.get_geometry_hash(),
+                                            build_flags);
+      if (cache_.load(device, key, serialized[i])) {
+        ++hits;
+      } else {
+        ++cache_stats_.misses;
+        uncached.push_back(i);
+      }
+    }
+    cache_stats_.hits += hits;
+    cache_stats_.read_milliseconds +=
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - read_start)
+            .count();
+
+    // Create the BLASes and compute the scratch size of each built one.
+    std::vector<VkDeviceSize> scratch_sizes(blas_.size(), 0);
+    std::vector<uint32_t> built;
+    for (uint32_t i = first_blas; i < blas_.size(); ++i) {
+      bottom_level_acceleration_structure &blas = blas_[i];
+      if (!serialized[i].empty()) {
+        if (!blas.create_deserialized(
+                mem, build_flags,
+                acceleration_structure_cache::deserialized_size(
+                    serialized[i]))) {
+          std::cerr << "Failed to create cached BLAS." << std::endl;
+          return false;
+        }
+        continue;
+      }
+
+      if (!blas.create(mem, build_flags, update_only, scratch_sizes[i])) {
+        std::cerr << "Failed to create BLAS." << std::endl;
         return false;
       }
-      std::cout << "Partial scratch buffer size: " << scratch_size << " bytes."
-                << std::endl;
-      max_scratch_size = std::max(max_scratch_size, scratch_size);
+      built.push_back(i);
+    }
+
+    // Each BLAS of a batch builds in its own region of the scratch buffer,
+    // so that the builds of a batch run concurrently. The scratch buffer is
+    // reused by the next batch after a barrier.
+    std::vector<VkDeviceSize> scratch_offsets(blas_.size(), 0);
+    scratch_size = plan_build_batches(built, scratch_sizes, scratch_alignment,
+                                      scratch_offsets);
+    std::cout << "BLAS builds: " << built.size() << " in "
+              << build_batches_.size() << " batches, scratch buffer size: "
+              << scratch_size << " bytes." << std::endl;
+
+    // Create scratch buffer, none when every BLAS is cached.
+    if (scratch_size > 0 &&
+        !create_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory,
+                               scratch_size, scratch_alignment,
+                               scratch_address)) {
+      return false;
+    }
+
+    // Upload the serialized BLASes.
+    serialized_buffer_t upload;
+    std::vector<VkDeviceSize> sizes(blas_.size(), 0);
+    for (uint32_t i = 0; i < blas_.size(); ++i) {
+      sizes[i] = serialized[i].size();
+    }
+    if (hits > 0) {
+      if (!create_serialized_buffer(mem, sizes, upload)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < blas_.size(); ++i) {
+        if (!serialized[i].empty()) {
+          memcpy(upload.mapped + upload.offsets[i], serialized[i].data(),
+                 serialized[i].size());
+        }
+      }
+      serialized.clear();
     }
-    std::cout << "Final scratch buffer size: " << max_scratch_size << " bytes."
-              << std::endl;
 
-    // Create scratch buffer.
-    VkBuffer scratch_buffer;
-    VkDeviceMemory scratch_buffer_memory;
-    if (!create_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory,
-                               max_scratch_size)) {
+    // The serialized size of the built BLASes that go to the cache is only
+    // known once they are built.
+    VkQueryPool size_query_pool = VK_NULL_HANDLE;
+    if (!uncached.empty() &&
+        !create_size_query_pool(mem, static_cast<uint32_t>(uncached.size()),
+                                size_query_pool)) {
+      return false;
+    }
+
+    // A timestamp before the batches and after each of them.
+    VkQueryPool timestamp_query_pool = VK_NULL_HANDLE;
+    const uint32_t timestamp_count =
+        static_cast<uint32_t>(build_batches_.size()) + 1;
+    if (timestamp_valid_bits_ > 0 && !build_batches_.empty() &&
+        !create_timestamp_query_pool(mem, timestamp_count,
+                                     timestamp_query_pool)) {
       return false;
     }
 
@@ -91,15 +487,62 @@ class acceleration_structure {
       return false;
     }
 
-    // Create the actual BLASs.
-    VkDeviceSize scratch_offset = 0;
-    for (auto &blas : blas_) {
-      if (!blas.generate(device, blas_command_buffer, scratch_buffer,
-                         scratch_offset, update_only)) {
-        std::cerr << "Failed to generate BLAS." << std::endl;
-        return false;
+    // Copy the cached BLASes, the barrier after the first batch covers them.
+    for (uint32_t i = 0; i < blas_.size(); ++i) {
+      if (sizes[i] > 0) {
+        blas_[i].deserialize(blas_command_buffer,
+                             upload.address + upload.offsets[i]);
       }
     }
+    if (hits > 0 && build_batches_.empty()) {
+      build_barrier(blas_command_buffer);
+    }
+
+    // Build the batches.
+    if (VK_NULL_HANDLE != timestamp_query_pool) {
+      vkCmdResetQueryPool(blas_command_buffer, timestamp_query_pool, 0,
+                          timestamp_count);
+      vkCmdWriteTimestamp(blas_command_buffer,
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          timestamp_query_pool, 0);
+    }
+    uint32_t next = 0;  // In built.
+    for (uint32_t b = 0; b < build_batches_.size(); ++b) {
+      for (uint32_t n = 0; n < build_batches_[b].blas_count; ++n, ++next) {
+        const uint32_t i = built[next];
+        if (!blas_[i].generate(blas_command_buffer,
+                               scratch_address + scratch_offsets[i],
+                               update_only)) {
+          std::cerr << "Failed to generate BLAS." << std::endl;
+          return false;
+        }
+      }
+
+      // The next batch reuses the scratch memory, and the TLAS reads the
+      // BLASes.
+      build_barrier(blas_command_buffer);
+      if (VK_NULL_HANDLE != timestamp_query_pool) {
+        vkCmdWriteTimestamp(
+            blas_command_buffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            timestamp_query_pool, b + 1);
+      }
+    }
+
+    if (!uncached.empty()) {
+      std::vector<VkAccelerationStructureKHR> structures;
+      for (const uint32_t i : uncached) {
+        structures.push_back(blas_[i].get_acceleration_structure());
+      }
+      const uint32_t count = static_cast<uint32_t>(structures.size());
+      static constexpr uint32_t first_query = 0;
+      vkCmdResetQueryPool(blas_command_buffer, size_query_pool, first_query,
+                          count);
+      vkCmdWriteAccelerationStructuresPropertiesKHR(
+          blas_command_buffer, count, structures.data(),
+          VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+          size_query_pool, first_query);
+    }
 
     if (!end_single_time_commands(blas_command_buffer, device, command_pool,
                                   graphics_queue)) {
@@ -107,41 +550,74 @@ class acceleration_structure {
       return false;
     }
 
-    // Create the TLAS.
-    //
+    destroy_serialized_buffer(mem, upload);
 
-    // Add instances to TLAS.
-    uint32_t hit_group_id = 0;
-    for (int i = 0; i < blas_.size(); ++i) {
-      for (auto &transform : blas_[i].get_transforms()) {
-        if (!add_instance(i, hit_group_id, transform)) {
-          return false;
-        }
+    if (VK_NULL_HANDLE != timestamp_query_pool) {
+      read_batch_timestamps(mem, timestamp_query_pool, timestamp_count);
+      vkDestroyQueryPool(device, timestamp_query_pool,
+                         mem.get_allocation_callbacks());
+    }
+
+    // Instances of all the BLASes, in TLAS order.
+    instances_.clear();
+    for (uint32_t i = 0; i < blas_.size(); ++i) {
+      for (uint32_t t = 0; t < blas_[i].get_transforms().size(); ++t) {
+        instances_.push_back({i, t});
       }
     }
+    built_blas_count_ = static_cast<uint32_t>(blas_.size());
+
+    if (!uncached.empty()) {
+      // A BLAS that fails to go to the cache is built again next time.
+      const auto write_start = std::chrono::steady_clock::now();
+      store_in_cache(mem, command_pool, graphics_queue, build_flags, uncached,
+                     size_query_pool);
+      cache_stats_.write_milliseconds +=
+          std::chrono::duration<double, std::milli>(
+              std::chrono::steady_clock::now() - write_start)
+              .count();
+      vkDestroyQueryPool(device, size_query_pool,
+                         mem.get_allocation_callbacks());
+    }
+
+    return true;
+  }
 
-    // Create TLAS descriptor.
-    if (!tlas_.create(device, mem.get_allocation_callbacks(), update_only)) {
-      std::cerr << "Failed to create TLAS descriptor." << std::endl;
+  // Add the instances to the TLAS and build it. The scratch buffer is reused
+  // when it is large enough, otherwise it is re-created.
+  bool build_tlas(memory &mem, VkCommandPool &command_pool,
+                  VkQueue &graphics_queue,
+                  VkBuildAccelerationStructureFlagsKHR build_flags,
+                  VkDeviceSize scratch_alignment, bool update_only,
+                  const std::vector<uint32_t> &instances,
+                  VkDeviceSize &scratch_size, VkBuffer &scratch_buffer,
+                  VkDeviceMemory &scratch_buffer_memory,
+                  VkDeviceAddress &scratch_address) {
+    VkDevice device = mem.get_device();
+
+    if (!add_tlas_instances(instances)) {
       return false;
     }
 
-    // Compute TLAS scratch buffer size. If possible, reuse scratch buffer used
-    // for BLASes.
+    // Create TLAS and compute its scratch buffer size. If possible, reuse
+    // scratch buffer used for BLASes.
     VkDeviceSize tlas_scratch_size = 0;
-    if (!tlas_.compute_buffer_sizes(device, mem, tlas_scratch_size)) {
-      std::cerr << "Failed to compute TLAS scratch buffer size." << std::endl;
+    if (!tlas_.create(mem, build_flags, update_only || dynamic_,
+                      tlas_scratch_size)) {
+      std::cerr << "Failed to create TLAS." << std::endl;
       return false;
     }
-    if (tlas_scratch_size > max_scratch_size) {
-      // BLAS scratch buffer is not big enough. Delete it and recreate it.
+    if (tlas_scratch_size > scratch_size) {
+      // Scratch buffer is not big enough. Delete it and recreate it.
       std::cout << "TLAS scratch buffer re-created." << std::endl;
       destroy_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory);
       if (!create_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory,
-                                 tlas_scratch_size)) {
+                                 tlas_scratch_size, scratch_alignment,
+                                 scratch_address)) {
         std::cerr << "Failed to re-create scratch buffer." << std::endl;
         return false;
       }
+      scratch_size = tlas_scratch_size;
     }
 
     // Use a temporary command buffer to create the TLAS.
@@ -153,9 +629,8 @@ class acceleration_structure {
     }
 
     // Generate the TLAS.
-    scratch_offset = 0;
-    if (!tlas_.generate(device, mem, tlas_command_buffer, scratch_buffer,
-                        scratch_offset, update_only)) {
+    if (!tlas_.generate(mem, tlas_command_buffer, scratch_address,
+                        update_only)) {
       std::cerr << "Failed to generate TLAS." << std::endl;
       return false;
     }
@@ -166,52 +641,331 @@ class acceleration_structure {
       return false;
     }
 
-    destroy_scratch_buffer(mem, scratch_buffer, scratch_buffer_memory);
+    return true;
+  }
 
+  // Add instances to TLAS.
+  bool add_tlas_instances(const std::vector<uint32_t> &instances) {
+    uint32_t hit_group_id = 0;
+    for (const uint32_t i : instances) {
+      const instance_t &instance = instances_[i];
+      const bottom_level_acceleration_structure &blas =
+          blas_[instance.blas_id];
+      if (!add_instance(instance.blas_id, hit_group_id,
+                        blas.get_transforms()[instance.transform],
+                        blas.get_first_instance() + instance.transform)) {
+        return false;
+      }
+    }
     return true;
   }
 
-  void destroy(memory &mem) {
-    // Destroy TLAS.
-    tlas_.destroy(mem.get_device(), mem.get_allocation_callbacks());
+  bool add_instance(uint32_t blas_id, uint32_t hit_group_id,
+                    const glm::mat4 &transform, uint32_t custom_index) {
+    // This method has to be called after the BLAS is created with its
+    // generate() method.
 
-    // Destroy BLASses.
-    for (auto &blas : blas_) {
-      blas.destroy(mem.get_device(), mem.get_allocation_callbacks());
+    const bottom_level_acceleration_structure &blas = blas_[blas_id];
+    if (!tlas_.add_instance(blas, transform, custom_index, hit_group_id,
+                            blas.get_mask())) {
+      std::cerr << "Failed to add instance." << std::endl;
+      return false;
     }
-    blas_.clear();
+    return true;
   }
 
-  const VkAccelerationStructureNV &get_tlas() const {
-    return tlas_.get_acceleration_structure();
+  // Split the built BLASes, in order, into batches whose scratch regions fit
+  // in the budget. Returns the scratch size of the largest batch, and the
+  // offset of each BLAS region in the scratch buffer.
+  VkDeviceSize plan_build_batches(const std::vector<uint32_t> &built,
+                                  const std::vector<VkDeviceSize> &sizes,
+                                  VkDeviceSize scratch_alignment,
+                                  std::vector<VkDeviceSize> &offsets) {
+    build_batches_.clear();
+    VkDeviceSize max_scratch_size = 0;
+    for (const uint32_t i : built) {
+      const VkDeviceSize size = align(sizes[i], scratch_alignment);
+      if (build_batches_.empty() ||
+          build_batches_.back().scratch_size + size > scratch_budget_) {
+        build_batches_.emplace_back();
+      }
+      build_batch_t &batch = build_batches_.back();
+      offsets[i] = batch.scratch_size;
+      batch.scratch_size += size;
+      ++batch.blas_count;
+      max_scratch_size = std::max(max_scratch_size, batch.scratch_size);
+    }
+    return max_scratch_size;
   }
 
- private:
-  std::vector<bottom_level_acceleration_structure> blas_;  // TODO: blases_.
-  top_level_acceleration_structure tlas_;
+  bool create_timestamp_query_pool(memory &mem, uint32_t count,
+                                   VkQueryPool &query_pool) {
+    VkQueryPoolCreateInfo query_pool_create_info{};
+    query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_pool_create_info.queryCount = count;
+    VkResult res =
+        vkCreateQueryPool(mem.get_device(), &query_pool_create_info,
+                          mem.get_allocation_callbacks(), &query_pool);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create BLAS timestamp query pool: " << res
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
 
-  bool add_instance(uint32_t blas_id, uint32_t hit_group_id,
-                    const glm::mat4 &transform) {
-    // This method has to be called after the BLAS is created with its
-    // generate() method.
+  void read_batch_timestamps(memory &mem, VkQueryPool query_pool,
+                             uint32_t count) {
+    std::vector<uint64_t> timestamps(count, 0);
+    VkResult res = vkGetQueryPoolResults(
+        mem.get_device(), query_pool, 0, count,
+        sizeof(uint64_t) * timestamps.size(), timestamps.data(),
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to get BLAS build timestamps: " << res
+                << std::endl;
+      return;
+    }
 
-    if (!tlas_.add_instance(blas_[blas_id], transform, tlas_.num_instances(),
-                            hit_group_id)) {
-      std::cerr << "Failed to add instance." << std::endl;
+    const uint64_t mask = timestamp_valid_bits_ >= 64
+                              ? UINT64_MAX
+                              : (uint64_t(1) << timestamp_valid_bits_) - 1;
+    for (uint32_t b = 0; b < build_batches_.size(); ++b) {
+      const uint64_t ticks = (timestamps[b + 1] - timestamps[b]) & mask;
+      build_batches_[b].milliseconds =
+          static_cast<float>(ticks) * timestamp_period_ * 1e-6f;
+    }
+  }
+
+  // Make the BLAS builds visible to the next builds, and wait for them to be
+  // done with their scratch memory.
+  static void build_barrier(VkCommandBuffer command_buffer) {
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+        &memory_barrier, 0, nullptr, 0, nullptr);
+  }
+
+  static VkDeviceSize align(VkDeviceSize size, VkDeviceSize alignment) {
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  // Slice the refit scratch buffer between the dynamic BLASes and the TLAS,
+  // each slice aligned.
+  bool create_refit_scratch(memory &mem, VkDeviceSize scratch_alignment) {
+    destroy_scratch_buffer(mem, refit_scratch_buffer_,
+                           refit_scratch_buffer_memory_);
+
+    const VkDeviceSize alignment =
+        std::max<VkDeviceSize>(scratch_alignment, 1);
+
+    std::vector<VkDeviceSize> offsets;
+    VkDeviceSize size = 0;
+    for (const auto &blas : blas_) {
+      offsets.push_back(size);
+      if (blas.is_dynamic()) {
+        size += align(blas.get_scratch_size(), alignment);
+      }
+    }
+    offsets.push_back(size);
+    size += tlas_.get_scratch_size();
+
+    VkDeviceAddress address = 0;
+    if (!create_scratch_buffer(mem, refit_scratch_buffer_,
+                               refit_scratch_buffer_memory_, size, alignment,
+                               address)) {
+      std::cerr << "Failed to create refit scratch buffer." << std::endl;
+      return false;
+    }
+
+    refit_scratch_addresses_.clear();
+    for (uint32_t i = 0; i < offsets.size(); ++i) {
+      const bool used = i == blas_.size() || blas_[i].is_dynamic();
+      refit_scratch_addresses_.push_back(used ? address + offsets[i] : 0);
+    }
+
+    return true;
+  }
+
+  // Serialize the BLASes built from the geometries in their cache keys, and
+  // write them to the cache. Their serialized sizes were written to
+  // size_query_pool, in the same order.
+  bool store_in_cache(memory &mem, VkCommandPool &command_pool,
+                      VkQueue &graphics_queue,
+                      VkBuildAccelerationStructureFlagsKHR build_flags,
+                      const std::vector<uint32_t> &blases,
+                      VkQueryPool size_query_pool) {
+    VkDevice device = mem.get_device();
+
+    std::vector<VkDeviceSize> query_sizes(blases.size(), 0);
+    VkResult res = vkGetQueryPoolResults(
+        device, size_query_pool, 0, static_cast<uint32_t>(blases.size()),
+        sizeof(VkDeviceSize) * query_sizes.size(), query_sizes.data(),
+        sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to get serialized BLAS sizes: " << res
+                << std::endl;
+      return false;
+    }
+
+    std::vector<VkDeviceSize> sizes(blas_.size(), 0);
+    for (uint32_t b = 0; b < blases.size(); ++b) {
+      sizes[blases[b]] = query_sizes[b];
+    }
+
+    serialized_buffer_t download;
+    if (!create_serialized_buffer(mem, sizes, download)) {
+      return false;
+    }
+
+    VkCommandBuffer command_buffer;
+    if (!begin_single_time_commands(command_buffer, device, command_pool)) {
+      std::cerr << "BLAS cache: begin of single time command failed."
+                << std::endl;
+      destroy_serialized_buffer(mem, download);
+      return false;
+    }
+
+    for (const uint32_t i : blases) {
+      blas_[i].serialize(command_buffer,
+                         download.address + download.offsets[i]);
+    }
+
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0, nullptr, 0,
+        nullptr);
+
+    if (!end_single_time_commands(command_buffer, device, command_pool,
+                                  graphics_queue)) {
+      std::cerr << "BLAS cache: end of single time command failed."
+                << std::endl;
+      destroy_serialized_buffer(mem, download);
+      return false;
+    }
+
+    bool stored = true;
+    for (const uint32_t i : blases) {
+      const uint64_t key = acceleration_structure_cache::key(
+          blas_[i].get_geometry_hash(), build_flags);
+      stored = cache_.store(key, download.mapped + download.offsets[i],
+                            sizes[i]) &&
+               stored;
+    }
+
+    destroy_serialized_buffer(mem, download);
+
+    return stored;
+  }
+
+  bool create_size_query_pool(memory &mem, uint32_t count,
+                              VkQueryPool &query_pool) {
+    VkQueryPoolCreateInfo query_pool_create_info{};
+    query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_pool_create_info.queryType =
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+    query_pool_create_info.queryCount = count;
+    VkResult res =
+        vkCreateQueryPool(mem.get_device(), &query_pool_create_info,
+                          mem.get_allocation_callbacks(), &query_pool);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create BLAS size query pool: " << res
+                << std::endl;
       return false;
     }
     return true;
   }
 
+  // Serialized acceleration structures must be 256 bytes aligned. The buffer
+  // is over-allocated so that its address can be rounded up, and it stays
+  // mapped.
+  bool create_serialized_buffer(memory &mem,
+                                const std::vector<VkDeviceSize> &sizes,
+                                serialized_buffer_t &serialized) {
+    static constexpr VkDeviceSize alignment = 256;
+    VkDeviceSize size = 0;
+    serialized.offsets.clear();
+    for (const VkDeviceSize s : sizes) {
+      serialized.offsets.push_back(size);
+      size += (s + alignment - 1) / alignment * alignment;
+    }
+
+    VkBufferUsageFlags usage =
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (!mem.create_buffer(size + alignment - 1, usage, properties,
+                           serialized.buffer, serialized.memory)) {
+      std::cerr << "Failed to create serialized BLAS buffer." << std::endl;
+      return false;
+    }
+
+    void *mapped = nullptr;
+    VkResult res = vkMapMemory(mem.get_device(), serialized.memory, 0,
+                               VK_WHOLE_SIZE, 0, &mapped);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to map serialized BLAS buffer: " << res
+                << std::endl;
+      destroy_serialized_buffer(mem, serialized);
+      return false;
+    }
+
+    const VkDeviceAddress address =
+        mem.get_buffer_device_address(serialized.buffer);
+    serialized.address = (address + alignment - 1) / alignment * alignment;
+    serialized.mapped =
+        static_cast<uint8_t *>(mapped) + (serialized.address - address);
+
+    return true;
+  }
+
+  void destroy_serialized_buffer(memory &mem,
+                                 serialized_buffer_t &serialized) {
+    if (serialized.mapped) {
+      vkUnmapMemory(mem.get_device(), serialized.memory);
+    }
+    vkDestroyBuffer(mem.get_device(), serialized.buffer,
+                    mem.get_allocation_callbacks());
+    vkFreeMemory(mem.get_device(), serialized.memory,
+                 mem.get_allocation_callbacks());
+    serialized = serialized_buffer_t();
+  }
+
+  // The builder requires the scratch address to be aligned. The buffer is
+  // over-allocated so that its address can be rounded up to the alignment.
   bool create_scratch_buffer(memory &mem, VkBuffer &buffer,
-                             VkDeviceMemory &buffer_memory, VkDeviceSize size) {
-    VkBufferUsageFlags usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+                             VkDeviceMemory &buffer_memory, VkDeviceSize size,
+                             VkDeviceSize alignment,
+                             VkDeviceAddress &aligned_address) {
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    if (!mem.create_buffer(size, usage, properties, buffer, buffer_memory)) {
+    if (!mem.create_buffer(size + alignment - 1, usage, properties, buffer,
+                           buffer_memory)) {
       std::cerr << "Failed to create scratch buffer." << std::endl;
       return false;
     }
 
+    const VkDeviceAddress address = mem.get_buffer_device_address(buffer);
+    aligned_address = (address + alignment - 1) / alignment * alignment;
+
     return true;
   }
 
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "object.h"
+
+namespace rtx {
+
+// Files of serialized bottom level acceleration structures.
+//
+// Building the BLASes of a large scene takes a good part of the startup, while
+// copying a serialized BLAS back into memory is about as fast as uploading its
+// bytes. A BLAS is found by the hash of its triangles and build flags, and the
+// file also records the UUID of the driver that serialized it. Serialized
+// data is only valid for compatible drivers, so the device checks it before
+// it is deserialized, and a mismatch falls back to a build.
+class acceleration_structure_cache {
+ public:
+  acceleration_structure_cache() : directory_(), driver_uuid_{} {}
+
+  // Files go to directory, created when missing. An empty directory disables
+  // the cache.
+  void init(const std::string &directory,
+            const uint8_t driver_uuid[VK_UUID_SIZE]) {
+    directory_ = directory;
+    memcpy(driver_uuid_, driver_uuid, sizeof(driver_uuid_));
+  }
+
+  bool enabled() const { return !directory_.empty(); }
+
+  // Hash of the triangles of the given level of detail of an object, as
+  // added to a BLAS. The positions are hashed rather than the whole vertices,
+  // the builder reads nothing else.
+  static uint64_t geometry_hash(const object_model_t &object, uint32_t lod) {
+    uint64_t hash = FNV_OFFSET;
+    const uint64_t vertex_count = object.vertices.size();
+    hash = fnv1a(hash, &vertex_count, sizeof(vertex_count));
+    for (const Vertex &vertex : object.vertices) {
+      hash = fnv1a(hash, &vertex.pos, sizeof(vertex.pos));
+    }
+    if (lod < object.lods.size() && !object.indices.empty()) {
+      const lod_t &level = object.lods[lod];
+      hash = fnv1a(hash, &level.index_count, sizeof(level.index_count));
+      hash = fnv1a(hash, object.indices.data() + level.first_index,
+                   sizeof(uint32_t) * level.index_count);
+    }
+    return hash;
+  }
+
+  // Key of a BLAS in the cache, also built with flags.
+  static uint64_t key(uint64_t geometry_hash,
+                      VkBuildAccelerationStructureFlagsKHR flags) {
+    const uint32_t version = VERSION;
+    uint64_t hash = fnv1a(geometry_hash, &flags, sizeof(flags));
+    return fnv1a(hash, &version, sizeof(version));
+  }
+
+  std::string cache_path(uint64_t key) const {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key
+         << ".rtxblas";
+    return (std::filesystem::path(directory_) / name.str()).string();
+  }
+
+  // Read the serialized BLAS of key, and check that the device can
+  // deserialize it. Returns false on a miss.
+  bool load(VkDevice device, uint64_t key, std::vector<uint8_t> &data) const {
+    if (!enabled()) {
+      return false;
+    }
+
+    std::ifstream file(cache_path(key), std::ios::binary);
+    if (!file.is_open()) {
+      return false;
+    }
+
+    header_t header{};
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+      return false;
+    }
+
+    if (0 != memcmp(header.magic, MAGIC, sizeof(header.magic)) ||
+        VERSION != header.version || key != header.key ||
+        0 != memcmp(header.driver_uuid, driver_uuid_, sizeof(driver_uuid_)) ||
+        header.size < SERIALIZED_HEADER_SIZE) {
+      std::cout << "Acceleration structure cache " << cache_path(key)
+                << " is stale." << std::endl;
+      return false;
+    }
+
+    // The size is checked against the file before allocating it.
+    const std::streamoff data_offset = file.tellg();
+    file.seekg(0, std::ios::end);
+    const std::streamoff file_size = file.tellg();
+    file.seekg(data_offset);
+    if (data_offset < 0 || file_size < data_offset || !file ||
+        header.size > static_cast<uint64_t>(file_size - data_offset)) {
+      std::cerr << "Acceleration structure cache " << cache_path(key)
+                << " is truncated." << std::endl;
+      return false;
+    }
+
+    std::vector<uint8_t> serialized(header.size);
+    if (!file.read(reinterpret_cast<char *>(serialized.data()),
+                   serialized.size())) {
+      std::cerr << "Acceleration structure cache " << cache_path(key)
+                << " is truncated." << std::endl;
+      return false;
+    }
+
+    // The serialized data starts with the driver UUID and the compatibility
+    // UUID of the implementation.
+    VkAccelerationStructureVersionInfoKHR version_info{};
+    version_info.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+    version_info.pVersionData = serialized.data();
+    VkAccelerationStructureCompatibilityKHR compatibility =
+        VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+    vkGetDeviceAccelerationStructureCompatibilityKHR(device, &version_info,
+                                                     &compatibility);
+    if (VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR !=
+        compatibility) {
+      std::cout << "Acceleration structure cache " << cache_path(key)
+                << " is incompatible with the driver." << std::endl;
+      return false;
+    }
+
+    data.swap(serialized);
+
+    return true;
+  }
+
+  // Write the serialized BLAS of key.
+  bool store(uint64_t key, const uint8_t *data, VkDeviceSize size) const {
+    if (!enabled()) {
+      return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if (error) {
+      std::cerr << "Failed to create " << directory_ << ": "
+                << error.message() << std::endl;
+      return false;
+    }
+
+    header_t header{};
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.key = key;
+    memcpy(header.driver_uuid, driver_uuid_, sizeof(driver_uuid_));
+    header.size = size;
+
+    std::ofstream file(cache_path(key), std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      std::cerr << "Failed to open acceleration structure cache "
+                << cache_path(key) << "." << std::endl;
+      return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(data), size);
+
+    if (!file) {
+      std::cerr << "Failed to write acceleration structure cache "
+                << cache_path(key) << "." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Size of the acceleration structure that the serialized data is
+  // deserialized into, read from the header of the data.
+  static VkDeviceSize deserialized_size(const std::vector<uint8_t> &data) {
+    uint64_t size = 0;
+    memcpy(&size, data.data() + DESERIALIZED_SIZE_OFFSET, sizeof(size));
+    return size;
+  }
+
+ private:
+  static constexpr char MAGIC[8] = {'R', 'T', 'X', 'B', 'L', 'A', 'S', '\0'};
+
+  // Bump it every time the layout of the cache or the geometry of the BLASes
+  // changes.
+  static constexpr uint32_t VERSION = 1;
+
+  // The serialized data starts with the driver and compatibility UUIDs, then
+  // the serialized size, the deserialized size and the handle count, 64 bits
+  // each.
+  static constexpr size_t DESERIALIZED_SIZE_OFFSET = 2 * VK_UUID_SIZE + 8;
+  static constexpr size_t SERIALIZED_HEADER_SIZE =
+      DESERIALIZED_SIZE_OFFSET + 16;
+
+  struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t key;
+    uint8_t driver_uuid[VK_UUID_SIZE];
+    uint64_t size;  // Of the serialized data that follows.
+  };
+
+  static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+  static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+  static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+  }
+
+  std::string directory_;
+  uint8_t driver_uuid_[VK_UUID_SIZE];
+};
+
+}  // namespace rtx
@@ -6,23 +6,31 @@
 
 namespace rtx {
 
+// Instance visibility masks, AND-ed with the cull mask of the rays.
+//
+// Camera rays only see full resolution geometry. Shadow and bounce rays see the
+// simplified level of detail of an object when there is one.
+static constexpr uint32_t INSTANCE_MASK_PRIMARY = 0x01;
+static constexpr uint32_t INSTANCE_MASK_SECONDARY = 0x02;
+
 // Helper structure to hold the instance data.
 struct new_blas_instance_t {
-  new_blas_instance_t(const VkAccelerationStructureNV &_blas,
-                      uint32_t _instance_id, uint32_t _hit_group_id,
+  new_blas_instance_t(VkDeviceAddress _blas_address, uint32_t _instance_id,
+                      uint32_t _hit_group_id, uint32_t _mask,
                       const glm::mat4 &_transform)
-      : blas(_blas),
+      : blas_address(_blas_address),
         instance_id(_instance_id),
         hit_group_id(_hit_group_id),
+        mask(_mask),
         transform(_transform) {}
 
   // Index of the blas on Engine::blas_.
   // uint32_t blas_id;
 
-  // Bottom-Level Acceleration Structure.
-  VkAccelerationStructureNV blas;
+  // Device address of the Bottom-Level Acceleration Structure.
+  VkDeviceAddress blas_address;
 
-  // Instance ID used by shaders gl_InstanceID.
+  // Instance ID used by shaders gl_InstanceCustomIndexEXT.
   uint32_t instance_id;
 
   // Hit group index on the SBT.
@@ -32,37 +40,36 @@ struct new_blas_instance_t {
   uint32_t mask = 0xff;
 
   // instance flags.
-  VkGeometryInstanceFlagsNV flags =
-      VK_GEOMETRY_INSTANCE_TRIANGLE_CULL_DISABLE_BIT_NV;
+  VkGeometryInstanceFlagsKHR flags =
+      VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
 
   // Transform matrix.
   glm::mat4 transform = glm::mat4(1.0f);
 };
 
-// Struct containing the passing instance data required by the
-// VK_NV_ray_tracing extension.
-// This struct details a 64-byte data layout that for some reason is not in any
-// vulkan header.
-struct geometry_instance_t {
-  // Transform matrix, containing only the top 3 rows.
-  glm::mat3x4 transform;
-
-  // Instance index.
-  uint32_t instance_id : 24;
-
-  // Visibility mask.
-  uint32_t mask : 8;
-
-  // Index of the hit group which will be invoked when a ray hits the instance.
-  uint32_t hit_group_id : 24;
-
-  // Instance flags, such as culling.
-  uint32_t flags : 8;
-
-  // Opaque handle of the bottom-level acceleration structure.
-  uint64_t acceleration_structure_handle;
+// Entry of the instance table of the ray tracing shaders, indexed by the
+// custom index of the TLAS instances. Same layout as Instance in
+// vertex.glsl.
+struct rt_instance_t {
+  glm::mat4 transform;         // Object to world.
+  glm::mat4 normal_transform;  // Inverse transpose of the transform.
+
+  // Device addresses of the geometry of the object.
+  VkDeviceAddress vertices;
+  VkDeviceAddress indices;
+
+  // Levels of detail share the index buffer, this is the first triangle of
+  // the level in the BLAS.
+  uint32_t first_primitive;
+  uint32_t object;  // Index of the object.
+
+  // Material.
+  int32_t textured;
+  int32_t illumination;
+  glm::vec4 diffuse;
+  glm::vec4 specular;
 };
+static_assert(sizeof(rt_instance_t) == 192,
+              "rt_instance_t must match the std430 layout of Instance.");
 
-static_assert(sizeof(geometry_instance_t) == 64,
-              "geometry_instance_t compiles with wrong size.");
 }  // namespace rtx
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 
 #include <vulkan/vulkan.h>
@@ -12,23 +13,47 @@ class bottom_level_acceleration_structure {
  public:
   bottom_level_acceleration_structure() = default;
 
-  // Add an object vertex and index buffers in GPU memory into the acceleration
-  // structure. Index buffer is optional.
-  bool add_object(const object_model_t &object) {
-    VkGeometryNV geometry{};
-
-    // VK_GEOMETRY_OPAQUE_BIT_NV means the object won't invoke any-hit shaders.
-    VkGeometryFlagBitsNV flags = VK_GEOMETRY_OPAQUE_BIT_NV;
-
-    if (!convert_object_to_geometry_nv(object, geometry, flags)) {
+  // Add an object vertices and indices in GPU memory into the acceleration
+  // structure, read at their offsets from geometry_address. Indices are
+  // optional. Only the triangles of the given level of detail are added.
+  //
+  // All the objects added to the BLAS are built together as a multi-geometry
+  // acceleration structure.
+  bool add_object(VkDeviceAddress geometry_address,
+                  const object_model_t &object, uint32_t lod) {
+    VkAccelerationStructureGeometryKHR geometry{};
+    VkAccelerationStructureBuildRangeInfoKHR build_range{};
+
+    // VK_GEOMETRY_OPAQUE_BIT_KHR means the object won't invoke any-hit
+    // shaders.
+    VkGeometryFlagsKHR flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+
+    if (!convert_object_to_geometry_khr(geometry_address, object, lod, flags,
+                                        geometry, build_range)) {
       std::cerr << "BLAS: Failed to add geometry." << std::endl;
       return false;
     }
     geometries_.push_back(geometry);
+    build_ranges_.push_back(build_range);
 
     return true;
   }
 
+  // Move the geometries from the geometry buffer at from to the same offsets
+  // at to.
+  void relocate_geometry(VkDeviceAddress from, VkDeviceAddress to) {
+    for (auto &geometry : geometries_) {
+      VkAccelerationStructureGeometryTrianglesDataKHR &triangles =
+          geometry.geometry.triangles;
+      triangles.vertexData.deviceAddress =
+          triangles.vertexData.deviceAddress - from + to;
+      if (VK_INDEX_TYPE_NONE_KHR != triangles.indexType) {
+        triangles.indexData.deviceAddress =
+            triangles.indexData.deviceAddress - from + to;
+      }
+    }
+  }
+
   void add_transform(const glm::mat4 &transform) {
     transforms_.emplace_back(transform);
   }
@@ -37,277 +62,355 @@ class bottom_level_acceleration_structure {
 
   const std::vector<glm::mat4> &get_transforms() const { return transforms_; }
 
-  // Create the handle required to build the acceleration structure.
+  // Visibility mask of the instances of the BLAS.
+  void set_mask(uint32_t mask) { mask_ = mask; }
+  uint32_t get_mask() const { return mask_; }
+
+  // Position of the first instance of the BLAS in the instance table of the
+  // shaders. The custom index of each instance is its position in the table.
+  void set_first_instance(uint32_t first_instance) {
+    first_instance_ = first_instance;
+  }
+  uint32_t get_first_instance() const { return first_instance_; }
+
+  // Whether the vertices of the BLAS are deformed every frame, so that it is
+  // created with update support and refit.
+  void set_dynamic(bool dynamic) { dynamic_ = dynamic; }
+  bool is_dynamic() const { return dynamic_; }
+
+  // Hash of the geometries of a BLAS found in the acceleration structure
+  // cache, 0 when it is not cached.
+  void set_geometry_hash(uint64_t hash) { geometry_hash_ = hash; }
+  uint64_t get_geometry_hash() const { return geometry_hash_; }
+
+  // Create the acceleration structure and the buffer that will contain it, and
+  // compute the size of the scratch buffer required to build it.
   //
-  // It requires a flag to indicate whether the acceleration structure will
+  // build_flags chooses between a faster trace or a faster build. It also
+  // requires a flag to indicate whether the acceleration structure will
   // support dynamic updates, so that the builder can later optimize the
   // structure for that usage.
   //
-  // It is required to know the number of geometries inserted in advance, that
-  // is why this method must be called after all the geometries have been added
-  // with add_object().
-  bool create(VkDevice device,
-              const VkAllocationCallbacks *allocation_callbacks,
-              bool allow_update) {
+  // It is required to know the geometries inserted in advance, that is why
+  // this method must be called after all the geometries have been added with
+  // add_object(). Dynamic BLASes always allow updates.
+  bool create(memory &mem, VkBuildAccelerationStructureFlagsKHR build_flags,
+              bool allow_update, VkDeviceSize &scratch_size) {
     // The generated acceleration structure can support iterative updates. This
     // updates may change the final size of the acceleration structure and then
     // the memory requirements. This flag must be set before the acceleration
     // structure is built.
-    flags_ =
-        allow_update ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV : 0;
-
-    // Setup the descriptor of the acceleration structure which contains the
-    // number of geometries it will contain.
-    VkAccelerationStructureInfoNV as_info = descriptor();
-
-    VkAccelerationStructureCreateInfoNV as_create_info{};
-    as_create_info.sType =
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
-    as_create_info.info = as_info;
-
-    VkResult res = vkCreateAccelerationStructureNV(device, &as_create_info,
-                                                   allocation_callbacks,
-                                                   &acceleration_structure_);
-    if (VK_SUCCESS != res) {
-      std::cerr << "Failed to create BLAS: " << res << std::endl;
-      return false;
+    flags_ = build_flags;
+    if (allow_update || dynamic_) {
+      flags_ |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
     }
 
-    return true;
-  }
-
-  // Compute the size of the scratch buffer required to build the acceleration
-  // structure and the size of the structure once built.
-  bool compute_buffer_sizes(VkDevice device, memory &mem,
-                            VkDeviceSize &scratch_size) {
-    // Create the descriptor for the memory requirements.
+    // Compute the size of the built acceleration structure and of the scratch
+    // buffers needed to build and update it.
     //
-    VkAccelerationStructureMemoryRequirementsInfoNV memory_requirements_info{};
-    memory_requirements_info.sType =
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
-    memory_requirements_info.type =
-        VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_OBJECT_NV;
-    memory_requirements_info.accelerationStructure = acceleration_structure_;
-
-    // Compute the size of the built acceleration structure and store it for
-    // future build/updates.
-    //
-    VkMemoryRequirements2 memory_requirements{};
-    memory_requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
-    vkGetAccelerationStructureMemoryRequirementsNV(
-        device, &memory_requirements_info, &memory_requirements);
-    structure_size_ = memory_requirements.memoryRequirements.size;
+    VkAccelerationStructureBuildGeometryInfoKHR build_info =
+        descriptor(VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
 
-    // Allocate the GPU memory that will contain the acceleration structure.
-    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    if (!mem.allocate_memory(memory_requirements.memoryRequirements, properties,
-                             acceleration_structure_memory_)) {
-      std::cerr << "Failed to allocate BLAS memory." << std::endl;
-      return false;
+    std::vector<uint32_t> max_primitive_counts;
+    for (auto &build_range : build_ranges_) {
+      max_primitive_counts.push_back(build_range.primitiveCount);
     }
 
-    // Compute the scratch buffer size needed to build the acceleration
-    // structure.
-    //
-    memory_requirements_info.type =
-        VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
-    vkGetAccelerationStructureMemoryRequirementsNV(
-        device, &memory_requirements_info, &memory_requirements);
-    scratch_size_ = memory_requirements.memoryRequirements.size;
-
-    // Compute the scratch buffer size needed to update the acceleration
-    // structure.
-    //
-    memory_requirements_info.type =
-        VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_NV;
-    vkGetAccelerationStructureMemoryRequirementsNV(
-        device, &memory_requirements_info, &memory_requirements);
-    scratch_size_ =
-        std::max(scratch_size_, memory_requirements.memoryRequirements.size);
+    VkAccelerationStructureBuildSizesInfoKHR build_sizes{};
+    build_sizes.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+    vkGetAccelerationStructureBuildSizesKHR(
+        mem.get_device(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &build_info, max_primitive_counts.data(), &build_sizes);
 
+    structure_size_ = build_sizes.accelerationStructureSize;
+    scratch_size_ =
+        std::max(build_sizes.buildScratchSize, build_sizes.updateScratchSize);
     scratch_size = scratch_size_;
 
-    return true;
+    return allocate(mem);
   }
 
-  bool generate(VkDevice device, VkCommandBuffer command_buffer,
-                VkBuffer scratch_buffer, VkDeviceSize scratch_offset,
-                bool update_only) {
-    // Sanity checks for update option.
-    if (update_only) {
-      if (!(flags_ & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV)) {
-        std::cerr
-            << "Cannot update BLAS originally built without update support."
-            << std::endl;
-        return false;
-      }
-      if (VK_NULL_HANDLE == acceleration_structure_) {
-        std::cerr << "Cannot update BLAS not built." << std::endl;
-        return false;
-      }
-    }
-
-    // Sanity checks for buffer sizes.
-    if (0 == scratch_size_ || 0 == structure_size_) {
-      std::cerr << "BLAS: compute_buffer_sizes() must be run before generate()."
-                << std::endl;
-      return false;
-    }
+  // Create the acceleration structure to deserialize into instead of
+  // building it, of the size given by the serialized data. It was serialized
+  // from a BLAS of the same geometries built with build_flags.
+  bool create_deserialized(memory &mem,
+                           VkBuildAccelerationStructureFlagsKHR build_flags,
+                           VkDeviceSize size) {
+    flags_ = build_flags;
+    structure_size_ = size;
+    scratch_size_ = 0;
+    return allocate(mem);
+  }
 
-    // Bind the acceleration structure descriptor to the memory that will
-    // contain it.
-    //
-    VkBindAccelerationStructureMemoryInfoNV bind{};
-    bind.sType = VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_NV;
-    bind.accelerationStructure = acceleration_structure_;
-    bind.memory =
-        acceleration_structure_memory_;  // TODO: Receive VkDeviceMemory +
-                                         // offset for all BLASs.
-    bind.memoryOffset = 0;
-    bind.deviceIndexCount = 0;
-    bind.pDeviceIndices = nullptr;
-
-    static constexpr uint32_t bind_info_count = 1;
-    VkResult res =
-        vkBindAccelerationStructureMemoryNV(device, bind_info_count, &bind);
-    if (VK_SUCCESS != res) {
-      std::cerr << "Bind of BLAS failed: " << res << std::endl;
-      return false;
-    }
+  // Record the copy of serialized data at address, valid for this device,
+  // into the BLAS created by create_deserialized().
+  void deserialize(VkCommandBuffer command_buffer, VkDeviceAddress address) {
+    VkCopyMemoryToAccelerationStructureInfoKHR copy_info{};
+    copy_info.sType =
+        VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+    copy_info.src.deviceAddress = address;
+    copy_info.dst = acceleration_structure_;
+    copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+    vkCmdCopyMemoryToAccelerationStructureKHR(command_buffer, &copy_info);
+  }
 
-    // Build the actual acceleration structure.
-    //
+  // Record the copy of the built BLAS to address in its serialized form,
+  // whose size is queried with
+  // VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR.
+  void serialize(VkCommandBuffer command_buffer, VkDeviceAddress address) {
+    VkCopyAccelerationStructureToMemoryInfoKHR copy_info{};
+    copy_info.sType =
+        VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+    copy_info.src = acceleration_structure_;
+    copy_info.dst.deviceAddress = address;
+    copy_info.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+    vkCmdCopyAccelerationStructureToMemoryKHR(command_buffer, &copy_info);
+  }
 
-    // Re-create the acceleration structure descriptor.
-    VkAccelerationStructureInfoNV as_info = descriptor();
-
-    VkBuffer instance_data = VK_NULL_HANDLE;
-    VkDeviceSize instance_offset = 0;
-    vkCmdBuildAccelerationStructureNV(
-        command_buffer, &as_info, instance_data, instance_offset, update_only,
-        acceleration_structure_,
-        update_only ? acceleration_structure_ : VK_NULL_HANDLE, scratch_buffer,
-        scratch_offset);
-
-    // Since the scratch buffer is reused for each BLAS, add a barrier to
-    // wait from previous build before the next.
-    VkMemoryBarrier memory_barrier{};
-    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    memory_barrier.srcAccessMask =
-        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
-    memory_barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
-
-    VkPipelineStageFlags src_stage_mask =
-        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV;
-    VkPipelineStageFlags dst_stage_mask =
-        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV;
-    VkDependencyFlags dependency_flags = 0;
-    uint32_t memory_barrier_count = 1;
-    uint32_t buffer_memory_barrier_count = 0;
-    const VkBufferMemoryBarrier *buffer_memory_barrier = nullptr;
-    uint32_t image_memory_barrier_count = 0;
-    const VkImageMemoryBarrier *image_memory_barrier = nullptr;
-
-    vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask,
-                         dependency_flags, memory_barrier_count,
-                         &memory_barrier, buffer_memory_barrier_count,
-                         buffer_memory_barrier, image_memory_barrier_count,
-                         image_memory_barrier);
+  // Record the build of the BLAS, or its update when update_only.
+  //
+  // No barrier is recorded: BLASes built with disjoint scratch memory run
+  // concurrently. The caller waits for the builds before their scratch
+  // memory is reused and before the BLAS is read.
+  bool generate(VkCommandBuffer command_buffer, VkDeviceAddress scratch_address,
+                bool update_only) {
+    return build(command_buffer, scratch_address, update_only);
+  }
 
-    return true;
+  // Update the BLAS from the current vertices, or build it again when
+  // rebuild. Refitting keeps the tree of the first build and only moves its
+  // bounds, so it is much faster but traces slower as the vertices move away
+  // from their built positions. As with generate(), no barrier is recorded.
+  bool refit(VkCommandBuffer command_buffer, VkDeviceAddress scratch_address,
+             bool rebuild) {
+    return build(command_buffer, scratch_address, !rebuild);
   }
 
+  VkDeviceSize get_scratch_size() const { return scratch_size_; }
+
+  VkBuildAccelerationStructureFlagsKHR get_flags() const { return flags_; }
+
   void destroy(VkDevice device,
                const VkAllocationCallbacks *allocation_callbacks) {
-    vkDestroyAccelerationStructureNV(device, acceleration_structure_,
-                                     allocation_callbacks);
+    vkDestroyAccelerationStructureKHR(device, acceleration_structure_,
+                                      allocation_callbacks);
     acceleration_structure_ = VK_NULL_HANDLE;
 
+    vkDestroyBuffer(device, acceleration_structure_buffer_,
+                    allocation_callbacks);
+    acceleration_structure_buffer_ = VK_NULL_HANDLE;
+
     vkFreeMemory(device, acceleration_structure_memory_, allocation_callbacks);
     acceleration_structure_memory_ = VK_NULL_HANDLE;
   }
 
-  const VkAccelerationStructureNV &get_acceleration_structure() const {
+  const VkAccelerationStructureKHR &get_acceleration_structure() const {
     return acceleration_structure_;
   }
 
+  VkDeviceAddress get_device_address() const { return device_address_; }
+
  private:
   // Attributes
   //
 
   // The acceleration structure.
-  VkAccelerationStructureNV acceleration_structure_;
+  VkAccelerationStructureKHR acceleration_structure_ = VK_NULL_HANDLE;
 
-  // The memory containing the acceleration structure.
-  VkDeviceMemory acceleration_structure_memory_;
+  // The buffer containing the acceleration structure.
+  VkBuffer acceleration_structure_buffer_ = VK_NULL_HANDLE;
 
-  // Construction flags, used to indicate whether the AS allows updates.
-  VkBuildAccelerationStructureFlagsNV flags_;
+  // The memory of the acceleration structure buffer.
+  VkDeviceMemory acceleration_structure_memory_ = VK_NULL_HANDLE;
 
-  // List of geometries contained on the BLAS.
-  std::vector<VkGeometryNV> geometries_;
+  // Device address of the acceleration structure, referenced by the TLAS.
+  VkDeviceAddress device_address_ = 0;
+
+  // Construction flags, used to indicate whether the AS allows updates and
+  // whether it prefers a fast trace or a fast build.
+  VkBuildAccelerationStructureFlagsKHR flags_ = 0;
+
+  // List of geometries contained on the BLAS and their ranges.
+  std::vector<VkAccelerationStructureGeometryKHR> geometries_;
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR> build_ranges_;
 
   // List of transofmration matrix that applied to all geometries.
   std::vector<glm::mat4> transforms_;
 
+  // Visibility mask of the instances.
+  uint32_t mask_ = 0xff;
+
+  // Instance table entry of the first instance.
+  uint32_t first_instance_ = 0;
+
+  // Whether the BLAS is refit every frame.
+  bool dynamic_ = false;
+
+  // Key of the geometries in the acceleration structure cache, 0 if none.
+  uint64_t geometry_hash_ = 0;
+
   // Size needed for the temporary memory used to build the BLAS.
-  VkDeviceSize scratch_size_;
+  VkDeviceSize scratch_size_ = 0;
 
   // Size of the buffer containing the BLAS.
-  VkDeviceSize structure_size_;
+  VkDeviceSize structure_size_ = 0;
 
   // Methods
   //
-  static bool convert_object_to_geometry_nv(const object_model_t &object,
-                                            VkGeometryNV &geometry,
-                                            VkGeometryFlagBitsNV flags) {
-    geometry.sType = VK_STRUCTURE_TYPE_GEOMETRY_NV;
-    geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_NV;
+
+  // Allocate the buffer of structure_size_ bytes and create the acceleration
+  // structure in it.
+  bool allocate(memory &mem) {
+    // Allocate the GPU memory that will contain the acceleration structure.
+    //
+    VkBufferUsageFlags usage =
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if (!mem.create_buffer(structure_size_, usage, properties,
+                           acceleration_structure_buffer_,
+                           acceleration_structure_memory_)) {
+      std::cerr << "Failed to allocate BLAS memory." << std::endl;
+      return false;
+    }
+
+    VkAccelerationStructureCreateInfoKHR as_create_info{};
+    as_create_info.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    as_create_info.buffer = acceleration_structure_buffer_;
+    as_create_info.offset = 0;
+    as_create_info.size = structure_size_;
+    as_create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+    VkResult res = vkCreateAccelerationStructureKHR(
+        mem.get_device(), &as_create_info, mem.get_allocation_callbacks(),
+        &acceleration_structure_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create BLAS: " << res << std::endl;
+      return false;
+    }
+
+    // The TLAS instances reference the BLAS by its device address.
+    VkAccelerationStructureDeviceAddressInfoKHR address_info{};
+    address_info.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+    address_info.accelerationStructure = acceleration_structure_;
+    device_address_ =
+        vkGetAccelerationStructureDeviceAddressKHR(mem.get_device(),
+                                                   &address_info);
+
+    return true;
+  }
+
+  // Record the build, or the update, of the BLAS.
+  bool build(VkCommandBuffer command_buffer, VkDeviceAddress scratch_address,
+             bool update_only) {
+    // Sanity checks for update option.
+    if (update_only) {
+      if (!(flags_ & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
+        std::cerr
+            << "Cannot update BLAS originally built without update support."
+            << std::endl;
+        return false;
+      }
+      if (VK_NULL_HANDLE == acceleration_structure_) {
+        std::cerr << "Cannot update BLAS not built." << std::endl;
+        return false;
+      }
+    }
+
+    // Sanity checks for buffer sizes.
+    if (0 == scratch_size_ || 0 == structure_size_) {
+      std::cerr << "BLAS: create() must be run before generate()."
+                << std::endl;
+      return false;
+    }
+
+    // Build the actual acceleration structure. All the geometries of the BLAS
+    // are built with a single command.
+    //
+    VkBuildAccelerationStructureModeKHR mode =
+        update_only ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+                    : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    VkAccelerationStructureBuildGeometryInfoKHR build_info = descriptor(mode);
+    build_info.srcAccelerationStructure =
+        update_only ? acceleration_structure_ : VK_NULL_HANDLE;
+    build_info.dstAccelerationStructure = acceleration_structure_;
+    build_info.scratchData.deviceAddress = scratch_address;
+
+    const VkAccelerationStructureBuildRangeInfoKHR *build_ranges =
+        build_ranges_.data();
+
+    static constexpr uint32_t info_count = 1;
+    vkCmdBuildAccelerationStructuresKHR(command_buffer, info_count,
+                                        &build_info, &build_ranges);
+
+    return true;
+  }
+
+  static bool convert_object_to_geometry_khr(
+      VkDeviceAddress geometry_address, const object_model_t &object,
+      uint32_t lod, VkGeometryFlagsKHR flags,
+      VkAccelerationStructureGeometryKHR &geometry,
+      VkAccelerationStructureBuildRangeInfoKHR &build_range) {
+    if (lod >= object.lods.size()) {
+      std::cerr << "BLAS: Object has no LOD " << lod << "." << std::endl;
+      return false;
+    }
+
+    geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+    geometry.flags = flags;
+
+    VkAccelerationStructureGeometryTrianglesDataKHR &triangles =
+        geometry.geometry.triangles;
+    triangles.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
 
     // Vertex buffer.
-    geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
-    geometry.geometry.triangles.vertexData = object.vertex_buf;
-    geometry.geometry.triangles.vertexOffset = object.vertex_offset;
-    geometry.geometry.triangles.vertexCount =
-        static_cast<uint32_t>(object.vertices.size());
-    geometry.geometry.triangles.vertexStride = sizeof(Vertex);
-    geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+    triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+    triangles.vertexData.deviceAddress =
+        geometry_address + object.vertex_offset;
+    triangles.vertexStride = sizeof(Vertex);
+    triangles.maxVertex = static_cast<uint32_t>(object.vertices.size()) - 1;
 
     // Index buffer.
     // This one is optional.
     //
-    geometry.geometry.triangles.indexData = object.index_buf;
-    geometry.geometry.triangles.indexOffset = object.index_offset;
-    geometry.geometry.triangles.indexCount =
-        static_cast<uint32_t>(object.indices.size());
-    geometry.geometry.triangles.indexType = object.index_buf != VK_NULL_HANDLE
-                                                ? VK_INDEX_TYPE_UINT32
-                                                : VK_INDEX_TYPE_NONE_NV;
+    if (!object.indices.empty()) {
+      triangles.indexType = VK_INDEX_TYPE_UINT32;
+      triangles.indexData.deviceAddress =
+          geometry_address + object.index_offset;
+    } else {
+      triangles.indexType = VK_INDEX_TYPE_NONE_KHR;
+    }
 
     // Transformation matrix.
     // Not used.
     //
-    geometry.geometry.triangles.transformData = VK_NULL_HANDLE;
-    geometry.geometry.triangles.transformOffset = 0;
+    triangles.transformData.deviceAddress = 0;
 
-    // axis-aligned bounding box.
-    //
-    geometry.geometry.aabbs = {};
-    geometry.geometry.aabbs.sType = VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV;
-
-    geometry.flags = flags;
+    // Triangles of the level of detail.
+    build_range.primitiveCount = object.lods[lod].index_count / 3;
+    build_range.primitiveOffset =
+        object.lods[lod].first_index * sizeof(uint32_t);
+    build_range.firstVertex = 0;
+    build_range.transformOffset = 0;
 
     return true;
   }
 
-  VkAccelerationStructureInfoNV descriptor() const {
-    VkAccelerationStructureInfoNV build_info{};
-    build_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
-    build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
-    build_info.instanceCount = 0;  // Always zero with bottom-level.
+  VkAccelerationStructureBuildGeometryInfoKHR descriptor(
+      VkBuildAccelerationStructureModeKHR mode) const {
+    VkAccelerationStructureBuildGeometryInfoKHR build_info{};
+    build_info.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+    build_info.flags = flags_;
+    build_info.mode = mode;
     build_info.geometryCount = static_cast<uint32_t>(geometries_.size());
     build_info.pGeometries = geometries_.data();
-    build_info.flags = flags_;
     return build_info;
   }
 };
@@ -0,0 +1,522 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "acceleration_structure.h"
+#include "gpu_timer.h"
+#include "helpers.h"
+#include "memory.h"
+
+// Denoiser shaders
+#include "denoiser_atrous.comp.h"
+#include "denoiser_temporal.comp.h"
+
+namespace rtx {
+
+// Spatio-temporal denoiser of the ray traced image, see denoiser.glsl.
+//
+// The ray tracers write the G-buffer of their camera rays to the ray tracing
+// descriptor set. The denoiser reprojects its history with the motion vectors
+// of the G-buffer, blends the new frame into it and filters the result with a
+// few a-trous iterations. The denoised image is then copied to the swap chain
+// instead of the ray traced one.
+class denoiser {
+ public:
+  static constexpr uint32_t MAX_ITERATIONS = 5;
+
+  // GPU timer passes.
+  enum pass { pass_temporal = 0, pass_filter = 1, pass_count = 2 };
+
+  denoiser()
+      : descriptor_pool_(),
+        descriptor_layout_(),
+        descriptor_sets_{},
+        pipeline_layout_(),
+        temporal_pipeline_(),
+        atrous_pipeline_(),
+        history_{},
+        moments_{},
+        normal_depth_{},
+        filter_{},
+        output_(),
+        current_history_(0),
+        reset_(true),
+        timer_() {}
+
+  // Ray tracing descriptor set layout of the ray tracers, with the G-buffer.
+  bool init(memory &mem, const VkPhysicalDeviceProperties &properties,
+            uint32_t timestamp_valid_bits, VkExtent2D window_size,
+            VkFormat output_format,
+            VkDescriptorSetLayout rt_descriptor_layout) {
+    if (!timer_.init(mem, properties, timestamp_valid_bits, pass_count)) {
+      std::cerr << "Failed to init denoiser timer." << std::endl;
+      return false;
+    }
+
+    if (!init_images(mem, window_size, output_format)) {
+      std::cerr << "Failed to create denoiser images." << std::endl;
+      return false;
+    }
+
+    if (!init_descriptor_sets(mem)) {
+      std::cerr << "Failed to create denoiser descriptor sets." << std::endl;
+      return false;
+    }
+
+    if (!init_pipelines(mem, rt_descriptor_layout)) {
+      std::cerr << "Failed to create denoiser pipelines." << std::endl;
+      return false;
+    }
+
+    // New images have no history.
+    reset_ = true;
+
+    return true;
+  }
+
+  void fini(memory &mem) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    vkDestroyPipeline(device, temporal_pipeline_, allocation_callbacks);
+    temporal_pipeline_ = VK_NULL_HANDLE;
+    vkDestroyPipeline(device, atrous_pipeline_, allocation_callbacks);
+    atrous_pipeline_ = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout(device, pipeline_layout_, allocation_callbacks);
+    pipeline_layout_ = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(device, descriptor_pool_, allocation_callbacks);
+    descriptor_pool_ = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(device, descriptor_layout_,
+                                 allocation_callbacks);
+    descriptor_layout_ = VK_NULL_HANDLE;
+
+    for (storage_image_t *image : images()) {
+      destroy_image(mem, *image);
+    }
+
+    timer_.fini(mem);
+  }
+
+  // Read the GPU times of a frame. Call after waiting for its fence.
+  void read(memory &mem, uint32_t frame) { timer_.read(mem, frame); }
+
+  // Discard the history, it no longer matches the ray traced image.
+  void reset() { reset_ = true; }
+
+  // Denoise the ray traced image of this frame into the output image.
+  void denoise(VkCommandBuffer cmd_buf, uint32_t frame, VkExtent2D window_size,
+               VkDescriptorSet rt_descriptor_set, uint32_t iterations) {
+    timer_.reset(cmd_buf, frame);
+
+    // Wait for the ray tracers. The previous contents of the images are
+    // discarded on a reset.
+    std::vector<VkImageMemoryBarrier> image_barriers;
+    if (reset_) {
+      for (storage_image_t *image : images()) {
+        VkImageMemoryBarrier image_barrier{};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_barrier.dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.image = image->image;
+        image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        image_barrier.subresourceRange.levelCount = 1;
+        image_barrier.subresourceRange.layerCount = 1;
+        image_barriers.push_back(image_barrier);
+      }
+    }
+
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd_buf,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memory_barrier, 0, nullptr,
+                         static_cast<uint32_t>(image_barriers.size()),
+                         image_barriers.data());
+
+    const uint32_t groups_x = group_count(window_size.width);
+    const uint32_t groups_y = group_count(window_size.height);
+
+    // Temporal accumulation, writes the first filter input.
+    //
+    constants_t constants{};
+    constants.reset = reset_ ? 1 : 0;
+
+    bind(cmd_buf, rt_descriptor_set, 1);
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      temporal_pipeline_);
+    push_constants(cmd_buf, constants);
+    timer_.begin(cmd_buf, frame, pass_temporal);
+    vkCmdDispatch(cmd_buf, groups_x, groups_y, 1);
+    timer_.end(cmd_buf, frame, pass_temporal);
+    barrier(cmd_buf);
+
+    // A-trous iterations. The first one becomes the history of the next frame.
+    //
+    iterations = std::max(1u, std::min(iterations, MAX_ITERATIONS));
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      atrous_pipeline_);
+    timer_.begin(cmd_buf, frame, pass_filter);
+    for (uint32_t i = 0; i < iterations; ++i) {
+      constants.step = 1 << i;
+      constants.feedback = 0 == i ? 1 : 0;
+      constants.last = iterations - 1 == i ? 1 : 0;
+      constants.reset = 0;
+
+      bind(cmd_buf, rt_descriptor_set, i % 2);
+      push_constants(cmd_buf, constants);
+      vkCmdDispatch(cmd_buf, groups_x, groups_y, 1);
+      barrier(cmd_buf);
+    }
+    timer_.end(cmd_buf, frame, pass_filter);
+
+    // The output image is copied to the swap chain.
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier,
+                         0, nullptr, 0, nullptr);
+
+    current_history_ = 1 - current_history_;
+    reset_ = false;
+  }
+
+  // Denoised image, in general layout.
+  const storage_image_t &output() const { return output_; }
+
+  bool timer_enabled() const { return timer_.enabled(); }
+
+  // Averaged GPU time of a pass, 0 if never measured.
+  float milliseconds(uint32_t pass) const {
+    return timer_.milliseconds(pass);
+  }
+
+ private:
+  static constexpr uint32_t HISTORY_COUNT = 2;  // Previous and current.
+  static constexpr uint32_t FILTER_COUNT = 2;   // Ping-pong.
+  static constexpr uint32_t TILE_SIZE = 8;      // Same as denoiser.glsl.
+  static constexpr uint32_t BINDING_COUNT = 9;
+
+  // Push constants of denoiser.glsl.
+  struct constants_t {
+    int32_t step;
+    int32_t feedback;
+    int32_t last;
+    int32_t reset;
+  };
+
+  static uint32_t group_count(uint32_t size) {
+    return (size + TILE_SIZE - 1) / TILE_SIZE;
+  }
+
+  std::vector<storage_image_t *> images() {
+    return {&history_[0], &history_[1],      &moments_[0],
+            &moments_[1], &normal_depth_[0], &normal_depth_[1],
+            &filter_[0],  &filter_[1],       &output_};
+  }
+
+  bool init_images(memory &mem, VkExtent2D window_size,
+                   VkFormat output_format) {
+    for (uint32_t i = 0; i < HISTORY_COUNT; ++i) {
+      if (!create_image(mem, window_size, VK_FORMAT_R16G16B16A16_SFLOAT,
+                        VK_IMAGE_USAGE_STORAGE_BIT, history_[i]) ||
+          !create_image(mem, window_size, VK_FORMAT_R16G16B16A16_SFLOAT,
+                        VK_IMAGE_USAGE_STORAGE_BIT, moments_[i]) ||
+          !create_image(mem, window_size, VK_FORMAT_R32G32B32A32_SFLOAT,
+                        VK_IMAGE_USAGE_STORAGE_BIT, normal_depth_[i])) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < FILTER_COUNT; ++i) {
+      if (!create_image(mem, window_size, VK_FORMAT_R16G16B16A16_SFLOAT,
+                        VK_IMAGE_USAGE_STORAGE_BIT, filter_[i])) {
+        return false;
+      }
+    }
+
+    // Same format as the ray traced image, to be copied to the swap chain.
+    return create_image(
+        mem, window_size, output_format,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, output_);
+  }
+
+  static bool create_image(memory &mem, VkExtent2D size, VkFormat format,
+                           VkImageUsageFlags usage, storage_image_t &image) {
+    image.format = format;
+
+    if (!helpers::create_image(mem, size.width, size.height, format,
+                               VK_IMAGE_TILING_OPTIMAL, usage,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                               image.image, image.mem)) {
+      std::cerr << "Failed to create denoiser image." << std::endl;
+      return false;
+    }
+
+    if (!helpers::create_image_view(mem, image.image, format,
+                                    VK_IMAGE_ASPECT_COLOR_BIT, image.view)) {
+      std::cerr << "Failed to create denoiser image view." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  static void destroy_image(memory &mem, storage_image_t &image) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    vkDestroyImageView(device, image.view, allocation_callbacks);
+    image.view = VK_NULL_HANDLE;
+    vkDestroyImage(device, image.image, allocation_callbacks);
+    image.image = VK_NULL_HANDLE;
+    vkFreeMemory(device, image.mem, allocation_callbacks);
+    image.mem = VK_NULL_HANDLE;
+  }
+
+  bool init_descriptor_sets(memory &mem) {
+    VkDevice device = mem.get_device();
+
+    // Layout.
+    //
+    VkDescriptorSetLayoutBinding layout_bindings[BINDING_COUNT] = {};
+    for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+      layout_bindings[i].binding = i;
+      layout_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      layout_bindings[i].descriptorCount = 1;
+      layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptor_layout_create_info{};
+    descriptor_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptor_layout_create_info.bindingCount = BINDING_COUNT;
+    descriptor_layout_create_info.pBindings = layout_bindings;
+
+    VkResult res = vkCreateDescriptorSetLayout(
+        device, &descriptor_layout_create_info,
+        mem.get_allocation_callbacks(), &descriptor_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create denoiser descriptor set layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Pool.
+    //
+    static constexpr uint32_t SET_COUNT = HISTORY_COUNT * FILTER_COUNT;
+    const VkDescriptorPoolSize descriptor_pool_size = {
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, SET_COUNT * BINDING_COUNT};
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info{};
+    descriptor_pool_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_create_info.maxSets = SET_COUNT;
+    descriptor_pool_create_info.poolSizeCount = 1;
+    descriptor_pool_create_info.pPoolSizes = &descriptor_pool_size;
+
+    res = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+                                 mem.get_allocation_callbacks(),
+                                 &descriptor_pool_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create denoiser descriptor pool: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Sets. Set [h][f] reads history h and filter image f, and writes the
+    // other ones.
+    //
+    std::vector<VkDescriptorSetLayout> layouts(SET_COUNT, descriptor_layout_);
+
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{};
+    descriptor_set_allocate_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_set_allocate_info.descriptorPool = descriptor_pool_;
+    descriptor_set_allocate_info.descriptorSetCount = SET_COUNT;
+    descriptor_set_allocate_info.pSetLayouts = layouts.data();
+
+    res = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+                                   &descriptor_sets_[0][0]);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to allocate denoiser descriptor sets: " << res
+                << std::endl;
+      return false;
+    }
+
+    for (uint32_t h = 0; h < HISTORY_COUNT; ++h) {
+      for (uint32_t f = 0; f < FILTER_COUNT; ++f) {
+        const storage_image_t *bindings[BINDING_COUNT] = {
+            &history_[h],     &history_[1 - h],     &moments_[h],
+            &moments_[1 - h], &normal_depth_[h],    &normal_depth_[1 - h],
+            &filter_[f],      &filter_[1 - f],      &output_};
+
+        VkDescriptorImageInfo image_infos[BINDING_COUNT] = {};
+        VkWriteDescriptorSet writes[BINDING_COUNT] = {};
+        for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+          image_infos[i].imageView = bindings[i]->view;
+          image_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+          writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+          writes[i].dstSet = descriptor_sets_[h][f];
+          writes[i].dstBinding = i;
+          writes[i].descriptorCount = 1;
+          writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+          writes[i].pImageInfo = &image_infos[i];
+        }
+
+        vkUpdateDescriptorSets(device, BINDING_COUNT, writes, 0, nullptr);
+      }
+    }
+
+    return true;
+  }
+
+  bool init_pipelines(memory &mem, VkDescriptorSetLayout rt_descriptor_layout) {
+    VkDescriptorSetLayout layouts[] = {rt_descriptor_layout,
+                                       descriptor_layout_};
+
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(constants_t);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 2;
+    pipeline_layout_create_info.pSetLayouts = layouts;
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant;
+
+    VkResult res = vkCreatePipelineLayout(
+        mem.get_device(), &pipeline_layout_create_info,
+        mem.get_allocation_callbacks(), &pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create denoiser pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    return create_pipeline(mem, denoiser_temporal_comp,
+                           sizeof(denoiser_temporal_comp),
+                           temporal_pipeline_) &&
+           create_pipeline(mem, denoiser_atrous_comp,
+                           sizeof(denoiser_atrous_comp), atrous_pipeline_);
+  }
+
+  bool create_pipeline(memory &mem, const uint32_t *code, size_t code_size,
+                       VkPipeline &pipeline) {
+    VkShaderModuleCreateInfo shader_module_create_info{};
+    shader_module_create_info.sType =
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_module_create_info.codeSize = code_size;
+    shader_module_create_info.pCode = code;
+
+    VkPipelineShaderStageCreateInfo shader_stage{};
+    shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shader_stage.pName = "main";
+
+    VkResult res = vkCreateShaderModule(
+        mem.get_device(), &shader_module_create_info,
+        mem.get_allocation_callbacks(), &shader_stage.module);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create denoiser shader module: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkComputePipelineCreateInfo pipeline_create_info{};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stage = shader_stage;
+    pipeline_create_info.layout = pipeline_layout_;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+
+    res = vkCreateComputePipelines(mem.get_device(), pipeline_cache,
+                                   create_info_count, &pipeline_create_info,
+                                   mem.get_allocation_callbacks(), &pipeline);
+
+    // The pipeline keeps its own copy of the shader.
+    vkDestroyShaderModule(mem.get_device(), shader_stage.module,
+                          mem.get_allocation_callbacks());
+
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create denoiser pipeline: " << res << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void bind(VkCommandBuffer cmd_buf, VkDescriptorSet rt_descriptor_set,
+            uint32_t filter) {
+    // The previous history is the one written on the last frame.
+    const uint32_t previous_history = 1 - current_history_;
+
+    static constexpr uint32_t first_set = 0;
+    static constexpr uint32_t dynamic_offset_count = 0;
+    static constexpr uint32_t *dynamic_offsets = nullptr;
+    VkDescriptorSet sets[] = {rt_descriptor_set,
+                              descriptor_sets_[previous_history][filter]};
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, first_set, 2, sets,
+                            dynamic_offset_count, dynamic_offsets);
+  }
+
+  void push_constants(VkCommandBuffer cmd_buf, const constants_t &constants) {
+    static constexpr uint32_t offset = 0;
+    vkCmdPushConstants(cmd_buf, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT,
+                       offset, sizeof(constants), &constants);
+  }
+
+  // Passes read what the previous pass wrote.
+  static void barrier(VkCommandBuffer cmd_buf) {
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memory_barrier, 0, nullptr, 0, nullptr);
+  }
+
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSetLayout descriptor_layout_;
+  VkDescriptorSet descriptor_sets_[HISTORY_COUNT][FILTER_COUNT];
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline temporal_pipeline_;
+  VkPipeline atrous_pipeline_;
+
+  storage_image_t history_[HISTORY_COUNT];
+  storage_image_t moments_[HISTORY_COUNT];
+  storage_image_t normal_depth_[HISTORY_COUNT];
+  storage_image_t filter_[FILTER_COUNT];
+  storage_image_t output_;
+  uint32_t current_history_;  // Written this frame, read on the next one.
+  bool reset_;                // Images have no history.
+
+  gpu_timer timer_;
+};
+
+}  // namespace rtx
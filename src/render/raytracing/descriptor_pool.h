@@ -15,8 +15,8 @@ class rt_descriptor_pool {
   bool init(memory& mem) {
     static constexpr uint32_t POOL_DESCRIPTOR_COUNT = 1;
     const VkDescriptorPoolSize descriptor_pool_size[] = {
-        {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, POOL_DESCRIPTOR_COUNT},
-        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, POOL_DESCRIPTOR_COUNT},
+        {VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, POOL_DESCRIPTOR_COUNT},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 9},
         {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, POOL_DESCRIPTOR_COUNT},
         {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2}};
 
@@ -0,0 +1,685 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "acceleration_structure.h"
+#include "helpers.h"
+#include "memory.h"
+#include "object.h"
+#include "vertex.h"
+
+// Hybrid renderer shaders
+#include "hybrid.comp.h"
+#include "visibility.frag.h"
+#include "visibility.vert.h"
+
+namespace rtx {
+
+// Hybrid renderer: rasterized visibility, ray traced shadows and reflections.
+//
+// The objects are rasterized at full resolution into a visibility buffer that
+// holds, per pixel, the entry of the instance table and the triangle seen
+// through its center. A compute pass then intersects the camera ray of each
+// pixel with that triangle only, shades the hit, and traces the shadow and
+// reflection rays with ray queries. Camera rays, most of the rays at low ray
+// depths, are not traced at all.
+//
+// The instances of the full resolution objects come first in the instance
+// table, in the same order as in the rasterizer instance buffer, so the
+// instance index of the rasterizer is the custom index of the ray tracers.
+class hybrid_renderer {
+ public:
+  hybrid_renderer()
+      : render_pass_(),
+        visibility_(),
+        depth_(),
+        framebuffer_(),
+        descriptor_pool_(),
+        descriptor_layout_(),
+        descriptor_set_(),
+        raster_pipeline_layout_(),
+        raster_pipeline_(),
+        pipeline_layout_(),
+        pipeline_() {}
+
+  // Ray tracing and scene descriptor set layouts, and push constants, are the
+  // same of the ray tracing pipeline. The visibility buffer is rasterized
+  // with the scene descriptor set, as the rasterizer.
+  bool init(memory &mem, VkExtent2D render_size, VkFormat depth_format,
+            VkDescriptorSetLayout rt_descriptor_layout,
+            VkDescriptorSetLayout scene_descriptor_layout,
+            VkShaderStageFlags push_constant_stages) {
+    if (!init_images(mem, render_size, depth_format)) {
+      std::cerr << "Failed to create visibility buffer." << std::endl;
+      return false;
+    }
+
+    if (!init_render_pass(mem, depth_format)) {
+      std::cerr << "Failed to create visibility render pass." << std::endl;
+      return false;
+    }
+
+    if (!init_framebuffer(mem, render_size)) {
+      std::cerr << "Failed to create visibility framebuffer." << std::endl;
+      return false;
+    }
+
+    if (!init_descriptor_set(mem)) {
+      std::cerr << "Failed to create hybrid descriptor set." << std::endl;
+      return false;
+    }
+
+    if (!init_raster_pipeline(mem, render_size, scene_descriptor_layout)) {
+      std::cerr << "Failed to create visibility pipeline." << std::endl;
+      return false;
+    }
+
+    if (!init_pipeline(mem, rt_descriptor_layout, scene_descriptor_layout,
+                       push_constant_stages)) {
+      std::cerr << "Failed to create hybrid pipeline." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void fini(memory &mem) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    vkDestroyPipeline(device, pipeline_, allocation_callbacks);
+    pipeline_ = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout(device, pipeline_layout_, allocation_callbacks);
+    pipeline_layout_ = VK_NULL_HANDLE;
+    vkDestroyPipeline(device, raster_pipeline_, allocation_callbacks);
+    raster_pipeline_ = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout(device, raster_pipeline_layout_,
+                            allocation_callbacks);
+    raster_pipeline_layout_ = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(device, descriptor_pool_, allocation_callbacks);
+    descriptor_pool_ = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(device, descriptor_layout_,
+                                 allocation_callbacks);
+    descriptor_layout_ = VK_NULL_HANDLE;
+
+    vkDestroyFramebuffer(device, framebuffer_, allocation_callbacks);
+    framebuffer_ = VK_NULL_HANDLE;
+    vkDestroyRenderPass(device, render_pass_, allocation_callbacks);
+    render_pass_ = VK_NULL_HANDLE;
+
+    destroy_image(mem, visibility_);
+    destroy_image(mem, depth_);
+  }
+
+  // Rasterize the visibility buffer of the objects, whose vertices and
+  // indices are in geometry_buffer and whose instance transforms are in
+  // instance_buffer, then shade it into the ray tracing images.
+  void render(VkCommandBuffer cmd_buf, VkExtent2D render_size,
+              VkDescriptorSet rt_descriptor_set,
+              VkDescriptorSet scene_descriptor_set,
+              const ray_tracing_constants_t &rt_constants,
+              VkShaderStageFlags push_constant_stages,
+              const std::vector<object_model_t> &objects,
+              VkBuffer geometry_buffer, VkBuffer instance_buffer) {
+    draw_visibility(cmd_buf, render_size, scene_descriptor_set, objects,
+                    geometry_buffer, instance_buffer);
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+
+    uint32_t first_set = 0;
+    uint32_t dynamic_offset_count = 0;
+    const uint32_t *dynamic_offsets = nullptr;
+    std::vector<VkDescriptorSet> sets(
+        {rt_descriptor_set, scene_descriptor_set, descriptor_set_});
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, first_set,
+                            static_cast<uint32_t>(sets.size()), sets.data(),
+                            dynamic_offset_count, dynamic_offsets);
+
+    uint32_t offset = 0;
+    vkCmdPushConstants(cmd_buf, pipeline_layout_, push_constant_stages, offset,
+                       static_cast<uint32_t>(sizeof(rt_constants)),
+                       &rt_constants);
+
+    vkCmdDispatch(cmd_buf, group_count(render_size.width),
+                  group_count(render_size.height), 1);
+  }
+
+ private:
+  static constexpr uint32_t WORKGROUP_SIZE = 8;  // Same as hybrid.comp.
+  static constexpr VkFormat VISIBILITY_FORMAT = VK_FORMAT_R32G32_UINT;
+
+  static uint32_t group_count(uint32_t size) {
+    return (size + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+  }
+
+  void draw_visibility(VkCommandBuffer cmd_buf, VkExtent2D render_size,
+                       VkDescriptorSet scene_descriptor_set,
+                       const std::vector<object_model_t> &objects,
+                       VkBuffer geometry_buffer, VkBuffer instance_buffer) {
+    // Pixels where nothing is rasterized have no instance.
+    VkClearValue clear_values[2];
+    clear_values[0].color.uint32[0] = UINT32_MAX;
+    clear_values[0].color.uint32[1] = UINT32_MAX;
+    clear_values[0].color.uint32[2] = 0;
+    clear_values[0].color.uint32[3] = 0;
+    clear_values[1].depthStencil.depth = 1.0f;
+    clear_values[1].depthStencil.stencil = 0;
+
+    VkRenderPassBeginInfo render_pass_begin_info{};
+    render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_begin_info.renderPass = render_pass_;
+    render_pass_begin_info.framebuffer = framebuffer_;
+    render_pass_begin_info.renderArea.extent = render_size;
+    render_pass_begin_info.clearValueCount = 2;
+    render_pass_begin_info.pClearValues = clear_values;
+
+    vkCmdBeginRenderPass(cmd_buf, &render_pass_begin_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      raster_pipeline_);
+    static constexpr uint32_t first_set = 0;
+    static constexpr uint32_t set_count = 1;
+    static constexpr uint32_t dynamic_offset_count = 0;
+    static constexpr uint32_t *dynamic_offsets = nullptr;
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            raster_pipeline_layout_, first_set, set_count,
+                            &scene_descriptor_set, dynamic_offset_count,
+                            dynamic_offsets);
+
+    static constexpr uint32_t instance_binding = 1;
+    static constexpr uint32_t binding_count = 1;
+    const VkDeviceSize instance_offset = 0;
+    vkCmdBindVertexBuffers(cmd_buf, instance_binding, binding_count,
+                           &instance_buffer, &instance_offset);
+
+    // Full resolution, as the camera rays of the ray tracers.
+    for (const object_model_t &object : objects) {
+      static constexpr uint32_t vertex_binding = 0;
+      const VkDeviceSize vertex_offset = object.vertex_offset;
+      vkCmdBindVertexBuffers(cmd_buf, vertex_binding, binding_count,
+                             &geometry_buffer, &vertex_offset);
+      vkCmdBindIndexBuffer(cmd_buf, geometry_buffer, object.index_offset,
+                           VK_INDEX_TYPE_UINT32);
+
+      const lod_t &lod = object.lods[0];
+      vkCmdDrawIndexed(cmd_buf, lod.index_count,
+                       static_cast<uint32_t>(object.transforms.size()),
+                       lod.first_index, 0, object.first_instance);
+    }
+
+    vkCmdEndRenderPass(cmd_buf);
+  }
+
+  bool init_images(memory &mem, VkExtent2D render_size,
+                   VkFormat depth_format) {
+    return create_image(
+               mem, render_size, VISIBILITY_FORMAT,
+               VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+               VK_IMAGE_ASPECT_COLOR_BIT, visibility_) &&
+           create_image(mem, render_size, depth_format,
+                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                        VK_IMAGE_ASPECT_DEPTH_BIT, depth_);
+  }
+
+  static bool create_image(memory &mem, VkExtent2D size, VkFormat format,
+                           VkImageUsageFlags usage,
+                           VkImageAspectFlags aspect_flags,
+                           storage_image_t &image) {
+    image.format = format;
+
+    if (!helpers::create_image(mem, size.width, size.height, format,
+                               VK_IMAGE_TILING_OPTIMAL, usage,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                               image.image, image.mem)) {
+      std::cerr << "Failed to create hybrid renderer image." << std::endl;
+      return false;
+    }
+
+    if (!helpers::create_image_view(mem, image.image, format, aspect_flags,
+                                    image.view)) {
+      std::cerr << "Failed to create hybrid renderer image view."
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  static void destroy_image(memory &mem, storage_image_t &image) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    vkDestroyImageView(device, image.view, allocation_callbacks);
+    image.view = VK_NULL_HANDLE;
+    vkDestroyImage(device, image.image, allocation_callbacks);
+    image.image = VK_NULL_HANDLE;
+    vkFreeMemory(device, image.mem, allocation_callbacks);
+    image.mem = VK_NULL_HANDLE;
+  }
+
+  bool init_render_pass(memory &mem, VkFormat depth_format) {
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = VISIBILITY_FORMAT;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_GENERAL;  // Storage image.
+
+    attachments[1].format = depth_format;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference color_reference{};
+    color_reference.attachment = 0;
+    color_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depth_reference{};
+    depth_reference.attachment = 1;
+    depth_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_reference;
+    subpass.pDepthStencilAttachment = &depth_reference;
+
+    // The shading pass of the previous frame reads the visibility buffer
+    // before it is cleared, and the one of this frame after it is written.
+    VkSubpassDependency dependencies[2] = {};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[0].dstStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    VkRenderPassCreateInfo render_pass_create_info{};
+    render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_create_info.attachmentCount = 2;
+    render_pass_create_info.pAttachments = attachments;
+    render_pass_create_info.subpassCount = 1;
+    render_pass_create_info.pSubpasses = &subpass;
+    render_pass_create_info.dependencyCount = 2;
+    render_pass_create_info.pDependencies = dependencies;
+
+    VkResult res = vkCreateRenderPass(mem.get_device(),
+                                      &render_pass_create_info,
+                                      mem.get_allocation_callbacks(),
+                                      &render_pass_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create visibility render pass: " << res
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool init_framebuffer(memory &mem, VkExtent2D render_size) {
+    const VkImageView attachments[2] = {visibility_.view, depth_.view};
+
+    VkFramebufferCreateInfo framebuffer_create_info{};
+    framebuffer_create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_create_info.renderPass = render_pass_;
+    framebuffer_create_info.attachmentCount = 2;
+    framebuffer_create_info.pAttachments = attachments;
+    framebuffer_create_info.width = render_size.width;
+    framebuffer_create_info.height = render_size.height;
+    framebuffer_create_info.layers = 1;
+
+    VkResult res = vkCreateFramebuffer(mem.get_device(),
+                                       &framebuffer_create_info,
+                                       mem.get_allocation_callbacks(),
+                                       &framebuffer_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create visibility framebuffer: " << res
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  // The visibility buffer, as a storage image of the shading pass.
+  bool init_descriptor_set(memory &mem) {
+    VkDevice device = mem.get_device();
+
+    VkDescriptorSetLayoutBinding layout_binding{};
+    layout_binding.binding = 0;
+    layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    layout_binding.descriptorCount = 1;
+    layout_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo descriptor_layout_create_info{};
+    descriptor_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptor_layout_create_info.bindingCount = 1;
+    descriptor_layout_create_info.pBindings = &layout_binding;
+
+    VkResult res = vkCreateDescriptorSetLayout(
+        device, &descriptor_layout_create_info,
+        mem.get_allocation_callbacks(), &descriptor_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create hybrid descriptor set layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    const VkDescriptorPoolSize descriptor_pool_size = {
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1};
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info{};
+    descriptor_pool_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_create_info.maxSets = 1;
+    descriptor_pool_create_info.poolSizeCount = 1;
+    descriptor_pool_create_info.pPoolSizes = &descriptor_pool_size;
+
+    res = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+                                 mem.get_allocation_callbacks(),
+                                 &descriptor_pool_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create hybrid descriptor pool: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{};
+    descriptor_set_allocate_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_set_allocate_info.descriptorPool = descriptor_pool_;
+    descriptor_set_allocate_info.descriptorSetCount = 1;
+    descriptor_set_allocate_info.pSetLayouts = &descriptor_layout_;
+
+    res = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+                                   &descriptor_set_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to allocate hybrid descriptor set: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkDescriptorImageInfo image_info{};
+    image_info.imageView = visibility_.view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptor_set_;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write.pImageInfo = &image_info;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+    return true;
+  }
+
+  bool init_raster_pipeline(memory &mem, VkExtent2D render_size,
+                            VkDescriptorSetLayout scene_descriptor_layout) {
+    VkDevice device = mem.get_device();
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 1;
+    pipeline_layout_create_info.pSetLayouts = &scene_descriptor_layout;
+
+    VkResult res = vkCreatePipelineLayout(
+        device, &pipeline_layout_create_info, mem.get_allocation_callbacks(),
+        &raster_pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create visibility pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkPipelineShaderStageCreateInfo shader_stages[2] = {};
+    if (!create_shader_module(mem, visibility_vert, sizeof(visibility_vert),
+                              VK_SHADER_STAGE_VERTEX_BIT, shader_stages[0]) ||
+        !create_shader_module(mem, visibility_frag, sizeof(visibility_frag),
+                              VK_SHADER_STAGE_FRAGMENT_BIT,
+                              shader_stages[1])) {
+      vkDestroyShaderModule(device, shader_stages[0].module,
+                            mem.get_allocation_callbacks());
+      return false;
+    }
+
+    // Vertices and, one per instance, their transform. As the rasterizer.
+    const VkVertexInputBindingDescription vertex_input_bindings[] = {
+        Vertex::get_binding_description(),
+        RasterInstance::get_binding_description()};
+    std::vector<VkVertexInputAttributeDescription> vertex_input_attributes =
+        Vertex::get_attribute_descriptions();
+    const std::vector<VkVertexInputAttributeDescription>
+        instance_input_attributes =
+            RasterInstance::get_attribute_descriptions();
+    vertex_input_attributes.insert(vertex_input_attributes.end(),
+                                   instance_input_attributes.begin(),
+                                   instance_input_attributes.end());
+
+    VkPipelineVertexInputStateCreateInfo vi{};
+    vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vi.vertexBindingDescriptionCount = 2;
+    vi.pVertexBindingDescriptions = vertex_input_bindings;
+    vi.vertexAttributeDescriptionCount =
+        static_cast<uint32_t>(vertex_input_attributes.size());
+    vi.pVertexAttributeDescriptions = vertex_input_attributes.data();
+
+    VkPipelineInputAssemblyStateCreateInfo ia{};
+    ia.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    ia.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    // Rays hit both faces of the triangles.
+    VkPipelineRasterizationStateCreateInfo rs{};
+    rs.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rs.polygonMode = VK_POLYGON_MODE_FILL;
+    rs.cullMode = VK_CULL_MODE_NONE;
+    rs.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rs.lineWidth = 1.0f;
+
+    // The viewport is the render size, recreated with it.
+    VkViewport viewport{};
+    viewport.width = static_cast<float>(render_size.width);
+    viewport.height = static_cast<float>(render_size.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor{};
+    scissor.extent = render_size;
+
+    VkPipelineViewportStateCreateInfo vp{};
+    vp.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    vp.viewportCount = 1;
+    vp.pViewports = &viewport;
+    vp.scissorCount = 1;
+    vp.pScissors = &scissor;
+
+    VkPipelineDepthStencilStateCreateInfo ds{};
+    ds.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    ds.depthTestEnable = VK_TRUE;
+    ds.depthWriteEnable = VK_TRUE;
+    ds.depthCompareOp = VK_COMPARE_OP_LESS;  // Lower depth = closer.
+
+    VkPipelineMultisampleStateCreateInfo ms{};
+    ms.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    ms.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // Integer attachment, no blending.
+    VkPipelineColorBlendAttachmentState cb_attachment_state{};
+    cb_attachment_state.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT;
+
+    VkPipelineColorBlendStateCreateInfo cb{};
+    cb.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    cb.attachmentCount = 1;
+    cb.pAttachments = &cb_attachment_state;
+
+    VkGraphicsPipelineCreateInfo pipeline_create_info{};
+    pipeline_create_info.sType =
+        VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stageCount = 2;
+    pipeline_create_info.pStages = shader_stages;
+    pipeline_create_info.pVertexInputState = &vi;
+    pipeline_create_info.pInputAssemblyState = &ia;
+    pipeline_create_info.pViewportState = &vp;
+    pipeline_create_info.pRasterizationState = &rs;
+    pipeline_create_info.pMultisampleState = &ms;
+    pipeline_create_info.pDepthStencilState = &ds;
+    pipeline_create_info.pColorBlendState = &cb;
+    pipeline_create_info.layout = raster_pipeline_layout_;
+    pipeline_create_info.renderPass = render_pass_;
+    pipeline_create_info.subpass = 0;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+    res = vkCreateGraphicsPipelines(device, pipeline_cache, create_info_count,
+                                    &pipeline_create_info,
+                                    mem.get_allocation_callbacks(),
+                                    &raster_pipeline_);
+
+    // The pipeline keeps its own copy of the shaders.
+    for (const VkPipelineShaderStageCreateInfo &stage : shader_stages) {
+      vkDestroyShaderModule(device, stage.module,
+                            mem.get_allocation_callbacks());
+    }
+
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create visibility pipeline: " << res
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool init_pipeline(memory &mem, VkDescriptorSetLayout rt_descriptor_layout,
+                     VkDescriptorSetLayout scene_descriptor_layout,
+                     VkShaderStageFlags push_constant_stages) {
+    VkDescriptorSetLayout layouts[] = {
+        rt_descriptor_layout, scene_descriptor_layout, descriptor_layout_};
+
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = push_constant_stages;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(ray_tracing_constants_t);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 3;
+    pipeline_layout_create_info.pSetLayouts = layouts;
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant;
+
+    VkResult res = vkCreatePipelineLayout(
+        mem.get_device(), &pipeline_layout_create_info,
+        mem.get_allocation_callbacks(), &pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create hybrid pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkPipelineShaderStageCreateInfo shader_stage{};
+    if (!create_shader_module(mem, hybrid_comp, sizeof(hybrid_comp),
+                              VK_SHADER_STAGE_COMPUTE_BIT, shader_stage)) {
+      return false;
+    }
+
+    VkComputePipelineCreateInfo pipeline_create_info{};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stage = shader_stage;
+    pipeline_create_info.layout = pipeline_layout_;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+
+    res = vkCreateComputePipelines(mem.get_device(), pipeline_cache,
+                                   create_info_count, &pipeline_create_info,
+                                   mem.get_allocation_callbacks(), &pipeline_);
+
+    // The pipeline keeps its own copy of the shader.
+    vkDestroyShaderModule(mem.get_device(), shader_stage.module,
+                          mem.get_allocation_callbacks());
+
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create hybrid pipeline: " << res << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  static bool create_shader_module(memory &mem, const uint32_t *code,
+                                   size_t code_size,
+                                   VkShaderStageFlagBits stage,
+                                   VkPipelineShaderStageCreateInfo &shader) {
+    VkShaderModuleCreateInfo shader_module_create_info{};
+    shader_module_create_info.sType =
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_module_create_info.codeSize = code_size;
+    shader_module_create_info.pCode = code;
+
+    shader.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader.stage = stage;
+    shader.pName = "main";
+
+    VkResult res = vkCreateShaderModule(
+        mem.get_device(), &shader_module_create_info,
+        mem.get_allocation_callbacks(), &shader.module);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create hybrid shader module: " << res
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  VkRenderPass render_pass_;
+  storage_image_t visibility_;  // Instance table entry and triangle.
+  storage_image_t depth_;
+  VkFramebuffer framebuffer_;
+
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSetLayout descriptor_layout_;
+  VkDescriptorSet descriptor_set_;
+
+  VkPipelineLayout raster_pipeline_layout_;
+  VkPipeline raster_pipeline_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline pipeline_;
+};
+
+}  // namespace rtx
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "glm.h"
+
+namespace rtx {
+
+// Spatial clusters of the object instances, so that scenes with more instances
+// than a TLAS should hold are traced with a bounded rebuild cost.
+//
+// Object instances are grouped by a CPU side BVH over their world bounds,
+// whose leaves are the clusters. Culling walks the tree and keeps the
+// clusters in the view frustum or near the camera, then the closest ones
+// within a budget of TLAS instances. Only the TLAS instances of those
+// clusters go into the TLAS.
+//
+// An object instance has a TLAS instance per level of detail it is traced
+// at, which are always selected together.
+class instance_clusters {
+ public:
+  // Object instances per cluster, at most.
+  static constexpr uint32_t CLUSTER_SIZE = 64;
+
+  // TLAS instances per object instance, at most: full resolution and the
+  // secondary level of detail.
+  static constexpr uint32_t MAX_LEVELS = 2;
+
+  instance_clusters()
+      : bounds_(), order_(), nodes_(), selected_(), tlas_instance_count_(0) {}
+
+  // World bounds of an object instance, with the TLAS instance tracing it.
+  // Returns the index of the object instance.
+  uint32_t add_instance(const glm::vec3 &aabb_min, const glm::vec3 &aabb_max,
+                        uint32_t tlas_instance) {
+    bounds_.push_back({aabb_min, aabb_max, {tlas_instance, 0}, 1});
+    ++tlas_instance_count_;
+    return static_cast<uint32_t>(bounds_.size() - 1);
+  }
+
+  // Another TLAS instance of an object instance, at another level of
+  // detail.
+  bool add_level(uint32_t instance, uint32_t tlas_instance) {
+    bounds_t &b = bounds_[instance];
+    if (b.level_count == MAX_LEVELS) {
+      std::cerr << "Too many levels of detail for instance " << instance
+                << "." << std::endl;
+      return false;
+    }
+    b.tlas_instances[b.level_count++] = tlas_instance;
+    ++tlas_instance_count_;
+    return true;
+  }
+
+  void clear() {
+    bounds_.clear();
+    order_.clear();
+    nodes_.clear();
+    selected_.clear();
+    tlas_instance_count_ = 0;
+  }
+
+  // Build the tree once all the instances are added. All the clusters start
+  // selected, as the TLAS built with every instance.
+  void build() {
+    order_.resize(bounds_.size());
+    for (uint32_t i = 0; i < order_.size(); ++i) {
+      order_[i] = i;
+    }
+
+    nodes_.clear();
+    if (!bounds_.empty()) {
+      build_node(0, static_cast<uint32_t>(bounds_.size()));
+    }
+
+    selected_.clear();
+    for (uint32_t n = 0; n < nodes_.size(); ++n) {
+      if (nodes_[n].is_leaf()) {
+        selected_.push_back(n);
+      }
+    }
+  }
+
+  // Object instances.
+  size_t bounds_count() const { return bounds_.size(); }
+
+  // TLAS instances of all the object instances.
+  size_t instance_count() const { return tlas_instance_count_; }
+
+  size_t cluster_count() const { return (nodes_.size() + 1) / 2; }
+
+  size_t selected_cluster_count() const { return selected_.size(); }
+
+  // Whether some clusters are culled.
+  bool culled() const { return selected_.size() < cluster_count(); }
+
+  // Select the clusters in the frustum of view_projection, or whose bounds
+  // are within nearby_distance of the eye, as shadow and bounce rays reach
+  // them too. The closest are kept while their TLAS instances fit in
+  // instance_budget, the closest one always is. When no cluster passes
+  // culling, the closest of all is selected, so that the selection is never
+  // empty.
+  //
+  // Returns whether the selection changed, and then the TLAS indices of the
+  // selected instances.
+  bool select(const glm::mat4 &view_projection, const glm::vec3 &eye,
+              float nearby_distance, uint32_t instance_budget,
+              std::vector<uint32_t> &instances) {
+    if (nodes_.empty()) {
+      return false;
+    }
+
+    glm::vec4 planes[6];
+    frustum_planes(view_projection, planes);
+
+    // Clusters that pass culling, with their distance to the eye.
+    std::vector<std::pair<float, uint32_t>> candidates;
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+      const node_t &node = nodes_[stack.back()];
+      const uint32_t n = stack.back();
+      stack.pop_back();
+
+      const float d = distance(node.aabb_min, node.aabb_max, eye);
+      if (d > nearby_distance &&
+          !intersects_frustum(node.aabb_min, node.aabb_max, planes)) {
+        continue;
+      }
+
+      if (node.is_leaf()) {
+        candidates.emplace_back(d, n);
+      } else {
+        stack.push_back(node.left);
+        stack.push_back(node.right);
+      }
+    }
+
+    if (candidates.empty()) {
+      for (uint32_t n = 0; n < nodes_.size(); ++n) {
+        if (!nodes_[n].is_leaf()) {
+          continue;
+        }
+        const float d = distance(nodes_[n].aabb_min, nodes_[n].aabb_max, eye);
+        if (candidates.empty() || d < candidates[0].first) {
+          candidates.assign(1, {d, n});
+        }
+      }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<uint32_t> selected;
+    uint64_t selected_instances = 0;
+    for (const auto &candidate : candidates) {
+      const uint32_t count = nodes_[candidate.second].tlas_instance_count;
+      if (!selected.empty() && selected_instances + count > instance_budget) {
+        break;
+      }
+      selected.push_back(candidate.second);
+      selected_instances += count;
+    }
+
+    std::sort(selected.begin(), selected.end());
+    if (selected == selected_) {
+      return false;
+    }
+    selected_ = selected;
+
+    instances.clear();
+    for (const uint32_t n : selected_) {
+      const node_t &node = nodes_[n];
+      for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+        const bounds_t &b = bounds_[order_[i]];
+        instances.insert(instances.end(), b.tlas_instances,
+                         b.tlas_instances + b.level_count);
+      }
+    }
+    std::sort(instances.begin(), instances.end());
+
+    return true;
+  }
+
+ private:
+  struct bounds_t {
+    glm::vec3 aabb_min;
+    glm::vec3 aabb_max;
+    uint32_t tlas_instances[MAX_LEVELS];
+    uint32_t level_count;
+  };
+
+  struct node_t {
+    glm::vec3 aabb_min;
+    glm::vec3 aabb_max;
+    uint32_t first;  // Object instances of the node in order_.
+    uint32_t count;
+    uint32_t tlas_instance_count;
+    uint32_t left;  // Children, leaves have none.
+    uint32_t right;
+
+    bool is_leaf() const { return left == right; }
+  };
+
+  std::vector<bounds_t> bounds_;  // Of each object instance.
+  std::vector<uint32_t> order_;   // Object instances sorted by node.
+  std::vector<node_t> nodes_;     // Root first.
+  std::vector<uint32_t> selected_;  // Selected leaves, sorted.
+  size_t tlas_instance_count_;
+
+  // Median split on the longest axis of the centers.
+  uint32_t build_node(uint32_t first, uint32_t count) {
+    const uint32_t n = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back({glm::vec3(std::numeric_limits<float>::max()),
+                      glm::vec3(std::numeric_limits<float>::lowest()), first,
+                      count, 0, 0, 0});
+
+    glm::vec3 aabb_min(std::numeric_limits<float>::max());
+    glm::vec3 aabb_max(std::numeric_limits<float>::lowest());
+    glm::vec3 center_min(std::numeric_limits<float>::max());
+    glm::vec3 center_max(std::numeric_limits<float>::lowest());
+    uint32_t tlas_instance_count = 0;
+    for (uint32_t i = first; i < first + count; ++i) {
+      const bounds_t &b = bounds_[order_[i]];
+      tlas_instance_count += b.level_count;
+      aabb_min = glm::min(aabb_min, b.aabb_min);
+      aabb_max = glm::max(aabb_max, b.aabb_max);
+      const glm::vec3 center = (b.aabb_min + b.aabb_max) * 0.5f;
+      center_min = glm::min(center_min, center);
+      center_max = glm::max(center_max, center);
+    }
+    nodes_[n].aabb_min = aabb_min;
+    nodes_[n].aabb_max = aabb_max;
+    nodes_[n].tlas_instance_count = tlas_instance_count;
+
+    if (count <= CLUSTER_SIZE) {
+      return n;
+    }
+
+    const glm::vec3 extent = center_max - center_min;
+    int axis = 0;
+    if (extent.y > extent[axis]) {
+      axis = 1;
+    }
+    if (extent.z > extent[axis]) {
+      axis = 2;
+    }
+
+    const uint32_t half = count / 2;
+    std::nth_element(order_.begin() + first, order_.begin() + first + half,
+                     order_.begin() + first + count,
+                     [this, axis](uint32_t a, uint32_t b) {
+                       return bounds_[a].aabb_min[axis] +
+                                  bounds_[a].aabb_max[axis] <
+                              bounds_[b].aabb_min[axis] +
+                                  bounds_[b].aabb_max[axis];
+                     });
+
+    const uint32_t left = build_node(first, half);
+    const uint32_t right = build_node(first + half, count - half);
+    nodes_[n].left = left;
+    nodes_[n].right = right;
+
+    return n;
+  }
+
+  // Planes of the clip volume, with Vulkan depth in [0, w]. Points inside
+  // have a positive distance to all of them.
+  static void frustum_planes(const glm::mat4 &m, glm::vec4 planes[6]) {
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; ++r) {
+      rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    }
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    planes[4] = rows[2];
+    planes[5] = rows[3] - rows[2];
+  }
+
+  // Conservative, boxes outside the frustum near its corners pass.
+  static bool intersects_frustum(const glm::vec3 &aabb_min,
+                                 const glm::vec3 &aabb_max,
+                                 const glm::vec4 planes[6]) {
+    for (int p = 0; p < 6; ++p) {
+      // Corner of the box furthest along the plane normal.
+      const glm::vec3 corner(planes[p].x > 0.0f ? aabb_max.x : aabb_min.x,
+                             planes[p].y > 0.0f ? aabb_max.y : aabb_min.y,
+                             planes[p].z > 0.0f ? aabb_max.z : aabb_min.z);
+      if (glm::dot(glm::vec3(planes[p]), corner) + planes[p].w < 0.0f) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Zero inside the box.
+  static float distance(const glm::vec3 &aabb_min, const glm::vec3 &aabb_max,
+                        const glm::vec3 &point) {
+    const glm::vec3 closest = glm::min(glm::max(point, aabb_min), aabb_max);
+    return glm::length(point - closest);
+  }
+};
+
+}  // namespace rtx
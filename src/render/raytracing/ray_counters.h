@@ -0,0 +1,515 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+#include <vulkan/vulkan.h>
+
+#include "constants.h"
+#include "gpu_timer.h"
+#include "memory.h"
+
+// Ray counters shaders
+#include "counters_heatmap.comp.h"
+#include "counters_reduce.comp.h"
+
+namespace rtx {
+
+// Per pixel ray counters and their heat maps, see counters.glsl.
+//
+// While the pixel temperature is on, the ray tracers count the clock cycles,
+// rays, deepest bounce, shadow rays and closest hits of each pixel with
+// atomics on the counters buffer. After tracing, the counters are reduced on
+// the GPU into totals, maximums and log2 histograms, and the selected counter
+// is drawn on the ray traced image normalized by its 99th percentile. The
+// reduction is read by the host after the frame fence for the stats.
+class ray_counters {
+ public:
+  // Same as counters.glsl.
+  enum counter {
+    counter_clock = 0,
+    counter_rays = 1,
+    counter_depth = 2,
+    counter_shadow_rays = 3,
+    counter_hits = 4,
+    counter_count = 5
+  };
+
+  static constexpr uint32_t HISTOGRAM_BINS = 32;  // Same as counters.glsl.
+
+  static const char *name(counter c) {
+    static const char *names[counter_count] = {"Clock", "Rays", "Depth",
+                                               "Shadow rays", "Hits"};
+    return names[c];
+  }
+
+  ray_counters()
+      : pixel_count_(0),
+        descriptor_pool_(),
+        descriptor_layout_(),
+        descriptor_set_(),
+        pipeline_layout_(),
+        reduce_pipeline_(),
+        heatmap_pipeline_(),
+        counters_(),
+        counters_mem_(),
+        reduction_(),
+        reduction_mem_(),
+        stats_(),
+        stats_mem_(),
+        stats_data_(nullptr),
+        timer_(),
+        reduction_read_() {}
+
+  // Ray tracing descriptor set layout of the ray tracers, with the counters
+  // buffer.
+  bool init(memory &mem, const VkPhysicalDeviceProperties &properties,
+            uint32_t timestamp_valid_bits, VkExtent2D size,
+            VkDescriptorSetLayout rt_descriptor_layout) {
+    pixel_count_ = size.width * size.height;
+
+    if (!timer_.init(mem, properties, timestamp_valid_bits, 1)) {
+      std::cerr << "Failed to init ray counters timer." << std::endl;
+      return false;
+    }
+
+    if (!init_buffers(mem)) {
+      std::cerr << "Failed to create ray counters buffers." << std::endl;
+      return false;
+    }
+
+    if (!init_descriptor_set(mem)) {
+      std::cerr << "Failed to create ray counters descriptor set."
+                << std::endl;
+      return false;
+    }
+
+    if (!init_pipelines(mem, rt_descriptor_layout)) {
+      std::cerr << "Failed to create ray counters pipelines." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void fini(memory &mem) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    for (VkPipeline *pipeline : {&reduce_pipeline_, &heatmap_pipeline_}) {
+      vkDestroyPipeline(device, *pipeline, allocation_callbacks);
+      *pipeline = VK_NULL_HANDLE;
+    }
+    vkDestroyPipelineLayout(device, pipeline_layout_, allocation_callbacks);
+    pipeline_layout_ = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(device, descriptor_pool_, allocation_callbacks);
+    descriptor_pool_ = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(device, descriptor_layout_,
+                                 allocation_callbacks);
+    descriptor_layout_ = VK_NULL_HANDLE;
+
+    if (stats_data_) {
+      vkUnmapMemory(device, stats_mem_);
+      stats_data_ = nullptr;
+    }
+
+    destroy_buffer(mem, counters_, counters_mem_);
+    destroy_buffer(mem, reduction_, reduction_mem_);
+    destroy_buffer(mem, stats_, stats_mem_);
+
+    timer_.fini(mem);
+  }
+
+  // Read the reduction of a frame. Call after waiting for its fence.
+  void read(memory &mem, uint32_t frame) {
+    timer_.read(mem, frame);
+
+    if (!stats_data_) {
+      return;
+    }
+
+    reduction_read_ = stats_data_[frame];
+  }
+
+  // Counters of each pixel, for the ray tracing descriptor set.
+  VkBuffer buffer() const { return counters_; }
+
+  // Zero the counters before the ray tracers count into them.
+  void clear(VkCommandBuffer cmd_buf) {
+    vkCmdFillBuffer(cmd_buf, counters_, 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+  }
+
+  // Reduce the counters of this frame and draw the heat map of one of them
+  // on the ray traced image.
+  void draw_heatmap(VkCommandBuffer cmd_buf, uint32_t frame, VkExtent2D size,
+                    VkDescriptorSet rt_descriptor_set, counter c) {
+    timer_.reset(cmd_buf, frame);
+
+    vkCmdFillBuffer(cmd_buf, reduction_, 0, VK_WHOLE_SIZE, 0);
+
+    // Wait for the ray tracers.
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd_buf,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memory_barrier, 0, nullptr, 0, nullptr);
+
+    static constexpr uint32_t first_set = 0;
+    static constexpr uint32_t dynamic_offset_count = 0;
+    static constexpr uint32_t *dynamic_offsets = nullptr;
+    VkDescriptorSet sets[] = {rt_descriptor_set, descriptor_set_};
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, first_set, 2, sets,
+                            dynamic_offset_count, dynamic_offsets);
+
+    constants_t constants{};
+    constants.counter = static_cast<uint32_t>(c);
+    static constexpr uint32_t offset = 0;
+    vkCmdPushConstants(cmd_buf, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT,
+                       offset, sizeof(constants), &constants);
+
+    timer_.begin(cmd_buf, frame, 0);
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      reduce_pipeline_);
+    vkCmdDispatch(cmd_buf, group_count(size.width), group_count(size.height),
+                  1);
+
+    // The heat map is normalized with the reduction.
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memory_barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      heatmap_pipeline_);
+    vkCmdDispatch(cmd_buf, group_count(size.width), group_count(size.height),
+                  1);
+
+    timer_.end(cmd_buf, frame, 0);
+
+    // The reduction of this frame is read by the host after the frame fence.
+    // The image is upscaled or blitted to the swap chain.
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(
+        cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy region{};
+    region.dstOffset = frame * sizeof(reduction_t);
+    region.size = sizeof(reduction_t);
+    vkCmdCopyBuffer(cmd_buf, reduction_, stats_, 1, &region);
+
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0,
+                         nullptr, 0, nullptr);
+  }
+
+  bool timer_enabled() const { return timer_.enabled(); }
+
+  // Averaged GPU time of the reduction and heat map, 0 if never measured.
+  float milliseconds() const { return timer_.milliseconds(0); }
+
+  // Stats of the last read frame.
+  uint64_t total(counter c) const {
+    return static_cast<uint64_t>(reduction_read_.total[c][1]) << 32 |
+           reduction_read_.total[c][0];
+  }
+
+  float average(counter c) const {
+    return pixel_count_ > 0 ? static_cast<float>(total(c)) / pixel_count_
+                            : 0.0f;
+  }
+
+  uint32_t maximum(counter c) const { return reduction_read_.maximum[c]; }
+
+  // Pixels of each log2 bin. Bin 0 counts zeros, bin b > 0 the values in
+  // [2^(b - 1), 2^b).
+  const uint32_t *histogram(counter c) const {
+    return reduction_read_.histogram[c];
+  }
+
+ private:
+  static constexpr uint32_t TILE_SIZE = 8;  // Same as the counters shaders.
+
+  // CounterReduction in counters.glsl.
+  struct reduction_t {
+    uint32_t total[counter_count][2];  // Low and high words.
+    uint32_t maximum[counter_count];
+    uint32_t histogram[counter_count][HISTOGRAM_BINS];
+  };
+
+  // Push constants of counters_heatmap.comp.
+  struct constants_t {
+    uint32_t counter;
+  };
+
+  static uint32_t group_count(uint32_t size) {
+    return (size + TILE_SIZE - 1) / TILE_SIZE;
+  }
+
+  bool init_buffers(memory &mem) {
+    if (!mem.create_buffer(
+            pixel_count_ * counter_count * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, counters_, counters_mem_)) {
+      std::cerr << "Failed to create ray counters buffer." << std::endl;
+      return false;
+    }
+
+    if (!mem.create_buffer(sizeof(reduction_t),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, reduction_,
+                           reduction_mem_)) {
+      std::cerr << "Failed to create ray counters reduction buffer."
+                << std::endl;
+      return false;
+    }
+
+    const VkDeviceSize stats_size =
+        constants::MAX_FRAMES_IN_FLIGHT * sizeof(reduction_t);
+    if (!mem.create_buffer(stats_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           stats_, stats_mem_)) {
+      std::cerr << "Failed to create ray counters stats buffer." << std::endl;
+      return false;
+    }
+
+    void *mapped_data = nullptr;
+    VkDeviceSize offset = 0;
+    VkMemoryMapFlags map_flags = 0;
+    VkResult res = vkMapMemory(mem.get_device(), stats_mem_, offset,
+                               stats_size, map_flags, &mapped_data);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to map ray counters stats buffer: " << res
+                << std::endl;
+      return false;
+    }
+    stats_data_ = static_cast<reduction_t *>(mapped_data);
+    std::fill(stats_data_, stats_data_ + constants::MAX_FRAMES_IN_FLIGHT,
+              reduction_t{});
+
+    return true;
+  }
+
+  static void destroy_buffer(memory &mem, VkBuffer &buffer,
+                             VkDeviceMemory &buffer_memory) {
+    vkDestroyBuffer(mem.get_device(), buffer, mem.get_allocation_callbacks());
+    buffer = VK_NULL_HANDLE;
+    vkFreeMemory(mem.get_device(), buffer_memory,
+                 mem.get_allocation_callbacks());
+    buffer_memory = VK_NULL_HANDLE;
+  }
+
+  bool init_descriptor_set(memory &mem) {
+    VkDevice device = mem.get_device();
+
+    // Layout.
+    //
+    VkDescriptorSetLayoutBinding layout_binding{};
+    layout_binding.binding = 0;
+    layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layout_binding.descriptorCount = 1;
+    layout_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo descriptor_layout_create_info{};
+    descriptor_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptor_layout_create_info.bindingCount = 1;
+    descriptor_layout_create_info.pBindings = &layout_binding;
+
+    VkResult res = vkCreateDescriptorSetLayout(
+        device, &descriptor_layout_create_info,
+        mem.get_allocation_callbacks(), &descriptor_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create ray counters descriptor set layout: "
+                << res << std::endl;
+      return false;
+    }
+
+    // Pool.
+    //
+    const VkDescriptorPoolSize descriptor_pool_size = {
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1};
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info{};
+    descriptor_pool_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_create_info.maxSets = 1;
+    descriptor_pool_create_info.poolSizeCount = 1;
+    descriptor_pool_create_info.pPoolSizes = &descriptor_pool_size;
+
+    res = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+                                 mem.get_allocation_callbacks(),
+                                 &descriptor_pool_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create ray counters descriptor pool: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Set.
+    //
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{};
+    descriptor_set_allocate_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_set_allocate_info.descriptorPool = descriptor_pool_;
+    descriptor_set_allocate_info.descriptorSetCount = 1;
+    descriptor_set_allocate_info.pSetLayouts = &descriptor_layout_;
+
+    res = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+                                   &descriptor_set_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to allocate ray counters descriptor set: " << res
+                << std::endl;
+      return false;
+    }
+
+    const VkDescriptorBufferInfo buffer_info = {reduction_, 0,
+                                                VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptor_set_;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+    return true;
+  }
+
+  bool init_pipelines(memory &mem,
+                      VkDescriptorSetLayout rt_descriptor_layout) {
+    VkDescriptorSetLayout layouts[] = {rt_descriptor_layout,
+                                       descriptor_layout_};
+
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(constants_t);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 2;
+    pipeline_layout_create_info.pSetLayouts = layouts;
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant;
+
+    VkResult res = vkCreatePipelineLayout(
+        mem.get_device(), &pipeline_layout_create_info,
+        mem.get_allocation_callbacks(), &pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create ray counters pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    return create_pipeline(mem, counters_reduce_comp,
+                           sizeof(counters_reduce_comp), reduce_pipeline_) &&
+           create_pipeline(mem, counters_heatmap_comp,
+                           sizeof(counters_heatmap_comp), heatmap_pipeline_);
+  }
+
+  bool create_pipeline(memory &mem, const uint32_t *code, size_t code_size,
+                       VkPipeline &pipeline) {
+    VkShaderModuleCreateInfo shader_module_create_info{};
+    shader_module_create_info.sType =
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_module_create_info.codeSize = code_size;
+    shader_module_create_info.pCode = code;
+
+    VkPipelineShaderStageCreateInfo shader_stage{};
+    shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shader_stage.pName = "main";
+
+    VkResult res = vkCreateShaderModule(
+        mem.get_device(), &shader_module_create_info,
+        mem.get_allocation_callbacks(), &shader_stage.module);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create ray counters shader module: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkComputePipelineCreateInfo pipeline_create_info{};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stage = shader_stage;
+    pipeline_create_info.layout = pipeline_layout_;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+
+    res = vkCreateComputePipelines(mem.get_device(), pipeline_cache,
+                                   create_info_count, &pipeline_create_info,
+                                   mem.get_allocation_callbacks(), &pipeline);
+
+    // The pipeline keeps its own copy of the shader.
+    vkDestroyShaderModule(mem.get_device(), shader_stage.module,
+                          mem.get_allocation_callbacks());
+
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create ray counters pipeline: " << res
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  uint32_t pixel_count_;  // Of the ray traced image.
+
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSetLayout descriptor_layout_;
+  VkDescriptorSet descriptor_set_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline reduce_pipeline_;
+  VkPipeline heatmap_pipeline_;
+
+  VkBuffer counters_;
+  VkDeviceMemory counters_mem_;
+  VkBuffer reduction_;
+  VkDeviceMemory reduction_mem_;
+  VkBuffer stats_;  // Reduction of each frame in flight.
+  VkDeviceMemory stats_mem_;
+  reduction_t *stats_data_;
+
+  gpu_timer timer_;
+  reduction_t reduction_read_;  // Of the last read frame.
+};
+
+}  // namespace rtx
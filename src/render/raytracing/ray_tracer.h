@@ -1,11 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <vector>
 
 #include <vulkan/vulkan.h>
 
 #include "memory.h"
 #include "raytracing/acceleration_structure.h"
+#include "raytracing/acceleration_structure_instance.h"
+#include "raytracing/instance_clusters.h"
 
 namespace rtx {
 
@@ -13,35 +18,351 @@ class ray_tracer {
  public:
   ray_tracer() = default;
 
-  bool build_acceleration_structures(memory &mem,
-                                     VkCommandPool &command_pool,
-                                     VkQueue &graphics_queue,
-                                     std::vector<object_model_t> &objects,
-                                     bool update) {
-    // Add each object into its own BLAS.
-    for (auto &object : objects) {
-      if (!acceleration_structure_.add_object(object)) {
-        std::cerr << "Failed to add ray tracing object." << std::endl;
-        return false;
-      }
+  // Properties of the acceleration structures supported by the device.
+  void set_properties(
+      const VkPhysicalDeviceAccelerationStructurePropertiesKHR &properties) {
+    scratch_alignment_ =
+        properties.minAccelerationStructureScratchOffsetAlignment;
+  }
+
+  // Timestamps of the queue the acceleration structures are built on, to
+  // time the BLAS build batches. 0 valid bits disables the timing.
+  void set_timestamp_properties(float period, uint32_t valid_bits) {
+    acceleration_structure_.set_timestamp_properties(period, valid_bits);
+  }
+
+  // Scratch memory of the concurrent BLAS builds, at most.
+  void set_scratch_budget(VkDeviceSize budget) {
+    acceleration_structure_.set_scratch_budget(budget);
+  }
+
+  // Objects are traced at full resolution by camera rays. When secondary_lod
+  // is not zero, shadow and bounce rays use that level of detail instead.
+  //
+  // The geometry of the objects is read at their offsets from
+  // geometry_address, the device address of the geometry buffer.
+  //
+  // build_flags prefers either a fast trace or a fast build of the
+  // acceleration structures.
+  bool build_acceleration_structures(
+      memory &mem, VkCommandPool &command_pool, VkQueue &graphics_queue,
+      std::vector<object_model_t> &objects, VkDeviceAddress geometry_address,
+      uint32_t secondary_lod, VkBuildAccelerationStructureFlagsKHR build_flags,
+      bool update) {
+    instances_.clear();
+    clusters_.clear();
+    build_flags_ = build_flags;
+    secondary_lod_ = secondary_lod;
+    geometry_address_ = geometry_address;
+
+    static constexpr uint32_t first_object = 0;
+    if (!add_blases(objects, first_object)) {
+      return false;
     }
 
-    if (!acceleration_structure_.generate(mem.get_device(), mem, command_pool,
-                                          graphics_queue, update)) {
+    if (!init_instance_table(mem)) {
+      return false;
+    }
+
+    if (!acceleration_structure_.generate(mem, command_pool, graphics_queue,
+                                          build_flags, scratch_alignment_,
+                                          update)) {
       std::cerr << "Failed to generate acceleration strucutures." << std::endl;
       return false;
     }
 
+    clusters_.build();
+
+    return true;
+  }
+
+  // Add the objects from first_object on to the structures built by
+  // build_acceleration_structures(), with the same settings. Only their
+  // BLASes are built, then the TLAS is rebuilt with all the instances and
+  // the instance table is created again. Nothing may be in use.
+  //
+  // When the geometry buffer was moved to geometry_address, the table
+  // entries and the refits of the objects already added follow it.
+  bool add_objects(memory &mem, VkCommandPool &command_pool,
+                   VkQueue &graphics_queue,
+                   const std::vector<object_model_t> &objects,
+                   uint32_t first_object, VkDeviceAddress geometry_address) {
+    if (first_object >= objects.size()) {
+      return true;
+    }
+
+    if (geometry_address != geometry_address_) {
+      for (rt_instance_t &instance : instances_) {
+        instance.vertices = instance.vertices - geometry_address_ +
+                            geometry_address;
+        instance.indices = instance.indices - geometry_address_ +
+                           geometry_address;
+      }
+      acceleration_structure_.relocate_geometry(geometry_address_,
+                                                geometry_address);
+      geometry_address_ = geometry_address;
+    }
+
+    if (!add_blases(objects, first_object)) {
+      return false;
+    }
+
+    if (!init_instance_table(mem)) {
+      return false;
+    }
+
+    if (!acceleration_structure_.append(mem, command_pool, graphics_queue,
+                                        build_flags_, scratch_alignment_)) {
+      std::cerr << "Failed to add acceleration structures." << std::endl;
+      return false;
+    }
+
+    // All the clusters are selected again, as the new TLAS.
+    clusters_.build();
+
     return true;
   }
 
-  const VkAccelerationStructureNV &get_tlas() const {
+  // Record the rebuild of the TLAS with the instance clusters selected by
+  // instance_clusters::select() into the command buffer of the frame in
+  // flight, when the selection changed. rebuilt tells whether it was, so
+  // that the accumulated samples are reset. The TLAS is built again in
+  // place, its descriptor stays valid.
+  bool cull_instances(memory &mem, VkCommandBuffer command_buffer,
+                      uint32_t frame, const glm::mat4 &view_projection,
+                      const glm::vec3 &eye, float nearby_distance,
+                      uint32_t instance_budget, bool &rebuilt) {
+    rebuilt = false;
+
+    std::vector<uint32_t> instances;
+    if (!clusters_.select(view_projection, eye, nearby_distance,
+                          instance_budget, instances)) {
+      return true;
+    }
+
+    if (!acceleration_structure_.record_tlas_rebuild(mem, command_buffer,
+                                                     frame, instances)) {
+      std::cerr << "Failed to rebuild TLAS of the visible clusters."
+                << std::endl;
+      return false;
+    }
+    rebuilt = true;
+
+    return true;
+  }
+
+  // Whether some objects are skinned, so that their BLASes and the TLAS are
+  // refit every frame.
+  bool dynamic() const { return acceleration_structure_.dynamic(); }
+
+  // Record the refit of the acceleration structures after the skinned
+  // vertices were written, or their build when rebuild. Refits are cheap but
+  // trace slower the further the vertices move from the last build.
+  bool refit(memory &mem, VkCommandBuffer command_buffer, bool rebuild) {
+    return acceleration_structure_.refit(mem, command_buffer, rebuild);
+  }
+
+  const instance_clusters &clusters() const { return clusters_; }
+
+  // Files of the static BLASes, read instead of building them.
+  acceleration_structure_cache &cache() {
+    return acceleration_structure_.cache();
+  }
+
+  const acceleration_structure::cache_stats_t &cache_stats() const {
+    return acceleration_structure_.cache_stats();
+  }
+
+  const std::vector<acceleration_structure::build_batch_t> &build_batches()
+      const {
+    return acceleration_structure_.build_batches();
+  }
+
+  size_t tlas_instance_count() const {
+    return acceleration_structure_.tlas_instance_count();
+  }
+
+  const VkAccelerationStructureKHR &get_tlas() const {
     return acceleration_structure_.get_tlas();
   }
 
-  void destroy(memory &mem) { acceleration_structure_.destroy(mem); }
+  // Storage buffer of rt_instance_t, indexed by the instance custom index.
+  VkBuffer get_instance_table() const { return instance_table_buffer_; }
+
+  void destroy(memory &mem) {
+    acceleration_structure_.destroy(mem);
+    clusters_.clear();
+    fini_instance_table(mem);
+  }
 
  private:
   acceleration_structure acceleration_structure_;
+
+  // Instance table, in the order of the custom indices.
+  std::vector<rt_instance_t> instances_;
+  VkBuffer instance_table_buffer_ = VK_NULL_HANDLE;
+  VkDeviceMemory instance_table_memory_ = VK_NULL_HANDLE;
+
+  // World bounds of the object instances, grouped into clusters.
+  instance_clusters clusters_;
+
+  // Settings of the last build, TLAS rebuilds and added objects use them
+  // too.
+  VkBuildAccelerationStructureFlagsKHR build_flags_ = 0;
+  uint32_t secondary_lod_ = 0;
+  VkDeviceAddress geometry_address_ = 0;
+
+  // Required alignment of the scratch memory used to build the acceleration
+  // structures.
+  VkDeviceSize scratch_alignment_ = 1;
+
+  // Add the objects from first_object on, each into its own BLAS. Their
+  // simplified BLASes go after the full resolution ones, and their instances
+  // have their own table entries, with the first triangle of the level.
+  //
+  // Both TLAS instances of an object instance belong to the same cluster
+  // entry, so that culling never keeps one level without the other.
+  bool add_blases(const std::vector<object_model_t> &objects,
+                  uint32_t first_object) {
+    // Cluster entry of the first instance of each object.
+    std::vector<uint32_t> first_cluster_instance;
+    for (uint32_t i = first_object; i < objects.size(); ++i) {
+      const object_model_t &object = objects[i];
+      static constexpr uint32_t lod = 0;
+      uint32_t mask = INSTANCE_MASK_PRIMARY;
+      if (!has_secondary_lod(object, secondary_lod_)) {
+        mask |= INSTANCE_MASK_SECONDARY;
+      }
+      const uint32_t first_instance =
+          add_instances(geometry_address_, objects, i, lod);
+      first_cluster_instance.push_back(
+          static_cast<uint32_t>(clusters_.bounds_count()));
+      for (size_t t = 0; t < object.transforms.size(); ++t) {
+        glm::vec3 aabb_min, aabb_max;
+        world_bounds(object, object.transforms[t], aabb_min, aabb_max);
+        clusters_.add_instance(aabb_min, aabb_max,
+                               first_instance + static_cast<uint32_t>(t));
+      }
+      if (!acceleration_structure_.add_object(geometry_address_, object, lod,
+                                              mask, first_instance)) {
+        std::cerr << "Failed to add ray tracing object." << std::endl;
+        return false;
+      }
+    }
+
+    for (uint32_t i = first_object; i < objects.size(); ++i) {
+      const object_model_t &object = objects[i];
+      if (!has_secondary_lod(object, secondary_lod_)) {
+        continue;
+      }
+      const uint32_t lod = std::min(
+          secondary_lod_, static_cast<uint32_t>(object.lods.size()) - 1);
+      const uint32_t first_instance =
+          add_instances(geometry_address_, objects, i, lod);
+      for (size_t t = 0; t < object.transforms.size(); ++t) {
+        if (!clusters_.add_level(
+                first_cluster_instance[i - first_object] +
+                    static_cast<uint32_t>(t),
+                first_instance + static_cast<uint32_t>(t))) {
+          return false;
+        }
+      }
+      if (!acceleration_structure_.add_object(geometry_address_, object, lod,
+                                              INSTANCE_MASK_SECONDARY,
+                                              first_instance)) {
+        std::cerr << "Failed to add ray tracing object LOD." << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // World bounds of the transformed object bounds.
+  static void world_bounds(const object_model_t &object,
+                           const glm::mat4 &transform, glm::vec3 &aabb_min,
+                           glm::vec3 &aabb_max) {
+    aabb_min = glm::vec3(std::numeric_limits<float>::max());
+    aabb_max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (int corner = 0; corner < 8; ++corner) {
+      const glm::vec3 p((corner & 1) ? object.aabb_max.x : object.aabb_min.x,
+                        (corner & 2) ? object.aabb_max.y : object.aabb_min.y,
+                        (corner & 4) ? object.aabb_max.z : object.aabb_min.z);
+      const glm::vec3 world(transform * glm::vec4(p, 1.0f));
+      aabb_min = glm::min(aabb_min, world);
+      aabb_max = glm::max(aabb_max, world);
+    }
+  }
+
+  // Append the table entries of the instances of an object drawn at the
+  // given level of detail. Returns the position of the first one.
+  uint32_t add_instances(VkDeviceAddress geometry_address,
+                         const std::vector<object_model_t> &objects,
+                         uint32_t object_index, uint32_t lod) {
+    const object_model_t &object = objects[object_index];
+    const uint32_t first_instance = static_cast<uint32_t>(instances_.size());
+
+    rt_instance_t instance{};
+    instance.vertices = geometry_address + object.vertex_offset;
+    instance.indices = geometry_address + object.index_offset;
+    instance.first_primitive = object.lods[lod].first_index / 3;
+    instance.object = object_index;
+    instance.textured = object.textured ? 1 : 0;
+
+    for (size_t i = 0; i < object.transforms.size(); ++i) {
+      const material_t &material = object.materials[i];
+      instance.transform = object.transforms[i];
+      const glm::mat3 linear(instance.transform);
+      instance.normal_transform =
+          glm::mat4(glm::transpose(glm::inverse(linear)));
+      instance.illumination = material.illumination;
+      instance.diffuse = glm::vec4(material.diffuse, 1.0f);
+      instance.specular = glm::vec4(material.specular, 1.0f);
+      instances_.push_back(instance);
+    }
+
+    return first_instance;
+  }
+
+  // Create the instance table with all the entries, the previous one is
+  // destroyed.
+  bool init_instance_table(memory &mem) {
+    // Shaders index the table by the custom index of the instances, which
+    // has 24 bits.
+    if (instances_.empty() || instances_.size() > (1u << 24)) {
+      std::cerr << "Invalid number of ray tracing instances: "
+                << instances_.size() << "." << std::endl;
+      return false;
+    }
+
+    fini_instance_table(mem);
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (!mem.create_buffer_and_copy(sizeof(rt_instance_t) * instances_.size(),
+                                    usage, properties, instance_table_buffer_,
+                                    instance_table_memory_,
+                                    instances_.data())) {
+      std::cerr << "Failed to create ray tracing instance table." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void fini_instance_table(memory &mem) {
+    vkDestroyBuffer(mem.get_device(), instance_table_buffer_,
+                    mem.get_allocation_callbacks());
+    instance_table_buffer_ = VK_NULL_HANDLE;
+    vkFreeMemory(mem.get_device(), instance_table_memory_,
+                 mem.get_allocation_callbacks());
+    instance_table_memory_ = VK_NULL_HANDLE;
+  }
+
+  static bool has_secondary_lod(const object_model_t &object,
+                                uint32_t secondary_lod) {
+    return secondary_lod > 0 && object.lods.size() > 1;
+  }
 };
 }  // namespace rtx
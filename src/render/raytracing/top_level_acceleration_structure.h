@@ -1,9 +1,13 @@
 #pragma once
 
+#include <string.h>
+
+#include <algorithm>
 #include <iostream>
 
 #include <vulkan/vulkan.h>
 
+#include "constants.h"
 #include "memory.h"
 #include "raytracing/acceleration_structure_instance.h"
 #include "raytracing/bottom_level_acceleration_structure.h"
@@ -16,113 +20,110 @@ class top_level_acceleration_structure {
 
   bool add_instance(const bottom_level_acceleration_structure &blas,
                     const glm::mat4 &transform, uint32_t instance_id,
-                    uint32_t hit_group_id) {
-    instances_.emplace_back(blas.get_acceleration_structure(), instance_id,
-                            hit_group_id, transform);
+                    uint32_t hit_group_id, uint32_t mask) {
+    instances_.emplace_back(blas.get_device_address(), instance_id,
+                            hit_group_id, mask, transform);
     return true;
   }
 
-  // Create the handle required to build the acceleration structure.
+  // Create the acceleration structure, the buffer that will contain it and the
+  // buffer of instances, and compute the size of the scratch buffer required
+  // to build it.
   //
-  // It requires a flag to indicate whether the acceleration structure will
+  // build_flags chooses between a faster trace or a faster build. It also
+  // requires a flag to indicate whether the acceleration structure will
   // support dynamic updates, so that the builder can later optimize the
   // structure for that usage.
   //
   // It is required to know the number of instances inserted in advance, that
   // is why this method must be called after all the instances have been added
   // with add_instance().
-  bool create(VkDevice device,
-              const VkAllocationCallbacks *allocation_callbacks,
-              bool allow_update) {
+  bool create(memory &mem, VkBuildAccelerationStructureFlagsKHR build_flags,
+              bool allow_update, VkDeviceSize &scratch_size) {
     // The generated acceleration structure can support iterative updates. This
     // updates may change the final size of the acceleration structure and then
     // the memory requirements. This flag must be set before the acceleration
     // structure is built.
-    flags_ =
-        allow_update ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV : 0;
-
-    // Setup the descriptor of the acceleration structure which contains the
-    // number of geometries it will contain.
-    VkAccelerationStructureInfoNV as_info = descriptor();
-
-    VkAccelerationStructureCreateInfoNV as_create_info{};
-    as_create_info.sType =
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
-    as_create_info.info = as_info;
-
-    VkResult res = vkCreateAccelerationStructureNV(device, &as_create_info,
-                                                   allocation_callbacks,
-                                                   &acceleration_structure_);
-    if (VK_SUCCESS != res) {
-      std::cerr << "Failed to create TLAS: " << res << std::endl;
-      return false;
+    flags_ = build_flags;
+    if (allow_update) {
+      flags_ |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
     }
 
-    return true;
-  }
-
-  bool compute_buffer_sizes(VkDevice device, memory &mem,
-                            VkDeviceSize &scratch_size) {
-    // Create the descriptor for the memory requirements.
+    // Create the buffer of instance descriptors. It is read by the builder
+    // through its device address.
     //
-    VkAccelerationStructureMemoryRequirementsInfoNV memory_requirements_info{};
-    memory_requirements_info.sType =
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
-    memory_requirements_info.type =
-        VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_OBJECT_NV;
-    memory_requirements_info.accelerationStructure = acceleration_structure_;
-
-    // Compute the size of the built acceleration structure and store it for
-    // future build/updates.
-    //
-    VkMemoryRequirements2 memory_requirements{};
-    memory_requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
-    vkGetAccelerationStructureMemoryRequirementsNV(
-        device, &memory_requirements_info, &memory_requirements);
-    structure_size_ = memory_requirements.memoryRequirements.size;
+    instance_descriptors_size_ =
+        instances_.size() * sizeof(VkAccelerationStructureInstanceKHR);
 
-    // Allocate the GPU memory that will contain the acceleration structure.
-    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    if (!mem.allocate_memory(memory_requirements.memoryRequirements, properties,
-                             acceleration_structure_memory_)) {
-      std::cerr << "Failed to allocate BLAS memory." << std::endl;
+    VkBufferUsageFlags usage =
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT;  // See rebuild().
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (!mem.create_buffer(instance_descriptors_size_, usage, properties,
+                           instance_buffer_, instance_buffer_memory_)) {
+      std::cerr << "Failed to create tlas instance buffer." << std::endl;
       return false;
     }
 
-    // Compute the scratch buffer size needed to build the acceleration
-    // structure.
-    //
-    memory_requirements_info.type =
-        VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
-    vkGetAccelerationStructureMemoryRequirementsNV(
-        device, &memory_requirements_info, &memory_requirements);
-    scratch_size_ = memory_requirements.memoryRequirements.size;
-
-    // Compute the scratch buffer size needed to update the acceleration
-    // structure.
+    // Compute the size of the built acceleration structure and of the scratch
+    // buffers needed to build and update it.
     //
-    memory_requirements_info.type =
-        VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_NV;
-    vkGetAccelerationStructureMemoryRequirementsNV(
-        device, &memory_requirements_info, &memory_requirements);
-    scratch_size_ =
-        std::max(scratch_size_, memory_requirements.memoryRequirements.size);
+    VkAccelerationStructureGeometryKHR geometry = instances_geometry(mem);
+    VkAccelerationStructureBuildGeometryInfoKHR build_info =
+        descriptor(VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR, geometry);
+
+    const uint32_t instance_count = static_cast<uint32_t>(instances_.size());
+
+    VkAccelerationStructureBuildSizesInfoKHR build_sizes{};
+    build_sizes.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+    vkGetAccelerationStructureBuildSizesKHR(
+        mem.get_device(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &build_info, &instance_count, &build_sizes);
 
+    structure_size_ = build_sizes.accelerationStructureSize;
+    scratch_size_ =
+        std::max(build_sizes.buildScratchSize, build_sizes.updateScratchSize);
     scratch_size = scratch_size_;
 
-    // Size of the instance descriptors.
-    instance_descriptors_size_ =
-        instances_.size() * sizeof(geometry_instance_t);
+    // Allocate the GPU memory that will contain the acceleration structure.
+    //
+    usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if (!mem.create_buffer(structure_size_, usage, properties,
+                           acceleration_structure_buffer_,
+                           acceleration_structure_memory_)) {
+      std::cerr << "Failed to allocate TLAS memory." << std::endl;
+      return false;
+    }
+
+    VkAccelerationStructureCreateInfoKHR as_create_info{};
+    as_create_info.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    as_create_info.buffer = acceleration_structure_buffer_;
+    as_create_info.offset = 0;
+    as_create_info.size = structure_size_;
+    as_create_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+
+    VkResult res = vkCreateAccelerationStructureKHR(
+        mem.get_device(), &as_create_info, mem.get_allocation_callbacks(),
+        &acceleration_structure_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create TLAS: " << res << std::endl;
+      return false;
+    }
 
     return true;
   }
 
-  bool generate(VkDevice device, memory &mem, VkCommandBuffer command_buffer,
-                VkBuffer scratch_buffer, VkDeviceSize scratch_offset,
-                bool update_only) {
+  bool generate(memory &mem, VkCommandBuffer command_buffer,
+                VkDeviceAddress scratch_address, bool update_only) {
     // Sanity checks for update option.
     if (update_only) {
-      if (!(flags_ & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV)) {
+      if (!(flags_ & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
         std::cerr
             << "Cannot update TLAS originally built without update support."
             << std::endl;
@@ -137,54 +138,24 @@ class top_level_acceleration_structure {
     // Sanity checks for buffer sizes.
     if (0 == scratch_size_ || 0 == instance_descriptors_size_ ||
         0 == structure_size_) {
-      std::cerr << "TLAS: compute_buffer_sizes() must be run before generate()."
+      std::cerr << "TLAS: create() must be run before generate()."
                 << std::endl;
       return false;
     }
 
-    std::vector<geometry_instance_t> geometry_instances;
+    std::vector<VkAccelerationStructureInstanceKHR> geometry_instances;
     for (auto &instance : instances_) {
       geometry_instances.emplace_back();
-      if (!convert_instance_to_instance_descriptor(device, instance,
-                                                   geometry_instances.back())) {
-        std::cerr << "TLAS: Failed to convert instance to geometry instance."
-                  << std::endl;
-        return false;
-      }
+      convert_instance_to_instance_descriptor(instance,
+                                              geometry_instances.back());
     }
 
     // Copy the instance descriptors into the instance buffer.
     //
-    VkBufferUsageFlags usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
-
-    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-
-    if (!mem.create_buffer_and_copy(
-            instance_descriptors_size_, usage, properties, instance_buffer_,
-            instance_buffer_memory_, geometry_instances.data())) {
-      std::cerr << "Failed to create tlas instance buffer." << std::endl;
-      return false;
-    }
-
-    // Bind the acceleration structure descriptor to the memory that will
-    // contain it.
-    //
-    VkBindAccelerationStructureMemoryInfoNV bind{};
-    bind.sType = VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_NV;
-    bind.accelerationStructure = acceleration_structure_;
-    bind.memory =
-        acceleration_structure_memory_;  // TODO: Receive VkDeviceMemory +
-                                         // offset after all BLASs.
-    bind.memoryOffset = 0;
-    bind.deviceIndexCount = 0;
-    bind.pDeviceIndices = nullptr;
-
-    static constexpr uint32_t bind_info_count = 1;
-    VkResult res =
-        vkBindAccelerationStructureMemoryNV(device, bind_info_count, &bind);
-    if (VK_SUCCESS != res) {
-      std::cerr << "Bind of TLAS failed: " << res << std::endl;
+    if (!mem.copy_to_buffer(instance_buffer_memory_,
+                            instance_descriptors_size_,
+                            geometry_instances.data())) {
+      std::cerr << "Failed to copy tlas instances." << std::endl;
       return false;
     }
 
@@ -192,13 +163,15 @@ class top_level_acceleration_structure {
     // the acceleration structure build.
     VkMemoryBarrier memory_barrier{};
     memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
     memory_barrier.dstAccessMask =
-        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
 
-    VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkPipelineStageFlags src_stage_mask =
+        VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
     VkPipelineStageFlags dst_stage_mask =
-        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV;
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
     VkDependencyFlags dependency_flags = 0;
     uint32_t memory_barrier_count = 1;
     uint32_t buffer_memory_barrier_count = 0;
@@ -211,25 +184,195 @@ class top_level_acceleration_structure {
                          buffer_memory_barriers, image_memory_barrier_count,
                          image_memory_barriers);
 
-    VkAccelerationStructureInfoNV as_info = descriptor();
-
-    VkDeviceSize instance_offset = 0;
-    VkAccelerationStructureNV as_src =
+    VkAccelerationStructureGeometryKHR geometry = instances_geometry(mem);
+    VkBuildAccelerationStructureModeKHR mode =
+        update_only ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+                    : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    VkAccelerationStructureBuildGeometryInfoKHR build_info =
+        descriptor(mode, geometry);
+    build_info.srcAccelerationStructure =
         update_only ? acceleration_structure_ : VK_NULL_HANDLE;
-    vkCmdBuildAccelerationStructureNV(command_buffer, &as_info,
-                                      instance_buffer_, instance_offset,
-                                      update_only, acceleration_structure_,
-                                      as_src, scratch_buffer, scratch_offset);
+    build_info.dstAccelerationStructure = acceleration_structure_;
+    build_info.scratchData.deviceAddress = scratch_address;
+
+    VkAccelerationStructureBuildRangeInfoKHR build_range{};
+    build_range.primitiveCount = static_cast<uint32_t>(instances_.size());
+    const VkAccelerationStructureBuildRangeInfoKHR *build_ranges = &build_range;
+
+    static constexpr uint32_t info_count = 1;
+    vkCmdBuildAccelerationStructuresKHR(command_buffer, info_count,
+                                        &build_info, &build_ranges);
 
     return true;
   }
 
+  // Update the TLAS after its BLASes were refit, or build it again when
+  // rebuild. The instances are the ones uploaded by generate() or
+  // rebuild(), as a refit requires the instance count of the last build.
+  // The TLAS is refit in place: the earlier frames tracing it are waited by
+  // the ALL_COMMANDS barrier that skinning records before writing the
+  // vertices.
+  bool refit(memory &mem, VkCommandBuffer command_buffer,
+             VkDeviceAddress scratch_address, bool rebuild) {
+    if (VK_NULL_HANDLE == acceleration_structure_ || 0 == scratch_size_) {
+      std::cerr << "Cannot refit TLAS not built." << std::endl;
+      return false;
+    }
+    if (!rebuild &&
+        !(flags_ & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
+      std::cerr << "Cannot update TLAS originally built without update "
+                   "support."
+                << std::endl;
+      return false;
+    }
+
+    VkAccelerationStructureGeometryKHR geometry = instances_geometry(mem);
+    VkBuildAccelerationStructureModeKHR mode =
+        rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR
+                : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+    VkAccelerationStructureBuildGeometryInfoKHR build_info =
+        descriptor(mode, geometry);
+    build_info.srcAccelerationStructure =
+        rebuild ? VK_NULL_HANDLE : acceleration_structure_;
+    build_info.dstAccelerationStructure = acceleration_structure_;
+    build_info.scratchData.deviceAddress = scratch_address;
+
+    VkAccelerationStructureBuildRangeInfoKHR build_range{};
+    build_range.primitiveCount = static_cast<uint32_t>(instances_.size());
+    const VkAccelerationStructureBuildRangeInfoKHR *build_ranges = &build_range;
+
+    static constexpr uint32_t info_count = 1;
+    vkCmdBuildAccelerationStructuresKHR(command_buffer, info_count,
+                                        &build_info, &build_ranges);
+
+    return true;
+  }
+
+  // Record a build of the TLAS with the instances added since
+  // clear_instances(), at most as many as when it was created. The
+  // acceleration structure is built again in place, so that its descriptors
+  // stay valid.
+  //
+  // The instance descriptors are staged in the slice of the frame in
+  // flight, which its fence makes free, and copied by the command buffer.
+  // Barriers order the copy and the build after the earlier frames are done
+  // building and tracing the TLAS, and the traces of this frame after them.
+  bool rebuild(memory &mem, VkCommandBuffer command_buffer, uint32_t frame,
+               VkDeviceAddress scratch_address) {
+    const VkDeviceSize size =
+        instances_.size() * sizeof(VkAccelerationStructureInstanceKHR);
+    if (0 == size || size > instance_descriptors_size_) {
+      std::cerr << "Cannot rebuild TLAS with " << instances_.size()
+                << " instances." << std::endl;
+      return false;
+    }
+
+    if (VK_NULL_HANDLE == staging_buffer_) {
+      const VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+      const VkMemoryPropertyFlags properties =
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+      if (!mem.create_buffer(
+              constants::MAX_FRAMES_IN_FLIGHT * instance_descriptors_size_,
+              usage, properties, staging_buffer_, staging_buffer_memory_)) {
+        std::cerr << "Failed to create tlas instance staging buffer."
+                  << std::endl;
+        return false;
+      }
+    }
+
+    std::vector<VkAccelerationStructureInstanceKHR> geometry_instances;
+    for (auto &instance : instances_) {
+      geometry_instances.emplace_back();
+      convert_instance_to_instance_descriptor(instance,
+                                              geometry_instances.back());
+    }
+
+    const VkDeviceSize offset = frame * instance_descriptors_size_;
+    void *mapped_data;
+    static constexpr VkMemoryMapFlags map_flags = 0;
+    VkResult res = vkMapMemory(mem.get_device(), staging_buffer_memory_,
+                               offset, size, map_flags, &mapped_data);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to map tlas instance staging buffer: " << res
+                << std::endl;
+      return false;
+    }
+    memcpy(mapped_data, geometry_instances.data(), size);
+    vkUnmapMemory(mem.get_device(), staging_buffer_memory_);
+
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_TRANSFER_WRITE_BIT |
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_TRANSFER_WRITE_BIT |
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT |
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR |
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT |
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy copy_region{};
+    copy_region.srcOffset = offset;
+    copy_region.size = size;
+    static constexpr uint32_t region_count = 1;
+    vkCmdCopyBuffer(command_buffer, staging_buffer_, instance_buffer_,
+                    region_count, &copy_region);
+
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT |
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+        &memory_barrier, 0, nullptr, 0, nullptr);
+
+    static constexpr bool build = true;
+    if (!refit(mem, command_buffer, scratch_address, build)) {
+      return false;
+    }
+
+    // Refits of this frame read the built TLAS too.
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+        VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(
+        command_buffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR |
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    return true;
+  }
+
+  // The instances of the next rebuild() are added again.
+  void clear_instances() { instances_.clear(); }
+
+  VkDeviceSize get_scratch_size() const { return scratch_size_; }
+
   void destroy(VkDevice device,
                const VkAllocationCallbacks *allocation_callbacks) {
-    vkDestroyAccelerationStructureNV(device, acceleration_structure_,
-                                     allocation_callbacks);
+    vkDestroyAccelerationStructureKHR(device, acceleration_structure_,
+                                      allocation_callbacks);
     acceleration_structure_ = VK_NULL_HANDLE;
 
+    vkDestroyBuffer(device, acceleration_structure_buffer_,
+                    allocation_callbacks);
+    acceleration_structure_buffer_ = VK_NULL_HANDLE;
+
     vkFreeMemory(device, acceleration_structure_memory_, allocation_callbacks);
     acceleration_structure_memory_ = VK_NULL_HANDLE;
 
@@ -239,12 +382,18 @@ class top_level_acceleration_structure {
     vkFreeMemory(device, instance_buffer_memory_, allocation_callbacks);
     instance_buffer_memory_ = VK_NULL_HANDLE;
 
+    vkDestroyBuffer(device, staging_buffer_, allocation_callbacks);
+    staging_buffer_ = VK_NULL_HANDLE;
+
+    vkFreeMemory(device, staging_buffer_memory_, allocation_callbacks);
+    staging_buffer_memory_ = VK_NULL_HANDLE;
+
     instances_.clear();
   }
 
   size_t num_instances() const { return instances_.size(); }
 
-  const VkAccelerationStructureNV &get_acceleration_structure() const {
+  const VkAccelerationStructureKHR &get_acceleration_structure() const {
     return acceleration_structure_;
   }
 
@@ -253,28 +402,38 @@ class top_level_acceleration_structure {
   //
 
   // The acceleration structure.
-  VkAccelerationStructureNV acceleration_structure_;
+  VkAccelerationStructureKHR acceleration_structure_ = VK_NULL_HANDLE;
+
+  // The buffer containing the acceleration structure.
+  VkBuffer acceleration_structure_buffer_ = VK_NULL_HANDLE;
 
-  // The memory containing the acceleration structure.
-  VkDeviceMemory acceleration_structure_memory_;
+  // The memory of the acceleration structure buffer.
+  VkDeviceMemory acceleration_structure_memory_ = VK_NULL_HANDLE;
 
   // The buffer containing the instance descriptors.
-  VkBuffer instance_buffer_;
+  VkBuffer instance_buffer_ = VK_NULL_HANDLE;
 
   // The memory where the instance buffer is stored.
-  VkDeviceMemory instance_buffer_memory_;
+  VkDeviceMemory instance_buffer_memory_ = VK_NULL_HANDLE;
 
-  // Construction flags, used to indicate whether the AS allows updates.
-  VkBuildAccelerationStructureFlagsNV flags_;
+  // Instance descriptors of rebuild(), a slice per frame in flight. Created
+  // by the first one.
+  VkBuffer staging_buffer_ = VK_NULL_HANDLE;
+  VkDeviceMemory staging_buffer_memory_ = VK_NULL_HANDLE;
+
+  // Construction flags, used to indicate whether the AS allows updates and
+  // whether it prefers a fast trace or a fast build.
+  VkBuildAccelerationStructureFlagsKHR flags_ = 0;
 
   // Size needed for the temporary memory used to build the TLAS.
-  VkDeviceSize scratch_size_;
+  VkDeviceSize scratch_size_ = 0;
 
-  // Size of the buffer containing the instance descriptors.
-  VkDeviceSize instance_descriptors_size_;
+  // Size of the buffer containing the instance descriptors, of all the
+  // instances at create().
+  VkDeviceSize instance_descriptors_size_ = 0;
 
   // Size of the buffer containing the TLAS.
-  VkDeviceSize structure_size_;
+  VkDeviceSize structure_size_ = 0;
 
   // List of BLAS instances.
   std::vector<new_blas_instance_t> instances_;
@@ -282,41 +441,50 @@ class top_level_acceleration_structure {
   // Methods
   //
 
-  VkAccelerationStructureInfoNV descriptor() const {
-    VkAccelerationStructureInfoNV build_info{};
-    build_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
-    build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV;
-    build_info.instanceCount = static_cast<uint32_t>(instances_.size());
-    build_info.geometryCount = 0;  // Always zero with top-level.
-    build_info.pGeometries = VK_NULL_HANDLE;
+  // The only geometry of a TLAS is the array of instances.
+  VkAccelerationStructureGeometryKHR instances_geometry(
+      const memory &mem) const {
+    VkAccelerationStructureGeometryKHR geometry{};
+    geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.geometry.instances.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+    geometry.geometry.instances.data.deviceAddress =
+        mem.get_buffer_device_address(instance_buffer_);
+    return geometry;
+  }
+
+  VkAccelerationStructureBuildGeometryInfoKHR descriptor(
+      VkBuildAccelerationStructureModeKHR mode,
+      const VkAccelerationStructureGeometryKHR &geometry) const {
+    VkAccelerationStructureBuildGeometryInfoKHR build_info{};
+    build_info.sType =
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
     build_info.flags = flags_;
+    build_info.mode = mode;
+    build_info.geometryCount = 1;
+    build_info.pGeometries = &geometry;
     return build_info;
   }
 
-  bool convert_instance_to_instance_descriptor(
-      VkDevice device, const new_blas_instance_t &instance,
-      geometry_instance_t &geometry_instance) {
-    // For each BLAS, fetch the acceleration structure handle that will allow
-    // the builder to access it from the device;
-    uint64_t as_handle;
-    VkResult res = vkGetAccelerationStructureHandleNV(
-        device, instance.blas, sizeof(as_handle), &as_handle);
-    if (VK_SUCCESS != res) {
-      std::cerr << "Failed to get acceleration structure handle: " << res
-                << std::endl;
-      return false;
-    }
+  static void convert_instance_to_instance_descriptor(
+      const new_blas_instance_t &instance,
+      VkAccelerationStructureInstanceKHR &geometry_instance) {
+    // The transform is a row-major 3x4 matrix.
+    const glm::mat3x4 transform =
+        glm::mat3x4(glm::transpose(instance.transform));
 
     geometry_instance = {};
-    geometry_instance.transform =
-        glm::mat3x4(glm::transpose(instance.transform));
-    geometry_instance.instance_id = instance.instance_id;
+    memcpy(&geometry_instance.transform, &transform,
+           sizeof(geometry_instance.transform));
+    geometry_instance.instanceCustomIndex = instance.instance_id;
     geometry_instance.mask = instance.mask;
-    geometry_instance.hit_group_id = instance.hit_group_id;
+    geometry_instance.instanceShaderBindingTableRecordOffset =
+        instance.hit_group_id;
     geometry_instance.flags = instance.flags;
-    geometry_instance.acceleration_structure_handle = as_handle;
-
-    return true;
+    geometry_instance.accelerationStructureReference = instance.blas_address;
   }
 };
 
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "acceleration_structure.h"
+#include "gpu_timer.h"
+#include "helpers.h"
+#include "memory.h"
+
+// Upscaler shader
+#include "upscaler.comp.h"
+
+namespace rtx {
+
+// Upscaler of the ray traced image, see upscaler.comp.
+//
+// The ray tracers trace a fraction of the window size. Bilinear upscaling
+// needs no pass, the ray traced image is blitted to the swap chain with a
+// linear filter. The edge-aware and temporal modes upscale it to a window
+// sized output image, that is then blitted as is.
+class upscaler {
+ public:
+  enum mode {
+    mode_bilinear = 0,
+    mode_edge_aware = 1,
+    mode_temporal = 2,
+    mode_count = 3
+  };
+
+  // Image being upscaled.
+  enum source { source_ray_traced = 0, source_denoised = 1, source_count = 2 };
+
+  upscaler()
+      : descriptor_pool_(),
+        descriptor_layout_(),
+        descriptor_sets_{},
+        pipeline_layout_(),
+        pipeline_(),
+        history_{},
+        output_(),
+        current_history_(0),
+        mode_(mode_bilinear),
+        reset_(true),
+        timer_() {}
+
+  // Ray tracing descriptor set layout of the ray tracers, with the G-buffer.
+  bool init(memory &mem, const VkPhysicalDeviceProperties &properties,
+            uint32_t timestamp_valid_bits, VkExtent2D window_size,
+            const storage_image_t &ray_traced, const storage_image_t &denoised,
+            VkDescriptorSetLayout rt_descriptor_layout) {
+    if (!timer_.init(mem, properties, timestamp_valid_bits, 1)) {
+      std::cerr << "Failed to init upscaler timer." << std::endl;
+      return false;
+    }
+
+    if (!init_images(mem, window_size, ray_traced.format)) {
+      std::cerr << "Failed to create upscaler images." << std::endl;
+      return false;
+    }
+
+    const storage_image_t *sources[source_count] = {&ray_traced, &denoised};
+    if (!init_descriptor_sets(mem, sources)) {
+      std::cerr << "Failed to create upscaler descriptor sets." << std::endl;
+      return false;
+    }
+
+    if (!init_pipeline(mem, rt_descriptor_layout)) {
+      std::cerr << "Failed to create upscaler pipeline." << std::endl;
+      return false;
+    }
+
+    // New images have no history.
+    reset_ = true;
+
+    return true;
+  }
+
+  void fini(memory &mem) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    vkDestroyPipeline(device, pipeline_, allocation_callbacks);
+    pipeline_ = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout(device, pipeline_layout_, allocation_callbacks);
+    pipeline_layout_ = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(device, descriptor_pool_, allocation_callbacks);
+    descriptor_pool_ = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(device, descriptor_layout_,
+                                 allocation_callbacks);
+    descriptor_layout_ = VK_NULL_HANDLE;
+
+    for (storage_image_t *image : images()) {
+      destroy_image(mem, *image);
+    }
+
+    timer_.fini(mem);
+  }
+
+  // Read the GPU times of a frame. Call after waiting for its fence.
+  void read(memory &mem, uint32_t frame) { timer_.read(mem, frame); }
+
+  // Discard the history, it no longer matches the ray traced image.
+  void reset() { reset_ = true; }
+
+  // Upscale the ray traced or denoised image of this frame into the output
+  // image. rt_frame is the ray tracing frame counter of the new samples.
+  void upscale(VkCommandBuffer cmd_buf, uint32_t frame, VkExtent2D window_size,
+               VkDescriptorSet rt_descriptor_set, source image, mode m,
+               bool moving, int32_t rt_frame) {
+    timer_.reset(cmd_buf, frame);
+
+    // The history of another mode, or of an accumulation that started over,
+    // is stale.
+    if (m != mode_ || 0 == rt_frame) {
+      reset_ = true;
+    }
+    mode_ = m;
+
+    // Wait for the ray tracers and the denoiser. The previous contents of
+    // the images are discarded on a reset.
+    std::vector<VkImageMemoryBarrier> image_barriers;
+    if (reset_) {
+      for (storage_image_t *storage_image : images()) {
+        VkImageMemoryBarrier image_barrier{};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_barrier.dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.image = storage_image->image;
+        image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        image_barrier.subresourceRange.levelCount = 1;
+        image_barrier.subresourceRange.layerCount = 1;
+        image_barriers.push_back(image_barrier);
+      }
+    }
+
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memory_barrier, 0, nullptr,
+                         static_cast<uint32_t>(image_barriers.size()),
+                         image_barriers.data());
+
+    constants_t constants{};
+    constants.mode = static_cast<int32_t>(m);
+    constants.reset = reset_ ? 1 : 0;
+    constants.moving = moving ? 1 : 0;
+    constants.frame = rt_frame;
+
+    // The previous history is the one written on the last frame.
+    const uint32_t previous_history = 1 - current_history_;
+
+    static constexpr uint32_t first_set = 0;
+    static constexpr uint32_t dynamic_offset_count = 0;
+    static constexpr uint32_t *dynamic_offsets = nullptr;
+    VkDescriptorSet sets[] = {rt_descriptor_set,
+                              descriptor_sets_[image][previous_history]};
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, first_set, 2, sets,
+                            dynamic_offset_count, dynamic_offsets);
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+
+    static constexpr uint32_t offset = 0;
+    vkCmdPushConstants(cmd_buf, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT,
+                       offset, sizeof(constants), &constants);
+
+    timer_.begin(cmd_buf, frame, 0);
+    vkCmdDispatch(cmd_buf, group_count(window_size.width),
+                  group_count(window_size.height), 1);
+    timer_.end(cmd_buf, frame, 0);
+
+    // The output image is blitted to the swap chain.
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier,
+                         0, nullptr, 0, nullptr);
+
+    current_history_ = 1 - current_history_;
+    reset_ = false;
+  }
+
+  // Upscaled image, in general layout.
+  const storage_image_t &output() const { return output_; }
+
+  bool timer_enabled() const { return timer_.enabled(); }
+
+  // Averaged GPU time of the upscaling pass, 0 if never measured.
+  float milliseconds() const { return timer_.milliseconds(0); }
+
+ private:
+  static constexpr uint32_t HISTORY_COUNT = 2;  // Previous and current.
+  static constexpr uint32_t TILE_SIZE = 8;      // Same as upscaler.comp.
+  static constexpr uint32_t BINDING_COUNT = 4;
+
+  // Push constants of upscaler.comp.
+  struct constants_t {
+    int32_t mode;
+    int32_t reset;
+    int32_t moving;
+    int32_t frame;
+  };
+
+  static uint32_t group_count(uint32_t size) {
+    return (size + TILE_SIZE - 1) / TILE_SIZE;
+  }
+
+  std::vector<storage_image_t *> images() {
+    return {&history_[0], &history_[1], &output_};
+  }
+
+  bool init_images(memory &mem, VkExtent2D window_size,
+                   VkFormat output_format) {
+    for (uint32_t i = 0; i < HISTORY_COUNT; ++i) {
+      if (!create_image(mem, window_size, VK_FORMAT_R16G16B16A16_SFLOAT,
+                        VK_IMAGE_USAGE_STORAGE_BIT, history_[i])) {
+        return false;
+      }
+    }
+
+    // Same format as the ray traced image, to be blitted to the swap chain.
+    return create_image(
+        mem, window_size, output_format,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, output_);
+  }
+
+  static bool create_image(memory &mem, VkExtent2D size, VkFormat format,
+                           VkImageUsageFlags usage, storage_image_t &image) {
+    image.format = format;
+
+    if (!helpers::create_image(mem, size.width, size.height, format,
+                               VK_IMAGE_TILING_OPTIMAL, usage,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                               image.image, image.mem)) {
+      std::cerr << "Failed to create upscaler image." << std::endl;
+      return false;
+    }
+
+    if (!helpers::create_image_view(mem, image.image, format,
+                                    VK_IMAGE_ASPECT_COLOR_BIT, image.view)) {
+      std::cerr << "Failed to create upscaler image view." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  static void destroy_image(memory &mem, storage_image_t &image) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    vkDestroyImageView(device, image.view, allocation_callbacks);
+    image.view = VK_NULL_HANDLE;
+    vkDestroyImage(device, image.image, allocation_callbacks);
+    image.image = VK_NULL_HANDLE;
+    vkFreeMemory(device, image.mem, allocation_callbacks);
+    image.mem = VK_NULL_HANDLE;
+  }
+
+  bool init_descriptor_sets(memory &mem,
+                            const storage_image_t *sources[source_count]) {
+    VkDevice device = mem.get_device();
+
+    // Layout.
+    //
+    VkDescriptorSetLayoutBinding layout_bindings[BINDING_COUNT] = {};
+    for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+      layout_bindings[i].binding = i;
+      layout_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      layout_bindings[i].descriptorCount = 1;
+      layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptor_layout_create_info{};
+    descriptor_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptor_layout_create_info.bindingCount = BINDING_COUNT;
+    descriptor_layout_create_info.pBindings = layout_bindings;
+
+    VkResult res = vkCreateDescriptorSetLayout(
+        device, &descriptor_layout_create_info,
+        mem.get_allocation_callbacks(), &descriptor_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create upscaler descriptor set layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Pool.
+    //
+    static constexpr uint32_t SET_COUNT = source_count * HISTORY_COUNT;
+    const VkDescriptorPoolSize descriptor_pool_size = {
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, SET_COUNT * BINDING_COUNT};
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info{};
+    descriptor_pool_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_create_info.maxSets = SET_COUNT;
+    descriptor_pool_create_info.poolSizeCount = 1;
+    descriptor_pool_create_info.pPoolSizes = &descriptor_pool_size;
+
+    res = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+                                 mem.get_allocation_callbacks(),
+                                 &descriptor_pool_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create upscaler descriptor pool: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Sets. Set [s][h] upscales source s, reads history h and writes the
+    // other one.
+    //
+    std::vector<VkDescriptorSetLayout> layouts(SET_COUNT, descriptor_layout_);
+
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{};
+    descriptor_set_allocate_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_set_allocate_info.descriptorPool = descriptor_pool_;
+    descriptor_set_allocate_info.descriptorSetCount = SET_COUNT;
+    descriptor_set_allocate_info.pSetLayouts = layouts.data();
+
+    res = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+                                   &descriptor_sets_[0][0]);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to allocate upscaler descriptor sets: " << res
+                << std::endl;
+      return false;
+    }
+
+    for (uint32_t s = 0; s < source_count; ++s) {
+      for (uint32_t h = 0; h < HISTORY_COUNT; ++h) {
+        const storage_image_t *bindings[BINDING_COUNT] = {
+            sources[s], &history_[h], &history_[1 - h], &output_};
+
+        VkDescriptorImageInfo image_infos[BINDING_COUNT] = {};
+        VkWriteDescriptorSet writes[BINDING_COUNT] = {};
+        for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+          image_infos[i].imageView = bindings[i]->view;
+          image_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+          writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+          writes[i].dstSet = descriptor_sets_[s][h];
+          writes[i].dstBinding = i;
+          writes[i].descriptorCount = 1;
+          writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+          writes[i].pImageInfo = &image_infos[i];
+        }
+
+        vkUpdateDescriptorSets(device, BINDING_COUNT, writes, 0, nullptr);
+      }
+    }
+
+    return true;
+  }
+
+  bool init_pipeline(memory &mem, VkDescriptorSetLayout rt_descriptor_layout) {
+    VkDescriptorSetLayout layouts[] = {rt_descriptor_layout,
+                                       descriptor_layout_};
+
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(constants_t);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 2;
+    pipeline_layout_create_info.pSetLayouts = layouts;
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant;
+
+    VkResult res = vkCreatePipelineLayout(
+        mem.get_device(), &pipeline_layout_create_info,
+        mem.get_allocation_callbacks(), &pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create upscaler pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkShaderModuleCreateInfo shader_module_create_info{};
+    shader_module_create_info.sType =
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_module_create_info.codeSize = sizeof(upscaler_comp);
+    shader_module_create_info.pCode = upscaler_comp;
+
+    VkPipelineShaderStageCreateInfo shader_stage{};
+    shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shader_stage.pName = "main";
+
+    res = vkCreateShaderModule(mem.get_device(), &shader_module_create_info,
+                               mem.get_allocation_callbacks(),
+                               &shader_stage.module);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create upscaler shader module: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkComputePipelineCreateInfo pipeline_create_info{};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stage = shader_stage;
+    pipeline_create_info.layout = pipeline_layout_;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+
+    res = vkCreateComputePipelines(mem.get_device(), pipeline_cache,
+                                   create_info_count, &pipeline_create_info,
+                                   mem.get_allocation_callbacks(), &pipeline_);
+
+    // The pipeline keeps its own copy of the shader.
+    vkDestroyShaderModule(mem.get_device(), shader_stage.module,
+                          mem.get_allocation_callbacks());
+
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create upscaler pipeline: " << res << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSetLayout descriptor_layout_;
+  VkDescriptorSet descriptor_sets_[source_count][HISTORY_COUNT];
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline pipeline_;
+
+  storage_image_t history_[HISTORY_COUNT];
+  storage_image_t output_;
+  uint32_t current_history_;  // Written this frame, read on the next one.
+  mode mode_;                 // Of the history.
+  bool reset_;                // Images have no history.
+
+  gpu_timer timer_;
+};
+
+}  // namespace rtx
@@ -0,0 +1,650 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "acceleration_structure.h"
+#include "constants.h"
+#include "gpu_timer.h"
+#include "memory.h"
+
+// Wavefront shaders
+#include "wavefront_generate.comp.h"
+#include "wavefront_histogram.comp.h"
+#include "wavefront_resolve.comp.h"
+#include "wavefront_scan.comp.h"
+#include "wavefront_scatter.comp.h"
+#include "wavefront_shade.comp.h"
+
+namespace rtx {
+
+// Wavefront path tracer.
+//
+// Instead of tracing every bounce of a path in a single shader invocation,
+// each bounce is a compute dispatch over a queue of rays. Rays that keep
+// bouncing are appended to the next queue, so the queue is compacted, and can
+// be sorted by material and direction octant before being traced, so that
+// divergent reflection rays are traced in coherent batches.
+//
+// Samples of a pixel are traced one after the other, so a pixel has a single
+// path in flight and the ray queues are one ray per pixel.
+class wavefront_path_tracer {
+ public:
+  static constexpr uint32_t MAX_BOUNCES = 32;
+
+  // GPU timer passes.
+  enum pass {
+    pass_generate = 0,
+    pass_resolve = 1,
+    pass_sort = 2,                  // One per bounce.
+    pass_shade = 2 + MAX_BOUNCES,  // One per bounce.
+    pass_count = 2 + 2 * MAX_BOUNCES
+  };
+
+  wavefront_path_tracer()
+      : ray_count_(0),
+        descriptor_pool_(),
+        descriptor_layout_(),
+        descriptor_sets_{},
+        pipeline_layout_(),
+        generate_pipeline_(),
+        shade_pipeline_(),
+        histogram_pipeline_(),
+        scan_pipeline_(),
+        scatter_pipeline_(),
+        resolve_pipeline_(),
+        rays_{},
+        rays_mem_{},
+        queues_(),
+        queues_mem_(),
+        radiance_(),
+        radiance_mem_(),
+        buckets_(),
+        buckets_mem_(),
+        stats_(),
+        stats_mem_(),
+        stats_data_(nullptr),
+        timer_(),
+        rays_per_bounce_{} {}
+
+  // Ray tracing and scene descriptor set layouts, and push constants, are the
+  // same of the ray tracing pipeline.
+  bool init(memory &mem, const VkPhysicalDeviceProperties &properties,
+            uint32_t timestamp_valid_bits, VkExtent2D window_size,
+            VkDescriptorSetLayout rt_descriptor_layout,
+            VkDescriptorSetLayout scene_descriptor_layout,
+            VkShaderStageFlags push_constant_stages) {
+    ray_count_ = window_size.width * window_size.height;
+
+    if (!timer_.init(mem, properties, timestamp_valid_bits, pass_count)) {
+      std::cerr << "Failed to init wavefront timer." << std::endl;
+      return false;
+    }
+
+    if (!init_buffers(mem)) {
+      std::cerr << "Failed to create wavefront buffers." << std::endl;
+      return false;
+    }
+
+    if (!init_descriptor_sets(mem)) {
+      std::cerr << "Failed to create wavefront descriptor sets." << std::endl;
+      return false;
+    }
+
+    if (!init_pipelines(mem, rt_descriptor_layout, scene_descriptor_layout,
+                        push_constant_stages)) {
+      std::cerr << "Failed to create wavefront pipelines." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void fini(memory &mem) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    for (VkPipeline *pipeline :
+         {&generate_pipeline_, &shade_pipeline_, &histogram_pipeline_,
+          &scan_pipeline_, &scatter_pipeline_, &resolve_pipeline_}) {
+      vkDestroyPipeline(device, *pipeline, allocation_callbacks);
+      *pipeline = VK_NULL_HANDLE;
+    }
+    vkDestroyPipelineLayout(device, pipeline_layout_, allocation_callbacks);
+    pipeline_layout_ = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(device, descriptor_pool_, allocation_callbacks);
+    descriptor_pool_ = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(device, descriptor_layout_,
+                                 allocation_callbacks);
+    descriptor_layout_ = VK_NULL_HANDLE;
+
+    vkUnmapMemory(device, stats_mem_);
+    stats_data_ = nullptr;
+
+    for (uint32_t i = 0; i < QUEUE_COUNT; ++i) {
+      destroy_buffer(mem, rays_[i], rays_mem_[i]);
+    }
+    destroy_buffer(mem, queues_, queues_mem_);
+    destroy_buffer(mem, radiance_, radiance_mem_);
+    destroy_buffer(mem, buckets_, buckets_mem_);
+    destroy_buffer(mem, stats_, stats_mem_);
+
+    timer_.fini(mem);
+  }
+
+  // Read the stats of a frame. Call after waiting for its fence.
+  void read(memory &mem, uint32_t frame) {
+    timer_.read(mem, frame);
+
+    if (!stats_data_) {
+      return;
+    }
+
+    const uint32_t *counts = stats_data_ + frame * MAX_BOUNCES;
+    std::copy(counts, counts + MAX_BOUNCES, rays_per_bounce_);
+  }
+
+  void trace(VkCommandBuffer cmd_buf, uint32_t frame, VkExtent2D window_size,
+             VkDescriptorSet rt_descriptor_set,
+             VkDescriptorSet scene_descriptor_set,
+             const ray_tracing_constants_t &rt_constants,
+             VkShaderStageFlags push_constant_stages, bool sort) {
+    timer_.reset(cmd_buf, frame);
+
+    // Ray counts of this frame, bounces that are not traced have no rays.
+    vkCmdFillBuffer(cmd_buf, stats_, frame * MAX_BOUNCES * sizeof(uint32_t),
+                    MAX_BOUNCES * sizeof(uint32_t), 0);
+    vkCmdFillBuffer(cmd_buf, radiance_, 0, VK_WHOLE_SIZE, 0);
+
+    uint32_t first_set = 0;
+    uint32_t dynamic_offset_count = 0;
+    const uint32_t *dynamic_offsets = nullptr;
+    std::vector<VkDescriptorSet> sets(
+        {rt_descriptor_set, scene_descriptor_set});
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, first_set,
+                            static_cast<uint32_t>(sets.size()), sets.data(),
+                            dynamic_offset_count, dynamic_offsets);
+
+    uint32_t offset = 0;
+    vkCmdPushConstants(cmd_buf, pipeline_layout_, push_constant_stages, offset,
+                       static_cast<uint32_t>(sizeof(rt_constants)),
+                       &rt_constants);
+
+    const uint32_t bounces = std::min(
+        MAX_BOUNCES, static_cast<uint32_t>(rt_constants.max_iterations));
+
+    // Queue with the rays to trace next.
+    uint32_t in = 0;
+
+    for (int sample = 0; sample < rt_constants.samples; ++sample) {
+      // Stages are timed and rays counted on the first sample.
+      const bool profile = 0 == sample;
+
+      // Camera rays.
+      //
+      reset_queue(cmd_buf, 1 - in);
+      barrier(cmd_buf);
+
+      bind_queues(cmd_buf, in);
+      vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                        generate_pipeline_);
+      begin(cmd_buf, frame, pass_generate, profile);
+      vkCmdDispatch(cmd_buf, group_count(ray_count_, WORKGROUP_SIZE), 1, 1);
+      end(cmd_buf, frame, pass_generate, profile);
+      in = 1 - in;
+      barrier(cmd_buf);
+
+      for (uint32_t bounce = 0; bounce < bounces; ++bounce) {
+        if (profile) {
+          VkBufferCopy region{};
+          region.srcOffset = in * sizeof(queue_t);
+          region.dstOffset = (frame * MAX_BOUNCES + bounce) * sizeof(uint32_t);
+          region.size = sizeof(uint32_t);
+          vkCmdCopyBuffer(cmd_buf, queues_, stats_, 1, &region);
+        }
+
+        if (sort) {
+          vkCmdFillBuffer(cmd_buf, buckets_, 0, VK_WHOLE_SIZE, 0);
+          barrier(cmd_buf);
+
+          bind_queues(cmd_buf, in);
+          begin(cmd_buf, frame, pass_sort + bounce, profile);
+          vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            histogram_pipeline_);
+          vkCmdDispatchIndirect(cmd_buf, queues_, indirect_offset(in));
+          barrier(cmd_buf);
+          vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            scan_pipeline_);
+          vkCmdDispatch(cmd_buf, 1, 1, 1);
+          barrier(cmd_buf);
+          vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            scatter_pipeline_);
+          vkCmdDispatchIndirect(cmd_buf, queues_, indirect_offset(in));
+          end(cmd_buf, frame, pass_sort + bounce, profile);
+          in = 1 - in;
+          barrier(cmd_buf);
+        }
+
+        reset_queue(cmd_buf, 1 - in);
+        barrier(cmd_buf);
+
+        bind_queues(cmd_buf, in);
+        vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          shade_pipeline_);
+        begin(cmd_buf, frame, pass_shade + bounce, profile);
+        vkCmdDispatchIndirect(cmd_buf, queues_, indirect_offset(in));
+        end(cmd_buf, frame, pass_shade + bounce, profile);
+        in = 1 - in;
+        barrier(cmd_buf);
+      }
+    }
+
+    // Average the samples on the result image.
+    //
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      resolve_pipeline_);
+    begin(cmd_buf, frame, pass_resolve, true);
+    vkCmdDispatch(cmd_buf, group_count(window_size.width, RESOLVE_TILE_SIZE),
+                  group_count(window_size.height, RESOLVE_TILE_SIZE), 1);
+    end(cmd_buf, frame, pass_resolve, true);
+
+    // Ray counts are read by the host after the frame fence.
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0,
+                         nullptr, 0, nullptr);
+  }
+
+  bool timer_enabled() const { return timer_.enabled(); }
+
+  // Averaged GPU time of a pass, 0 if never measured.
+  float milliseconds(uint32_t pass) const {
+    return timer_.milliseconds(pass);
+  }
+
+  // Rays traced on a bounce by the first sample of the last read frame.
+  uint32_t rays(uint32_t bounce) const { return rays_per_bounce_[bounce]; }
+
+  uint32_t camera_rays() const { return ray_count_; }
+
+ private:
+  static constexpr uint32_t QUEUE_COUNT = 2;        // Ping-pong.
+  static constexpr uint32_t WORKGROUP_SIZE = 64;    // Same as wavefront.glsl.
+  static constexpr uint32_t RESOLVE_TILE_SIZE = 8;  // Same as resolve shader.
+  static constexpr uint32_t SORT_BUCKETS = 256;     // Same as wavefront.glsl.
+  static constexpr VkDeviceSize RAY_SIZE = 48;      // Ray in wavefront.glsl.
+  static constexpr VkDeviceSize PIXEL_SIZE = 32;    // PixelSamples.
+  static constexpr uint32_t BINDING_COUNT = 6;
+
+  // Queue in wavefront.glsl.
+  struct queue_t {
+    uint32_t count;
+    VkDispatchIndirectCommand groups;
+  };
+
+  static uint32_t group_count(uint32_t size, uint32_t group_size) {
+    return (size + group_size - 1) / group_size;
+  }
+
+  static VkDeviceSize indirect_offset(uint32_t queue) {
+    return queue * sizeof(queue_t) + offsetof(queue_t, groups);
+  }
+
+  bool init_buffers(memory &mem) {
+    for (uint32_t i = 0; i < QUEUE_COUNT; ++i) {
+      if (!mem.create_buffer(ray_count_ * RAY_SIZE,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, rays_[i],
+                             rays_mem_[i])) {
+        std::cerr << "Failed to create ray queue." << std::endl;
+        return false;
+      }
+    }
+
+    if (!mem.create_buffer(QUEUE_COUNT * sizeof(queue_t),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, queues_,
+                           queues_mem_)) {
+      std::cerr << "Failed to create ray queue counters." << std::endl;
+      return false;
+    }
+
+    if (!mem.create_buffer(
+            ray_count_ * PIXEL_SIZE,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, radiance_, radiance_mem_)) {
+      std::cerr << "Failed to create radiance buffer." << std::endl;
+      return false;
+    }
+
+    if (!mem.create_buffer(
+            2 * SORT_BUCKETS * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buckets_, buckets_mem_)) {
+      std::cerr << "Failed to create ray sort buckets buffer." << std::endl;
+      return false;
+    }
+
+    const VkDeviceSize stats_size =
+        constants::MAX_FRAMES_IN_FLIGHT * MAX_BOUNCES * sizeof(uint32_t);
+    if (!mem.create_buffer(stats_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                           stats_, stats_mem_)) {
+      std::cerr << "Failed to create wavefront stats buffer." << std::endl;
+      return false;
+    }
+
+    void *mapped_data = nullptr;
+    VkDeviceSize offset = 0;
+    VkMemoryMapFlags map_flags = 0;
+    VkResult res = vkMapMemory(mem.get_device(), stats_mem_, offset,
+                               stats_size, map_flags, &mapped_data);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to map wavefront stats buffer: " << res
+                << std::endl;
+      return false;
+    }
+    stats_data_ = static_cast<uint32_t *>(mapped_data);
+    std::fill(stats_data_,
+              stats_data_ + constants::MAX_FRAMES_IN_FLIGHT * MAX_BOUNCES, 0);
+
+    return true;
+  }
+
+  static void destroy_buffer(memory &mem, VkBuffer &buffer,
+                             VkDeviceMemory &buffer_memory) {
+    vkDestroyBuffer(mem.get_device(), buffer, mem.get_allocation_callbacks());
+    buffer = VK_NULL_HANDLE;
+    vkFreeMemory(mem.get_device(), buffer_memory,
+                 mem.get_allocation_callbacks());
+    buffer_memory = VK_NULL_HANDLE;
+  }
+
+  bool init_descriptor_sets(memory &mem) {
+    VkDevice device = mem.get_device();
+
+    // Layout.
+    //
+    VkDescriptorSetLayoutBinding layout_bindings[BINDING_COUNT] = {};
+    for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+      layout_bindings[i].binding = i;
+      layout_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      layout_bindings[i].descriptorCount = 1;
+      layout_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptor_layout_create_info{};
+    descriptor_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptor_layout_create_info.bindingCount = BINDING_COUNT;
+    descriptor_layout_create_info.pBindings = layout_bindings;
+
+    VkResult res = vkCreateDescriptorSetLayout(
+        device, &descriptor_layout_create_info,
+        mem.get_allocation_callbacks(), &descriptor_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create wavefront descriptor set layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Pool.
+    //
+    const VkDescriptorPoolSize descriptor_pool_size = {
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, QUEUE_COUNT * BINDING_COUNT};
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info{};
+    descriptor_pool_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_create_info.maxSets = QUEUE_COUNT;
+    descriptor_pool_create_info.poolSizeCount = 1;
+    descriptor_pool_create_info.pPoolSizes = &descriptor_pool_size;
+
+    res = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+                                 mem.get_allocation_callbacks(),
+                                 &descriptor_pool_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create wavefront descriptor pool: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Sets. Set i reads queue i and appends to the other queue.
+    //
+    VkDescriptorSetLayout layouts[QUEUE_COUNT] = {descriptor_layout_,
+                                                  descriptor_layout_};
+
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{};
+    descriptor_set_allocate_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_set_allocate_info.descriptorPool = descriptor_pool_;
+    descriptor_set_allocate_info.descriptorSetCount = QUEUE_COUNT;
+    descriptor_set_allocate_info.pSetLayouts = layouts;
+
+    res = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+                                   descriptor_sets_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to allocate wavefront descriptor sets: " << res
+                << std::endl;
+      return false;
+    }
+
+    for (uint32_t in = 0; in < QUEUE_COUNT; ++in) {
+      const uint32_t out = 1 - in;
+
+      const VkDescriptorBufferInfo buffer_infos[BINDING_COUNT] = {
+          {rays_[in], 0, VK_WHOLE_SIZE},
+          {rays_[out], 0, VK_WHOLE_SIZE},
+          {queues_, in * sizeof(queue_t), sizeof(queue_t)},
+          {queues_, out * sizeof(queue_t), sizeof(queue_t)},
+          {radiance_, 0, VK_WHOLE_SIZE},
+          {buckets_, 0, VK_WHOLE_SIZE}};
+
+      VkWriteDescriptorSet writes[BINDING_COUNT] = {};
+      for (uint32_t i = 0; i < BINDING_COUNT; ++i) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptor_sets_[in];
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &buffer_infos[i];
+      }
+
+      vkUpdateDescriptorSets(device, BINDING_COUNT, writes, 0, nullptr);
+    }
+
+    return true;
+  }
+
+  bool init_pipelines(memory &mem, VkDescriptorSetLayout rt_descriptor_layout,
+                      VkDescriptorSetLayout scene_descriptor_layout,
+                      VkShaderStageFlags push_constant_stages) {
+    VkDescriptorSetLayout layouts[] = {
+        rt_descriptor_layout, scene_descriptor_layout, descriptor_layout_};
+
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = push_constant_stages;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(ray_tracing_constants_t);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 3;
+    pipeline_layout_create_info.pSetLayouts = layouts;
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant;
+
+    VkResult res = vkCreatePipelineLayout(
+        mem.get_device(), &pipeline_layout_create_info,
+        mem.get_allocation_callbacks(), &pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create wavefront pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    return create_pipeline(mem, wavefront_generate_comp,
+                           sizeof(wavefront_generate_comp),
+                           generate_pipeline_) &&
+           create_pipeline(mem, wavefront_shade_comp,
+                           sizeof(wavefront_shade_comp), shade_pipeline_) &&
+           create_pipeline(mem, wavefront_histogram_comp,
+                           sizeof(wavefront_histogram_comp),
+                           histogram_pipeline_) &&
+           create_pipeline(mem, wavefront_scan_comp,
+                           sizeof(wavefront_scan_comp), scan_pipeline_) &&
+           create_pipeline(mem, wavefront_scatter_comp,
+                           sizeof(wavefront_scatter_comp),
+                           scatter_pipeline_) &&
+           create_pipeline(mem, wavefront_resolve_comp,
+                           sizeof(wavefront_resolve_comp), resolve_pipeline_);
+  }
+
+  bool create_pipeline(memory &mem, const uint32_t *code, size_t code_size,
+                       VkPipeline &pipeline) {
+    VkShaderModuleCreateInfo shader_module_create_info{};
+    shader_module_create_info.sType =
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_module_create_info.codeSize = code_size;
+    shader_module_create_info.pCode = code;
+
+    VkPipelineShaderStageCreateInfo shader_stage{};
+    shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shader_stage.pName = "main";
+
+    VkResult res = vkCreateShaderModule(
+        mem.get_device(), &shader_module_create_info,
+        mem.get_allocation_callbacks(), &shader_stage.module);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create wavefront shader module: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkComputePipelineCreateInfo pipeline_create_info{};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stage = shader_stage;
+    pipeline_create_info.layout = pipeline_layout_;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+
+    res = vkCreateComputePipelines(mem.get_device(), pipeline_cache,
+                                   create_info_count, &pipeline_create_info,
+                                   mem.get_allocation_callbacks(), &pipeline);
+
+    // The pipeline keeps its own copy of the shader.
+    vkDestroyShaderModule(mem.get_device(), shader_stage.module,
+                          mem.get_allocation_callbacks());
+
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create wavefront pipeline: " << res
+                << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void bind_queues(VkCommandBuffer cmd_buf, uint32_t in) {
+    static constexpr uint32_t first_set = 2;
+    static constexpr uint32_t set_count = 1;
+    static constexpr uint32_t dynamic_offset_count = 0;
+    static constexpr uint32_t *dynamic_offsets = nullptr;
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, first_set, set_count,
+                            &descriptor_sets_[in], dynamic_offset_count,
+                            dynamic_offsets);
+  }
+
+  // Empty a queue before appending rays to it.
+  void reset_queue(VkCommandBuffer cmd_buf, uint32_t queue) {
+    queue_t empty_queue{};
+    empty_queue.groups.y = 1;
+    empty_queue.groups.z = 1;
+    vkCmdUpdateBuffer(cmd_buf, queues_, queue * sizeof(queue_t),
+                      sizeof(empty_queue), &empty_queue);
+  }
+
+  // Stages depend on the writes of the previous stage, both from shaders and
+  // from transfers, including the indirect dispatch arguments.
+  static void barrier(VkCommandBuffer cmd_buf) {
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask =
+        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+        VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+    vkCmdPipelineBarrier(
+        cmd_buf,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT |
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+  }
+
+  void begin(VkCommandBuffer cmd_buf, uint32_t frame, uint32_t pass,
+             bool profile) {
+    if (profile) {
+      timer_.begin(cmd_buf, frame, pass);
+    }
+  }
+
+  void end(VkCommandBuffer cmd_buf, uint32_t frame, uint32_t pass,
+           bool profile) {
+    if (profile) {
+      timer_.end(cmd_buf, frame, pass);
+    }
+  }
+
+  uint32_t ray_count_;  // Rays of a queue, one per pixel.
+
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSetLayout descriptor_layout_;
+  VkDescriptorSet descriptor_sets_[QUEUE_COUNT];
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline generate_pipeline_;
+  VkPipeline shade_pipeline_;
+  VkPipeline histogram_pipeline_;
+  VkPipeline scan_pipeline_;
+  VkPipeline scatter_pipeline_;
+  VkPipeline resolve_pipeline_;
+
+  VkBuffer rays_[QUEUE_COUNT];
+  VkDeviceMemory rays_mem_[QUEUE_COUNT];
+  VkBuffer queues_;
+  VkDeviceMemory queues_mem_;
+  VkBuffer radiance_;
+  VkDeviceMemory radiance_mem_;
+  VkBuffer buckets_;
+  VkDeviceMemory buckets_mem_;
+  VkBuffer stats_;  // Rays per bounce of each frame in flight.
+  VkDeviceMemory stats_mem_;
+  uint32_t *stats_data_;
+
+  gpu_timer timer_;
+  uint32_t rays_per_bounce_[MAX_BOUNCES];
+};
+
+}  // namespace rtx
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glm.h"
+#include "json.h"
+#include "object.h"
+
+namespace rtx {
+
+// Description of a scene, read from a JSON file:
+//
+//   {
+//     "textures": [{"name": "room", "path": "../textures/viking_room.png"}],
+//     "materials": [{"name": "metal", "illumination": 3,
+//                    "specular": [0.8, 0.8, 0.8]}],
+//     "models": [{"name": "room", "path": "../models/viking_room.obj",
+//                 "texture": "room",
+//                 "animation": {"joints": 8, "angle": 30, "period": 2}}],
+//     "instances": [{"model": "room", "translation": [0, 0, 0],
+//                    "rotation": [0, 90, 0], "scale": 1.0}],
+//     "light": {"type": "directional", "position": [7, 5, -8],
+//               "intensity": 1.0},
+//     "camera": {"rotation": [-20, 45, 0], "distance": 3.0,
+//                "center": [0, 0, 0]}
+//   }
+//
+// Paths are relative to the scene file. Models are loaded once, however many
+// instances they have. An instance is placed either by a column-major
+// "matrix" or by a translation, a rotation in degrees around X, then Y, then
+// Z, and a uniform or per axis scale.
+//
+// Models are Wavefront OBJ files, binary PLY files, or glTF 2.0 files (.gltf
+// or .glb) whose meshes are placed in each instance by the nodes of the
+// model. The material of an instance overrides the glTF ones, and glTF
+// models without texture bind their own base color image.
+//
+// Models with an "animation" are skinned with a chain of joints along their
+// longest axis, that bends them back and forth by up to "angle" degrees every
+// "period" seconds, see skin_t::bend().
+struct scene_texture_t {
+  std::string name;
+  std::string path;
+};
+
+struct scene_material_t {
+  std::string name;
+  material_t material;
+};
+
+struct scene_animation_t {
+  bool enabled = false;
+  float joints = 8.0f;
+  float angle = 30.0f;  // Degrees.
+  float period = 2.0f;  // Seconds.
+};
+
+struct scene_model_t {
+  std::string name;
+  std::string path;
+  int texture = -1;  // Index in the textures, -1 if untextured.
+  scene_animation_t animation;
+};
+
+struct scene_instance_t {
+  int model;
+  int material = -1;  // Index in the materials, -1 for the default one.
+  glm::mat4 transform = glm::mat4(1.0f);
+};
+
+struct scene_light_t {
+  int type = 1;  // Point = 0, directional = 1.
+  glm::vec3 position = glm::vec3(7.0f, 5.0f, -8.0f);
+  float intensity = 1.0f;
+};
+
+struct scene_camera_t {
+  glm::vec3 rotation = glm::vec3(-20.0f, 45.0f, 0.0f);  // Degrees.
+  float distance = 3.0f;
+  glm::vec3 center = glm::vec3(0.0f);
+};
+
+struct scene_t {
+  std::vector<scene_texture_t> textures;
+  std::vector<scene_material_t> materials;
+  std::vector<scene_model_t> models;
+  std::vector<scene_instance_t> instances;
+  scene_light_t light;
+  scene_camera_t camera;
+
+  bool load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+      std::cerr << "Failed to open scene " << path << "." << std::endl;
+      return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+
+    json_value document;
+    std::string error;
+    if (!json_value::parse(text.str(), document, error)) {
+      std::cerr << "Failed to parse scene " << path << ": " << error << "."
+                << std::endl;
+      return false;
+    }
+
+    if (!read(document, directory(path))) {
+      std::cerr << "Invalid scene " << path << "." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+ private:
+  bool read(const json_value &document, const std::string &directory) {
+    if (!document.is_object()) {
+      std::cerr << "The scene is not a JSON object." << std::endl;
+      return false;
+    }
+
+    if (const json_value *textures_json = document.find("textures")) {
+      for (const json_value &t : textures_json->values()) {
+        scene_texture_t texture;
+        if (!read_string(t, "name", texture.name) ||
+            !read_string(t, "path", texture.path)) {
+          return false;
+        }
+        texture.path = resolve(directory, texture.path);
+        textures.push_back(texture);
+      }
+    }
+
+    if (const json_value *materials_json = document.find("materials")) {
+      for (const json_value &m : materials_json->values()) {
+        scene_material_t material;
+        if (!read_string(m, "name", material.name)) {
+          return false;
+        }
+        float illumination =
+            static_cast<float>(material.material.illumination);
+        if (!read_number(m, "illumination", illumination) ||
+            !read_vec3(m, "diffuse", material.material.diffuse) ||
+            !read_vec3(m, "specular", material.material.specular)) {
+          return false;
+        }
+        material.material.illumination = static_cast<int>(illumination);
+        materials.push_back(material);
+      }
+    }
+
+    const json_value *models_json = document.find("models");
+    if (!models_json || models_json->values().empty()) {
+      std::cerr << "The scene has no models." << std::endl;
+      return false;
+    }
+    for (const json_value &m : models_json->values()) {
+      scene_model_t model;
+      if (!read_string(m, "name", model.name) ||
+          !read_string(m, "path", model.path)) {
+        return false;
+      }
+      model.path = resolve(directory, model.path);
+      if (m.find("texture")) {
+        std::string texture;
+        if (!read_string(m, "texture", texture) ||
+            !find_by_name(textures, "texture", texture, model.texture)) {
+          return false;
+        }
+      }
+      if (const json_value *animation_json = m.find("animation")) {
+        model.animation.enabled = true;
+        if (!read_number(*animation_json, "joints", model.animation.joints) ||
+            !read_number(*animation_json, "angle", model.animation.angle) ||
+            !read_number(*animation_json, "period", model.animation.period)) {
+          return false;
+        }
+        if (model.animation.joints < 2.0f ||
+            model.animation.period <= 0.0f) {
+          std::cerr << "Animation of " << model.name
+                    << " needs 2 joints or more and a positive period."
+                    << std::endl;
+          return false;
+        }
+      }
+      models.push_back(model);
+    }
+
+    const json_value *instances_json = document.find("instances");
+    if (!instances_json || instances_json->values().empty()) {
+      std::cerr << "The scene has no instances." << std::endl;
+      return false;
+    }
+    for (const json_value &i : instances_json->values()) {
+      scene_instance_t instance;
+      std::string model;
+      if (!read_string(i, "model", model) ||
+          !find_by_name(models, "model", model, instance.model)) {
+        return false;
+      }
+      if (i.find("material")) {
+        std::string material;
+        if (!read_string(i, "material", material) ||
+            !find_by_name(materials, "material", material,
+                          instance.material)) {
+          return false;
+        }
+      }
+      if (!read_transform(i, instance.transform)) {
+        return false;
+      }
+      instances.push_back(instance);
+    }
+
+    if (const json_value *light_json = document.find("light")) {
+      if (light_json->find("type")) {
+        std::string type;
+        if (!read_string(*light_json, "type", type)) {
+          return false;
+        }
+        if ("point" == type) {
+          light.type = 0;
+        } else if ("directional" == type) {
+          light.type = 1;
+        } else {
+          std::cerr << "Unknown light type " << type << "." << std::endl;
+          return false;
+        }
+      }
+      if (!read_vec3(*light_json, "position", light.position) ||
+          !read_number(*light_json, "intensity", light.intensity)) {
+        return false;
+      }
+    }
+
+    if (const json_value *camera_json = document.find("camera")) {
+      if (!read_vec3(*camera_json, "rotation", camera.rotation) ||
+          !read_number(*camera_json, "distance", camera.distance) ||
+          !read_vec3(*camera_json, "center", camera.center)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Optional members keep their default value when missing.
+  static bool read_string(const json_value &object, const char *key,
+                          std::string &s) {
+    const json_value *value = object.find(key);
+    if (!value || !value->is_string()) {
+      std::cerr << "Expected a string " << key << "." << std::endl;
+      return false;
+    }
+    s = value->string();
+    return true;
+  }
+
+  static bool read_number(const json_value &object, const char *key,
+                          float &number) {
+    const json_value *value = object.find(key);
+    if (!value) {
+      return true;
+    }
+    if (!value->is_number()) {
+      std::cerr << "Expected a number " << key << "." << std::endl;
+      return false;
+    }
+    number = static_cast<float>(value->number());
+    return true;
+  }
+
+  static bool read_vec3(const json_value &object, const char *key,
+                        glm::vec3 &v) {
+    const json_value *value = object.find(key);
+    if (!value) {
+      return true;
+    }
+    if (!read_numbers(*value, 3, &v[0])) {
+      std::cerr << "Expected 3 numbers " << key << "." << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  static bool read_numbers(const json_value &value, size_t count,
+                           float *numbers) {
+    if (!value.is_array() || value.values().size() != count) {
+      return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (!value.values()[i].is_number()) {
+        return false;
+      }
+      numbers[i] = static_cast<float>(value.values()[i].number());
+    }
+    return true;
+  }
+
+  static bool read_transform(const json_value &instance,
+                             glm::mat4 &transform) {
+    if (const json_value *matrix = instance.find("matrix")) {
+      if (!read_numbers(*matrix, 16, &transform[0][0])) {
+        std::cerr << "Expected 16 numbers matrix." << std::endl;
+        return false;
+      }
+      return true;
+    }
+
+    glm::vec3 translation(0.0f);
+    glm::vec3 rotation(0.0f);
+    glm::vec3 scale(1.0f);
+    if (!read_vec3(instance, "translation", translation) ||
+        !read_vec3(instance, "rotation", rotation)) {
+      return false;
+    }
+    if (const json_value *s = instance.find("scale")) {
+      if (s->is_number()) {
+        scale = glm::vec3(static_cast<float>(s->number()));
+      } else if (!read_vec3(instance, "scale", scale)) {
+        return false;
+      }
+    }
+
+    transform = glm::translate(glm::mat4(1.0f), translation);
+    transform = glm::rotate(transform, glm::radians(rotation.z),
+                            glm::vec3(0.0f, 0.0f, 1.0f));
+    transform = glm::rotate(transform, glm::radians(rotation.y),
+                            glm::vec3(0.0f, 1.0f, 0.0f));
+    transform = glm::rotate(transform, glm::radians(rotation.x),
+                            glm::vec3(1.0f, 0.0f, 0.0f));
+    transform = glm::scale(transform, scale);
+    return true;
+  }
+
+  template <typename T>
+  static bool find_by_name(const std::vector<T> &items, const char *kind,
+                           const std::string &name, int &index) {
+    for (size_t i = 0; i < items.size(); ++i) {
+      if (items[i].name == name) {
+        index = static_cast<int>(i);
+        return true;
+      }
+    }
+    std::cerr << "Unknown " << kind << " " << name << "." << std::endl;
+    return false;
+  }
+
+  static std::string directory(const std::string &path) {
+    const size_t slash = path.find_last_of("/\\");
+    return std::string::npos == slash ? "" : path.substr(0, slash + 1);
+  }
+
+  static std::string resolve(const std::string &directory,
+                             const std::string &path) {
+    const bool absolute =
+        !path.empty() &&
+        ('/' == path[0] || '\\' == path[0] ||
+         (path.size() > 1 && ':' == path[1]));
+    return absolute ? path : directory + path;
+  }
+};
+
+}  // namespace rtx
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glm.h"
+
+#include "vertex.h"
+
+namespace rtx {
+
+// Keyframes of one property of one joint, as a glTF animation channel with a
+// linear sampler. Values are translations and scales in xyz, or rotations as
+// quaternions in xyzw.
+struct animation_channel_t {
+  enum path { path_translation = 0, path_rotation = 1, path_scale = 2 };
+
+  uint32_t joint = 0;
+  path property = path_rotation;
+  std::vector<float> times;  // Seconds, ascending.
+  std::vector<glm::vec4> values;
+};
+
+struct animation_clip_t {
+  std::string name;
+  float duration = 0.0f;  // Seconds, the clip loops.
+  std::vector<animation_channel_t> channels;
+};
+
+// Local transform of a joint relative to its parent.
+struct joint_transform_t {
+  glm::vec3 translation = glm::vec3(0.0f);
+  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+  glm::vec3 scale = glm::vec3(1.0f);
+
+  glm::mat4 matrix() const {
+    return glm::translate(glm::mat4(1.0f), translation) *
+           glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+  }
+};
+
+// Skeleton of a skinned object and the joint influences of its vertices.
+//
+// Each vertex follows up to 4 joints. Its skinned position is the sum of its
+// rest position transformed by the pose matrix of each joint, scaled by the
+// joint weight. The pose matrix of a joint takes a rest position to the
+// joint space with its inverse bind matrix, then back to object space with
+// the posed transforms of the joint and its ancestors.
+struct skin_t {
+  // Per vertex, same order as the vertices of the object.
+  std::vector<glm::uvec4> joints;
+  std::vector<glm::vec4> weights;  // Sum 1.
+
+  // Per joint. Parents go before their children, roots have parent -1.
+  std::vector<int> parents;
+  std::vector<glm::mat4> inverse_bind_matrices;
+  std::vector<joint_transform_t> rest;  // Local transforms without clip.
+
+  std::vector<animation_clip_t> clips;
+
+  bool empty() const { return joints.empty() || parents.empty(); }
+
+  uint32_t joint_count() const {
+    return static_cast<uint32_t>(parents.size());
+  }
+
+  // Pose matrices of the joints for the clip at time, looped.
+  void pose(const animation_clip_t &clip, float time,
+            std::vector<glm::mat4> &matrices) const {
+    std::vector<joint_transform_t> local = rest;
+    if (clip.duration > 0.0f) {
+      time = std::fmod(time, clip.duration);
+      if (time < 0.0f) {
+        time += clip.duration;
+      }
+    }
+    for (const animation_channel_t &channel : clip.channels) {
+      if (channel.joint < local.size()) {
+        sample(channel, time, local[channel.joint]);
+      }
+    }
+
+    std::vector<glm::mat4> global(parents.size());
+    matrices.resize(parents.size());
+    for (size_t j = 0; j < parents.size(); ++j) {
+      global[j] = parents[j] < 0 ? local[j].matrix()
+                                 : global[parents[j]] * local[j].matrix();
+      matrices[j] = global[j] * inverse_bind_matrices[j];
+    }
+  }
+
+  // Procedural skin of a static mesh: a chain of joint_count joints along
+  // the longest axis of its bounds, that sways back and forth by up to
+  // angle degrees at the tip every period seconds. Each vertex follows the
+  // two joints around it.
+  static skin_t bend(const std::vector<Vertex> &vertices,
+                     const glm::vec3 &aabb_min, const glm::vec3 &aabb_max,
+                     uint32_t joint_count, float angle, float period) {
+    skin_t skin;
+    joint_count = std::max(joint_count, 2u);
+    period = std::max(period, 0.01f);
+
+    const glm::vec3 extent = aabb_max - aabb_min;
+    int axis = 0;
+    if (extent.y > extent[axis]) {
+      axis = 1;
+    }
+    if (extent.z > extent[axis]) {
+      axis = 2;
+    }
+    glm::vec3 direction(0.0f);
+    direction[axis] = 1.0f;
+    glm::vec3 bend_axis(0.0f);
+    bend_axis[(axis + 1) % 3] = 1.0f;
+
+    // Joints from the minimum of the axis, at the center of the others.
+    glm::vec3 root = (aabb_min + aabb_max) * 0.5f;
+    root[axis] = aabb_min[axis];
+    const float segment =
+        std::max(extent[axis], 1e-6f) / static_cast<float>(joint_count - 1);
+
+    for (uint32_t j = 0; j < joint_count; ++j) {
+      skin.parents.push_back(static_cast<int>(j) - 1);
+      joint_transform_t transform;
+      transform.translation = 0 == j ? root : direction * segment;
+      skin.rest.push_back(transform);
+      skin.inverse_bind_matrices.push_back(glm::translate(
+          glm::mat4(1.0f), -(root + direction * (segment * j))));
+    }
+
+    for (const Vertex &vertex : vertices) {
+      const float t = glm::clamp((vertex.pos[axis] - root[axis]) / segment,
+                                 0.0f, static_cast<float>(joint_count - 1));
+      const uint32_t first =
+          std::min(static_cast<uint32_t>(t), joint_count - 2);
+      const float w = t - static_cast<float>(first);
+      skin.joints.push_back(glm::uvec4(first, first + 1, 0, 0));
+      skin.weights.push_back(glm::vec4(1.0f - w, w, 0.0f, 0.0f));
+    }
+
+    // Every joint but the root rotates by its share of the angle, sampled
+    // along a sine.
+    static constexpr uint32_t KEY_COUNT = 16;
+    animation_clip_t clip;
+    clip.name = "bend";
+    clip.duration = period;
+    const float share =
+        glm::radians(angle) / static_cast<float>(joint_count - 1);
+    for (uint32_t j = 1; j < joint_count; ++j) {
+      animation_channel_t channel;
+      channel.joint = j;
+      channel.property = animation_channel_t::path_rotation;
+      for (uint32_t k = 0; k <= KEY_COUNT; ++k) {
+        const float time = period * k / KEY_COUNT;
+        const float a =
+            share * std::sin(2.0f * 3.14159265f * k / KEY_COUNT);
+        const glm::quat q = glm::angleAxis(a, bend_axis);
+        channel.times.push_back(time);
+        channel.values.push_back(glm::vec4(q.x, q.y, q.z, q.w));
+      }
+      clip.channels.push_back(channel);
+    }
+    skin.clips.push_back(clip);
+
+    return skin;
+  }
+
+ private:
+  // Linear interpolation of the keys around time, spherical for rotations.
+  static void sample(const animation_channel_t &channel, float time,
+                     joint_transform_t &transform) {
+    if (channel.times.empty() || channel.values.size() < channel.times.size()) {
+      return;
+    }
+
+    size_t next = std::upper_bound(channel.times.begin(), channel.times.end(),
+                                   time) -
+                  channel.times.begin();
+    size_t previous = next > 0 ? next - 1 : 0;
+    next = std::min(next, channel.times.size() - 1);
+    const float span = channel.times[next] - channel.times[previous];
+    const float t =
+        span > 0.0f
+            ? glm::clamp((time - channel.times[previous]) / span, 0.0f, 1.0f)
+            : 0.0f;
+
+    const glm::vec4 &a = channel.values[previous];
+    const glm::vec4 &b = channel.values[next];
+    switch (channel.property) {
+      case animation_channel_t::path_translation:
+        transform.translation = glm::mix(glm::vec3(a), glm::vec3(b), t);
+        break;
+      case animation_channel_t::path_rotation:
+        transform.rotation = glm::normalize(
+            glm::slerp(glm::quat(a.w, a.x, a.y, a.z),
+                       glm::quat(b.w, b.x, b.y, b.z), t));
+        break;
+      case animation_channel_t::path_scale:
+        transform.scale = glm::mix(glm::vec3(a), glm::vec3(b), t);
+        break;
+    }
+  }
+};
+
+}  // namespace rtx
@@ -0,0 +1,459 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "constants.h"
+#include "glm.h"
+#include "memory.h"
+#include "object.h"
+
+// Skinning shader
+#include "skinning.comp.h"
+
+namespace rtx {
+
+// Compute skinning of the animated objects, see skin_t.
+//
+// The rest vertices and joint influences of the skinned objects are kept in
+// a buffer of their own. Every frame the joints are posed on the host into
+// the joint matrices of the frame in flight, and skinning.comp writes the
+// deformed positions and normals over the vertices of the objects in the
+// geometry buffer, which the rasterizer draws and the acceleration
+// structures are refit from.
+class skinning {
+ public:
+  skinning()
+      : descriptor_pool_(),
+        descriptor_layout_(),
+        descriptor_set_(),
+        pipeline_layout_(),
+        pipeline_(),
+        rest_vertices_(),
+        rest_vertices_mem_(),
+        joints_(),
+        joints_mem_(),
+        joints_data_(nullptr),
+        joint_count_(0),
+        objects_(),
+        matrices_() {}
+
+  // Skinned objects of objects, whose vertices are in geometry_buffer at
+  // their vertex offset. Nothing is created without skinned objects.
+  bool init(memory &mem, const std::vector<object_model_t> &objects,
+            VkBuffer geometry_buffer) {
+    std::vector<rest_vertex_t> rest_vertices;
+    for (uint32_t i = 0; i < objects.size(); ++i) {
+      const object_model_t &object = objects[i];
+      if (object.skin.empty()) {
+        continue;
+      }
+      if (object.skin.joints.size() != object.vertices.size() ||
+          object.skin.weights.size() != object.vertices.size()) {
+        std::cerr << "Skin of object " << i << " does not match its "
+                  << object.vertices.size() << " vertices." << std::endl;
+        return false;
+      }
+
+      skinned_object_t skinned{};
+      skinned.object = i;
+      skinned.constants.first_rest_vertex =
+          static_cast<uint32_t>(rest_vertices.size());
+      skinned.constants.vertex_count =
+          static_cast<uint32_t>(object.vertices.size());
+      skinned.constants.first_joint = joint_count_;
+      skinned.constants.first_float =
+          static_cast<uint32_t>(object.vertex_offset / sizeof(float));
+      objects_.push_back(skinned);
+      joint_count_ += object.skin.joint_count();
+
+      for (size_t v = 0; v < object.vertices.size(); ++v) {
+        rest_vertex_t rest{};
+        rest.position = glm::vec4(object.vertices[v].pos, 1.0f);
+        rest.normal = glm::vec4(object.vertices[v].normal, 0.0f);
+        rest.joints = object.skin.joints[v];
+        rest.weights = object.skin.weights[v];
+        rest_vertices.push_back(rest);
+      }
+    }
+    if (objects_.empty()) {
+      return true;
+    }
+
+    if (!init_buffers(mem, rest_vertices)) {
+      std::cerr << "Failed to create skinning buffers." << std::endl;
+      return false;
+    }
+
+    if (!init_descriptor_set(mem, geometry_buffer)) {
+      std::cerr << "Failed to create skinning descriptor set." << std::endl;
+      return false;
+    }
+
+    if (!init_pipeline(mem)) {
+      std::cerr << "Failed to create skinning pipeline." << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void fini(memory &mem) {
+    VkDevice device = mem.get_device();
+    const VkAllocationCallbacks *allocation_callbacks =
+        mem.get_allocation_callbacks();
+
+    vkDestroyPipeline(device, pipeline_, allocation_callbacks);
+    pipeline_ = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout(device, pipeline_layout_, allocation_callbacks);
+    pipeline_layout_ = VK_NULL_HANDLE;
+
+    vkDestroyDescriptorPool(device, descriptor_pool_, allocation_callbacks);
+    descriptor_pool_ = VK_NULL_HANDLE;
+    descriptor_set_ = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(device, descriptor_layout_,
+                                 allocation_callbacks);
+    descriptor_layout_ = VK_NULL_HANDLE;
+
+    if (joints_data_) {
+      vkUnmapMemory(device, joints_mem_);
+      joints_data_ = nullptr;
+    }
+    destroy_buffer(mem, rest_vertices_, rest_vertices_mem_);
+    destroy_buffer(mem, joints_, joints_mem_);
+
+    joint_count_ = 0;
+    objects_.clear();
+  }
+
+  // Whether there are skinned objects.
+  bool enabled() const { return !objects_.empty(); }
+
+  // Pose the first clip of the skinned objects at time and skin their
+  // vertices. The joints of the frame in flight are written by the host, its
+  // fence must have been waited for.
+  //
+  // Drawing and tracing of the previous frame may still read the vertices,
+  // so the skinning waits for all the previous commands. Its writes are made
+  // visible to vertex input and shaders, and to acceleration structure
+  // builds and ray tracing shaders when ray_tracing.
+  void skin(VkCommandBuffer cmd_buf, uint32_t frame,
+            const std::vector<object_model_t> &objects, float time,
+            bool ray_tracing) {
+    if (objects_.empty()) {
+      return;
+    }
+
+    glm::mat4 *joints = joints_data_ + frame * joint_count_;
+    for (const skinned_object_t &skinned : objects_) {
+      const skin_t &skin = objects[skinned.object].skin;
+      if (skin.clips.empty()) {
+        for (uint32_t j = 0; j < skin.joint_count(); ++j) {
+          joints[skinned.constants.first_joint + j] = glm::mat4(1.0f);
+        }
+        continue;
+      }
+      skin.pose(skin.clips[0], time, matrices_);
+      std::copy(matrices_.begin(), matrices_.end(),
+                joints + skinned.constants.first_joint);
+    }
+
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = 0;
+    memory_barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memory_barrier, 0, nullptr, 0, nullptr);
+
+    static constexpr uint32_t first_set = 0;
+    static constexpr uint32_t set_count = 1;
+    static constexpr uint32_t dynamic_offset_count = 0;
+    static constexpr uint32_t *dynamic_offsets = nullptr;
+    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            pipeline_layout_, first_set, set_count,
+                            &descriptor_set_, dynamic_offset_count,
+                            dynamic_offsets);
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+
+    for (const skinned_object_t &skinned : objects_) {
+      constants_t constants = skinned.constants;
+      constants.first_joint += frame * joint_count_;
+      static constexpr uint32_t offset = 0;
+      vkCmdPushConstants(cmd_buf, pipeline_layout_,
+                         VK_SHADER_STAGE_COMPUTE_BIT, offset,
+                         sizeof(constants), &constants);
+      vkCmdDispatch(cmd_buf, group_count(constants.vertex_count), 1, 1);
+    }
+
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    VkPipelineStageFlags dst_stage_mask =
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (ray_tracing) {
+      memory_barrier.dstAccessMask |=
+          VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+      dst_stage_mask |= VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR |
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+    }
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         dst_stage_mask, 0, 1, &memory_barrier, 0, nullptr, 0,
+                         nullptr);
+  }
+
+  size_t object_count() const { return objects_.size(); }
+
+  uint32_t joint_count() const { return joint_count_; }
+
+ private:
+  static constexpr uint32_t GROUP_SIZE = 64;  // Same as skinning.comp.
+
+  // RestVertex in skinning.comp.
+  struct rest_vertex_t {
+    glm::vec4 position;
+    glm::vec4 normal;
+    glm::uvec4 joints;
+    glm::vec4 weights;
+  };
+
+  // Push constants of skinning.comp.
+  struct constants_t {
+    uint32_t first_rest_vertex;
+    uint32_t vertex_count;
+    uint32_t first_joint;  // In the joints of all the frames in flight.
+    uint32_t first_float;  // Of the vertices in the geometry buffer.
+  };
+
+  struct skinned_object_t {
+    uint32_t object;  // Index in the objects of the engine.
+    constants_t constants;
+  };
+
+  static uint32_t group_count(uint32_t size) {
+    return (size + GROUP_SIZE - 1) / GROUP_SIZE;
+  }
+
+  bool init_buffers(memory &mem,
+                    const std::vector<rest_vertex_t> &rest_vertices) {
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (!mem.create_buffer_and_copy(
+            sizeof(rest_vertex_t) * rest_vertices.size(), usage, properties,
+            rest_vertices_, rest_vertices_mem_, rest_vertices.data())) {
+      std::cerr << "Failed to create skinning rest vertices." << std::endl;
+      return false;
+    }
+
+    // Joint matrices of each frame in flight, one after another.
+    const VkDeviceSize joints_size =
+        constants::MAX_FRAMES_IN_FLIGHT * joint_count_ * sizeof(glm::mat4);
+    if (!mem.create_buffer(joints_size, usage, properties, joints_,
+                           joints_mem_)) {
+      std::cerr << "Failed to create skinning joints." << std::endl;
+      return false;
+    }
+
+    void *mapped_data = nullptr;
+    VkDeviceSize offset = 0;
+    VkMemoryMapFlags map_flags = 0;
+    VkResult res = vkMapMemory(mem.get_device(), joints_mem_, offset,
+                               joints_size, map_flags, &mapped_data);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to map skinning joints: " << res << std::endl;
+      return false;
+    }
+    joints_data_ = static_cast<glm::mat4 *>(mapped_data);
+
+    return true;
+  }
+
+  static void destroy_buffer(memory &mem, VkBuffer &buffer,
+                             VkDeviceMemory &buffer_memory) {
+    vkDestroyBuffer(mem.get_device(), buffer, mem.get_allocation_callbacks());
+    buffer = VK_NULL_HANDLE;
+    vkFreeMemory(mem.get_device(), buffer_memory,
+                 mem.get_allocation_callbacks());
+    buffer_memory = VK_NULL_HANDLE;
+  }
+
+  bool init_descriptor_set(memory &mem, VkBuffer geometry_buffer) {
+    VkDevice device = mem.get_device();
+
+    // Layout: rest vertices, joints and geometry.
+    //
+    static constexpr uint32_t binding_count = 3;
+    VkDescriptorSetLayoutBinding layout_bindings[binding_count] = {};
+    for (uint32_t b = 0; b < binding_count; ++b) {
+      layout_bindings[b].binding = b;
+      layout_bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      layout_bindings[b].descriptorCount = 1;
+      layout_bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptor_layout_create_info{};
+    descriptor_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptor_layout_create_info.bindingCount = binding_count;
+    descriptor_layout_create_info.pBindings = layout_bindings;
+
+    VkResult res = vkCreateDescriptorSetLayout(
+        device, &descriptor_layout_create_info,
+        mem.get_allocation_callbacks(), &descriptor_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create skinning descriptor set layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Pool.
+    //
+    const VkDescriptorPoolSize descriptor_pool_size = {
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, binding_count};
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info{};
+    descriptor_pool_create_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_create_info.maxSets = 1;
+    descriptor_pool_create_info.poolSizeCount = 1;
+    descriptor_pool_create_info.pPoolSizes = &descriptor_pool_size;
+
+    res = vkCreateDescriptorPool(device, &descriptor_pool_create_info,
+                                 mem.get_allocation_callbacks(),
+                                 &descriptor_pool_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create skinning descriptor pool: " << res
+                << std::endl;
+      return false;
+    }
+
+    // Set.
+    //
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{};
+    descriptor_set_allocate_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptor_set_allocate_info.descriptorPool = descriptor_pool_;
+    descriptor_set_allocate_info.descriptorSetCount = 1;
+    descriptor_set_allocate_info.pSetLayouts = &descriptor_layout_;
+
+    res = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info,
+                                   &descriptor_set_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to allocate skinning descriptor set: " << res
+                << std::endl;
+      return false;
+    }
+
+    const VkDescriptorBufferInfo buffer_infos[binding_count] = {
+        {rest_vertices_, 0, VK_WHOLE_SIZE},
+        {joints_, 0, VK_WHOLE_SIZE},
+        {geometry_buffer, 0, VK_WHOLE_SIZE}};
+
+    VkWriteDescriptorSet writes[binding_count] = {};
+    for (uint32_t b = 0; b < binding_count; ++b) {
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = descriptor_set_;
+      writes[b].dstBinding = b;
+      writes[b].descriptorCount = 1;
+      writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[b].pBufferInfo = &buffer_infos[b];
+    }
+
+    vkUpdateDescriptorSets(device, binding_count, writes, 0, nullptr);
+
+    return true;
+  }
+
+  bool init_pipeline(memory &mem) {
+    VkPushConstantRange push_constant{};
+    push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_constant.offset = 0;
+    push_constant.size = sizeof(constants_t);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
+    pipeline_layout_create_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 1;
+    pipeline_layout_create_info.pSetLayouts = &descriptor_layout_;
+    pipeline_layout_create_info.pushConstantRangeCount = 1;
+    pipeline_layout_create_info.pPushConstantRanges = &push_constant;
+
+    VkResult res = vkCreatePipelineLayout(
+        mem.get_device(), &pipeline_layout_create_info,
+        mem.get_allocation_callbacks(), &pipeline_layout_);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create skinning pipeline layout: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkShaderModuleCreateInfo shader_module_create_info{};
+    shader_module_create_info.sType =
+        VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_module_create_info.codeSize = sizeof(skinning_comp);
+    shader_module_create_info.pCode = skinning_comp;
+
+    VkPipelineShaderStageCreateInfo shader_stage{};
+    shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shader_stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shader_stage.pName = "main";
+
+    res = vkCreateShaderModule(mem.get_device(), &shader_module_create_info,
+                               mem.get_allocation_callbacks(),
+                               &shader_stage.module);
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create skinning shader module: " << res
+                << std::endl;
+      return false;
+    }
+
+    VkComputePipelineCreateInfo pipeline_create_info{};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_create_info.stage = shader_stage;
+    pipeline_create_info.layout = pipeline_layout_;
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    static constexpr uint32_t create_info_count = 1;
+
+    res = vkCreateComputePipelines(mem.get_device(), pipeline_cache,
+                                   create_info_count, &pipeline_create_info,
+                                   mem.get_allocation_callbacks(), &pipeline_);
+
+    // The pipeline keeps its own copy of the shader.
+    vkDestroyShaderModule(mem.get_device(), shader_stage.module,
+                          mem.get_allocation_callbacks());
+
+    if (VK_SUCCESS != res) {
+      std::cerr << "Failed to create skinning pipeline: " << res << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  VkDescriptorPool descriptor_pool_;
+  VkDescriptorSetLayout descriptor_layout_;
+  VkDescriptorSet descriptor_set_;
+  VkPipelineLayout pipeline_layout_;
+  VkPipeline pipeline_;
+
+  VkBuffer rest_vertices_;
+  VkDeviceMemory rest_vertices_mem_;
+  VkBuffer joints_;  // Joint matrices of each frame in flight.
+  VkDeviceMemory joints_mem_;
+  glm::mat4 *joints_data_;
+  uint32_t joint_count_;  // Of all the skinned objects, per frame.
+
+  std::vector<skinned_object_t> objects_;
+  std::vector<glm::mat4> matrices_;  // Pose of an object, reused.
+};
+
+}  // namespace rtx
@@ -8,6 +8,7 @@ typedef struct {
   glm::mat4 mvp;
   glm::mat4 inverse_view;
   glm::mat4 inverse_projection;
+  glm::mat4 previous_mvp;  // Of the previous frame, for motion vectors.
 } uniform_data_data_t;
 
 typedef struct {
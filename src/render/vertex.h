@@ -21,7 +21,7 @@ struct Vertex {
   static const std::vector<VkVertexInputAttributeDescription>
   get_attribute_descriptions() {
     std::vector<VkVertexInputAttributeDescription> attribute_descriptions;
-    attribute_descriptions.resize(2);
+    attribute_descriptions.resize(3);
 
     // Allowed formats are:
     // (from:
@@ -39,8 +39,6 @@ struct Vertex {
     attribute_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;  // aka vec3
     attribute_descriptions[0].offset = offsetof(Vertex, pos);
 
-    // TODO: normal?
-
     // Location 1: Texture coordinates.
     attribute_descriptions[1].binding = 0;
     attribute_descriptions[1].location = 1;
@@ -48,6 +46,12 @@ struct Vertex {
         VK_FORMAT_R32G32_SFLOAT;  // texture coordinates are 2D.
     attribute_descriptions[1].offset = offsetof(Vertex, tex_coord);
 
+    // Location 7: Normal. Locations 2 to 6 are the per instance attributes.
+    attribute_descriptions[2].binding = 0;
+    attribute_descriptions[2].location = 7;
+    attribute_descriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attribute_descriptions[2].offset = offsetof(Vertex, normal);
+
     return attribute_descriptions;
   }
 
@@ -57,6 +61,50 @@ struct Vertex {
   }
 };
 
+// Per instance vertex attributes of the rasterizer, read from a second vertex
+// buffer so that all the instances of an object are drawn with one call.
+struct RasterInstance {
+  glm::mat4 transform;
+  float textured;  // 1 samples the texture, 0 is white.
+
+  static VkVertexInputBindingDescription get_binding_description() {
+    VkVertexInputBindingDescription binding_description{};
+    binding_description.binding = 1;
+    binding_description.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    binding_description.stride = sizeof(RasterInstance);
+
+    return binding_description;
+  }
+
+  static const std::vector<VkVertexInputAttributeDescription>
+  get_attribute_descriptions() {
+    std::vector<VkVertexInputAttributeDescription> attribute_descriptions;
+
+    // Locations 2 to 5: Columns of the transform. A mat4 takes a location per
+    // column.
+    //
+    for (uint32_t column = 0; column < 4; ++column) {
+      VkVertexInputAttributeDescription attribute_description{};
+      attribute_description.binding = 1;
+      attribute_description.location = 2 + column;
+      attribute_description.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+      attribute_description.offset = static_cast<uint32_t>(
+          offsetof(RasterInstance, transform) + sizeof(glm::vec4) * column);
+      attribute_descriptions.push_back(attribute_description);
+    }
+
+    // Location 6: Whether the texture is sampled.
+    VkVertexInputAttributeDescription attribute_description{};
+    attribute_description.binding = 1;
+    attribute_description.location = 6;
+    attribute_description.format = VK_FORMAT_R32_SFLOAT;
+    attribute_description.offset = offsetof(RasterInstance, textured);
+    attribute_descriptions.push_back(attribute_description);
+
+    return attribute_descriptions;
+  }
+};
+
 }  // namespace rtx
 
 namespace std {
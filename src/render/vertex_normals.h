@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "glm.h"
+
+#include "vertex.h"
+
+namespace rtx {
+
+// Smooth normals of indexed triangles: the normal of a vertex is the area
+// weighted sum of the normals of its triangles.
+//
+// Scanned meshes have millions of vertices, so the sums are scattered by a
+// pool of threads. Each thread owns a range of vertices and only adds into
+// them, so that no two threads write the same normal and no thread needs a
+// copy of the normals to reduce afterwards.
+class vertex_normals {
+ public:
+  static void compute(std::vector<Vertex> &vertices,
+                      const std::vector<uint32_t> &indices) {
+    const size_t vertex_count = vertices.size();
+    if (0 == vertex_count) {
+      return;
+    }
+
+    const size_t worker_count = std::min<size_t>(
+        std::max(1u, std::thread::hardware_concurrency()),
+        (vertex_count + MIN_WORKER_VERTICES - 1) / MIN_WORKER_VERTICES);
+    const size_t range = (vertex_count + worker_count - 1) / worker_count;
+
+    auto accumulate = [&](size_t first, size_t last) {
+      const size_t owned = last - first;
+      for (size_t v = first; v < last; ++v) {
+        vertices[v].normal = glm::vec3(0.0f);
+      }
+
+      for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const uint32_t a = indices[i];
+        const uint32_t b = indices[i + 1];
+        const uint32_t c = indices[i + 2];
+        const bool owns_a = a - first < owned;
+        const bool owns_b = b - first < owned;
+        const bool owns_c = c - first < owned;
+        if (!owns_a && !owns_b && !owns_c) {
+          continue;
+        }
+
+        const glm::vec3 n = glm::cross(vertices[b].pos - vertices[a].pos,
+                                       vertices[c].pos - vertices[a].pos);
+        if (owns_a) {
+          vertices[a].normal += n;
+        }
+        if (owns_b) {
+          vertices[b].normal += n;
+        }
+        if (owns_c) {
+          vertices[c].normal += n;
+        }
+      }
+
+      for (size_t v = first; v < last; ++v) {
+        const float length = glm::length(vertices[v].normal);
+        vertices[v].normal = length > 0.0f ? vertices[v].normal / length
+                                           : glm::vec3(0.0f, 1.0f, 0.0f);
+      }
+    };
+
+    std::vector<std::future<void>> workers;
+    for (size_t w = 1; w < worker_count && w * range < vertex_count; ++w) {
+      workers.push_back(std::async(std::launch::async, accumulate, w * range,
+                                   std::min((w + 1) * range, vertex_count)));
+    }
+    accumulate(0, std::min(range, vertex_count));
+    for (std::future<void> &worker : workers) {
+      worker.get();
+    }
+  }
+
+ private:
+  // Smaller meshes are not worth a thread.
+  static constexpr size_t MIN_WORKER_VERTICES = 1 << 16;
+};
+
+}  // namespace rtx
@@ -0,0 +1,105 @@
+// Per pixel convergence of the accumulated image, adaptive sampling and
+// russian roulette, shared by all the ray tracers.
+//
+// The statistics image keeps for each pixel the luminance of all its
+// accumulated samples:
+//   x: mean.
+//   y: sum of squared differences to the mean (Welford).
+//   z: number of samples.
+//
+// A pixel stops being traced once the standard error of its mean is below the
+// convergence threshold, relative to the mean.
+//
+// The including shader declares the RT constants, the result and statistics
+// images, and includes ray_common.glsl and random.glsl.
+
+// Samples before trusting the variance of a pixel.
+const float MIN_PIXEL_SAMPLES = 16.0;
+
+// Samples after which a pixel stops accumulating, even if not converged.
+const float MAX_PIXEL_SAMPLES = 65536.0;
+
+// Bounces before russian roulette may end a path.
+const int RUSSIAN_ROULETTE_MIN_DEPTH = 2;
+
+float luminance(vec3 color)
+{
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec4 load_statistics(ivec2 pixel)
+{
+  // Accumulation restarts on frame 0.
+  return constants.frame > 0 ? imageLoad(statistics, pixel) : vec4(0);
+}
+
+bool is_converged(vec4 pixel_statistics)
+{
+  const float n = pixel_statistics.z;
+
+  if (n >= MAX_PIXEL_SAMPLES) {
+    return true;
+  }
+
+  if (constants.convergence_threshold <= 0.0 || n < MIN_PIXEL_SAMPLES) {
+    return false;
+  }
+
+  const float variance = pixel_statistics.y / (n - 1.0);
+  const float error = sqrt(variance / n);
+
+  return error <= constants.convergence_threshold * max(pixel_statistics.x, 0.01);
+}
+
+// Merge a batch of samples, given the sum and the sum of squares of their
+// luminance, into the statistics of a pixel (Chan et al.).
+vec4 merge_statistics(vec4 pixel_statistics, float sum, float sum_squares,
+                      float count)
+{
+  if (count <= 0.0) {
+    return pixel_statistics;
+  }
+
+  const float n = pixel_statistics.z + count;
+  const float batch_mean = sum / count;
+  const float batch_m2 = max(sum_squares - sum * batch_mean, 0.0);
+  const float delta = batch_mean - pixel_statistics.x;
+
+  return vec4(pixel_statistics.x + delta * count / n,
+              pixel_statistics.y + batch_m2 +
+                  delta * delta * pixel_statistics.z * count / n,
+              n, 0.0);
+}
+
+// Blend the mean color of a batch of samples into the accumulated color of
+// the pixel, weighted by its number of samples.
+void accumulate(ivec2 pixel, vec3 batch_color, vec3 old_color,
+                vec4 old_statistics, vec4 new_statistics)
+{
+  const float a = (new_statistics.z - old_statistics.z) / new_statistics.z;
+
+  imageStore(image, pixel, vec4(mix(old_color, batch_color, a), 1.0));
+  imageStore(statistics, pixel, new_statistics);
+}
+
+// Russian roulette on the throughput of a path. Returns whether the path
+// ends, otherwise its throughput is scaled to keep the estimate unbiased.
+bool russian_roulette(inout hitPayload payload, inout uint seed)
+{
+  if (!constants.russian_roulette ||
+      payload.depth < RUSSIAN_ROULETTE_MIN_DEPTH) {
+    return false;
+  }
+
+  const float survival = clamp(
+      max(payload.attenuation.r, max(payload.attenuation.g, payload.attenuation.b)),
+      0.05, 1.0);
+
+  if (random_float(seed) >= survival) {
+    return true;
+  }
+
+  payload.attenuation /= survival;
+
+  return false;
+}
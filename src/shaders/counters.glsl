@@ -0,0 +1,32 @@
+// Per pixel ray counters of the heat maps, see ray_counters.h.
+//
+// The ray tracers count into the counters buffer while the pixel temperature
+// is on, see counting.glsl. The counters are then reduced into totals,
+// maximums and histograms that normalize the heat map.
+
+const uint COUNTER_CLOCK = 0;        // Shader clock cycles of the pixel.
+const uint COUNTER_RAYS = 1;         // Camera, bounce and shadow rays.
+const uint COUNTER_DEPTH = 2;        // Deepest path segment reached.
+const uint COUNTER_SHADOW_RAYS = 3;
+const uint COUNTER_HITS = 4;         // Closest hits shaded.
+const uint COUNTER_COUNT = 5;
+
+// Bin 0 counts zeros, bin b > 0 the values in [2^(b - 1), 2^b).
+const uint HISTOGRAM_BINS = 32;
+
+// Counters of each pixel of the ray traced image, one after the other.
+layout(binding = 12, set = 0) buffer Counters {
+  uint c[];
+} counters;
+
+uint histogram_bin(uint value)
+{
+  return value == 0 ? 0u : min(uint(findMSB(value)) + 1, HISTOGRAM_BINS - 1);
+}
+
+// Reduction of the counters of all pixels, see ray_counters.h.
+struct CounterReduction {
+  uint total[COUNTER_COUNT * 2];  // Low and high words.
+  uint maximum[COUNTER_COUNT];
+  uint histogram[COUNTER_COUNT * HISTOGRAM_BINS];
+};
@@ -0,0 +1,23 @@
+// Counting of the per pixel ray counters, while the pixel temperature is on.
+//
+// The including shader declares the RT constants and sets counter_pixel
+// before tracing.
+
+#include "counters.glsl"
+
+// Pixel of the invocation, index in the ray traced image.
+uint counter_pixel = 0;
+
+void count(uint counter, uint value)
+{
+  if (constants.temperature) {
+    atomicAdd(counters.c[counter_pixel * COUNTER_COUNT + counter], value);
+  }
+}
+
+void count_max(uint counter, uint value)
+{
+  if (constants.temperature) {
+    atomicMax(counters.c[counter_pixel * COUNTER_COUNT + counter], value);
+  }
+}
@@ -0,0 +1,54 @@
+// Spatio-temporal denoiser of the ray traced image, after SVGF: Schied et al.,
+// "Spatiotemporal Variance-Guided Filtering: Real-Time Reconstruction for
+// Path-Traced Global Illumination".
+//
+// The lighting, the color divided by the albedo of the G-buffer, is
+// accumulated over time along the motion vectors and then filtered with an
+// edge-avoiding a-trous wavelet guided by normals, depth and its variance.
+
+const int DENOISER_TILE_SIZE = 8;
+
+// Ray traced image.
+layout(binding = 1, set = 0, rgba32f) uniform image2D image;
+
+// G-buffer of the camera rays.
+layout(binding = 5, set = 0, rgba32f) uniform image2D gbuffer_normal_depth;
+layout(binding = 6, set = 0, rgba16f) uniform image2D gbuffer_albedo;
+layout(binding = 7, set = 0, rgba32f) uniform image2D gbuffer_motion;
+
+// History of the lighting, its length in frames in alpha.
+layout(binding = 0, set = 1, rgba16f) uniform image2D previous_history;
+layout(binding = 1, set = 1, rgba16f) uniform image2D history;
+
+// History of the first and second moments of the lighting luminance.
+layout(binding = 2, set = 1, rgba16f) uniform image2D previous_moments;
+layout(binding = 3, set = 1, rgba16f) uniform image2D moments;
+
+// G-buffer normal and depth of the history.
+layout(binding = 4, set = 1, rgba32f) uniform image2D previous_normal_depth;
+layout(binding = 5, set = 1, rgba32f) uniform image2D normal_depth;
+
+// Lighting being filtered, its variance in alpha.
+layout(binding = 6, set = 1, rgba16f) uniform image2D filter_input;
+layout(binding = 7, set = 1, rgba16f) uniform image2D filter_output;
+
+// Denoised image.
+layout(binding = 8, set = 1, rgba32f) uniform image2D denoised_image;
+
+layout(push_constant) uniform Constants {
+  int step;      // Distance between the taps of the a-trous filter.
+  int feedback;  // Filtered lighting becomes the history.
+  int last;      // Write the denoised image.
+  int reset;     // Discard the history.
+} constants;
+
+float luminance(vec3 color)
+{
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Lighting arriving at a surface of the given albedo.
+vec3 demodulate(vec3 color, vec3 albedo)
+{
+  return color / max(albedo, vec3(0.001));
+}
@@ -5,10 +5,12 @@
 // In
 layout(binding = 1) uniform sampler2D texSampler;
 layout (location = 0) in vec2 inTexCoord;
+layout (location = 1) in float inTextured;
 
 // Out
 layout (location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, inTexCoord);
+    // Untextured instances are white.
+    outColor = mix(vec4(1.0), texture(texSampler, inTexCoord), inTextured);
 }
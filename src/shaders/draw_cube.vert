@@ -10,11 +10,23 @@ layout (std140, binding = 0) uniform bufferVals {
 } myBufferVals;
 layout (location = 0) in vec4 pos;
 layout (location = 1) in vec2 inTexCoord;
+layout (location = 7) in vec3 inNormal;
+// Per instance.
+layout (location = 2) in mat4 transform;
+layout (location = 6) in float textured;
 
 // Out
 layout (location = 0) out vec2 outTexCoord;
+layout (location = 1) out float outTextured;
+// World space, for the shadow rays of draw_cube_shadow.frag.
+layout (location = 2) out vec3 outPosition;
+layout (location = 3) out vec3 outNormal;
 
 void main() {
-   gl_Position = myBufferVals.mvp * pos;
+   const vec4 world_pos = transform * pos;
+   gl_Position = myBufferVals.mvp * world_pos;
    outTexCoord = inTexCoord;
+   outTextured = textured;
+   outPosition = world_pos.xyz;
+   outNormal = transpose(inverse(mat3(transform))) * inNormal;
 }
@@ -0,0 +1,70 @@
+#version 460
+#extension GL_EXT_ray_query : require
+#extension GL_GOOGLE_include_directive : enable
+
+// Raster shading of draw_cube.frag with ray traced hard shadows: one shadow
+// ray per fragment towards the light, traced with a ray query against the
+// TLAS of the ray tracers.
+
+#include "ray_common.glsl"
+
+// In
+layout(binding = 1) uniform sampler2D texSampler;
+layout (location = 0) in vec2 inTexCoord;
+layout (location = 1) in float inTextured;
+layout (location = 2) in vec3 inPosition;  // World space.
+layout (location = 3) in vec3 inNormal;
+
+// Top-Level Acceleration Structure, of the ray tracing descriptor set.
+layout(binding = 0, set = 1) uniform accelerationStructureEXT tlas;
+
+// Out
+layout (location = 0) out vec4 outColor;
+
+// As the shadow rays of shading.glsl.
+const float SHADOW_ATTENUATION = 0.3;
+
+// The level of detail drawn may not be the one in the TLAS, the ray starts
+// off the surface so that it does not hit the one it leaves.
+const float NORMAL_OFFSET = 0.01;
+
+// Whether an occluder was found towards the light.
+bool trace_shadow_ray(vec3 origin, vec3 direction, float t_max)
+{
+  // Any hit is an occluder.
+  const uint ray_flags = gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT;
+
+  rayQueryEXT shadow_query;
+  rayQueryInitializeEXT(shadow_query, tlas, ray_flags, MASK_SECONDARY, origin,
+                        0.001, direction, t_max);
+
+  while (rayQueryProceedEXT(shadow_query)) {
+  }
+
+  return rayQueryGetIntersectionTypeEXT(shadow_query, true) !=
+         gl_RayQueryCommittedIntersectionNoneEXT;
+}
+
+void main() {
+    // Untextured instances are white.
+    const vec4 color = mix(vec4(1.0), texture(texSampler, inTexCoord), inTextured);
+
+    // Vector toward the light.
+    vec3 light;
+    float light_distance = 10000.0;
+    if (constants.light_type == 0) { // point.
+      const vec3 light_direction = constants.light_position - inPosition;
+      light_distance = length(light_direction);
+      light = light_direction / light_distance;
+    } else { // directional.
+      light = normalize(constants.light_position);
+    }
+
+    const vec3 normal = normalize(inNormal);
+    const bool lit =
+        dot(normal, light) > 0.0 &&
+        !trace_shadow_ray(inPosition + normal * NORMAL_OFFSET, light,
+                          light_distance);
+
+    outColor = vec4(color.rgb * (lit ? 1.0 : SHADOW_ATTENUATION), color.a);
+}
@@ -0,0 +1,46 @@
+// G-buffer of the camera rays, read by the denoiser and the upscaler.
+//
+// The including shader declares the camera uniform buffer, with the view
+// projection of the previous frame, the push constants and the G-buffer
+// images:
+//   gbuffer_normal_depth: world normal and hit distance, negative on a miss.
+//   gbuffer_albedo: surface color, the lighting is filtered without it.
+//   gbuffer_motion: offset in pixels to the hit on the previous frame, and
+//     the subpixel position of the camera ray.
+//   gbuffer_sample: color of the samples of this frame, and the frame.
+
+void write_gbuffer(ivec2 pixel, hitPayload payload, vec3 origin,
+                   vec3 direction)
+{
+  // Where the ray crosses the pixel, its jitter.
+  const vec2 size = vec2(imageSize(gbuffer_motion));
+  const vec4 ray_clip = cam.mvp * vec4(origin + direction, 1);
+  const vec2 jitter =
+      (ray_clip.xy / ray_clip.w * 0.5 + 0.5) * size - vec2(pixel);
+
+  if (payload.hit_t < 0.0) {
+    imageStore(gbuffer_normal_depth, pixel, vec4(0, 0, 0, -1));
+    imageStore(gbuffer_albedo, pixel, vec4(1));
+    imageStore(gbuffer_motion, pixel, vec4(0, 0, jitter));
+    return;
+  }
+
+  const vec3 position = origin + direction * payload.hit_t;
+
+  // The scene is static, the hit only moves with the camera.
+  const vec4 clip = cam.mvp * vec4(position, 1);
+  const vec4 previous_clip = cam.previous_mvp * vec4(position, 1);
+  const vec2 current = (clip.xy / clip.w * 0.5 + 0.5) * size;
+  const vec2 previous = (previous_clip.xy / previous_clip.w * 0.5 + 0.5) * size;
+
+  imageStore(gbuffer_normal_depth, pixel, vec4(payload.normal, payload.hit_t));
+  imageStore(gbuffer_albedo, pixel, vec4(payload.albedo, 1));
+  imageStore(gbuffer_motion, pixel, vec4(previous - current, jitter));
+}
+
+// Average of the samples of the pixel on this frame. Pixels that got no
+// samples keep the frame of their last ones.
+void write_gbuffer_sample(ivec2 pixel, vec3 color)
+{
+  imageStore(gbuffer_sample, pixel, vec4(color, float(constants.frame)));
+}
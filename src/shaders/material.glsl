@@ -27,9 +27,7 @@ vec3 compute_diffuse(Material material, vec3 light_direction, vec3 normal) {
 vec3 compute_diffuse_lol(Material material, vec3 light_direction, vec3 normal) {
   float dot_normal_light = max(dot(normal, light_direction), 0.0);
 
-  vec3 diffuse = vec3(0.8);
-
-  vec3 c = diffuse * dot_normal_light;
+  vec3 c = material.diffuse * dot_normal_light;
 
   vec3 ambient = vec3(1);
 
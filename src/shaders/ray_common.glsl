@@ -1,3 +1,23 @@
+// Instance masks. Camera rays only hit full resolution geometry, while shadow
+// and bounce rays may hit a simplified level of detail.
+const uint MASK_PRIMARY = 0x01;
+const uint MASK_SECONDARY = 0x02;
+
+// RT constants, as ray_tracing_constants_t. Every pipeline that includes
+// this file pushes all of them.
+layout(push_constant) uniform Constants {
+  vec4 clear_color;
+  vec3 light_position;
+  float light_intensity;
+  int light_type;
+  int frame;
+  int samples;
+  int max_iterations;
+  bool temperature;
+  float convergence_threshold;  // Relative error of converged pixels.
+  bool russian_roulette;
+} constants;
+
 struct hitPayload {
   vec3 hit_value;
   vec3 attenuation;
@@ -5,4 +25,8 @@ struct hitPayload {
   int depth;
   vec3 ray_origin;
   vec3 ray_direction;
+  // Surface of the closest hit, for the G-buffer. A miss has a negative hit_t.
+  vec3 normal;
+  float hit_t;
+  vec3 albedo;
 };
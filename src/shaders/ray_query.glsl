@@ -0,0 +1,64 @@
+// Inline ray tracing with ray queries, shared by the compute shader renderers.
+//
+// The including shader declares the resources that shading.glsl needs.
+
+// Shadow ray from a hit point towards the light. Returns whether an occluder
+// was found.
+bool trace_shadow_ray(vec3 origin, vec3 direction, float t_min, float t_max)
+{
+  // Any hit is an occluder.
+  const uint ray_flags = gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT;
+
+  rayQueryEXT shadow_query;
+  rayQueryInitializeEXT(shadow_query, tlas, ray_flags, MASK_SECONDARY, origin,
+                        t_min, direction, t_max);
+
+  while (rayQueryProceedEXT(shadow_query)) {
+  }
+
+  return rayQueryGetIntersectionTypeEXT(shadow_query, true) !=
+         gl_RayQueryCommittedIntersectionNoneEXT;
+}
+
+#include "shading.glsl"
+
+// Trace the ray of the payload and shade its closest hit, or the clear color
+// on a miss. Returns the TLAS index of the hit instance, -1 on a miss.
+int trace_ray_query(inout hitPayload payload, uint cull_mask)
+{
+  // Make all objects opaque.
+  const uint ray_flags = gl_RayFlagsOpaqueEXT;
+
+  // Rendering distance range.
+  float t_min     = 0.001;
+  float t_max     = 10000.0;
+
+  rayQueryEXT ray_query;
+  rayQueryInitializeEXT(ray_query, tlas, ray_flags, cull_mask,
+                        payload.ray_origin, t_min, payload.ray_direction,
+                        t_max);
+
+  // Opaque geometry only, the closest hit is committed by the traversal.
+  while (rayQueryProceedEXT(ray_query)) {
+  }
+
+  if (rayQueryGetIntersectionTypeEXT(ray_query, true) !=
+      gl_RayQueryCommittedIntersectionTriangleEXT) {
+    // Miss.
+    payload.hit_value = constants.clear_color.xyz;
+    payload.hit_t = -1.0;
+    return -1;
+  }
+
+  // Closest hit.
+  const int instance_id = rayQueryGetIntersectionInstanceIdEXT(ray_query, true);
+  shade_hit(payload,
+            uint(rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, true)),
+            uint(rayQueryGetIntersectionPrimitiveIndexEXT(ray_query, true)),
+            rayQueryGetIntersectionBarycentricsEXT(ray_query, true),
+            payload.ray_origin,
+            payload.ray_direction,
+            rayQueryGetIntersectionTEXT(ray_query, true));
+
+  return instance_id;
+}
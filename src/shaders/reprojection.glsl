@@ -0,0 +1,73 @@
+// Reprojection of the accumulated samples when the camera moves.
+//
+// Before tracing a frame with a moved camera, the accumulated image, its
+// statistics and the G-buffer normal and depth are copied to the history
+// images. A pixel then continues the accumulation of the pixel where its
+// camera hit was on the previous frame, if it is the same surface.
+//
+// The including shader declares the camera uniform buffer, the result,
+// statistics, G-buffer and history images, and includes convergence.glsl.
+
+// Reprojection is not exact, history is capped so that pixels keep
+// converging to the new view.
+const float MAX_REPROJECTED_SAMPLES = 64.0;
+
+bool camera_moved()
+{
+  return cam.mvp != cam.previous_mvp;
+}
+
+// Accumulated color and statistics that the new samples of the pixel are
+// merged into. Call after writing the G-buffer of the pixel.
+vec4 load_history(ivec2 pixel, out vec3 color)
+{
+  color = vec3(0);
+
+  if (!camera_moved()) {
+    const vec4 pixel_statistics = load_statistics(pixel);
+    if (pixel_statistics.z > 0.0) {
+      color = imageLoad(image, pixel).xyz;
+    }
+    return pixel_statistics;
+  }
+
+  if (constants.frame == 0) {
+    return vec4(0);
+  }
+
+  const vec4 normal_depth = imageLoad(gbuffer_normal_depth, pixel);
+  if (normal_depth.w < 0.0) {
+    return vec4(0);
+  }
+
+  // Nearest pixel, filtering would blur the accumulated image.
+  const ivec2 previous_pixel = ivec2(
+      floor(vec2(pixel) + 0.5 + imageLoad(gbuffer_motion, pixel).xy));
+  if (any(lessThan(previous_pixel, ivec2(0))) ||
+      any(greaterThanEqual(previous_pixel, imageSize(image)))) {
+    return vec4(0);
+  }
+
+  // Disocclusions start over.
+  const vec4 previous_normal_depth =
+      imageLoad(history_normal_depth, previous_pixel);
+  if (previous_normal_depth.w < 0.0 ||
+      abs(previous_normal_depth.w - normal_depth.w) > 0.05 * normal_depth.w ||
+      dot(previous_normal_depth.xyz, normal_depth.xyz) < 0.9) {
+    return vec4(0);
+  }
+
+  vec4 previous_statistics = imageLoad(history_statistics, previous_pixel);
+  if (previous_statistics.z <= 0.0) {
+    return vec4(0);
+  }
+
+  color = imageLoad(history_image, previous_pixel).xyz;
+
+  // Fewer samples with the same variance.
+  const float n = min(previous_statistics.z, MAX_REPROJECTED_SAMPLES);
+  previous_statistics.y *= n / previous_statistics.z;
+  previous_statistics.z = n;
+
+  return previous_statistics;
+}
@@ -0,0 +1,114 @@
+// Shading of a ray hit, shared by the closest hit shader of the ray tracing
+// pipeline and by the ray query compute shader.
+//
+// The including shader declares the RT constants, the instance table of
+// vertex.glsl, the texture sampler and the function
+//
+//   bool trace_shadow_ray(vec3 origin, vec3 direction, float t_min,
+//                         float t_max);
+//
+// that returns whether an occluder was found towards the light. It also
+// includes counting.glsl and sets the counter pixel.
+
+#include "material.glsl"
+
+void shade_hit(inout hitPayload payload,
+               uint custom_index,    // Entry of the instance table.
+               uint primitive_id,    // Triangle of the level of detail.
+               vec2 attribs,         // Barycentric coordinates of the hit.
+               vec3 ray_origin,
+               vec3 ray_direction,
+               float hit_t)
+{
+  count(COUNTER_HITS, 1);
+
+  const Instance instance = instances.i[custom_index];
+
+  // Levels of detail share the index buffer of the object.
+  const uint primitive = instance.first_primitive + primitive_id;
+
+  // Indices of the triangle.
+  ivec3 index = ivec3(instance.indices.i[3 * primitive], instance.indices.i[3 * primitive + 1], instance.indices.i[3 * primitive + 2]);
+
+  // Vertices of the triangle.
+  Vertex v0 = unpack(instance.vertices, index.x);
+  Vertex v1 = unpack(instance.vertices, index.y);
+  Vertex v2 = unpack(instance.vertices, index.z);
+
+  // Barycenter coordinates of the triangle.
+  const vec3 barycenter_coordinates = vec3(1.0f - attribs.x - attribs.y, attribs.x, attribs.y);
+
+  // Normal at the hit position, in world space.
+  vec3 object_normal = v0.normal * barycenter_coordinates.x + v1.normal * barycenter_coordinates.y + v2.normal * barycenter_coordinates.z;
+  vec3 normal = normalize(mat3(instance.normal_transform) * object_normal);
+
+  vec3 origin = ray_origin + ray_direction * hit_t;
+
+  // Vector torward the light.
+  vec3 light;
+  float light_intensity = constants.light_intensity;
+  float light_distance = 100000.0;
+
+  if (constants.light_type == 0) { // point.
+    vec3 light_direction = constants.light_position - origin;
+    light_distance = length(light_direction);
+    light_intensity = constants.light_intensity / (light_distance * light_distance);
+    light = normalize(light_direction);
+  } else { // directional.
+    light = normalize(constants.light_position - vec3(0));
+  }
+
+  Material material;
+  material.illumination = instance.illumination;  // 3 to enable reflection
+  material.diffuse = instance.diffuse.xyz;
+  material.specular = instance.specular.xyz;
+
+  // Diffuse
+  //
+  vec3 diffuse = compute_diffuse_lol(material, light, normal);
+  vec2 texture_coord = v0.texture_coord * barycenter_coordinates.x + v1.texture_coord * barycenter_coordinates.y + v2.texture_coord * barycenter_coordinates.z;
+  vec3 albedo = vec3(1);
+  if (0 != instance.textured) {
+    // No implicit derivatives outside fragment shaders, sample the base level.
+    albedo = textureLod(texture_sampler, texture_coord, 0.0).xyz;
+  }
+  diffuse *= albedo;
+
+  // Shadow Ray. Ray that goes from hit point to light source.
+  //
+  float attenuation = 1;
+  vec3 specular = vec3(0);
+
+  // Trace shadow ray only if light is visible from the hit surface.
+  if (dot(normal, light) > 0) {
+
+    // Rendering distance range.
+    float t_min     = 0.001;
+    float t_max     = 10000.0;
+
+    count(COUNTER_RAYS, 1);
+    count(COUNTER_SHADOW_RAYS, 1);
+
+    if (trace_shadow_ray(origin, light, t_min, t_max)) {
+      attenuation = 0.3;
+    } else {
+
+      // Specular
+      //
+      specular = compute_specular_lol(material, ray_direction, light, normal);
+    }
+  }
+
+  // Reflection
+  if (material.illumination == 3) {
+    payload.attenuation *= material.specular;
+    payload.done = 0;
+    payload.ray_origin = origin;
+    payload.ray_direction = reflect(ray_direction, normal);
+  }
+  payload.hit_value = vec3(attenuation * light_intensity * (diffuse + specular));
+
+  payload.normal = normal;
+  payload.hit_t = hit_t;
+  payload.albedo = albedo;
+}
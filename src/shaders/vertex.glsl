@@ -1,10 +1,41 @@
+// Geometry of the instances, read through the instance table.
+//
+// The including shader enables GL_EXT_buffer_reference and declares the
+// table:
+//
+//   layout(binding = 2, set = 0) buffer Instances {
+//     Instance i[];
+//   } instances;
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer VertexData {
+  float v[];  // 8 floats per vertex.
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer IndexData {
+  uint i[];
+};
+
+// Same layout as rt_instance_t.
+struct Instance {
+  mat4 transform;         // Object to world.
+  mat4 normal_transform;  // Inverse transpose of the transform.
+  VertexData vertices;
+  IndexData indices;
+  uint first_primitive;   // First triangle of the level of detail.
+  uint object;
+  int textured;
+  int illumination;       // As in material.glsl.
+  vec4 diffuse;
+  vec4 specular;
+};
+
 struct Vertex {
   vec3 position;
   vec3 normal;
   vec2 texture_coord;  // uv.
 };
 
-Vertex unpack(uint index) {
+Vertex unpack(VertexData vertices, uint index) {
   const uint offset = 8 * index;
 
   Vertex v;
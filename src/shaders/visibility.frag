@@ -0,0 +1,17 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Visibility buffer of the hybrid renderer, see hybrid.comp.
+
+// In
+layout (location = 0) flat in uint inInstance;
+
+// Out
+layout (location = 0) out uvec2 outVisibility;
+
+void main() {
+    // The primitive ID restarts at 0 on each instance, at the first triangle
+    // of the level of detail drawn.
+    outVisibility = uvec2(inInstance, uint(gl_PrimitiveID));
+}
@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// Visibility buffer of the hybrid renderer, see hybrid.comp.
+
+// In
+layout (std140, binding = 0) uniform bufferVals {
+    mat4 mvp;
+    mat4 inverse_view;
+    mat4 inverse_projection;
+} myBufferVals;
+layout (location = 0) in vec4 pos;
+// Per instance.
+layout (location = 2) in mat4 transform;
+
+// Out
+layout (location = 0) flat out uint outInstance;
+
+void main() {
+   gl_Position = myBufferVals.mvp * transform * pos;
+   // Instances of the full resolution objects have the same position in the
+   // rasterizer instance buffer and in the ray tracing instance table.
+   outInstance = gl_InstanceIndex;
+}
@@ -0,0 +1,97 @@
+// Wavefront path tracing. Ray queues shared by the wavefront_*.comp stages.
+//
+// Every stage reads the rays of the "in" queue and appends rays to the "out"
+// queue. Queues are ping-ponged by binding one of two descriptor sets that
+// swap them.
+
+const uint WAVEFRONT_WORKGROUP_SIZE = 64;
+
+// Sort key: 5 bits of material and 3 bits of direction octant.
+const uint WAVEFRONT_SORT_BUCKETS = 256;
+
+struct Ray {
+  vec3 origin;
+  uint pixel;
+  vec3 direction;
+  uint key;
+  vec3 attenuation;
+  uint depth;
+};
+
+// Number of rays of a queue, followed by the indirect dispatch arguments to
+// process them.
+struct Queue {
+  uint count;
+  uint groups_x;
+  uint groups_y;
+  uint groups_z;
+};
+
+layout(binding = 0, set = 2) buffer InRays {
+  Ray r[];
+} in_rays;
+
+layout(binding = 1, set = 2) buffer OutRays {
+  Ray r[];
+} out_rays;
+
+layout(binding = 2, set = 2) buffer InQueue {
+  Queue q;
+} in_queue;
+
+layout(binding = 3, set = 2) buffer OutQueue {
+  Queue q;
+} out_queue;
+
+// Samples of a pixel on this frame.
+struct PixelSamples {
+  vec3 radiance;              // Sum of the samples.
+  float count;                // Number of samples.
+  float luminance_sum;        // Of the finished samples.
+  float luminance_squares;    // Of the finished samples.
+  float finished_luminance;   // Luminance of radiance when a sample starts.
+  float padding;
+};
+
+layout(binding = 4, set = 2) buffer Pixels {
+  PixelSamples p[];
+} pixels;
+
+// Counting sort histogram and offsets of each bucket.
+layout(binding = 5, set = 2) buffer Buckets {
+  uint count[WAVEFRONT_SORT_BUCKETS];
+  uint offset[WAVEFRONT_SORT_BUCKETS];
+} buckets;
+
+// Luminance statistics of the last sample of a pixel, once all its rays are
+// done.
+void finish_sample(inout PixelSamples samples)
+{
+  if (samples.count <= 0.0) {
+    return;
+  }
+
+  const float total = dot(samples.radiance, vec3(0.2126, 0.7152, 0.0722));
+  const float last_sample = total - samples.finished_luminance;
+  samples.luminance_sum += last_sample;
+  samples.luminance_squares += last_sample * last_sample;
+  samples.finished_luminance = total;
+}
+
+// Append a ray to the out queue, compacting the rays that are still alive.
+void push_ray(Ray ray)
+{
+  const uint index = atomicAdd(out_queue.q.count, 1);
+  out_rays.r[index] = ray;
+  atomicMax(out_queue.q.groups_x, index / WAVEFRONT_WORKGROUP_SIZE + 1);
+}
+
+// Rays that leave the same material in the same direction octant are
+// traced together.
+uint sort_key(uint material, vec3 direction)
+{
+  const uint octant = (direction.x < 0.0 ? 1 : 0) |
+                      (direction.y < 0.0 ? 2 : 0) |
+                      (direction.z < 0.0 ? 4 : 0);
+  return ((material & 0x1f) << 3) | octant;
+}